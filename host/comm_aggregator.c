@@ -0,0 +1,479 @@
+/*******************************************************************************
+*
+* Multi-device host aggregator.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+*******************************************************************************/
+
+#include "comm_aggregator.h"
+#include "comm_uring.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// epoll_event.data.u64 of the stop eventfd (devices use their index)
+#define STOP_EVENT_ID (UINT64_MAX)
+
+// Maximum number of devices read by a worker with one submission
+#define COMM_AGGREGATOR_BATCH (64u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+struct comm_aggregator_t
+{
+    int epoll_fd; // All devices (EPOLLONESHOT) and stop_fd
+    int stop_fd; // Wakes up every worker when written
+    int frame_fd; // Written after frames were pushed to 'queue'
+    comm_host_t *devices;
+    size_t device_count;
+    size_t max_devices;
+    comm_frame_queue_t queue;
+    atomic_uint_fast64_t dropped; // Frames rejected by a full queue
+    pthread_t *workers;
+    unsigned worker_count;
+};
+
+
+/*******************************************************************************
+* PRIVATE PROTOTYPES
+*******************************************************************************/
+static void *_worker(void *arg);
+static void _on_read(void *context, void *user, ssize_t result);
+static void _read_device(comm_aggregator_t agg, uint16_t device);
+static void _decode_device(comm_aggregator_t agg, uint16_t device, bool connected);
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: comm_aggregator_new
+********************************************************************************
+* Summary:
+*  Create an aggregator.
+*
+* Parameters:
+*  max_devices: Maximum number of devices that can be added.
+*  queue_capacity: Number of frames the queue can hold before dropping.
+*
+* Return:
+*  comm_aggregator_t: The new aggregator, or NULL on error (see errno).
+*
+*******************************************************************************/
+comm_aggregator_t comm_aggregator_new(size_t max_devices, size_t queue_capacity)
+{
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = STOP_EVENT_ID};
+    comm_aggregator_t agg = calloc(1, sizeof(struct comm_aggregator_t));
+    if(!agg)
+        return NULL;
+
+    agg->max_devices = max_devices;
+    agg->devices = calloc(max_devices, sizeof(comm_host_t));
+    agg->queue = comm_frame_queue_new(queue_capacity);
+    agg->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    agg->stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    agg->frame_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    atomic_init(&agg->dropped, 0);
+    if(!agg->devices || !agg->queue || agg->epoll_fd < 0 || agg->stop_fd < 0
+       || agg->frame_fd < 0
+       || epoll_ctl(agg->epoll_fd, EPOLL_CTL_ADD, agg->stop_fd, &event) < 0) {
+        int err = errno;
+        comm_aggregator_free(&agg);
+        errno = err ? err : ENOMEM;
+        return NULL;
+    }
+
+    return agg;
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_free
+********************************************************************************
+* Summary:
+*  Stop the workers, close every device and deallocate the aggregator, and,
+*  as a side effect, set the pointer to NULL.
+*
+*******************************************************************************/
+void comm_aggregator_free(comm_aggregator_t *agg)
+{
+    if(!agg || !*agg)
+        return;
+
+    comm_aggregator_stop(*agg);
+    for(size_t i = 0; i < (*agg)->device_count; i++)
+        comm_host_close(&(*agg)->devices[i]);
+    if((*agg)->queue)
+        comm_frame_queue_free(&(*agg)->queue);
+    if((*agg)->epoll_fd >= 0)
+        close((*agg)->epoll_fd);
+    if((*agg)->stop_fd >= 0)
+        close((*agg)->stop_fd);
+    if((*agg)->frame_fd >= 0)
+        close((*agg)->frame_fd);
+    free((*agg)->devices);
+    free(*agg);
+    *agg = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_add
+********************************************************************************
+* Summary:
+*  Open a tty and add it to the devices serviced. Devices can be added while
+*  the workers are running.
+*
+* Return:
+*  int: The index of the device (comm_frame_t.device), or -1 on error.
+*
+*******************************************************************************/
+int comm_aggregator_add(comm_aggregator_t agg, const char *path)
+{
+    if(agg->device_count == agg->max_devices) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    comm_host_t host = comm_host_open(path, 0, 0);
+    if(!host)
+        return -1;
+
+    size_t device = agg->device_count;
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.u64 = device};
+    agg->devices[device] = host;
+    if(epoll_ctl(agg->epoll_fd, EPOLL_CTL_ADD, comm_host_fd(host), &event) < 0) {
+        comm_host_close(&agg->devices[device]);
+        return -1;
+    }
+    agg->device_count++;
+
+    return (int)device;
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_add_fd
+********************************************************************************
+* Summary:
+*  Same as comm_aggregator_add() for an already opened file descriptor,
+*  which will not be closed by the aggregator.
+*
+*******************************************************************************/
+int comm_aggregator_add_fd(comm_aggregator_t agg, int fd)
+{
+    if(agg->device_count == agg->max_devices) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    comm_host_t host = comm_host_attach(fd, 0, 0);
+    if(!host)
+        return -1;
+
+    size_t device = agg->device_count;
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.u64 = device};
+    agg->devices[device] = host;
+    if(epoll_ctl(agg->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        comm_host_close(&agg->devices[device]);
+        return -1;
+    }
+    agg->device_count++;
+
+    return (int)device;
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_device
+********************************************************************************
+* Summary:
+*  Handle of a device, to send it messages with comm_host_put*() (from a
+*  single thread). The workers own its RX side while they are running, so
+*  don't call comm_host_get*() or comm_host_poll() on it.
+*
+*******************************************************************************/
+comm_host_t comm_aggregator_device(comm_aggregator_t agg, int device)
+{
+    return agg->devices[device];
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_start
+********************************************************************************
+* Summary:
+*  Start the worker threads.
+*
+* Return:
+*  int: 0 on success, -1 on error (see errno).
+*
+*******************************************************************************/
+int comm_aggregator_start(comm_aggregator_t agg, unsigned workers)
+{
+    if(agg->workers || !workers) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    agg->workers = calloc(workers, sizeof(pthread_t));
+    if(!agg->workers)
+        return -1;
+
+    for(agg->worker_count = 0; agg->worker_count < workers; agg->worker_count++) {
+        int err = pthread_create(&agg->workers[agg->worker_count], NULL, _worker, agg);
+        if(err) {
+            comm_aggregator_stop(agg);
+            errno = err;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_stop
+********************************************************************************
+* Summary:
+*  Stop and join the worker threads. Frames already in the queue can still
+*  be popped.
+*
+*******************************************************************************/
+void comm_aggregator_stop(comm_aggregator_t agg)
+{
+    uint64_t one = 1;
+
+    if(!agg->workers)
+        return;
+
+    // Level-triggered: every worker sees it until it's read (never)
+    if(write(agg->stop_fd, &one, sizeof(one)) < 0) {}
+    for(unsigned i = 0; i < agg->worker_count; i++)
+        pthread_join(agg->workers[i], NULL);
+
+    free(agg->workers);
+    agg->workers = NULL;
+    agg->worker_count = 0;
+
+    // Allow the workers to be started again
+    if(read(agg->stop_fd, &one, sizeof(one)) < 0) {}
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_pop
+********************************************************************************
+* Summary:
+*  Take the oldest decoded frame, from any device. Never blocks.
+*
+* Return:
+*  bool: 'false' if no frame is available.
+*
+*******************************************************************************/
+bool comm_aggregator_pop(comm_aggregator_t agg, comm_frame_t *frame)
+{
+    return comm_frame_queue_pop(agg->queue, frame);
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_wait
+********************************************************************************
+* Summary:
+*  Wait until frames were pushed since the last call. Call it only after
+*  comm_aggregator_pop() returned 'false'.
+*
+* Return:
+*  int: 1 if frames may be available, 0 on timeout, -1 on error.
+*
+*******************************************************************************/
+int comm_aggregator_wait(comm_aggregator_t agg, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = agg->frame_fd, .events = POLLIN};
+    uint64_t count;
+
+    int ret = poll(&pfd, 1, timeout_ms);
+    if(ret <= 0)
+        return (ret < 0 && errno == EINTR) ? 0 : ret;
+    if(read(agg->frame_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return -1;
+
+    return 1;
+}
+
+/*******************************************************************************
+* Function Name: comm_aggregator_dropped
+********************************************************************************
+* Summary:
+*  Number of frames dropped because the queue was full.
+*
+*******************************************************************************/
+uint64_t comm_aggregator_dropped(const struct comm_aggregator_t *agg)
+{
+    return atomic_load_explicit(&agg->dropped, memory_order_relaxed);
+}
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _worker
+********************************************************************************
+* Summary:
+*  Worker thread: read every device that is ready with a single submission
+*  (see comm_uring.h), then decode them, until stopped. Without a
+*  comm_uring_t (out of memory), or if the submission failed, the devices
+*  are read one by one.
+*
+*******************************************************************************/
+static void *_worker(void *arg)
+{
+    comm_aggregator_t agg = arg;
+    struct epoll_event events[COMM_AGGREGATOR_BATCH];
+    uint16_t queued[COMM_AGGREGATOR_BATCH];
+    comm_uring_t uring = comm_uring_new(COMM_AGGREGATOR_BATCH);
+    bool stop = false;
+
+    while(!stop) {
+        int ret = epoll_wait(agg->epoll_fd, events, COMM_AGGREGATOR_BATCH, -1);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0)
+            break;
+
+        int count = 0;
+        for(int i = 0; i < ret; i++) {
+            if(events[i].data.u64 == STOP_EVENT_ID) {
+                stop = true;
+                continue;
+            }
+
+            // A full RX ring buffer only needs decoding
+            uint16_t device = (uint16_t)events[i].data.u64;
+            comm_host_t host = agg->devices[device];
+            if(!uring)
+                _read_device(agg, device);
+            else if(comm_uring_queue_read(uring, comm_host_fd(host), comm_host_rx_buffer(host),
+                                          (void *)(uintptr_t)device))
+                queued[count++] = device;
+            else
+                _decode_device(agg, device, true);
+        }
+
+        // A batch the kernel refused reports nothing and has nothing in
+        // flight: read its devices with readv so they're decoded and
+        // watched again
+        if(count && comm_uring_submit(uring, _on_read, agg) < 0) {
+            for(int i = 0; i < count; i++)
+                _read_device(agg, queued[i]);
+        }
+    }
+
+    if(uring)
+        comm_uring_free(&uring);
+    return NULL;
+}
+
+/*******************************************************************************
+* Function Name: _on_read
+********************************************************************************
+* Summary:
+*  Completion of a device read, decode what was received.
+*
+*******************************************************************************/
+static void _on_read(void *context, void *user, ssize_t result)
+{
+    bool connected = (result > 0 || result == -EAGAIN || result == -EINTR);
+
+    _decode_device(context, (uint16_t)(uintptr_t)user, connected);
+}
+
+/*******************************************************************************
+* Function Name: _read_device
+********************************************************************************
+* Summary:
+*  Read a device with comm_host_receive(), then decode what was received.
+*
+*******************************************************************************/
+static void _read_device(comm_aggregator_t agg, uint16_t device)
+{
+    _decode_device(agg, device, comm_host_receive(agg->devices[device]) >= 0);
+}
+
+/*******************************************************************************
+* Function Name: _decode_device
+********************************************************************************
+* Summary:
+*  Push every complete message of a device to the queue, then watch the
+*  device again. comm_host_getmsg() returns 0 after discarding a wrong
+*  length (and for an empty message), so it's called until nothing is
+*  taken out: the messages behind would otherwise wait for more bytes. If
+*  the RX ring buffer filled up before the tty was empty, epoll reports the
+*  device again right away. Disconnected devices are no longer watched.
+*
+*******************************************************************************/
+static void _decode_device(comm_aggregator_t agg, uint16_t device, bool connected)
+{
+    comm_host_t host = agg->devices[device];
+    ringbuf_t rx = comm_host_rx_buffer(host);
+    comm_frame_t frame = {.device = device};
+    struct timespec now;
+    size_t count, used;
+    uint64_t pushed = 0;
+
+    // One timestamp per read, all frames in it arrived together
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    frame.timestamp_ns = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+
+    do {
+        used = ringbuf_bytes_used(rx);
+        if(!(count = comm_host_getmsg(host, frame.data)))
+            continue;
+        frame.count = (uint8_t)count;
+        if(comm_frame_queue_push(agg->queue, &frame))
+            pushed++;
+        else
+            atomic_fetch_add_explicit(&agg->dropped, 1, memory_order_relaxed);
+    } while(count || ringbuf_bytes_used(rx) != used);
+
+    if(pushed && write(agg->frame_fd, &pushed, sizeof(pushed)) < 0) {}
+
+    if(connected) {
+        struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.u64 = device};
+        epoll_ctl(agg->epoll_fd, EPOLL_CTL_MOD, comm_host_fd(host), &event);
+    }
+}
+
+/* [] END OF FILE */
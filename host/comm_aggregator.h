@@ -0,0 +1,76 @@
+/*******************************************************************************
+*
+* Multi-device host aggregator.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Services many devices from a small pool of worker threads. Every device
+*  has its own comm_host_t (RX/TX ring buffers) and its tty is watched by a
+*  single shared epoll set with EPOLLONESHOT, so a device is only ever
+*  serviced by one worker at a time. Workers read all the ttys that are
+*  ready with one submission (see comm_uring.h), decode the custom messages
+*  and push them to a lock-free queue (see comm_frame_queue.h).
+*
+*******************************************************************************/
+
+#ifndef _COMM_AGGREGATOR_H
+#define _COMM_AGGREGATOR_H
+
+#include "comm_frame_queue.h"
+#include "comm_host.h"
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct comm_aggregator_t *comm_aggregator_t;
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+// Init
+comm_aggregator_t comm_aggregator_new(size_t max_devices, size_t queue_capacity);
+void comm_aggregator_free(comm_aggregator_t *agg);
+int comm_aggregator_add(comm_aggregator_t agg, const char *path);
+int comm_aggregator_add_fd(comm_aggregator_t agg, int fd);
+comm_host_t comm_aggregator_device(comm_aggregator_t agg, int device);
+
+// Workers
+int comm_aggregator_start(comm_aggregator_t agg, unsigned workers);
+void comm_aggregator_stop(comm_aggregator_t agg);
+
+// Frames
+bool comm_aggregator_pop(comm_aggregator_t agg, comm_frame_t *frame);
+int comm_aggregator_wait(comm_aggregator_t agg, int timeout_ms);
+uint64_t comm_aggregator_dropped(const struct comm_aggregator_t *agg);
+
+#endif // _COMM_AGGREGATOR_H
+
+/* [] END OF FILE */
@@ -0,0 +1,175 @@
+/*******************************************************************************
+*
+* Multi-device host aggregator daemon.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Decodes the custom messages of many devices at once (see
+*  comm_aggregator.h) and prints them, one per line:
+*    <timestamp in ns> <device index> <payload in hex>
+*
+* Usage:
+*  comm_aggregatord [-j workers] [-s] [-m name] <tty>...
+*    -j: Number of worker threads (default: 4).
+*    -s: Only print statistics (frames/s, dropped) every second.
+*    -m: Also publish every frame to the shared ring 'name' (see comm_shm.h),
+*        e.g. /comm_frames.
+*
+* Build:
+*  cc -O2 -pthread -I../src -o comm_aggregatord comm_aggregatord.c \
+*     comm_aggregator.c comm_frame_queue.c comm_host.c comm_shm.c \
+*     comm_uring.c ../src/ringbuf.c
+*
+*******************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm_aggregator.h"
+#include "comm_shm.h"
+
+/*******************************************************************************
+* PRIVATE VARIABLES
+*******************************************************************************/
+static volatile sig_atomic_t _running = 1;
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+static void _on_signal(int sig)
+{
+    (void)sig;
+    _running = 0;
+}
+
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+    unsigned workers = 4;
+    int stats_only = 0;
+    const char *shm_name = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "j:sm:")) != -1) {
+        switch(opt) {
+        case 'j':
+            workers = (unsigned)atoi(optarg);
+            break;
+        case 's':
+            stats_only = 1;
+            break;
+        case 'm':
+            shm_name = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-j workers] [-s] [-m name] <tty>...\n", argv[0]);
+            return 2;
+        }
+    }
+    if(optind == argc || !workers) {
+        fprintf(stderr, "usage: %s [-j workers] [-s] [-m name] <tty>...\n", argv[0]);
+        return 2;
+    }
+
+    comm_aggregator_t agg = comm_aggregator_new(argc - optind, 65536);
+    if(!agg) {
+        perror("comm_aggregator_new");
+        return 1;
+    }
+    for(int i = optind; i < argc; i++) {
+        if(comm_aggregator_add(agg, argv[i]) < 0) {
+            perror(argv[i]);
+            return 1;
+        }
+    }
+
+    comm_shm_t shm = NULL;
+    if(shm_name && !(shm = comm_shm_create(shm_name, 1 << 20))) {
+        perror(shm_name);
+        return 1;
+    }
+
+    signal(SIGINT, _on_signal);
+    signal(SIGTERM, _on_signal);
+    if(comm_aggregator_start(agg, workers) < 0) {
+        perror("comm_aggregator_start");
+        return 1;
+    }
+
+    comm_frame_t frame;
+    unsigned long frames = 0;
+    double last_stats = _now();
+    while(_running) {
+        if(!comm_aggregator_pop(agg, &frame)) {
+            comm_aggregator_wait(agg, 100);
+        }
+        else {
+            if(shm)
+                comm_shm_publish(shm, &frame);
+            if(!stats_only) {
+                printf("%llu %u ", (unsigned long long)frame.timestamp_ns, frame.device);
+                for(uint8_t i = 0; i < frame.count; i++)
+                    printf("%02x", frame.data[i]);
+                putchar('\n');
+            }
+            else
+                frames++;
+        }
+
+        if(stats_only && _now() - last_stats >= 1.0) {
+            fprintf(stderr, "%lu frames/s, %llu dropped\n", frames,
+                    (unsigned long long)comm_aggregator_dropped(agg));
+            frames = 0;
+            last_stats += 1.0;
+        }
+    }
+
+    comm_aggregator_free(&agg);
+    if(shm)
+        comm_shm_destroy(&shm);
+    return 0;
+}
+
+/* [] END OF FILE */
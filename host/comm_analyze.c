@@ -0,0 +1,651 @@
+/*******************************************************************************
+*
+* Protocol analyzer.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+********************************************************************************
+*
+* Summary:
+*  Parses a stream the way comm_driver does, with either message framing
+*  (comm_getmsg(), see comm_parse.h) or line framing (comm_getline()), and
+*  reports:
+*   - every interval: throughput, frames, payload and overhead;
+*   - at the end: the payload size histogram, how the link bandwidth was
+*     spent (payload, framing bytes, garbage, resyncs) and the gaps between
+*     consecutive frames.
+*  The stream is one direction of a capture (see comm_capture.h), or read
+*  live from anything else (tty, pty, pipe, "-") until the end of the file
+*  or Ctrl-C. The frames can also be exported to a pcapng file (link type
+*  USER0, nanosecond wall-clock timestamps, inbound/outbound flags) for
+*  external viewers.
+*  Frame times are those of the read (or capture chunk) completing them, so
+*  gaps shorter than the reads are not resolved.
+*
+* Usage:
+*  comm_analyze [-l] [-d rx|tx] [-i seconds] [-p file.pcapng] <capture|tty|->
+*    -l: Line framing (default: message framing).
+*    -d: Direction of a capture to analyze (default: rx).
+*    -i: Reporting interval (default: 1 s, 0 for the summary only).
+*    -p: Export the frames to a pcapng file.
+*
+* Build:
+*  cc -O2 -I../src -o comm_analyze comm_analyze.c comm_capture.c
+*
+*******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm_capture.h"
+#include "comm_parse.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Same as COMM_LINE_TERMINATOR (comm_driver.h)
+#define ANALYZE_LINE_TERMINATOR ((uint8_t)'\n')
+
+// Bytes kept while looking for the end of a frame (longer lines are garbage)
+#define ANALYZE_BUFFER_SIZE (65536u)
+
+// Histograms (powers of two: 0, 1, 2-3, 4-7, ...)
+#define ANALYZE_SIZE_BUCKETS (18u)
+#define ANALYZE_GAP_BUCKETS (24u) // In us, the last one is 8 s and more
+
+// pcapng (see draft-ietf-opsawg-pcapng)
+#define PCAPNG_SHB (0x0A0D0D0Au)
+#define PCAPNG_IDB (0x00000001u)
+#define PCAPNG_EPB (0x00000006u)
+#define PCAPNG_BYTE_ORDER_MAGIC (0x1A2B3C4Du)
+#define PCAPNG_LINKTYPE_USER0 (147u)
+#define PCAPNG_OPT_ENDOFOPT (0u)
+#define PCAPNG_OPT_IF_TSRESOL (9u)
+#define PCAPNG_OPT_EPB_FLAGS (2u)
+#define PCAPNG_FLAG_INBOUND (1u)
+#define PCAPNG_FLAG_OUTBOUND (2u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    uint64_t bytes;
+    uint64_t frames;
+    uint64_t payload; // Bytes
+    uint64_t garbage; // Bytes
+    uint64_t resyncs;
+} _counters_t;
+
+typedef struct
+{
+    // Settings
+    bool lines;
+    uint8_t dir;
+    uint64_t interval_ns;
+    const struct comm_capture_reader_t *reader; // NULL when live
+    int64_t realtime_offset_ns; // Live: CLOCK_REALTIME - CLOCK_MONOTONIC
+    FILE *pcap;
+
+    // Statistics
+    bool started;
+    uint64_t start_ns, last_ns, interval_end_ns;
+    _counters_t interval, total;
+    uint64_t size_hist[ANALYZE_SIZE_BUCKETS];
+    uint64_t gap_hist[ANALYZE_GAP_BUCKETS];
+    uint64_t gap_min_ns, gap_max_ns, gap_sum_ns, gap_count;
+    uint64_t last_frame_ns;
+
+    // Bytes not parsed yet
+    uint8_t buffer[ANALYZE_BUFFER_SIZE];
+    size_t length;
+} _analyzer_t;
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+static volatile sig_atomic_t _stop = 0;
+
+static void _on_signal(int signal)
+{
+    (void)signal;
+    _stop = 1;
+}
+
+static uint64_t _now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Index of the power-of-two bucket of 'value'
+static unsigned _bucket(uint64_t value, unsigned buckets)
+{
+    unsigned bucket = value ? 64u - (unsigned)__builtin_clzll(value) : 0;
+    return bucket < buckets ? bucket : buckets - 1;
+}
+
+/*******************************************************************************
+* Function Name: _open_tty
+********************************************************************************
+* Summary:
+*  Open a tty in raw mode ("-" for the standard input).
+*
+* Return:
+*  int: The file descriptor, or -1 on error.
+*
+*******************************************************************************/
+static int _open_tty(const char *path)
+{
+    struct termios tio;
+    if(strcmp(path, "-") == 0)
+        return STDIN_FILENO;
+
+    int fd = open(path, O_RDONLY | O_NOCTTY);
+    if(fd < 0)
+        return -1;
+
+    // Not every file is a tty (pipes, pty used for testing, etc.)
+    if(tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    return fd;
+}
+
+/*******************************************************************************
+* Function Name: _pcapng_block
+********************************************************************************
+* Summary:
+*  Write a pcapng block: its fixed part, then a variable part padded to 32
+*  bits, then options (already padded).
+*
+*******************************************************************************/
+static void _pcapng_block(FILE *file, uint32_t type, const void *fixed, size_t fixed_length,
+                          const void *data, size_t data_length, const void *options, size_t options_length)
+{
+    static const uint8_t padding[3] = {0};
+    size_t pad = (4u - data_length % 4u) % 4u;
+    uint32_t total = (uint32_t)(12u + fixed_length + data_length + pad + options_length);
+
+    fwrite(&type, 4, 1, file);
+    fwrite(&total, 4, 1, file);
+    fwrite(fixed, 1, fixed_length, file);
+    // 'data' and 'options' may be NULL when empty
+    if(data_length)
+        fwrite(data, 1, data_length, file);
+    fwrite(padding, 1, pad, file);
+    if(options_length)
+        fwrite(options, 1, options_length, file);
+    fwrite(&total, 4, 1, file);
+}
+
+/*******************************************************************************
+* Function Name: _pcapng_header
+********************************************************************************
+* Summary:
+*  Write the section header and the single interface of the file.
+*
+*******************************************************************************/
+static void _pcapng_header(FILE *file)
+{
+    struct
+    {
+        uint32_t magic;
+        uint16_t major, minor;
+        int64_t section_length;
+    } shb = {PCAPNG_BYTE_ORDER_MAGIC, 1, 0, -1};
+    _pcapng_block(file, PCAPNG_SHB, &shb, sizeof(shb), NULL, 0, NULL, 0);
+
+    // Timestamps in ns
+    struct
+    {
+        uint16_t linktype, reserved;
+        uint32_t snaplen;
+    } idb = {PCAPNG_LINKTYPE_USER0, 0, 0};
+    uint8_t options[12] = {0}; // if_tsresol, then opt_endofopt
+    const uint16_t option[2] = {PCAPNG_OPT_IF_TSRESOL, 1};
+    memcpy(options, option, sizeof(option));
+    options[4] = 9;
+    _pcapng_block(file, PCAPNG_IDB, &idb, sizeof(idb), NULL, 0, options, sizeof(options));
+}
+
+/*******************************************************************************
+* Function Name: _pcapng_frame
+********************************************************************************
+* Summary:
+*  Write a frame (with its framing bytes) as an enhanced packet block.
+*
+*******************************************************************************/
+static void _pcapng_frame(const _analyzer_t *analyzer, uint64_t time_ns, const uint8_t *data, size_t count)
+{
+    uint64_t realtime_ns = analyzer->reader ? comm_capture_realtime_ns(analyzer->reader, time_ns)
+                                            : time_ns + (uint64_t)analyzer->realtime_offset_ns;
+    struct
+    {
+        uint32_t interface_id;
+        uint32_t timestamp_high, timestamp_low;
+        uint32_t captured_length, original_length;
+    } epb = {0, (uint32_t)(realtime_ns >> 32), (uint32_t)realtime_ns, (uint32_t)count, (uint32_t)count};
+    struct
+    {
+        uint16_t code, length;
+        uint32_t flags;
+        uint32_t end;
+    } options = {PCAPNG_OPT_EPB_FLAGS, 4,
+                 analyzer->dir == COMM_CAPTURE_TX ? PCAPNG_FLAG_OUTBOUND : PCAPNG_FLAG_INBOUND,
+                 PCAPNG_OPT_ENDOFOPT};
+
+    _pcapng_block(analyzer->pcap, PCAPNG_EPB, &epb, sizeof(epb), data, count, &options, sizeof(options));
+}
+
+/*******************************************************************************
+* Function Name: _print_interval
+********************************************************************************
+* Summary:
+*  Print and reset the counters of the interval ending at 'end_ns'.
+*
+*******************************************************************************/
+static void _print_interval(_analyzer_t *analyzer, uint64_t end_ns)
+{
+    _counters_t *c = &analyzer->interval;
+    double seconds = analyzer->interval_ns / 1e9;
+
+    printf("%9.1f %12.0f %10.0f %12.0f %8.1f%% %10llu %8llu\n",
+           (end_ns - analyzer->start_ns) / 1e9, c->bytes / seconds, c->frames / seconds,
+           c->payload / seconds, c->bytes ? 100.0 * (c->bytes - c->payload) / c->bytes : 0.0,
+           (unsigned long long)c->garbage, (unsigned long long)c->resyncs);
+    memset(c, 0, sizeof(*c));
+}
+
+/*******************************************************************************
+* Function Name: _advance
+********************************************************************************
+* Summary:
+*  Move the clock of the analyzer to 'time_ns', printing the intervals that
+*  ended before.
+*
+*******************************************************************************/
+static void _advance(_analyzer_t *analyzer, uint64_t time_ns)
+{
+    if(!analyzer->started) {
+        analyzer->started = true;
+        analyzer->start_ns = time_ns;
+        analyzer->interval_end_ns = time_ns + analyzer->interval_ns;
+    }
+
+    while(analyzer->interval_ns && time_ns >= analyzer->interval_end_ns) {
+        _print_interval(analyzer, analyzer->interval_end_ns);
+        analyzer->interval_end_ns += analyzer->interval_ns;
+    }
+    analyzer->last_ns = time_ns;
+}
+
+/*******************************************************************************
+* Function Name: _frame
+********************************************************************************
+* Summary:
+*  Account for a complete frame.
+*
+* Parameters:
+*  data: The frame, with its framing bytes.
+*  count: The number of bytes in 'data'.
+*  payload: The number of payload bytes in 'data'.
+*
+*******************************************************************************/
+static void _frame(_analyzer_t *analyzer, const uint8_t *data, size_t count, size_t payload)
+{
+    analyzer->interval.frames++;
+    analyzer->interval.payload += payload;
+    analyzer->total.frames++;
+    analyzer->total.payload += payload;
+    analyzer->size_hist[_bucket(payload, ANALYZE_SIZE_BUCKETS)]++;
+
+    if(analyzer->total.frames > 1) {
+        uint64_t gap_ns = analyzer->last_ns - analyzer->last_frame_ns;
+        if(!analyzer->gap_count || gap_ns < analyzer->gap_min_ns)
+            analyzer->gap_min_ns = gap_ns;
+        if(gap_ns > analyzer->gap_max_ns)
+            analyzer->gap_max_ns = gap_ns;
+        analyzer->gap_sum_ns += gap_ns;
+        analyzer->gap_count++;
+        analyzer->gap_hist[_bucket(gap_ns / 1000u, ANALYZE_GAP_BUCKETS)]++;
+    }
+    analyzer->last_frame_ns = analyzer->last_ns;
+
+    if(analyzer->pcap)
+        _pcapng_frame(analyzer, analyzer->last_ns, data, count);
+}
+
+/*******************************************************************************
+* Function Name: _garbage
+********************************************************************************
+* Summary:
+*  Account for bytes that aren't part of a frame.
+*
+*******************************************************************************/
+static void _garbage(_analyzer_t *analyzer, size_t count, bool resync)
+{
+    analyzer->interval.garbage += count;
+    analyzer->total.garbage += count;
+    if(resync) {
+        analyzer->interval.resyncs++;
+        analyzer->total.resyncs++;
+    }
+}
+
+/*******************************************************************************
+* Function Name: _parse
+********************************************************************************
+* Summary:
+*  Parse the complete frames in the buffer and remove them (and the garbage).
+*
+*******************************************************************************/
+static void _parse(_analyzer_t *analyzer)
+{
+    size_t i = 0, length;
+
+    while(i < analyzer->length) {
+        const uint8_t *data = analyzer->buffer + i;
+        size_t count = analyzer->length - i;
+
+        if(analyzer->lines) {
+            const uint8_t *terminator = memchr(data, ANALYZE_LINE_TERMINATOR, count);
+            if(!terminator) {
+                // Nothing else can fit in the buffer: drop the line
+                if(!i && count == ANALYZE_BUFFER_SIZE) {
+                    _garbage(analyzer, count, false);
+                    i = count;
+                }
+                break;
+            }
+            length = (size_t)(terminator - data) + 1;
+            _frame(analyzer, data, length, length - 1);
+        }
+        else {
+            comm_parse_result_t result = comm_parse_step(data, count, &length);
+            if(result == COMM_PARSE_MORE)
+                break;
+            if(result == COMM_PARSE_MESSAGE)
+                _frame(analyzer, data, length, length - MSG_STRUCTURE_LENGTH);
+            else
+                _garbage(analyzer, length, result == COMM_PARSE_RESYNC);
+        }
+        i += length;
+    }
+
+    memmove(analyzer->buffer, analyzer->buffer + i, analyzer->length - i);
+    analyzer->length -= i;
+}
+
+/*******************************************************************************
+* Function Name: _feed
+********************************************************************************
+* Summary:
+*  Analyze bytes received at 'time_ns'.
+*
+*******************************************************************************/
+static void _feed(_analyzer_t *analyzer, uint64_t time_ns, const uint8_t *data, size_t count)
+{
+    _advance(analyzer, time_ns);
+    analyzer->interval.bytes += count;
+    analyzer->total.bytes += count;
+
+    while(count) {
+        size_t n = ANALYZE_BUFFER_SIZE - analyzer->length;
+        if(n > count)
+            n = count;
+        memcpy(analyzer->buffer + analyzer->length, data, n);
+        analyzer->length += n;
+        data += n;
+        count -= n;
+        _parse(analyzer);
+    }
+}
+
+/*******************************************************************************
+* Function Name: _print_summary
+********************************************************************************
+* Summary:
+*  Print the statistics of the whole stream.
+*
+*******************************************************************************/
+static void _print_summary(const _analyzer_t *analyzer)
+{
+    const _counters_t *c = &analyzer->total;
+    double seconds = (analyzer->last_ns - analyzer->start_ns) / 1e9;
+    uint64_t framing = c->frames * (analyzer->lines ? 1u : MSG_STRUCTURE_LENGTH);
+    double bytes = c->bytes ? (double)c->bytes : 1.0;
+
+    printf("\n%llu bytes in %.3f s", (unsigned long long)c->bytes, seconds);
+    if(seconds > 0)
+        printf(" (%.0f bytes/s, %.0f frames/s)", c->bytes / seconds, c->frames / seconds);
+    printf(", %llu %s\n", (unsigned long long)c->frames, analyzer->lines ? "lines" : "messages");
+    printf("  payload  %12llu bytes %6.2f%%\n", (unsigned long long)c->payload, 100.0 * c->payload / bytes);
+    printf("  framing  %12llu bytes %6.2f%%\n", (unsigned long long)framing, 100.0 * framing / bytes);
+    printf("  garbage  %12llu bytes %6.2f%% (%llu resyncs)\n", (unsigned long long)c->garbage,
+           100.0 * c->garbage / bytes, (unsigned long long)c->resyncs);
+    if(analyzer->length)
+        printf("  pending  %12zu bytes (incomplete frame at the end)\n", analyzer->length);
+
+    printf("\npayload size      frames\n");
+    for(unsigned b = 0; b < ANALYZE_SIZE_BUCKETS; b++) {
+        if(!analyzer->size_hist[b])
+            continue;
+        uint64_t low = b ? 1ull << (b - 1) : 0, high = b ? (1ull << b) - 1 : 0;
+        printf("%5llu-%-6llu %11llu %6.2f%%\n", (unsigned long long)low, (unsigned long long)high,
+               (unsigned long long)analyzer->size_hist[b], 100.0 * analyzer->size_hist[b] / c->frames);
+    }
+
+    if(!analyzer->gap_count)
+        return;
+    printf("\ngap between frames: min %.1f us, mean %.1f us, max %.1f us\n", analyzer->gap_min_ns / 1e3,
+           analyzer->gap_sum_ns / 1e3 / analyzer->gap_count, analyzer->gap_max_ns / 1e3);
+    printf("gap (us)          frames\n");
+    for(unsigned b = 0; b < ANALYZE_GAP_BUCKETS; b++) {
+        if(!analyzer->gap_hist[b])
+            continue;
+        uint64_t low = b ? 1ull << (b - 1) : 0, high = (1ull << b) - 1;
+        if(b == ANALYZE_GAP_BUCKETS - 1)
+            printf("%8llu+    ", (unsigned long long)low);
+        else
+            printf("%8llu-%-8llu", (unsigned long long)low, (unsigned long long)high);
+        printf(" %8llu %6.2f%%\n", (unsigned long long)analyzer->gap_hist[b],
+               100.0 * analyzer->gap_hist[b] / analyzer->gap_count);
+    }
+}
+
+/*******************************************************************************
+* Function Name: _run_capture
+********************************************************************************
+* Summary:
+*  Analyze one direction of a capture.
+*
+*******************************************************************************/
+static void _run_capture(_analyzer_t *analyzer, comm_capture_reader_t reader)
+{
+    comm_capture_chunk_t chunk;
+
+    while(!_stop && comm_capture_next(reader, &chunk)) {
+        if(chunk.dir == analyzer->dir)
+            _feed(analyzer, chunk.timestamp_ns, chunk.data, chunk.count);
+    }
+}
+
+/*******************************************************************************
+* Function Name: _run_live
+********************************************************************************
+* Summary:
+*  Analyze what's read from a file descriptor until the end of the file or
+*  a signal.
+*
+* Return:
+*  int: 0 on success, -1 on error.
+*
+*******************************************************************************/
+static int _run_live(_analyzer_t *analyzer, int fd)
+{
+    static uint8_t data[4096];
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    analyzer->realtime_offset_ns = (int64_t)(_now_ns(CLOCK_REALTIME) - _now_ns(CLOCK_MONOTONIC));
+    _advance(analyzer, _now_ns(CLOCK_MONOTONIC));
+
+    while(!_stop) {
+        // Wake up at the end of the interval, even if nothing is received
+        int timeout_ms = -1;
+        if(analyzer->interval_ns) {
+            uint64_t now_ns = _now_ns(CLOCK_MONOTONIC);
+            timeout_ms = now_ns < analyzer->interval_end_ns ? (int)((analyzer->interval_end_ns - now_ns) / 1000000u) + 1 : 0;
+        }
+
+        int ready = poll(&pfd, 1, timeout_ms);
+        if(ready < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        if(!ready) {
+            _advance(analyzer, _now_ns(CLOCK_MONOTONIC));
+            continue;
+        }
+
+        ssize_t n = read(fd, data, sizeof(data));
+        if(n < 0) {
+            if(errno == EINTR || errno == EAGAIN)
+                continue;
+            // A pty whose other side was closed
+            if(errno == EIO)
+                break;
+            return -1;
+        }
+        if(!n)
+            break;
+        _feed(analyzer, _now_ns(CLOCK_MONOTONIC), data, (size_t)n);
+    }
+
+    return 0;
+}
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+    static _analyzer_t analyzer;
+    const char *pcap_path = NULL;
+    double interval_s = 1.0;
+    int opt;
+
+    analyzer.dir = COMM_CAPTURE_RX;
+    while((opt = getopt(argc, argv, "ld:i:p:")) != -1) {
+        switch(opt) {
+        case 'l':
+            analyzer.lines = true;
+            break;
+        case 'd':
+            analyzer.dir = strcmp(optarg, "tx") == 0 ? COMM_CAPTURE_TX : COMM_CAPTURE_RX;
+            break;
+        case 'i':
+            interval_s = atof(optarg);
+            break;
+        case 'p':
+            pcap_path = optarg;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if(argc - optind != 1 || interval_s < 0) {
+        fprintf(stderr, "usage: %s [-l] [-d rx|tx] [-i seconds] [-p file.pcapng] <capture|tty|->\n", argv[0]);
+        return 2;
+    }
+    analyzer.interval_ns = (uint64_t)(interval_s * 1e9);
+
+    if(pcap_path) {
+        analyzer.pcap = fopen(pcap_path, "wb");
+        if(!analyzer.pcap) {
+            perror(pcap_path);
+            return 1;
+        }
+        _pcapng_header(analyzer.pcap);
+    }
+
+    // Stop cleanly on Ctrl-C (poll() and read() are interrupted)
+    struct sigaction action = {.sa_handler = _on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    if(analyzer.interval_ns)
+        printf("%9s %12s %10s %12s %9s %10s %8s\n", "time (s)", "bytes/s", "frames/s", "payload/s",
+               "overhead", "garbage", "resyncs");
+
+    // A capture, or anything else read live
+    const char *path = argv[optind];
+    comm_capture_reader_t reader = strcmp(path, "-") == 0 ? NULL : comm_capture_open(path);
+    if(reader) {
+        analyzer.reader = reader;
+        _run_capture(&analyzer, reader);
+        comm_capture_close(&reader);
+    }
+    else {
+        int fd = _open_tty(path);
+        if(fd < 0 || _run_live(&analyzer, fd) < 0) {
+            perror(path);
+            return 1;
+        }
+    }
+
+    // The last, partial, interval
+    if(analyzer.interval_ns && analyzer.interval.bytes)
+        _print_interval(&analyzer, analyzer.last_ns);
+    _print_summary(&analyzer);
+
+    if(analyzer.pcap && fclose(analyzer.pcap) != 0) {
+        perror(pcap_path);
+        return 1;
+    }
+    return 0;
+}
+
+/* [] END OF FILE */
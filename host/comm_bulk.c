@@ -0,0 +1,410 @@
+/*******************************************************************************
+*
+* Host-side bulk transfer tool.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Sends a file to, or receives a file from, a device running comm_driver
+*  in bulk transfer mode (see comm_driver_bulk.h), then reports the
+*  effective transfer rate.
+*
+* Usage:
+*  comm_bulk send <tty> <file>   (device calls comm_bulk_receive())
+*  comm_bulk recv <tty> <file>   (device calls comm_bulk_send())
+*
+* Build:
+*  cc -O2 -I../src -o comm_bulk comm_bulk.c ../src/crc16.c
+*
+*******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm_driver_bulk.h"
+#include "crc16.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Time to wait for the device before sending the window again
+#define HOST_TIMEOUT_MS (100)
+
+// Time to wait for the device to start the transfer
+#define HOST_START_TIMEOUT_MS (5000)
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _open_tty
+********************************************************************************
+* Summary:
+*  Open a tty in raw mode.
+*
+* Parameters:
+*  path: Path of the tty.
+*
+* Return:
+*  int: The file descriptor, or -1 on error.
+*
+*******************************************************************************/
+static int _open_tty(const char *path)
+{
+    struct termios tio;
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if(fd < 0)
+        return -1;
+
+    // Not every file is a tty (pipes, pty used for testing, etc.)
+    if(tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIOFLUSH);
+    }
+
+    return fd;
+}
+
+/*******************************************************************************
+* Function Name: _now
+********************************************************************************
+* Summary:
+*  Monotonic time in seconds.
+*
+*******************************************************************************/
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*******************************************************************************
+* Function Name: _write_all
+********************************************************************************
+* Summary:
+*  Write 'count' bytes, retrying on short writes.
+*
+* Return:
+*  bool: 'false' on error.
+*
+*******************************************************************************/
+static bool _write_all(int fd, const void *data, size_t count)
+{
+    const unsigned char *u8data = data;
+
+    while(count) {
+        ssize_t n = write(fd, u8data, count);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        u8data += n;
+        count -= n;
+    }
+
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: _read_ack
+********************************************************************************
+* Summary:
+*  Wait for the next acknowledgement from the device, ignoring other bytes.
+*
+* Parameters:
+*  fd: File descriptor of the tty.
+*  type: Where BULK_ACK or BULK_NAK is copied.
+*  seq: Where the acknowledged sequence is copied.
+*  timeout_ms: Maximum time to wait.
+*
+* Return:
+*  int: 1 if an acknowledgement was read, 0 on timeout, -1 on error.
+*
+*******************************************************************************/
+static int _read_ack(int fd, unsigned char *type, unsigned char *seq, int timeout_ms)
+{
+    static unsigned char pending_type = 0;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    unsigned char byte;
+
+    while(1) {
+        int ret = poll(&pfd, 1, timeout_ms);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return ret;
+        if(read(fd, &byte, 1) != 1)
+            return -1;
+
+        if(!pending_type) {
+            if(byte == BULK_ACK || byte == BULK_NAK)
+                pending_type = byte;
+            continue;
+        }
+
+        *type = pending_type;
+        *seq = byte;
+        pending_type = 0;
+        return 1;
+    }
+}
+
+/*******************************************************************************
+* Function Name: _send_file
+********************************************************************************
+* Summary:
+*  Send a file with up to BULK_WINDOW blocks waiting for an acknowledgement.
+*
+* Return:
+*  long: The number of bytes sent, or -1 on error.
+*
+*******************************************************************************/
+static long _send_file(int fd, FILE *file)
+{
+    static unsigned char window[BULK_WINDOW][BULK_FRAME_LENGTH];
+    unsigned char base = 0, next = 0;
+    unsigned char type, seq;
+    unsigned retries = 0;
+    bool last_block_read = false;
+    long total = 0;
+    int ret;
+
+    // The device sends a NAK for sequence 0 when it's ready
+    do {
+        ret = _read_ack(fd, &type, &seq, HOST_START_TIMEOUT_MS);
+        if(ret <= 0) {
+            fprintf(stderr, "comm_bulk: device not ready\n");
+            return -1;
+        }
+    } while(type != BULK_NAK || seq != 0);
+
+    while(!last_block_read || base != next) {
+
+        // Fill the window with new blocks
+        while(!last_block_read && (unsigned char)(next - base) < BULK_WINDOW) {
+            unsigned char *frame = window[next % BULK_WINDOW];
+            size_t length = fread(&frame[BULK_HEADER_LENGTH], 1, BULK_BLOCK_SIZE, file);
+            memset(&frame[BULK_HEADER_LENGTH + length], 0, BULK_BLOCK_SIZE - length);
+            frame[BULK_SEQ_OFFS] = next;
+            frame[BULK_LENGTH_OFFS] = (unsigned char)length;
+            uint16_t crc = crc16_ccitt(CRC16_INIT, frame, BULK_FRAME_LENGTH - BULK_CRC_LENGTH);
+            frame[BULK_FRAME_LENGTH - 2] = (unsigned char)(crc >> 8);
+            frame[BULK_FRAME_LENGTH - 1] = (unsigned char)crc;
+
+            if(!_write_all(fd, frame, BULK_FRAME_LENGTH))
+                return -1;
+            last_block_read = (length < BULK_BLOCK_SIZE);
+            total += length;
+            next++;
+        }
+
+        // Wait for an acknowledgement, send the window again on timeout
+        ret = _read_ack(fd, &type, &seq, HOST_TIMEOUT_MS);
+        if(ret < 0)
+            return -1;
+        if(ret == 0) {
+            if(++retries > BULK_MAX_RETRIES) {
+                fprintf(stderr, "comm_bulk: device stopped answering\n");
+                return -1;
+            }
+            for(unsigned char s = base; s != next; s++)
+                if(!_write_all(fd, window[s % BULK_WINDOW], BULK_FRAME_LENGTH))
+                    return -1;
+            continue;
+        }
+
+        if((unsigned char)(seq - base) >= (unsigned char)(next - base))
+            continue;
+        if(type == BULK_ACK) {
+            base = seq + 1;
+            retries = 0;
+        }
+        else {
+            base = seq;
+            for(unsigned char s = base; s != next; s++)
+                if(!_write_all(fd, window[s % BULK_WINDOW], BULK_FRAME_LENGTH))
+                    return -1;
+        }
+    }
+
+    return total;
+}
+
+/*******************************************************************************
+* Function Name: _recv_file
+********************************************************************************
+* Summary:
+*  Receive blocks from the device, acknowledge them and write them to a file.
+*
+* Return:
+*  long: The number of bytes received, or -1 on error.
+*
+*******************************************************************************/
+static long _recv_file(int fd, FILE *file)
+{
+    unsigned char frame[BULK_FRAME_LENGTH];
+    unsigned char buffer[256];
+    unsigned char expected = 0;
+    unsigned char reply[BULK_ACK_LENGTH];
+    size_t frame_count = 0;
+    bool nak_sent = false;
+    long total = 0;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int timeout_ms = HOST_START_TIMEOUT_MS;
+
+    while(1) {
+        int ret = poll(&pfd, 1, timeout_ms);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0) {
+            fprintf(stderr, "comm_bulk: device stopped sending\n");
+            return -1;
+        }
+        timeout_ms = HOST_TIMEOUT_MS * BULK_MAX_RETRIES;
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if(n <= 0)
+            return -1;
+
+        for(ssize_t i = 0; i < n; i++) {
+            frame[frame_count++] = buffer[i];
+            if(frame_count < BULK_FRAME_LENGTH)
+                continue;
+
+            // Check the integrity of the block, resynchronize if invalid
+            uint16_t crc = crc16_ccitt(CRC16_INIT, frame, BULK_FRAME_LENGTH - BULK_CRC_LENGTH);
+            if(frame[BULK_LENGTH_OFFS] > BULK_BLOCK_SIZE
+               || frame[BULK_FRAME_LENGTH - 2] != (unsigned char)(crc >> 8)
+               || frame[BULK_FRAME_LENGTH - 1] != (unsigned char)crc) {
+                memmove(frame, &frame[1], BULK_FRAME_LENGTH - 1);
+                frame_count--;
+                if(!nak_sent) {
+                    reply[0] = BULK_NAK;
+                    reply[1] = expected;
+                    if(!_write_all(fd, reply, BULK_ACK_LENGTH))
+                        return -1;
+                    nak_sent = true;
+                }
+                continue;
+            }
+            frame_count = 0;
+
+            // Acknowledge again a block already received, or ask for the
+            // missing one
+            unsigned char seq = frame[BULK_SEQ_OFFS];
+            if(seq != expected) {
+                if((unsigned char)(expected - seq) <= BULK_WINDOW) {
+                    reply[0] = BULK_ACK;
+                    reply[1] = expected - 1;
+                }
+                else if(!nak_sent) {
+                    reply[0] = BULK_NAK;
+                    reply[1] = expected;
+                    nak_sent = true;
+                }
+                else
+                    continue;
+                if(!_write_all(fd, reply, BULK_ACK_LENGTH))
+                    return -1;
+                continue;
+            }
+
+            // Keep the block and acknowledge it
+            unsigned char length = frame[BULK_LENGTH_OFFS];
+            if(fwrite(&frame[BULK_HEADER_LENGTH], 1, length, file) != length)
+                return -1;
+            total += length;
+            reply[0] = BULK_ACK;
+            reply[1] = seq;
+            if(!_write_all(fd, reply, BULK_ACK_LENGTH))
+                return -1;
+            expected++;
+            nak_sent = false;
+
+            // A short block ends the transfer
+            if(length < BULK_BLOCK_SIZE)
+                return total;
+        }
+    }
+}
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+    bool sending;
+    long total;
+
+    if(argc != 4 || (strcmp(argv[1], "send") && strcmp(argv[1], "recv"))) {
+        fprintf(stderr, "usage: %s send|recv <tty> <file>\n", argv[0]);
+        return 2;
+    }
+    sending = !strcmp(argv[1], "send");
+
+    int fd = _open_tty(argv[2]);
+    if(fd < 0) {
+        perror(argv[2]);
+        return 1;
+    }
+    FILE *file = fopen(argv[3], sending ? "rb" : "wb");
+    if(!file) {
+        perror(argv[3]);
+        return 1;
+    }
+
+    double start = _now();
+    total = sending ? _send_file(fd, file) : _recv_file(fd, file);
+    double elapsed = _now() - start;
+
+    fclose(file);
+    close(fd);
+    if(total < 0)
+        return 1;
+
+    printf("%ld bytes in %.3f s (%.1f KB/s)\n", total, elapsed,
+           elapsed > 0 ? total / elapsed / 1024 : 0);
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,620 @@
+/*******************************************************************************
+*
+* Capture and replay of link traffic.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+*******************************************************************************/
+
+#include "comm_capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define CAPTURE_MAGIC "COMMCAP"
+#define CAPTURE_VERSION (1u)
+#define INDEX_MAGIC "COMMIDX"
+#define INDEX_ENTRY_LENGTH (16u)
+#define TRAILER_LENGTH (24u)
+
+// Buffer of the capture file (chunks are usually small)
+#define CAPTURE_FILE_BUFFER_SIZE (1u << 20)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+struct comm_capture_t
+{
+    FILE *file;
+    uint64_t offset; // Bytes written so far
+    uint64_t next_index; // Offset from which the next chunk gets an index entry
+    comm_capture_index_t *index;
+    size_t index_count, index_size;
+};
+
+struct comm_capture_reader_t
+{
+    const uint8_t *map;
+    size_t map_length;
+    uint64_t first; // Offset of the first chunk
+    uint64_t data_end; // End of the last complete chunk
+    uint64_t cursor; // Offset of the next chunk for comm_capture_next()
+    uint64_t start_realtime_ns, start_monotonic_ns;
+    comm_capture_index_t *index;
+    size_t index_count;
+};
+
+/*******************************************************************************
+* PRIVATE PROTOTYPES
+*******************************************************************************/
+static uint64_t _now_ns(clockid_t clock);
+static void _put_le16(uint8_t *p, uint16_t value);
+static void _put_le32(uint8_t *p, uint32_t value);
+static void _put_le64(uint8_t *p, uint64_t value);
+static uint16_t _get_le16(const uint8_t *p);
+static uint64_t _get_le64(const uint8_t *p);
+static int _add_index(comm_capture_index_t **index, size_t *count, size_t *size, uint64_t offset, uint64_t timestamp_ns);
+static bool _read_index(comm_capture_reader_t reader);
+static int _build_index(comm_capture_reader_t reader);
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: comm_capture_create
+********************************************************************************
+* Summary:
+*  Create (or truncate) a capture file and write its header.
+*
+* Return:
+*  comm_capture_t: The writer's handle, or NULL on error (see errno).
+*
+*******************************************************************************/
+comm_capture_t comm_capture_create(const char *path)
+{
+    comm_capture_t capture = calloc(1, sizeof(struct comm_capture_t));
+    if(!capture)
+        return NULL;
+
+    capture->file = fopen(path, "wb");
+    if(!capture->file) {
+        free(capture);
+        return NULL;
+    }
+    setvbuf(capture->file, NULL, _IOFBF, CAPTURE_FILE_BUFFER_SIZE);
+
+    uint8_t header[COMM_CAPTURE_HEADER_LENGTH] = CAPTURE_MAGIC;
+    _put_le16(header + 8, CAPTURE_VERSION);
+    _put_le32(header + 12, COMM_CAPTURE_HEADER_LENGTH);
+    _put_le64(header + 16, _now_ns(CLOCK_REALTIME));
+    _put_le64(header + 24, _now_ns(CLOCK_MONOTONIC));
+    if(fwrite(header, sizeof(header), 1, capture->file) != 1) {
+        int err = errno;
+        fclose(capture->file);
+        free(capture);
+        errno = err;
+        return NULL;
+    }
+    capture->offset = COMM_CAPTURE_HEADER_LENGTH;
+
+    return capture;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_finish
+********************************************************************************
+* Summary:
+*  Write the index and close the capture file, and, as a side effect, set the
+*  pointer to NULL.
+*
+* Return:
+*  int: -1 on error (the chunks written so far are still readable).
+*
+*******************************************************************************/
+int comm_capture_finish(comm_capture_t *capture)
+{
+    comm_capture_t cap = *capture;
+    int result = 0;
+
+    for(size_t i = 0; i < cap->index_count && !result; i++) {
+        uint8_t entry[INDEX_ENTRY_LENGTH];
+        _put_le64(entry, cap->index[i].offset);
+        _put_le64(entry + 8, cap->index[i].timestamp_ns);
+        if(fwrite(entry, sizeof(entry), 1, cap->file) != 1)
+            result = -1;
+    }
+
+    uint8_t trailer[TRAILER_LENGTH] = INDEX_MAGIC;
+    _put_le64(trailer + 8, cap->index_count);
+    _put_le64(trailer + 16, cap->offset);
+    if(!result && fwrite(trailer, sizeof(trailer), 1, cap->file) != 1)
+        result = -1;
+    if(fclose(cap->file) != 0)
+        result = -1;
+
+    free(cap->index);
+    free(cap);
+    *capture = NULL;
+
+    return result;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_write
+********************************************************************************
+* Summary:
+*  Append a chunk of data, timestamped now. Chunks larger than
+*  COMM_CAPTURE_CHUNK_MAX are split.
+*
+* Parameters:
+*  capture: The writer's handle.
+*  dir: COMM_CAPTURE_RX or COMM_CAPTURE_TX.
+*  data: The bytes read or written.
+*  count: The number of bytes in 'data'.
+*
+* Return:
+*  int: -1 on error.
+*
+*******************************************************************************/
+int comm_capture_write(comm_capture_t capture, uint8_t dir, const void *data, size_t count)
+{
+    struct iovec iov = {(void *)data, count};
+    return comm_capture_writev(capture, dir, &iov, 1, count);
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_writev
+********************************************************************************
+* Summary:
+*  Like comm_capture_write(), with the data in several areas (e.g. the two
+*  parts of a ring buffer, see ringbuf_head_iov()). Only the first 'count'
+*  bytes are written.
+*
+*******************************************************************************/
+int comm_capture_writev(comm_capture_t capture, uint8_t dir, const struct iovec *iov, int iovcnt, size_t count)
+{
+    uint64_t timestamp_ns = _now_ns(CLOCK_MONOTONIC);
+    int i = 0;
+    size_t pos = 0; // Position in iov[i]
+
+    while(count) {
+        size_t length = count > COMM_CAPTURE_CHUNK_MAX ? COMM_CAPTURE_CHUNK_MAX : count;
+
+        if(capture->offset >= capture->next_index) {
+            if(_add_index(&capture->index, &capture->index_count, &capture->index_size,
+                          capture->offset, timestamp_ns) < 0)
+                return -1;
+            capture->next_index = capture->offset + COMM_CAPTURE_INDEX_STEP;
+        }
+
+        uint8_t header[COMM_CAPTURE_CHUNK_HEADER_LENGTH] = {dir, 0};
+        _put_le16(header + 2, (uint16_t)length);
+        _put_le64(header + 4, timestamp_ns);
+        if(fwrite(header, sizeof(header), 1, capture->file) != 1)
+            return -1;
+        capture->offset += COMM_CAPTURE_CHUNK_HEADER_LENGTH + length;
+        count -= length;
+
+        while(length && i < iovcnt) {
+            size_t n = iov[i].iov_len - pos;
+            if(n > length)
+                n = length;
+            if(n && fwrite((const uint8_t *)iov[i].iov_base + pos, 1, n, capture->file) != n)
+                return -1;
+            pos += n;
+            length -= n;
+            if(pos == iov[i].iov_len) {
+                i++;
+                pos = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_tap
+********************************************************************************
+* Summary:
+*  comm_capture_writev() for comm_host_set_tap(), with the capture as
+*  context: comm_host_set_tap(host, comm_capture_tap, capture). Errors are
+*  ignored, the capture is best effort.
+*
+*******************************************************************************/
+void comm_capture_tap(void *capture, uint8_t dir, const struct iovec *iov, int iovcnt, size_t count)
+{
+    (void)comm_capture_writev(capture, dir, iov, iovcnt, count);
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_open
+********************************************************************************
+* Summary:
+*  Map a capture file for reading, and load its index (or build it if the
+*  capture wasn't finished).
+*
+* Return:
+*  comm_capture_reader_t: The reader's handle, or NULL on error (see errno).
+*
+*******************************************************************************/
+comm_capture_reader_t comm_capture_open(const char *path)
+{
+    struct stat st;
+    comm_capture_reader_t reader = calloc(1, sizeof(struct comm_capture_reader_t));
+    if(!reader)
+        return NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || fstat(fd, &st) < 0)
+        goto error;
+    if((size_t)st.st_size < COMM_CAPTURE_HEADER_LENGTH) {
+        errno = EPROTO;
+        goto error;
+    }
+
+    reader->map_length = (size_t)st.st_size;
+    reader->map = mmap(NULL, reader->map_length, PROT_READ, MAP_SHARED, fd, 0);
+    if(reader->map == MAP_FAILED)
+        goto error;
+    close(fd);
+    fd = -1;
+    madvise((void *)reader->map, reader->map_length, MADV_SEQUENTIAL);
+
+    // Later versions may have a longer header, the chunks start after it
+    reader->first = _get_le16(reader->map + 12) | (uint64_t)_get_le16(reader->map + 14) << 16;
+    if(memcmp(reader->map, CAPTURE_MAGIC, 8) != 0 || _get_le16(reader->map + 8) != CAPTURE_VERSION
+       || reader->first < COMM_CAPTURE_HEADER_LENGTH || reader->first > reader->map_length) {
+        errno = EPROTO;
+        goto error_unmap;
+    }
+    reader->start_realtime_ns = _get_le64(reader->map + 16);
+    reader->start_monotonic_ns = _get_le64(reader->map + 24);
+    reader->cursor = reader->first;
+
+    if(!_read_index(reader) && _build_index(reader) < 0)
+        goto error_unmap;
+
+    return reader;
+
+error_unmap:
+    munmap((void *)reader->map, reader->map_length);
+error:
+    {
+        int err = errno;
+        if(fd >= 0)
+            close(fd);
+        free(reader);
+        errno = err;
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_close
+********************************************************************************
+* Summary:
+*  Unmap a capture file, and, as a side effect, set the pointer to NULL.
+*
+*******************************************************************************/
+void comm_capture_close(comm_capture_reader_t *reader)
+{
+    munmap((void *)(*reader)->map, (*reader)->map_length);
+    free((*reader)->index);
+    free(*reader);
+    *reader = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_next
+********************************************************************************
+* Summary:
+*  Read the next chunk.
+*
+* Return:
+*  bool: 'false' at the end of the capture.
+*
+*******************************************************************************/
+bool comm_capture_next(comm_capture_reader_t reader, comm_capture_chunk_t *chunk)
+{
+    return comm_capture_chunk_at(reader, &reader->cursor, chunk);
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_seek
+********************************************************************************
+* Summary:
+*  Make comm_capture_next() read the chunk at 'offset' (an offset from the
+*  index or from comm_capture_find()).
+*
+*******************************************************************************/
+void comm_capture_seek(comm_capture_reader_t reader, uint64_t offset)
+{
+    reader->cursor = offset;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_chunk_at
+********************************************************************************
+* Summary:
+*  Read the chunk at '*offset' and move '*offset' to the next one. Doesn't
+*  touch the reader, so several threads can read the same capture.
+*
+* Return:
+*  bool: 'false' at the end of the capture (or on a corrupted chunk).
+*
+*******************************************************************************/
+bool comm_capture_chunk_at(const struct comm_capture_reader_t *reader, uint64_t *offset, comm_capture_chunk_t *chunk)
+{
+    if(*offset + COMM_CAPTURE_CHUNK_HEADER_LENGTH > reader->data_end)
+        return false;
+
+    const uint8_t *header = reader->map + *offset;
+    uint16_t count = _get_le16(header + 2);
+    if(*offset + COMM_CAPTURE_CHUNK_HEADER_LENGTH + count > reader->data_end
+       || (header[0] != COMM_CAPTURE_RX && header[0] != COMM_CAPTURE_TX))
+        return false;
+
+    chunk->dir = header[0];
+    chunk->flags = header[1];
+    chunk->count = count;
+    chunk->timestamp_ns = _get_le64(header + 4);
+    chunk->data = header + COMM_CAPTURE_CHUNK_HEADER_LENGTH;
+    *offset += COMM_CAPTURE_CHUNK_HEADER_LENGTH + count;
+
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_get_index
+********************************************************************************
+* Summary:
+*  Get the index: chunk offsets roughly COMM_CAPTURE_INDEX_STEP bytes apart,
+*  in order, the first one being the first chunk.
+*
+* Return:
+*  size_t: The number of entries.
+*
+*******************************************************************************/
+size_t comm_capture_get_index(const struct comm_capture_reader_t *reader, const comm_capture_index_t **index)
+{
+    *index = reader->index;
+    return reader->index_count;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_find
+********************************************************************************
+* Summary:
+*  Find, with the index, a chunk from which to read to reach 'timestamp_ns':
+*  the last indexed chunk that isn't later.
+*
+* Return:
+*  uint64_t: The offset of the chunk (see comm_capture_seek()).
+*
+*******************************************************************************/
+uint64_t comm_capture_find(const struct comm_capture_reader_t *reader, uint64_t timestamp_ns)
+{
+    size_t low = 0, high = reader->index_count;
+
+    // First entry later than 'timestamp_ns'
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(reader->index[mid].timestamp_ns <= timestamp_ns)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low ? reader->index[low - 1].offset : reader->first;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_end
+********************************************************************************
+* Summary:
+*  The offset just past the last chunk.
+*
+*******************************************************************************/
+uint64_t comm_capture_end(const struct comm_capture_reader_t *reader)
+{
+    return reader->data_end;
+}
+
+/*******************************************************************************
+* Function Name: comm_capture_realtime_ns
+********************************************************************************
+* Summary:
+*  Convert a chunk timestamp (CLOCK_MONOTONIC) to CLOCK_REALTIME, based on
+*  both clocks when the capture started.
+*
+*******************************************************************************/
+uint64_t comm_capture_realtime_ns(const struct comm_capture_reader_t *reader, uint64_t timestamp_ns)
+{
+    return reader->start_realtime_ns + (timestamp_ns - reader->start_monotonic_ns);
+}
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+static uint64_t _now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void _put_le16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void _put_le32(uint8_t *p, uint32_t value)
+{
+    _put_le16(p, (uint16_t)value);
+    _put_le16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void _put_le64(uint8_t *p, uint64_t value)
+{
+    _put_le32(p, (uint32_t)value);
+    _put_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint16_t _get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint64_t _get_le64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+/*******************************************************************************
+* Function Name: _add_index
+********************************************************************************
+* Summary:
+*  Append an entry to a growing index.
+*
+* Return:
+*  int: -1 if there's not enough memory.
+*
+*******************************************************************************/
+static int _add_index(comm_capture_index_t **index, size_t *count, size_t *size, uint64_t offset, uint64_t timestamp_ns)
+{
+    if(*count == *size) {
+        size_t new_size = *size ? 2 * *size : 256;
+        comm_capture_index_t *new_index = realloc(*index, new_size * sizeof(comm_capture_index_t));
+        if(!new_index)
+            return -1;
+        *index = new_index;
+        *size = new_size;
+    }
+
+    (*index)[*count].offset = offset;
+    (*index)[*count].timestamp_ns = timestamp_ns;
+    (*count)++;
+
+    return 0;
+}
+
+/*******************************************************************************
+* Function Name: _read_index
+********************************************************************************
+* Summary:
+*  Load the index written by comm_capture_finish(), if there's one.
+*
+* Return:
+*  bool: 'false' if the capture has no (valid) index.
+*
+*******************************************************************************/
+static bool _read_index(comm_capture_reader_t reader)
+{
+    if(reader->map_length < COMM_CAPTURE_HEADER_LENGTH + TRAILER_LENGTH)
+        return false;
+
+    const uint8_t *trailer = reader->map + reader->map_length - TRAILER_LENGTH;
+    uint64_t count = _get_le64(trailer + 8);
+    uint64_t offset = _get_le64(trailer + 16);
+    if(memcmp(trailer, INDEX_MAGIC, 8) != 0 || offset < reader->first
+       || count > reader->map_length / INDEX_ENTRY_LENGTH
+       || offset + count * INDEX_ENTRY_LENGTH + TRAILER_LENGTH != reader->map_length)
+        return false;
+
+    reader->index = malloc((count ? count : 1) * sizeof(comm_capture_index_t));
+    if(!reader->index)
+        return false;
+    for(uint64_t i = 0; i < count; i++) {
+        const uint8_t *entry = reader->map + offset + i * INDEX_ENTRY_LENGTH;
+        reader->index[i].offset = _get_le64(entry);
+        reader->index[i].timestamp_ns = _get_le64(entry + 8);
+    }
+    reader->index_count = count;
+    reader->data_end = offset;
+
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: _build_index
+********************************************************************************
+* Summary:
+*  Walk the chunks of a capture that has no index, to build it and find the
+*  end of the last complete chunk.
+*
+* Return:
+*  int: -1 if there's not enough memory.
+*
+*******************************************************************************/
+static int _build_index(comm_capture_reader_t reader)
+{
+    size_t size = 0;
+    uint64_t offset = reader->first;
+    uint64_t next_index = offset;
+    comm_capture_chunk_t chunk;
+
+    free(reader->index);
+    reader->index = NULL;
+    reader->index_count = 0;
+    reader->data_end = reader->map_length;
+
+    while(1) {
+        uint64_t start = offset;
+        if(!comm_capture_chunk_at(reader, &offset, &chunk)) {
+            reader->data_end = start;
+            break;
+        }
+        if(start >= next_index) {
+            if(_add_index(&reader->index, &reader->index_count, &size, start, chunk.timestamp_ns) < 0)
+                return -1;
+            next_index = start + COMM_CAPTURE_INDEX_STEP;
+        }
+    }
+
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,125 @@
+/*******************************************************************************
+*
+* Capture and replay of link traffic.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Records timestamped RX/TX chunks into an append-only binary file, and
+*  reads them back (memory-mapped) for replay and offline analysis.
+*
+*  File format (integers are little-endian):
+*    Header (32 bytes):
+*      "COMMCAP\0", version (uint16), reserved (uint16), header length
+*      (uint32), CLOCK_REALTIME and CLOCK_MONOTONIC when the capture started
+*      (uint64 ns each).
+*    Chunks (12 bytes + data), as many as needed:
+*      direction ('R' or 'T', uint8), flags (uint8), count (uint16),
+*      CLOCK_MONOTONIC timestamp (uint64 ns), then 'count' bytes of data.
+*    Index, written by comm_capture_finish():
+*      entries (offset of a chunk, its timestamp: uint64 each), roughly one
+*      every COMM_CAPTURE_INDEX_STEP bytes of file, then a 24-byte trailer:
+*      "COMMIDX\0", number of entries, offset of the first entry (uint64).
+*  A capture that wasn't finished (crash, power loss) has no index: readers
+*  build it by walking the chunks, and ignore a truncated last chunk.
+*
+* Build:
+*  cc -O2 -c comm_capture.c
+*
+*******************************************************************************/
+
+#ifndef _COMM_CAPTURE_H
+#define _COMM_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Directions, from the host's point of view
+#define COMM_CAPTURE_RX ((uint8_t)'R') // Device to host
+#define COMM_CAPTURE_TX ((uint8_t)'T') // Host to device
+
+// Approximate number of bytes of file between two index entries
+#define COMM_CAPTURE_INDEX_STEP (65536u)
+
+#define COMM_CAPTURE_HEADER_LENGTH (32u)
+#define COMM_CAPTURE_CHUNK_HEADER_LENGTH (12u)
+#define COMM_CAPTURE_CHUNK_MAX (65535u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+// A chunk read from a capture (points into the mapped file)
+typedef struct
+{
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC when the chunk was read or written
+    const uint8_t *data;
+    uint16_t count; // The number of bytes in 'data'
+    uint8_t dir; // COMM_CAPTURE_RX or COMM_CAPTURE_TX
+    uint8_t flags; // Reserved, 0
+} comm_capture_chunk_t;
+
+typedef struct
+{
+    uint64_t offset; // Offset of a chunk in the file
+    uint64_t timestamp_ns; // Its timestamp
+} comm_capture_index_t;
+
+typedef struct comm_capture_t *comm_capture_t;
+typedef struct comm_capture_reader_t *comm_capture_reader_t;
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+// Writer (one thread at a time)
+comm_capture_t comm_capture_create(const char *path);
+int comm_capture_finish(comm_capture_t *capture);
+int comm_capture_write(comm_capture_t capture, uint8_t dir, const void *data, size_t count);
+int comm_capture_writev(comm_capture_t capture, uint8_t dir, const struct iovec *iov, int iovcnt, size_t count);
+void comm_capture_tap(void *capture, uint8_t dir, const struct iovec *iov, int iovcnt, size_t count);
+
+// Reader
+comm_capture_reader_t comm_capture_open(const char *path);
+void comm_capture_close(comm_capture_reader_t *reader);
+bool comm_capture_next(comm_capture_reader_t reader, comm_capture_chunk_t *chunk);
+void comm_capture_seek(comm_capture_reader_t reader, uint64_t offset);
+bool comm_capture_chunk_at(const struct comm_capture_reader_t *reader, uint64_t *offset, comm_capture_chunk_t *chunk);
+size_t comm_capture_get_index(const struct comm_capture_reader_t *reader, const comm_capture_index_t **index);
+uint64_t comm_capture_find(const struct comm_capture_reader_t *reader, uint64_t timestamp_ns);
+uint64_t comm_capture_end(const struct comm_capture_reader_t *reader);
+uint64_t comm_capture_realtime_ns(const struct comm_capture_reader_t *reader, uint64_t timestamp_ns);
+
+#endif // _COMM_CAPTURE_H
+
+/* [] END OF FILE */
@@ -0,0 +1,569 @@
+/*******************************************************************************
+*
+* Parallel decoder of capture files.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+********************************************************************************
+*
+* Summary:
+*  Decodes the custom messages of one direction of a capture (see
+*  comm_capture.h) on all cores, and prints per-message-type statistics (the
+*  type being the first byte of the payload).
+*  The capture is memory-mapped and cut into jobs at its index entries. Each
+*  job is decoded from its first byte as if the stream started there, which
+*  may be in the middle of a message. When every job is done, the jobs are
+*  stitched in order: the parse of the previous job is continued over the
+*  beginning of the next one until it reaches a position the next job's
+*  parse also went through (see comm_parse.h), which happens within a
+*  message or two; from there the next job's results are exact. The result
+*  is identical to a sequential decode.
+*
+* Usage:
+*  comm_decode [-d rx|tx] [-j threads] [-n jobs] <capture>
+*    -d: Direction to decode (default: rx).
+*    -j: Number of threads (default: number of cores).
+*    -n: Number of jobs (default: 8 per thread, 1 is a sequential decode).
+*
+* Build:
+*  cc -O2 -pthread -I../src -o comm_decode comm_decode.c comm_capture.c
+*
+*******************************************************************************/
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm_capture.h"
+#include "comm_parse.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Bytes of the stream decoded at once by a job
+#define DECODE_BUFFER_SIZE (1u << 20)
+
+// Beginning of a job over which the previous job's parse must converge
+#define DECODE_WINDOW (4096u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    uint64_t messages;
+    uint64_t garbage; // Bytes
+    uint64_t resyncs;
+    uint64_t type_count[256];
+    uint64_t type_bytes[256]; // Payload bytes
+} _stats_t;
+
+// A step of the parser (see comm_parse_step())
+typedef struct
+{
+    uint64_t pos;
+    uint32_t length;
+    uint8_t kind;
+    uint8_t type;
+} _event_t;
+
+typedef struct
+{
+    uint64_t begin, end; // File offsets of the job's chunks
+    uint64_t stream_begin, stream_end; // Positions in the decoded direction
+    uint64_t stream_stop; // Where the parse stopped (>= stream_end unless the data ended)
+    _stats_t stats; // Steps past the window
+    _event_t *events; // Steps in the window
+    size_t event_count;
+    uint8_t window[DECODE_WINDOW + MSG_MAX_LENGTH]; // Bytes from 'stream_begin'
+    size_t window_length;
+} _job_t;
+
+// Bytes of one direction of a capture, across chunks
+typedef struct
+{
+    const struct comm_capture_reader_t *reader;
+    uint8_t dir;
+    uint64_t offset; // Next chunk
+    const uint8_t *data; // Rest of the current chunk
+    size_t count;
+} _stream_t;
+
+typedef struct
+{
+    const struct comm_capture_reader_t *reader;
+    uint8_t dir;
+    _job_t *jobs;
+    size_t job_count;
+    atomic_size_t next_job;
+    bool count_only; // First pass: only count the bytes of each job
+} _context_t;
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+static double _now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*******************************************************************************
+* Function Name: _stream_read
+********************************************************************************
+* Summary:
+*  Copy up to 'max' bytes of the stream.
+*
+* Return:
+*  size_t: The number of bytes copied, 0 at the end of the capture.
+*
+*******************************************************************************/
+static size_t _stream_read(_stream_t *stream, uint8_t *dst, size_t max)
+{
+    size_t total = 0;
+    comm_capture_chunk_t chunk;
+
+    while(total < max) {
+        if(!stream->count) {
+            if(!comm_capture_chunk_at(stream->reader, &stream->offset, &chunk))
+                break;
+            if(chunk.dir != stream->dir)
+                continue;
+            stream->data = chunk.data;
+            stream->count = chunk.count;
+        }
+
+        size_t n = stream->count < max - total ? stream->count : max - total;
+        memcpy(dst + total, stream->data, n);
+        stream->data += n;
+        stream->count -= n;
+        total += n;
+    }
+
+    return total;
+}
+
+/*******************************************************************************
+* Function Name: _add_event
+********************************************************************************
+* Summary:
+*  Account for a step of the parser.
+*
+*******************************************************************************/
+static void _add_event(_stats_t *stats, const _event_t *event)
+{
+    switch(event->kind) {
+    case COMM_PARSE_GARBAGE:
+        stats->garbage += event->length;
+        break;
+    case COMM_PARSE_RESYNC:
+        stats->resyncs++;
+        stats->garbage += event->length;
+        break;
+    case COMM_PARSE_MESSAGE:
+        stats->messages++;
+        stats->type_count[event->type]++;
+        stats->type_bytes[event->type] += event->length - MSG_STRUCTURE_LENGTH;
+        break;
+    }
+}
+
+/*******************************************************************************
+* Function Name: _make_event
+********************************************************************************
+* Summary:
+*  Parse one step at 'pos'.
+*
+* Return:
+*  bool: 'false' if more bytes are needed.
+*
+*******************************************************************************/
+static bool _make_event(_event_t *event, uint64_t pos, const uint8_t *data, size_t count)
+{
+    size_t length;
+    comm_parse_result_t result = comm_parse_step(data, count, &length);
+    if(result == COMM_PARSE_MORE)
+        return false;
+
+    event->pos = pos;
+    event->length = (uint32_t)length;
+    event->kind = (uint8_t)result;
+    event->type = result == COMM_PARSE_MESSAGE && length > MSG_STRUCTURE_LENGTH ? data[MSG_HEADER_LENGTH] : 0;
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: _decode
+********************************************************************************
+* Summary:
+*  Decode a job from stream position 'pos' until the parse reaches the end of
+*  the job (or of the data). If 'pos' is the beginning of the job, the steps
+*  within DECODE_WINDOW are kept aside for the stitching, otherwise all of
+*  them go to the job's statistics.
+*
+*******************************************************************************/
+static void _decode(const _context_t *context, _job_t *job, uint64_t pos, uint8_t *buffer)
+{
+    _stream_t stream = {context->reader, context->dir, job->begin, NULL, 0};
+    bool keep_window = pos == job->stream_begin;
+    size_t events_size = 0;
+    _event_t event;
+
+    memset(&job->stats, 0, sizeof(job->stats));
+    job->event_count = 0;
+
+    // Skip to 'pos'
+    for(uint64_t skip = pos - job->stream_begin; skip;) {
+        size_t n = _stream_read(&stream, buffer, skip < DECODE_BUFFER_SIZE ? skip : DECODE_BUFFER_SIZE);
+        if(!n)
+            break;
+        skip -= n;
+    }
+
+    // Don't read much further than the last message of the job (or the window)
+    uint64_t limit = job->stream_end > job->stream_begin + DECODE_WINDOW ? job->stream_end : job->stream_begin + DECODE_WINDOW;
+    limit += MSG_MAX_LENGTH;
+
+    uint64_t base = pos; // Position of buffer[0]
+    size_t want = limit - pos < DECODE_BUFFER_SIZE ? limit - pos : DECODE_BUFFER_SIZE;
+    size_t length = _stream_read(&stream, buffer, want);
+    bool eof = length < want;
+    if(keep_window) {
+        job->window_length = length < sizeof(job->window) ? length : sizeof(job->window);
+        memcpy(job->window, buffer, job->window_length);
+    }
+
+    while(pos < job->stream_end) {
+        size_t i = pos - base;
+
+        // Keep at least a whole message ahead
+        if(!eof && length - i < MSG_MAX_LENGTH) {
+            memmove(buffer, buffer + i, length - i);
+            length -= i;
+            base = pos;
+            i = 0;
+            want = limit - (base + length) < DECODE_BUFFER_SIZE - length ? limit - (base + length) : DECODE_BUFFER_SIZE - length;
+            size_t n = _stream_read(&stream, buffer + length, want);
+            eof = n < want;
+            length += n;
+        }
+
+        if(!_make_event(&event, pos, buffer + i, length - i))
+            break;
+        pos += event.length;
+
+        if(keep_window && event.pos < job->stream_begin + DECODE_WINDOW) {
+            if(job->event_count == events_size) {
+                events_size = events_size ? 2 * events_size : 64;
+                job->events = realloc(job->events, events_size * sizeof(_event_t));
+                if(!job->events) {
+                    perror("comm_decode");
+                    exit(1);
+                }
+            }
+            job->events[job->event_count++] = event;
+        }
+        else
+            _add_event(&job->stats, &event);
+    }
+
+    job->stream_stop = pos;
+}
+
+/*******************************************************************************
+* Function Name: _count
+********************************************************************************
+* Summary:
+*  Count the bytes of the decoded direction in a job's chunks.
+*
+*******************************************************************************/
+static uint64_t _count(const _context_t *context, const _job_t *job)
+{
+    uint64_t offset = job->begin, total = 0;
+    comm_capture_chunk_t chunk;
+
+    while(offset < job->end && comm_capture_chunk_at(context->reader, &offset, &chunk)) {
+        if(chunk.dir == context->dir)
+            total += chunk.count;
+    }
+
+    return total;
+}
+
+/*******************************************************************************
+* Function Name: _worker
+********************************************************************************
+* Summary:
+*  Run jobs until there are none left.
+*
+*******************************************************************************/
+static void *_worker(void *arg)
+{
+    _context_t *context = arg;
+    uint8_t *buffer = context->count_only ? NULL : malloc(DECODE_BUFFER_SIZE);
+
+    while(1) {
+        size_t i = atomic_fetch_add(&context->next_job, 1);
+        if(i >= context->job_count)
+            break;
+
+        _job_t *job = &context->jobs[i];
+        if(context->count_only)
+            job->stream_end = _count(context, job);
+        else
+            _decode(context, job, job->stream_begin, buffer);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/*******************************************************************************
+* Function Name: _run
+********************************************************************************
+* Summary:
+*  Run all the jobs on 'threads' threads.
+*
+*******************************************************************************/
+static void _run(_context_t *context, unsigned threads)
+{
+    pthread_t thread[threads];
+
+    atomic_store(&context->next_job, 0);
+    for(unsigned i = 0; i < threads; i++) {
+        if(pthread_create(&thread[i], NULL, _worker, context) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for(unsigned i = 0; i < threads; i++)
+        pthread_join(thread[i], NULL);
+}
+
+/*******************************************************************************
+* Function Name: _stitch
+********************************************************************************
+* Summary:
+*  Merge the jobs' statistics in order, continuing each parse over the
+*  beginning of the next job until both parses meet.
+*
+*******************************************************************************/
+static void _stitch(_context_t *context, _stats_t *total, unsigned *redone)
+{
+    uint64_t pos = 0; // Where the exact parse is
+    uint8_t *buffer = NULL;
+    _event_t event;
+
+    memset(total, 0, sizeof(*total));
+    *redone = 0;
+
+    for(size_t j = 0; j < context->job_count; j++) {
+        _job_t *job = &context->jobs[j];
+        size_t e = 0;
+
+        // Parse the beginning of the job until reaching one of its steps
+        while(pos < job->stream_end) {
+            while(e < job->event_count && job->events[e].pos < pos)
+                e++;
+            if(e < job->event_count && job->events[e].pos == pos)
+                break;
+
+            size_t i = pos - job->stream_begin;
+            if(i >= DECODE_WINDOW || !_make_event(&event, pos, job->window + i, job->window_length - i))
+                break;
+            _add_event(total, &event);
+            pos += event.length;
+        }
+
+        // Already parsed up to the end of the job
+        if(pos >= job->stream_end)
+            continue;
+
+        // Met: the job's steps from here are exact
+        if(e < job->event_count && job->events[e].pos == pos) {
+            for(; e < job->event_count; e++)
+                _add_event(total, &job->events[e]);
+        }
+        // Didn't meet within the window: decode the job again from 'pos'
+        else {
+            if(!buffer && !(buffer = malloc(DECODE_BUFFER_SIZE))) {
+                perror("comm_decode");
+                exit(1);
+            }
+            _decode(context, job, pos, buffer);
+            (*redone)++;
+        }
+
+        total->messages += job->stats.messages;
+        total->garbage += job->stats.garbage;
+        total->resyncs += job->stats.resyncs;
+        for(int t = 0; t < 256; t++) {
+            total->type_count[t] += job->stats.type_count[t];
+            total->type_bytes[t] += job->stats.type_bytes[t];
+        }
+        pos = job->stream_stop;
+    }
+
+    free(buffer);
+}
+
+/*******************************************************************************
+* Function Name: _decode_capture
+********************************************************************************
+* Summary:
+*  Decode one direction of a capture in up to 'jobs' jobs (no more than there
+*  are index entries) on 'threads' threads.
+*
+* Parameters:
+*  total: Set to the statistics of the whole stream.
+*  stream_length: Set to the number of bytes decoded.
+*  redone: Set to the number of jobs decoded again by the stitching.
+*
+* Return:
+*  long: The number of jobs run.
+*
+*******************************************************************************/
+static long _decode_capture(const struct comm_capture_reader_t *reader, uint8_t dir, unsigned threads, size_t jobs,
+                            _stats_t *total, uint64_t *stream_length, unsigned *redone)
+{
+    // Cut the capture into jobs at index entries
+    const comm_capture_index_t *index;
+    size_t index_count = comm_capture_get_index(reader, &index);
+    if(jobs > index_count)
+        jobs = index_count ? index_count : 1;
+
+    _context_t context = {
+        .reader = reader,
+        .dir = dir,
+        .jobs = calloc(jobs, sizeof(_job_t)),
+        .job_count = jobs,
+    };
+    if(!context.jobs) {
+        perror("comm_decode");
+        exit(1);
+    }
+    for(size_t j = 0; j < jobs; j++) {
+        context.jobs[j].begin = index_count ? index[index_count * j / jobs].offset : comm_capture_end(reader);
+        context.jobs[j].end = j + 1 < jobs ? index[index_count * (j + 1) / jobs].offset : comm_capture_end(reader);
+    }
+
+    // Positions of the jobs in the stream, then decode
+    context.count_only = true;
+    _run(&context, threads);
+    *stream_length = 0;
+    for(size_t j = 0; j < jobs; j++) {
+        uint64_t count = context.jobs[j].stream_end;
+        context.jobs[j].stream_begin = *stream_length;
+        *stream_length += count;
+        context.jobs[j].stream_end = *stream_length;
+    }
+    context.count_only = false;
+    _run(&context, threads);
+
+    _stitch(&context, total, redone);
+
+    for(size_t j = 0; j < jobs; j++)
+        free(context.jobs[j].events);
+    free(context.jobs);
+    return (long)jobs;
+}
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+    uint8_t dir = COMM_CAPTURE_RX;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long jobs = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "d:j:n:")) != -1) {
+        switch(opt) {
+        case 'd':
+            dir = strcmp(optarg, "tx") == 0 ? COMM_CAPTURE_TX : COMM_CAPTURE_RX;
+            break;
+        case 'j':
+            threads = atol(optarg);
+            break;
+        case 'n':
+            jobs = atol(optarg);
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if(argc - optind != 1 || threads < 1 || jobs < 0) {
+        fprintf(stderr, "usage: %s [-d rx|tx] [-j threads] [-n jobs] <capture>\n", argv[0]);
+        return 2;
+    }
+
+    comm_capture_reader_t reader = comm_capture_open(argv[optind]);
+    if(!reader) {
+        perror(argv[optind]);
+        return 1;
+    }
+    double start = _now();
+    _stats_t total;
+    uint64_t stream_length;
+    unsigned redone;
+    if(!jobs)
+        jobs = 8 * threads;
+    jobs = _decode_capture(reader, dir, (unsigned)threads, (size_t)jobs, &total, &stream_length, &redone);
+    double elapsed = _now() - start;
+
+    printf("%s: %llu bytes (%s), %ld jobs on %ld threads, %.3f s (%.1f MB/s)",
+           argv[optind], (unsigned long long)stream_length, dir == COMM_CAPTURE_RX ? "rx" : "tx",
+           jobs, threads, elapsed, stream_length / elapsed / 1e6);
+    if(redone)
+        printf(", %u jobs decoded again", redone);
+    printf("\nmessages: %llu, garbage: %llu bytes, resyncs: %llu\n",
+           (unsigned long long)total.messages, (unsigned long long)total.garbage,
+           (unsigned long long)total.resyncs);
+    printf("type      count  payload bytes\n");
+    for(int t = 0; t < 256; t++) {
+        if(total.type_count[t])
+            printf("0x%02x %10llu %14llu\n", t, (unsigned long long)total.type_count[t],
+                   (unsigned long long)total.type_bytes[t]);
+    }
+
+    comm_capture_close(&reader);
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,192 @@
+/*******************************************************************************
+*
+* Lock-free queue of decoded frames.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+*******************************************************************************/
+
+#include "comm_frame_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    atomic_size_t sequence; // Position of the next push (or pop + 1) allowed
+    comm_frame_t frame;
+} _slot_t;
+
+struct comm_frame_queue_t
+{
+    alignas(COMM_CACHE_LINE_SIZE) atomic_size_t push_pos;
+    alignas(COMM_CACHE_LINE_SIZE) atomic_size_t pop_pos;
+    alignas(COMM_CACHE_LINE_SIZE) size_t mask;
+    _slot_t *slots;
+};
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: comm_frame_queue_new
+********************************************************************************
+* Summary:
+*  Create a queue holding at least 'capacity' frames (rounded up to a power
+*  of two).
+*
+* Return:
+*  comm_frame_queue_t: The new queue, or NULL if there's not enough memory.
+*
+*******************************************************************************/
+comm_frame_queue_t comm_frame_queue_new(size_t capacity)
+{
+    size_t size = 2;
+    while(size < capacity)
+        size <<= 1;
+
+    comm_frame_queue_t queue = aligned_alloc(COMM_CACHE_LINE_SIZE, sizeof(struct comm_frame_queue_t));
+    if(!queue)
+        return NULL;
+    queue->slots = malloc(size * sizeof(_slot_t));
+    if(!queue->slots) {
+        free(queue);
+        return NULL;
+    }
+
+    queue->mask = size - 1;
+    for(size_t i = 0; i < size; i++)
+        atomic_init(&queue->slots[i].sequence, i);
+    atomic_init(&queue->push_pos, 0);
+    atomic_init(&queue->pop_pos, 0);
+
+    return queue;
+}
+
+/*******************************************************************************
+* Function Name: comm_frame_queue_free
+********************************************************************************
+* Summary:
+*  Deallocate a queue, and, as a side effect, set the pointer to NULL.
+*
+*******************************************************************************/
+void comm_frame_queue_free(comm_frame_queue_t *queue)
+{
+    free((*queue)->slots);
+    free(*queue);
+    *queue = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_frame_queue_push
+********************************************************************************
+* Summary:
+*  Copy a frame at the end of the queue. Safe to call from any thread.
+*
+* Return:
+*  bool: 'false' if the queue is full (the frame is not copied).
+*
+*******************************************************************************/
+bool comm_frame_queue_push(comm_frame_queue_t queue, const comm_frame_t *frame)
+{
+    size_t pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+    _slot_t *slot;
+
+    while(1) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        // Free slot, try to claim it
+        if(diff == 0) {
+            if(atomic_compare_exchange_weak_explicit(&queue->push_pos, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        // Slot not popped yet: the queue is full
+        else if(diff < 0)
+            return false;
+        // Another producer claimed it first
+        else
+            pos = atomic_load_explicit(&queue->push_pos, memory_order_relaxed);
+    }
+
+    // Only copy the used part of the frame
+    memcpy(&slot->frame, frame, offsetof(comm_frame_t, data) + frame->count);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: comm_frame_queue_pop
+********************************************************************************
+* Summary:
+*  Copy the frame at the beginning of the queue and remove it. Safe to call
+*  from any thread.
+*
+* Return:
+*  bool: 'false' if the queue is empty.
+*
+*******************************************************************************/
+bool comm_frame_queue_pop(comm_frame_queue_t queue, comm_frame_t *frame)
+{
+    size_t pos = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+    _slot_t *slot;
+
+    while(1) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        // Ready slot, try to claim it
+        if(diff == 0) {
+            if(atomic_compare_exchange_weak_explicit(&queue->pop_pos, &pos, pos + 1,
+                                                     memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        // Slot not pushed yet: the queue is empty
+        else if(diff < 0)
+            return false;
+        // Another consumer claimed it first
+        else
+            pos = atomic_load_explicit(&queue->pop_pos, memory_order_relaxed);
+    }
+
+    memcpy(frame, &slot->frame, offsetof(comm_frame_t, data) + slot->frame.count);
+    atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+
+    return true;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,81 @@
+/*******************************************************************************
+*
+* Lock-free queue of decoded frames.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Bounded multi-producer/multi-consumer queue of decoded frames. Producers
+*  and consumers claim a slot with a compare-and-swap on their own position,
+*  and every slot has a sequence number telling whether it's ready to be
+*  written or read. No locks are taken, a full queue rejects the frame.
+*
+*******************************************************************************/
+
+#ifndef _COMM_FRAME_QUEUE_H
+#define _COMM_FRAME_QUEUE_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "comm_driver_msg.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define COMM_CACHE_LINE_SIZE (64u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+// A message decoded from a device (without its header/footer)
+typedef struct
+{
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC when the message was decoded
+    uint16_t device; // Index of the device it came from
+    uint8_t count; // The number of bytes in 'data'
+    uint8_t data[MSG_MAX_LENGTH];
+} comm_frame_t;
+
+typedef struct comm_frame_queue_t *comm_frame_queue_t;
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+comm_frame_queue_t comm_frame_queue_new(size_t capacity);
+void comm_frame_queue_free(comm_frame_queue_t *queue);
+bool comm_frame_queue_push(comm_frame_queue_t queue, const comm_frame_t *frame);
+bool comm_frame_queue_pop(comm_frame_queue_t queue, comm_frame_t *frame);
+
+#endif // _COMM_FRAME_QUEUE_H
+
+/* [] END OF FILE */
@@ -0,0 +1,713 @@
+/*******************************************************************************
+*
+* Host-side companion library for comm_driver.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+
+#include "comm_host.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+struct comm_host_t
+{
+    int fd; // tty (or any file descriptor)
+    int epoll_fd; // Only watches 'fd'
+    bool owns_fd; // 'fd' is closed by comm_host_close()
+    uint32_t events; // Events currently watched by 'epoll_fd'
+    ringbuf_t rx; // Circular buffer for RX operations
+    ringbuf_t tx; // Circular buffer for TX operations
+    comm_host_tap_t tap; // Sees every chunk read or written (may be NULL)
+    void *tap_context;
+};
+
+
+/*******************************************************************************
+* PRIVATE PROTOTYPES
+*******************************************************************************/
+static ringbuf_t _ring_new(size_t capacity);
+static int _update_events(comm_host_t host);
+static int _fill_rx(comm_host_t host);
+static int _flush_tx(comm_host_t host);
+static bool _wait_tx_room(comm_host_t host, size_t count);
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: comm_host_open
+********************************************************************************
+* Summary:
+*  Open a tty in raw non-blocking mode and attach it (see comm_host_attach).
+*
+* Parameters:
+*  path: Path of the tty.
+*  rx_size: Capacity of the RX ring buffer (0 for COMM_HOST_RX_BUFFER_SIZE).
+*  tx_size: Capacity of the TX ring buffer (0 for COMM_HOST_TX_BUFFER_SIZE).
+*
+* Return:
+*  comm_host_t: The new handle, or NULL on error (see errno).
+*
+*******************************************************************************/
+comm_host_t comm_host_open(const char *path, size_t rx_size, size_t tx_size)
+{
+    struct termios tio;
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(fd < 0)
+        return NULL;
+
+    // Not every file is a tty (pty used for testing, etc.)
+    if(tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    comm_host_t host = comm_host_attach(fd, rx_size, tx_size);
+    if(!host) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    host->owns_fd = true;
+
+    return host;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_attach
+********************************************************************************
+* Summary:
+*  Create a handle for an already opened file descriptor. The descriptor is
+*  switched to non-blocking mode and is not closed by comm_host_close().
+*
+* Parameters:
+*  fd: File descriptor connected to the device.
+*  rx_size: Capacity of the RX ring buffer (0 for COMM_HOST_RX_BUFFER_SIZE).
+*  tx_size: Capacity of the TX ring buffer (0 for COMM_HOST_TX_BUFFER_SIZE).
+*
+* Return:
+*  comm_host_t: The new handle, or NULL on error (see errno).
+*
+*******************************************************************************/
+comm_host_t comm_host_attach(int fd, size_t rx_size, size_t tx_size)
+{
+    struct epoll_event event = {.events = EPOLLIN};
+    comm_host_t host = calloc(1, sizeof(struct comm_host_t));
+    if(!host)
+        return NULL;
+
+    host->fd = fd;
+    host->events = event.events;
+    host->rx = _ring_new(rx_size ? rx_size : COMM_HOST_RX_BUFFER_SIZE);
+    host->tx = _ring_new(tx_size ? tx_size : COMM_HOST_TX_BUFFER_SIZE);
+    host->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(!host->rx || !host->tx || host->epoll_fd < 0
+       || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0
+       || epoll_ctl(host->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        int err = errno;
+        comm_host_close(&host);
+        errno = err ? err : ENOMEM;
+        return NULL;
+    }
+
+    return host;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_close
+********************************************************************************
+* Summary:
+*  Release a handle, and, as a side effect, set the pointer to NULL.
+*  Whatever is left in the TX ring buffer is discarded.
+*
+* Parameters:
+*  host: Pointer to the handle.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_host_close(comm_host_t *host)
+{
+    if(!host || !*host)
+        return;
+
+    if((*host)->epoll_fd >= 0)
+        close((*host)->epoll_fd);
+    if((*host)->owns_fd)
+        close((*host)->fd);
+    if((*host)->rx)
+        ringbuf_free(&(*host)->rx);
+    if((*host)->tx)
+        ringbuf_free(&(*host)->tx);
+    free(*host);
+    *host = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_fd
+********************************************************************************
+* Summary:
+*  File descriptor connected to the device.
+*
+*******************************************************************************/
+int comm_host_fd(const struct comm_host_t *host)
+{
+    return host->fd;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_epoll_fd
+********************************************************************************
+* Summary:
+*  Epoll file descriptor of the handle. It becomes readable when
+*  comm_host_poll() has something to do, so it can be added to the epoll
+*  set of an application's own event loop.
+*
+*******************************************************************************/
+int comm_host_epoll_fd(const struct comm_host_t *host)
+{
+    return host->epoll_fd;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_poll
+********************************************************************************
+* Summary:
+*  Wait until the tty is ready, then copy all available bytes into the RX
+*  ring buffer and as much as possible of the TX ring buffer into the tty.
+*  Reading stops while the RX ring buffer is full, it is never overwritten.
+*  If it is full and there's nothing to send, there's nothing to wait for:
+*  the function returns COMM_HOST_RX_FULL right away, and keeps doing so
+*  until bytes are read from (or discarded from) the RX ring buffer.
+*
+* Parameters:
+*  host: The handle.
+*  timeout_ms: Maximum time to wait (-1 to wait forever, 0 to return
+*              immediately).
+*
+* Return:
+*  int: 1 if bytes were transferred, 0 on timeout, COMM_HOST_RX_FULL, or -1
+*       on error or if the device was disconnected (see errno).
+*
+*******************************************************************************/
+int comm_host_poll(comm_host_t host, int timeout_ms)
+{
+    struct epoll_event event;
+    int ret;
+
+    // Only wait for what can be done
+    if(_update_events(host) < 0)
+        return -1;
+    if(!host->events)
+        return COMM_HOST_RX_FULL;
+
+    ret = epoll_wait(host->epoll_fd, &event, 1, timeout_ms);
+    if(ret < 0)
+        return (errno == EINTR) ? 0 : -1;
+    if(ret == 0)
+        return 0;
+
+    if(event.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        if(_fill_rx(host) < 0)
+            return -1;
+    }
+    if(event.events & EPOLLOUT) {
+        if(_flush_tx(host) < 0)
+            return -1;
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_receive
+********************************************************************************
+* Summary:
+*  Copy all available bytes into the RX ring buffer, without waiting. For
+*  applications watching comm_host_fd() in their own epoll set.
+*
+* Parameters:
+*  host: The handle.
+*
+* Return:
+*  int: The number of bytes read, or -1 on error or if the device was
+*       disconnected (see errno).
+*
+*******************************************************************************/
+int comm_host_receive(comm_host_t host)
+{
+    return _fill_rx(host);
+}
+
+/*******************************************************************************
+* Function Name: comm_host_flush
+********************************************************************************
+* Summary:
+*  Copy as much as possible of the TX ring buffer into the tty, without
+*  waiting. For applications watching comm_host_fd() in their own epoll set.
+*
+* Parameters:
+*  host: The handle.
+*
+* Return:
+*  int: The number of bytes written, or -1 on error (see errno).
+*
+*******************************************************************************/
+int comm_host_flush(comm_host_t host)
+{
+    return _flush_tx(host);
+}
+
+/*******************************************************************************
+* Function Name: comm_host_rx_buffer
+********************************************************************************
+* Summary:
+*  RX ring buffer of the handle, for applications filling it by other means
+*  (see comm_uring.h).
+*
+*******************************************************************************/
+ringbuf_t comm_host_rx_buffer(const struct comm_host_t *host)
+{
+    return host->rx;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_set_tap
+********************************************************************************
+* Summary:
+*  Call 'tap' with every chunk read from or written to the tty by this
+*  handle, e.g. comm_capture_tap() to record the traffic (see
+*  comm_capture.h). Chunks read by other means (comm_host_rx_buffer()) are
+*  not seen.
+*
+* Parameters:
+*  host: The handle.
+*  tap: The function to call, or NULL to stop.
+*  context: Passed to 'tap'.
+*
+*******************************************************************************/
+void comm_host_set_tap(comm_host_t host, comm_host_tap_t tap, void *context)
+{
+    host->tap = tap;
+    host->tap_context = context;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_getch
+********************************************************************************
+* Summary:
+*  Read a byte from the RX ring buffer.
+*
+* Parameters:
+*  host: The handle.
+*  data: Pointer to a uint8_t where the byte read will be copied.
+*
+* Return:
+*  size_t: The number of bytes copied.
+*
+*******************************************************************************/
+size_t comm_host_getch(comm_host_t host, uint8_t *data)
+{
+    // Exit if 'data' is NULL or if the buffer is empty
+    if(!data || ringbuf_is_empty(host->rx))
+        return 0;
+
+    ringbuf_memcpy_from(data, host->rx, 1);
+
+    return 1;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_putch
+********************************************************************************
+* Summary:
+*  Write a byte to the TX ring buffer.
+*
+* Parameters:
+*  host: The handle.
+*  data: Pointer to a uint8_t that will be sent.
+*
+* Return:
+*  bool: 'false' on error.
+*
+*******************************************************************************/
+bool comm_host_putch(comm_host_t host, const uint8_t *data)
+{
+    // Exit if 'data' is NULL
+    if(!data || !_wait_tx_room(host, 1))
+        return false;
+
+    ringbuf_memcpy_into(host->tx, data, 1);
+
+    return _flush_tx(host) >= 0;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_getline
+********************************************************************************
+* Summary:
+*  Read a line from the RX ring buffer. A line ends with
+*  COMM_HOST_LINE_TERMINATOR.
+*
+* Parameters:
+*  host: The handle.
+*  data: Pointer to an array of uint8_t where the bytes read will be copied.
+*        The line terminator will not be copied.
+*
+* Return:
+*  size_t: The number of bytes returned.
+*
+*******************************************************************************/
+size_t comm_host_getline(comm_host_t host, uint8_t *data)
+{
+    // Exit if 'data' is NULL or if the buffer is empty
+    if(!data || ringbuf_is_empty(host->rx))
+        return 0;
+
+    // Look for a line terminator in the buffer, exit if not found
+    size_t line_term_offs = ringbuf_findchr(host->rx, COMM_HOST_LINE_TERMINATOR, 0);
+    if(line_term_offs == ringbuf_bytes_used(host->rx))
+        return 0;
+
+    // Extract a line from the FIFO buffer (without the line terminator)
+    ringbuf_memcpy_from(data, host->rx, line_term_offs);
+
+    // Remove the line terminator from the FIFO buffer
+    ringbuf_remove_from_tail(host->rx, 1);
+
+    return line_term_offs;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_putline
+********************************************************************************
+* Summary:
+*  Write a line to the TX ring buffer. The line terminator
+*  COMM_HOST_LINE_TERMINATOR will be appended automatically.
+*
+* Parameters:
+*  host: The handle.
+*  data: Pointer to an array of uint8_t containing the line to send.
+*  count: The number of bytes in the array 'data'.
+*
+* Return:
+*  bool: 'false' on error.
+*
+*******************************************************************************/
+bool comm_host_putline(comm_host_t host, const uint8_t *data, size_t count)
+{
+    uint8_t line_terminator = COMM_HOST_LINE_TERMINATOR;
+
+    // Exit if 'data' is NULL
+    if(!data || !count || !_wait_tx_room(host, count + 1))
+        return false;
+
+    ringbuf_memcpy_into(host->tx, data, count);
+    ringbuf_memcpy_into(host->tx, &line_terminator, 1);
+
+    return _flush_tx(host) >= 0;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_getmsg
+********************************************************************************
+* Summary:
+*  Read a message from the RX ring buffer (see comm_driver_msg.h). Invalid
+*  bytes are discarded exactly like comm_getmsg() does on the device. It may
+*  return '0' if a complete message couldn't be found in the FIFO buffer.
+*
+* Parameters:
+*  host: The handle.
+*  data: Pointer to an array of uint8_t where the bytes read will be copied.
+*        The bytes used to verify the message's integrity will not be copied.
+*
+* Return:
+*  size_t: The number of bytes returned.
+*
+*******************************************************************************/
+size_t comm_host_getmsg(comm_host_t host, uint8_t *data)
+{
+    ringbuf_t rx = host->rx;
+    size_t msg_first_byte_offs;
+    uint8_t msg_length = 0;
+
+    // Exit if 'data' is NULL or if the buffer is empty
+    if(!data || ringbuf_is_empty(rx))
+        return 0;
+
+    // Find the first complete message in the FIFO buffer, exit if not found
+    while(1) {
+
+        // Find the first occurence of MSG_FIRST_BYTE, exit if not found
+        msg_first_byte_offs = ringbuf_findchr(rx, MSG_FIRST_BYTE, 0);
+        if(msg_first_byte_offs == ringbuf_bytes_used(rx))
+            return 0;
+
+        // Remove all bytes until MSG_FIRST_BYTE
+        if(msg_first_byte_offs)
+            ringbuf_remove_from_tail(rx, msg_first_byte_offs);
+
+        // Extract the MSG_LENGTH, exit if not found
+        if(ringbuf_bytes_used(rx) < MSG_HEADER_LENGTH)
+            return 0;
+        msg_length = ringbuf_peek(rx, MSG_LENGTH_OFFS_FROM_FIRST_BYTE);
+
+        // Check if message length is valid
+        if(msg_length > MSG_MAX_LENGTH) {
+            ringbuf_remove_from_tail(rx, 1);
+            return 0;
+        }
+
+        // Check if MSG_LAST_BYTE is where expected, exit if not enough bytes
+        if(ringbuf_bytes_used(rx) < msg_length)
+            return 0;
+        if(msg_length && ringbuf_peek(rx, msg_length - 1) == MSG_LAST_BYTE)
+            break;
+
+        // Remove first byte if message not found and try again
+        ringbuf_remove_from_tail(rx, MSG_LENGTH_OFFS_FROM_FIRST_BYTE);
+    }
+
+    // Extract the message without the header/footer
+    size_t count = msg_length - MSG_STRUCTURE_LENGTH;
+    ringbuf_remove_from_tail(rx, MSG_HEADER_LENGTH);
+    ringbuf_memcpy_from(data, rx, count);
+    ringbuf_remove_from_tail(rx, MSG_FOOTER_LENGTH);
+
+    return count;
+}
+
+/*******************************************************************************
+* Function Name: comm_host_putmsg
+********************************************************************************
+* Summary:
+*  Write a message to the TX ring buffer. The message will be padded with the
+*  custom structure found in "comm_driver_msg.h".
+*
+* Parameters:
+*  host: The handle.
+*  data: Pointer to an array of uint8_t containing the message to send.
+*  count: The number of bytes in the array 'data'.
+*
+* Return:
+*  bool: 'false' on error or if the message is too long.
+*
+*******************************************************************************/
+bool comm_host_putmsg(comm_host_t host, const uint8_t *data, size_t count)
+{
+    // Exit if 'data' is NULL or if the message doesn't fit MSG_LENGTH
+    if(!data || !count || count + MSG_STRUCTURE_LENGTH > MSG_MAX_LENGTH)
+        return false;
+
+    uint8_t msg_length = (uint8_t)(count + MSG_STRUCTURE_LENGTH);
+    if(!_wait_tx_room(host, msg_length))
+        return false;
+
+    uint8_t msg_header[MSG_HEADER_LENGTH] = {MSG_FIRST_BYTE, msg_length};
+    uint8_t msg_footer[MSG_FOOTER_LENGTH] = {MSG_LAST_BYTE};
+    ringbuf_memcpy_into(host->tx, msg_header, MSG_HEADER_LENGTH);
+    ringbuf_memcpy_into(host->tx, data, count);
+    ringbuf_memcpy_into(host->tx, msg_footer, MSG_FOOTER_LENGTH);
+
+    return _flush_tx(host) >= 0;
+}
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _ring_new
+********************************************************************************
+* Summary:
+*  Create a ring buffer, mirrored when possible so that reads, writes and
+*  searches never have to be split where the buffer wraps.
+*
+* Parameters:
+*  capacity: Minimum capacity of the ring buffer.
+*
+* Return:
+*  ringbuf_t: The new ring buffer, or NULL on error.
+*
+*******************************************************************************/
+static ringbuf_t _ring_new(size_t capacity)
+{
+#ifdef RINGBUF_HAVE_MIRROR
+    ringbuf_t rb = ringbuf_new_mirrored(capacity);
+    if(rb)
+        return rb;
+#endif
+    return ringbuf_new(capacity);
+}
+
+/*******************************************************************************
+* Function Name: _update_events
+********************************************************************************
+* Summary:
+*  Watch EPOLLIN only if the RX ring buffer has room, and EPOLLOUT only if
+*  the TX ring buffer has something to send.
+*
+* Return:
+*  int: -1 on error.
+*
+*******************************************************************************/
+static int _update_events(comm_host_t host)
+{
+    uint32_t events = 0;
+    if(!ringbuf_is_full(host->rx))
+        events |= EPOLLIN;
+    if(!ringbuf_is_empty(host->tx))
+        events |= EPOLLOUT;
+
+    if(events == host->events)
+        return 0;
+
+    struct epoll_event event = {.events = events};
+    if(epoll_ctl(host->epoll_fd, EPOLL_CTL_MOD, host->fd, &event) < 0)
+        return -1;
+    host->events = events;
+
+    return 0;
+}
+
+/*******************************************************************************
+* Function Name: _fill_rx
+********************************************************************************
+* Summary:
+*  Read until the tty has nothing left or the RX ring buffer is full.
+*
+* Return:
+*  int: The number of bytes read, or -1 on error or end of file.
+*
+*******************************************************************************/
+static int _fill_rx(comm_host_t host)
+{
+    int total = 0;
+
+    while(!ringbuf_is_full(host->rx)) {
+        struct iovec iov[2];
+        int iovcnt = host->tap ? ringbuf_head_iov(host->rx, iov, ringbuf_bytes_free(host->rx)) : 0;
+        ssize_t n = ringbuf_readv(host->fd, host->rx, ringbuf_bytes_free(host->rx));
+        if(n > 0) {
+            if(host->tap)
+                host->tap(host->tap_context, COMM_HOST_RX, iov, iovcnt, (size_t)n);
+            total += n;
+            continue;
+        }
+        if(n == 0) {
+            errno = ENOTCONN;
+            return -1;
+        }
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        return -1;
+    }
+
+    return total;
+}
+
+/*******************************************************************************
+* Function Name: _flush_tx
+********************************************************************************
+* Summary:
+*  Write until the TX ring buffer is empty or the tty is full.
+*
+* Return:
+*  int: The number of bytes written, or -1 on error.
+*
+*******************************************************************************/
+static int _flush_tx(comm_host_t host)
+{
+    int total = 0;
+
+    while(!ringbuf_is_empty(host->tx)) {
+        struct iovec iov[2];
+        int iovcnt = host->tap ? ringbuf_tail_iov(host->tx, iov, ringbuf_bytes_used(host->tx)) : 0;
+        ssize_t n = ringbuf_writev(host->fd, host->tx, ringbuf_bytes_used(host->tx));
+        if(n > 0) {
+            if(host->tap)
+                host->tap(host->tap_context, COMM_HOST_TX, iov, iovcnt, (size_t)n);
+            total += n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return -1;
+    }
+
+    return total;
+}
+
+/*******************************************************************************
+* Function Name: _wait_tx_room
+********************************************************************************
+* Summary:
+*  Wait until the tty accepted enough of the TX ring buffer to leave room
+*  for 'count' bytes.
+*
+* Return:
+*  bool: 'false' on error or if 'count' is larger than the ring buffer.
+*
+*******************************************************************************/
+static bool _wait_tx_room(comm_host_t host, size_t count)
+{
+    struct pollfd pfd = {.fd = host->fd, .events = POLLOUT};
+
+    if(count > ringbuf_capacity(host->tx))
+        return false;
+
+    // Only the TX side is touched, the RX ring buffer may belong to
+    // another thread (see comm_aggregator.c)
+    while(ringbuf_bytes_free(host->tx) < count) {
+        if(poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return false;
+        if(_flush_tx(host) < 0)
+            return false;
+    }
+
+    return true;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,122 @@
+/*******************************************************************************
+*
+* Host-side companion library for comm_driver.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Speaks the same line and custom message framing as comm_driver, from a PC.
+*  The tty is used in non-blocking mode and serviced with epoll, with the
+*  same ring buffers (ringbuf.c) as the device for RX and TX.
+*
+*  comm_host_get*() and comm_host_put*() behave like their comm_* device
+*  counterparts. Nothing is read from the tty until comm_host_poll() is
+*  called. The put functions write as much as the tty accepts right away,
+*  and wait for the tty when the TX ring buffer is full. They never touch
+*  the RX ring buffer.
+*
+* Required files:
+*  ../src/ringbuf.h
+*  ../src/ringbuf.c
+*  ../src/comm_driver_msg.h
+*
+* Build:
+*  cc -O2 -I../src -c comm_host.c ../src/ringbuf.c
+*
+*******************************************************************************/
+
+#ifndef _COMM_HOST_H
+#define _COMM_HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "comm_driver_msg.h"
+#include "ringbuf.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Default size of the ring buffers
+#define COMM_HOST_RX_BUFFER_SIZE (4096u)
+#define COMM_HOST_TX_BUFFER_SIZE (4096u)
+
+// Terminator of a line of data, must match COMM_LINE_TERMINATOR (comm_driver.h)
+#define COMM_HOST_LINE_TERMINATOR ((uint8_t)'\n')
+
+// Returned by comm_host_poll() when there's nothing to wait for: the RX ring
+// buffer is full and the TX ring buffer is empty
+#define COMM_HOST_RX_FULL (2)
+
+// Directions passed to a tap (same values as COMM_CAPTURE_RX/TX)
+#define COMM_HOST_RX ((uint8_t)'R')
+#define COMM_HOST_TX ((uint8_t)'T')
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct comm_host_t *comm_host_t;
+
+// Called with the first 'count' bytes described by 'iov' after each read or write
+typedef void (*comm_host_tap_t)(void *context, uint8_t dir, const struct iovec *iov, int iovcnt, size_t count);
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+// Init
+comm_host_t comm_host_open(const char *path, size_t rx_size, size_t tx_size);
+comm_host_t comm_host_attach(int fd, size_t rx_size, size_t tx_size);
+void comm_host_close(comm_host_t *host);
+
+// I/O
+int comm_host_fd(const struct comm_host_t *host);
+int comm_host_epoll_fd(const struct comm_host_t *host);
+int comm_host_poll(comm_host_t host, int timeout_ms);
+int comm_host_receive(comm_host_t host);
+int comm_host_flush(comm_host_t host);
+ringbuf_t comm_host_rx_buffer(const struct comm_host_t *host);
+void comm_host_set_tap(comm_host_t host, comm_host_tap_t tap, void *context);
+
+// Single character
+size_t comm_host_getch(comm_host_t host, uint8_t *data);
+bool comm_host_putch(comm_host_t host, const uint8_t *data);
+
+// Line
+size_t comm_host_getline(comm_host_t host, uint8_t *data);
+bool comm_host_putline(comm_host_t host, const uint8_t *data, size_t count);
+
+// Custom messages
+size_t comm_host_getmsg(comm_host_t host, uint8_t *data);
+bool comm_host_putmsg(comm_host_t host, const uint8_t *data, size_t count);
+
+#endif // _COMM_HOST_H
+
+/* [] END OF FILE */
@@ -0,0 +1,374 @@
+/*******************************************************************************
+*
+* Lock-free multi-producer byte ring for commands sent to a device.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+*******************************************************************************/
+
+#include "comm_mpsc.h"
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#ifndef COMM_CACHE_LINE_SIZE
+#define COMM_CACHE_LINE_SIZE (64u)
+#endif
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+struct comm_mpsc_t
+{
+    alignas(COMM_CACHE_LINE_SIZE) atomic_size_t reserve_pos; // End of the claimed space
+    alignas(COMM_CACHE_LINE_SIZE) atomic_size_t commit_pos; // End of the published bytes
+    alignas(COMM_CACHE_LINE_SIZE) atomic_size_t tail_pos; // End of the bytes written out
+    alignas(COMM_CACHE_LINE_SIZE) size_t mask;
+    uint8_t *buf;
+    atomic_uint_least32_t *done; // End of the published reservation starting at each position
+};
+
+/*******************************************************************************
+* PRIVATE PROTOTYPES
+*******************************************************************************/
+static void _reset(comm_mpsc_t mpsc, size_t pos);
+static bool _reserve(comm_mpsc_t mpsc, size_t count, size_t *pos);
+static void _copy_in(comm_mpsc_t mpsc, size_t pos, const uint8_t *data, size_t count);
+static void _publish(comm_mpsc_t mpsc, size_t pos, size_t count);
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: comm_mpsc_new
+********************************************************************************
+* Summary:
+*  Create a ring holding at least 'capacity' bytes (rounded up to a power of
+*  two, at most 2^31).
+*
+* Return:
+*  comm_mpsc_t: The new ring, or NULL if there's not enough memory.
+*
+*******************************************************************************/
+comm_mpsc_t comm_mpsc_new(size_t capacity)
+{
+    size_t size = 2;
+    while(size < capacity)
+        size <<= 1;
+    if(size > ((size_t)1 << 31))
+        return NULL;
+
+    comm_mpsc_t mpsc = aligned_alloc(COMM_CACHE_LINE_SIZE, sizeof(struct comm_mpsc_t));
+    if(!mpsc)
+        return NULL;
+    mpsc->buf = malloc(size);
+    mpsc->done = malloc(size * sizeof(atomic_uint_least32_t));
+    if(!mpsc->buf || !mpsc->done) {
+        free(mpsc->buf);
+        free(mpsc->done);
+        free(mpsc);
+        return NULL;
+    }
+
+    mpsc->mask = size - 1;
+    _reset(mpsc, 0);
+
+    return mpsc;
+}
+
+/*******************************************************************************
+* Function Name: comm_mpsc_free
+********************************************************************************
+* Summary:
+*  Deallocate a ring, and, as a side effect, set the pointer to NULL.
+*
+*******************************************************************************/
+void comm_mpsc_free(comm_mpsc_t *mpsc)
+{
+    free((*mpsc)->buf);
+    free((*mpsc)->done);
+    free(*mpsc);
+    *mpsc = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_mpsc_put
+********************************************************************************
+* Summary:
+*  Copy bytes at the end of the ring. Safe to call from any thread, the bytes
+*  are never interleaved with those of another call.
+*
+* Parameters:
+*  mpsc: The ring.
+*  data: Pointer to an array of uint8_t containing the bytes to send.
+*  count: The number of bytes in the array 'data'.
+*
+* Return:
+*  bool: 'false' if the ring doesn't have room for all the bytes (nothing is
+*        copied).
+*
+*******************************************************************************/
+bool comm_mpsc_put(comm_mpsc_t mpsc, const uint8_t *data, size_t count)
+{
+    size_t pos;
+    if(!data || !_reserve(mpsc, count, &pos))
+        return false;
+    if(!count)
+        return true;
+
+    _copy_in(mpsc, pos, data, count);
+    _publish(mpsc, pos, count);
+
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: comm_mpsc_putmsg
+********************************************************************************
+* Summary:
+*  Copy a message at the end of the ring. The message will be padded with the
+*  custom structure found in "comm_driver_msg.h". Safe to call from any
+*  thread.
+*
+* Parameters:
+*  mpsc: The ring.
+*  data: Pointer to an array of uint8_t containing the message to send.
+*  count: The number of bytes in the array 'data'.
+*
+* Return:
+*  bool: 'false' if the message is too long or if the ring doesn't have room
+*        for it.
+*
+*******************************************************************************/
+bool comm_mpsc_putmsg(comm_mpsc_t mpsc, const uint8_t *data, size_t count)
+{
+    // Exit if 'data' is NULL or if the message doesn't fit MSG_LENGTH
+    if(!data || !count || count + MSG_STRUCTURE_LENGTH > MSG_MAX_LENGTH)
+        return false;
+
+    uint8_t msg_length = (uint8_t)(count + MSG_STRUCTURE_LENGTH);
+    size_t pos;
+    if(!_reserve(mpsc, msg_length, &pos))
+        return false;
+
+    // Frame the message on the stack so it's copied in at once
+    uint8_t msg[MSG_MAX_LENGTH] = {MSG_FIRST_BYTE, msg_length};
+    memcpy(msg + MSG_HEADER_LENGTH, data, count);
+    msg[msg_length - MSG_FOOTER_LENGTH] = MSG_LAST_BYTE;
+    _copy_in(mpsc, pos, msg, msg_length);
+    _publish(mpsc, pos, msg_length);
+
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: comm_mpsc_bytes_used
+********************************************************************************
+* Summary:
+*  The number of published bytes not written out yet. Only meaningful to the
+*  consumer.
+*
+*******************************************************************************/
+size_t comm_mpsc_bytes_used(const struct comm_mpsc_t *mpsc)
+{
+    return atomic_load_explicit(&mpsc->commit_pos, memory_order_acquire)
+           - atomic_load_explicit(&mpsc->tail_pos, memory_order_relaxed);
+}
+
+/*******************************************************************************
+* Function Name: comm_mpsc_write
+********************************************************************************
+* Summary:
+*  Write up to 'count' published bytes to a file descriptor with a single
+*  writev(2), and remove the bytes written from the ring. Must only be called
+*  by one thread at a time.
+*
+* Parameters:
+*  fd: The file descriptor (usually comm_host_fd()).
+*  mpsc: The ring.
+*  count: The maximum number of bytes to write.
+*
+* Return:
+*  ssize_t: Like writev(2): the number of bytes written, or -1 on error
+*           (see errno).
+*
+*******************************************************************************/
+ssize_t comm_mpsc_write(int fd, comm_mpsc_t mpsc, size_t count)
+{
+    size_t tail = atomic_load_explicit(&mpsc->tail_pos, memory_order_relaxed);
+    size_t used = atomic_load_explicit(&mpsc->commit_pos, memory_order_acquire) - tail;
+    if(count > used)
+        count = used;
+    if(!count)
+        return 0;
+
+    // The published bytes may wrap around the end of the buffer
+    size_t offset = tail & mpsc->mask;
+    size_t first = mpsc->mask + 1 - offset;
+    struct iovec iov[2] = {{mpsc->buf + offset, count}, {mpsc->buf, 0}};
+    int iovcnt = 1;
+    if(count > first) {
+        iov[0].iov_len = first;
+        iov[1].iov_len = count - first;
+        iovcnt = 2;
+    }
+
+    ssize_t n = writev(fd, iov, iovcnt);
+    if(n > 0)
+        atomic_store_explicit(&mpsc->tail_pos, tail + (size_t)n, memory_order_release);
+
+    return n;
+}
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _reset
+********************************************************************************
+* Summary:
+*  Empty the ring, with all positions at 'pos'. done[] holds, at each
+*  position, the start of the next reservation there: an empty reservation,
+*  which is never taken as published.
+*
+*******************************************************************************/
+static void _reset(comm_mpsc_t mpsc, size_t pos)
+{
+    for(size_t i = 0; i <= mpsc->mask; i++)
+        atomic_init(&mpsc->done[(pos + i) & mpsc->mask], (uint_least32_t)(pos + i));
+    atomic_init(&mpsc->reserve_pos, pos);
+    atomic_init(&mpsc->commit_pos, pos);
+    atomic_init(&mpsc->tail_pos, pos);
+}
+
+/*******************************************************************************
+* Function Name: _reserve
+********************************************************************************
+* Summary:
+*  Claim 'count' bytes at the end of the ring.
+*
+* Parameters:
+*  mpsc: The ring.
+*  count: The number of bytes to claim.
+*  pos: Set to the position of the first byte claimed.
+*
+* Return:
+*  bool: 'false' if the ring doesn't have room for 'count' bytes.
+*
+*******************************************************************************/
+static bool _reserve(comm_mpsc_t mpsc, size_t count, size_t *pos)
+{
+    size_t reserve = atomic_load_explicit(&mpsc->reserve_pos, memory_order_relaxed);
+
+    do {
+        // Acquire: the consumer is done with the bytes it freed
+        size_t tail = atomic_load_explicit(&mpsc->tail_pos, memory_order_acquire);
+        if(reserve + count - tail > mpsc->mask + 1)
+            return false;
+    } while(!atomic_compare_exchange_weak_explicit(&mpsc->reserve_pos, &reserve, reserve + count,
+                                                   memory_order_relaxed, memory_order_relaxed));
+
+    *pos = reserve;
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: _copy_in
+********************************************************************************
+* Summary:
+*  Copy bytes into claimed space, wrapping around the end of the buffer.
+*
+*******************************************************************************/
+static void _copy_in(comm_mpsc_t mpsc, size_t pos, const uint8_t *data, size_t count)
+{
+    size_t offset = pos & mpsc->mask;
+    size_t first = mpsc->mask + 1 - offset;
+
+    if(count <= first)
+        memcpy(mpsc->buf + offset, data, count);
+    else {
+        memcpy(mpsc->buf + offset, data, first);
+        memcpy(mpsc->buf, data + first, count - first);
+    }
+}
+
+/*******************************************************************************
+* Function Name: _publish
+********************************************************************************
+* Summary:
+*  Make claimed bytes visible to the consumer. The end of the reservation is
+*  recorded at its start position (unless the commit position is already
+*  there), then the commit position is moved over
+*  every published reservation in a row, whichever producer published them.
+*  A producer never waits for another one: if an earlier reservation isn't
+*  published yet, its producer will move the commit position over this one.
+*  Once passed, an end is replaced by its start: 0 can't mark an entry as
+*  unpublished, since the 32-bit ends wrap around and 0 is then a valid end.
+*
+*******************************************************************************/
+static void _publish(comm_mpsc_t mpsc, size_t pos, size_t count)
+{
+    size_t commit = atomic_load(&mpsc->commit_pos);
+
+    // First in line: nobody else can move the commit position
+    if(commit == pos) {
+        commit = pos + count;
+        atomic_store(&mpsc->commit_pos, commit);
+    }
+    else {
+        atomic_store(&mpsc->done[pos & mpsc->mask], (uint_least32_t)(pos + count));
+        commit = atomic_load(&mpsc->commit_pos);
+    }
+
+    while(1) {
+        uint_least32_t end = atomic_load(&mpsc->done[commit & mpsc->mask]);
+        uint32_t length = (uint32_t)(end - (uint32_t)commit);
+
+        // Not published yet (empty), or left over from an older reservation
+        if(length - 1u > mpsc->mask)
+            break;
+
+        // On failure, 'commit' is reloaded and the loop tries again
+        size_t start = commit;
+        if(atomic_compare_exchange_strong(&mpsc->commit_pos, &commit, start + length)) {
+            atomic_compare_exchange_strong(&mpsc->done[start & mpsc->mask], &end, (uint_least32_t)start);
+            commit = start + length;
+        }
+    }
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,81 @@
+/*******************************************************************************
+*
+* Lock-free multi-producer byte ring for commands sent to a device.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Bounded multi-producer/single-consumer byte ring, for several threads
+*  sending to the same device. A producer claims space with a
+*  compare-and-swap on the reserve position, copies its bytes in, then
+*  publishes them. The commit position only moves over reservations that
+*  are published and contiguous, so the stream stays in order and a message
+*  is never interleaved with another; producers never wait for each other.
+*  A single consumer writes the published bytes to the tty with
+*  comm_mpsc_write(), like ringbuf_write() does for a ring buffer.
+*  The positions are free-running counters on their own cache lines.
+*
+* Build:
+*  cc -O2 -I../src -c comm_mpsc.c
+*
+*******************************************************************************/
+
+#ifndef _COMM_MPSC_H
+#define _COMM_MPSC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "comm_driver_msg.h"
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct comm_mpsc_t *comm_mpsc_t;
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+// Init
+comm_mpsc_t comm_mpsc_new(size_t capacity);
+void comm_mpsc_free(comm_mpsc_t *mpsc);
+
+// Producers (any thread)
+bool comm_mpsc_put(comm_mpsc_t mpsc, const uint8_t *data, size_t count);
+bool comm_mpsc_putmsg(comm_mpsc_t mpsc, const uint8_t *data, size_t count);
+
+// Consumer (a single thread)
+size_t comm_mpsc_bytes_used(const struct comm_mpsc_t *mpsc);
+ssize_t comm_mpsc_write(int fd, comm_mpsc_t mpsc, size_t count);
+
+#endif // _COMM_MPSC_H
+
+/* [] END OF FILE */
@@ -0,0 +1,111 @@
+/*******************************************************************************
+*
+* Stream parser for the custom message framing.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Stateless parser for offline tools, making the same decisions as
+*  comm_getmsg() (and comm_host_getmsg()) over a contiguous stream of bytes.
+*  A parser is only a position in the stream: two parsers that reach the
+*  same position (the start of a step) decode the rest identically, which is
+*  what lets a capture be decoded in independent pieces and stitched.
+*
+*******************************************************************************/
+
+#ifndef _COMM_PARSE_H
+#define _COMM_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "comm_driver_msg.h"
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef enum
+{
+    COMM_PARSE_MORE, // Not enough bytes to decide
+    COMM_PARSE_GARBAGE, // Bytes before the next MSG_FIRST_BYTE
+    COMM_PARSE_RESYNC, // A MSG_FIRST_BYTE not starting a valid message
+    COMM_PARSE_MESSAGE // A complete message (header, payload and footer)
+} comm_parse_result_t;
+
+/*******************************************************************************
+* Function Name: comm_parse_step
+********************************************************************************
+* Summary:
+*  Decide what the bytes at the current position of the stream are.
+*
+* Parameters:
+*  data: The stream from the current position.
+*  count: The number of bytes available in 'data'.
+*  length: Set to the number of bytes to skip to the next position (the
+*          whole message for COMM_PARSE_MESSAGE, 1 for COMM_PARSE_RESYNC).
+*
+* Return:
+*  comm_parse_result_t: See above. With COMM_PARSE_MORE, nothing can be
+*                       decided until more bytes are available.
+*
+*******************************************************************************/
+static inline comm_parse_result_t comm_parse_step(const uint8_t *data, size_t count, size_t *length)
+{
+    if(!count)
+        return COMM_PARSE_MORE;
+
+    if(data[0] != MSG_FIRST_BYTE) {
+        const uint8_t *first = memchr(data, MSG_FIRST_BYTE, count);
+        *length = first ? (size_t)(first - data) : count;
+        return COMM_PARSE_GARBAGE;
+    }
+
+    if(count < MSG_HEADER_LENGTH)
+        return COMM_PARSE_MORE;
+    uint8_t msg_length = data[MSG_LENGTH_OFFS_FROM_FIRST_BYTE];
+    if(msg_length > MSG_MAX_LENGTH || msg_length < MSG_STRUCTURE_LENGTH) {
+        *length = 1;
+        return COMM_PARSE_RESYNC;
+    }
+
+    if(count < msg_length)
+        return COMM_PARSE_MORE;
+    if(data[msg_length - 1] != MSG_LAST_BYTE) {
+        *length = 1;
+        return COMM_PARSE_RESYNC;
+    }
+
+    *length = msg_length;
+    return COMM_PARSE_MESSAGE;
+}
+
+#endif // _COMM_PARSE_H
+
+/* [] END OF FILE */
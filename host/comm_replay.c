@@ -0,0 +1,228 @@
+/*******************************************************************************
+*
+* Replay of a capture into a tty.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+********************************************************************************
+*
+* Summary:
+*  Writes the chunks of one direction of a capture (see comm_capture.h) to a
+*  tty, a pty or a pipe, with their original timing or faster, then reports
+*  the rate achieved. Replaying the TX direction to a device feeds the
+*  exact traffic comm_driver received into its RX path; replaying the RX
+*  direction into a pty feeds a host application what the device sent.
+*
+* Usage:
+*  comm_replay [-d rx|tx] [-x speed] [-s seconds] <capture> <tty|->
+*    -d: Direction to replay (default: tx).
+*    -x: Speed factor, 0 for as fast as possible (default: 1).
+*    -s: Start this many seconds into the capture (uses the index).
+*
+* Build:
+*  cc -O2 -o comm_replay comm_replay.c comm_capture.c
+*
+*******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "comm_capture.h"
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _open_tty
+********************************************************************************
+* Summary:
+*  Open a tty in raw mode ("-" for the standard output).
+*
+* Return:
+*  int: The file descriptor, or -1 on error.
+*
+*******************************************************************************/
+static int _open_tty(const char *path)
+{
+    struct termios tio;
+    if(strcmp(path, "-") == 0)
+        return STDOUT_FILENO;
+
+    int fd = open(path, O_WRONLY | O_NOCTTY);
+    if(fd < 0)
+        return -1;
+
+    // Not every file is a tty (pipes, pty used for testing, etc.)
+    if(tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    return fd;
+}
+
+static uint64_t _now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*******************************************************************************
+* Function Name: _sleep_until
+********************************************************************************
+* Summary:
+*  Sleep until a CLOCK_MONOTONIC time in ns.
+*
+*******************************************************************************/
+static void _sleep_until(uint64_t time_ns)
+{
+    struct timespec ts = {(time_t)(time_ns / 1000000000u), (long)(time_ns % 1000000000u)};
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/*******************************************************************************
+* Function Name: _write_all
+********************************************************************************
+* Summary:
+*  Write 'count' bytes, retrying on short writes.
+*
+* Return:
+*  bool: 'false' on error.
+*
+*******************************************************************************/
+static bool _write_all(int fd, const void *data, size_t count)
+{
+    const unsigned char *u8data = data;
+
+    while(count) {
+        ssize_t n = write(fd, u8data, count);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        u8data += n;
+        count -= (size_t)n;
+    }
+
+    return true;
+}
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(int argc, char *argv[])
+{
+    uint8_t dir = COMM_CAPTURE_TX;
+    double speed = 1.0;
+    double start_s = 0.0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "d:x:s:")) != -1) {
+        switch(opt) {
+        case 'd':
+            dir = strcmp(optarg, "rx") == 0 ? COMM_CAPTURE_RX : COMM_CAPTURE_TX;
+            break;
+        case 'x':
+            speed = atof(optarg);
+            break;
+        case 's':
+            start_s = atof(optarg);
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if(argc - optind != 2 || speed < 0 || start_s < 0) {
+        fprintf(stderr, "usage: %s [-d rx|tx] [-x speed] [-s seconds] <capture> <tty|->\n", argv[0]);
+        return 2;
+    }
+
+    comm_capture_reader_t reader = comm_capture_open(argv[optind]);
+    if(!reader) {
+        perror(argv[optind]);
+        return 1;
+    }
+    int fd = _open_tty(argv[optind + 1]);
+    if(fd < 0) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+
+    // Timestamps are relative to the first chunk of the capture
+    comm_capture_chunk_t chunk;
+    if(!comm_capture_next(reader, &chunk)) {
+        fprintf(stderr, "%s: empty capture\n", argv[optind]);
+        return 1;
+    }
+    uint64_t capture_start_ns = chunk.timestamp_ns;
+    uint64_t skip_ns = (uint64_t)(start_s * 1e9);
+    comm_capture_seek(reader, comm_capture_find(reader, capture_start_ns + skip_ns));
+
+    uint64_t first_ns = 0, last_ns = 0;
+    uint64_t replay_start_ns = _now_ns();
+    unsigned long long chunks = 0, bytes = 0;
+    while(comm_capture_next(reader, &chunk)) {
+        if(chunk.dir != dir || chunk.timestamp_ns < capture_start_ns + skip_ns)
+            continue;
+        if(!chunks)
+            first_ns = chunk.timestamp_ns;
+        last_ns = chunk.timestamp_ns;
+
+        if(speed > 0)
+            _sleep_until(replay_start_ns + (uint64_t)((chunk.timestamp_ns - first_ns) / speed));
+        if(!_write_all(fd, chunk.data, chunk.count)) {
+            perror(argv[optind + 1]);
+            return 1;
+        }
+        chunks++;
+        bytes += chunk.count;
+    }
+
+    double elapsed = (_now_ns() - replay_start_ns) / 1e9;
+    fprintf(stderr, "%llu chunks, %llu bytes in %.3f s (recorded: %.3f s), %.1f kB/s\n",
+            chunks, bytes, elapsed, (last_ns - first_ns) / 1e9, elapsed > 0 ? bytes / elapsed / 1e3 : 0.0);
+
+    comm_capture_close(&reader);
+    return 0;
+}
+
+/* [] END OF FILE */
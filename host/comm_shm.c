@@ -0,0 +1,443 @@
+/*******************************************************************************
+*
+* Shared-memory export of decoded frames to other processes.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+*******************************************************************************/
+
+#include "comm_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define COMM_SHM_MAGIC (0x434d5348u) // "CMSH"
+#define COMM_SHM_VERSION (1u)
+
+// Length of a record holding 'count' bytes of data
+#define RECORD_LENGTH(count) ((sizeof(comm_shm_record_t) + (count) + 7u) & ~(size_t)7u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+// First page of the shared memory, followed by the data area
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; // Size of the data area (a power of two)
+    alignas(COMM_CACHE_LINE_SIZE) atomic_uint_fast64_t head; // End of the published records
+    alignas(COMM_CACHE_LINE_SIZE) atomic_uint_fast64_t tail; // Start of the oldest record left
+    alignas(COMM_CACHE_LINE_SIZE) atomic_uint futex; // Bumped on publish when readers wait
+    atomic_uint waiters; // Number of readers in comm_shm_wait()
+} _header_t;
+
+struct comm_shm_t
+{
+    char *name;
+    _header_t *header;
+    uint8_t *data;
+    size_t map_length;
+    uint64_t head, tail, sequence;
+};
+
+struct comm_shm_reader_t
+{
+    _header_t *header;
+    uint8_t *data;
+    size_t map_length;
+    uint64_t cursor; // Start of the next record to read
+    uint64_t sequence; // Sequence number expected next
+    uint64_t lost;
+    uint32_t length; // Length of the record returned by comm_shm_peek()
+    bool synced; // 'sequence' is known
+};
+
+/*******************************************************************************
+* PRIVATE PROTOTYPES
+*******************************************************************************/
+static void *_map(int fd, size_t size);
+static size_t _page_size(void);
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: comm_shm_create
+********************************************************************************
+* Summary:
+*  Create (or replace) the shared ring 'name' (see shm_open(3)), with a data
+*  area of at least 'capacity' bytes (rounded up to a power of two, and at
+*  least a page).
+*
+* Return:
+*  comm_shm_t: The writer's handle, or NULL on error (see errno).
+*
+*******************************************************************************/
+comm_shm_t comm_shm_create(const char *name, size_t capacity)
+{
+    size_t page = _page_size();
+    size_t size = page;
+    while(size < capacity)
+        size <<= 1;
+
+    comm_shm_t shm = calloc(1, sizeof(struct comm_shm_t));
+    if(!shm || !(shm->name = strdup(name))) {
+        free(shm);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Readers still attached to an older ring keep it (never truncate it)
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if(fd < 0 || ftruncate(fd, page + size) < 0
+       || !(shm->header = _map(fd, size))) {
+        int err = errno;
+        if(fd >= 0) {
+            close(fd);
+            shm_unlink(name);
+        }
+        free(shm->name);
+        free(shm);
+        errno = err;
+        return NULL;
+    }
+    close(fd);
+
+    shm->data = (uint8_t *)shm->header + page;
+    shm->map_length = page + 2 * size;
+    shm->header->size = size;
+    atomic_init(&shm->header->head, 0);
+    atomic_init(&shm->header->tail, 0);
+    atomic_init(&shm->header->futex, 0);
+    atomic_init(&shm->header->waiters, 0);
+    shm->header->version = COMM_SHM_VERSION;
+    // Readers check the magic number last
+    atomic_thread_fence(memory_order_release);
+    shm->header->magic = COMM_SHM_MAGIC;
+
+    return shm;
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_destroy
+********************************************************************************
+* Summary:
+*  Remove the shared ring's name and unmap it, and, as a side effect, set the
+*  pointer to NULL. Attached readers keep their mapping.
+*
+*******************************************************************************/
+void comm_shm_destroy(comm_shm_t *shm)
+{
+    shm_unlink((*shm)->name);
+    munmap((*shm)->header, (*shm)->map_length);
+    free((*shm)->name);
+    free(*shm);
+    *shm = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_publish
+********************************************************************************
+* Summary:
+*  Copy a frame at the end of the shared ring, dropping the oldest records if
+*  there isn't enough room, and wake the readers waiting for it.
+*
+*******************************************************************************/
+void comm_shm_publish(comm_shm_t shm, const comm_frame_t *frame)
+{
+    _header_t *header = shm->header;
+    uint64_t mask = header->size - 1;
+    uint32_t length = RECORD_LENGTH(frame->count);
+
+    // Drop the oldest records. Readers must see the new tail before the
+    // records are overwritten (they check it after reading).
+    if(shm->head + length - shm->tail > header->size) {
+        while(shm->head + length - shm->tail > header->size)
+            shm->tail += ((comm_shm_record_t *)(shm->data + (shm->tail & mask)))->length;
+        atomic_store_explicit(&header->tail, shm->tail, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
+
+    comm_shm_record_t *record = (comm_shm_record_t *)(shm->data + (shm->head & mask));
+    record->length = length;
+    record->device = frame->device;
+    record->count = frame->count;
+    record->reserved = 0;
+    record->sequence = shm->sequence++;
+    record->timestamp_ns = frame->timestamp_ns;
+    memcpy(record->data, frame->data, frame->count);
+
+    shm->head += length;
+    atomic_store(&header->head, shm->head);
+    if(atomic_load(&header->waiters)) {
+        atomic_fetch_add(&header->futex, 1);
+        syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_attach
+********************************************************************************
+* Summary:
+*  Attach to the shared ring 'name'. Only the frames published from now on
+*  will be read.
+*
+* Return:
+*  comm_shm_reader_t: The reader's handle, or NULL on error (see errno).
+*
+*******************************************************************************/
+comm_shm_reader_t comm_shm_attach(const char *name)
+{
+    size_t page = _page_size();
+    struct stat st;
+    comm_shm_reader_t reader = calloc(1, sizeof(struct comm_shm_reader_t));
+    if(!reader) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // The futex and the waiters count are written by readers too
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0 || fstat(fd, &st) < 0)
+        goto error;
+    if((size_t)st.st_size <= page) {
+        errno = EINVAL;
+        goto error;
+    }
+    size_t size = (size_t)st.st_size - page;
+    if(!(reader->header = _map(fd, size)))
+        goto error;
+    close(fd);
+    fd = -1;
+
+    reader->data = (uint8_t *)reader->header + page;
+    reader->map_length = page + 2 * size;
+    atomic_thread_fence(memory_order_acquire);
+    if(reader->header->magic != COMM_SHM_MAGIC || reader->header->version != COMM_SHM_VERSION
+       || reader->header->size != size) {
+        munmap(reader->header, reader->map_length);
+        errno = EPROTO;
+        goto error;
+    }
+
+    reader->cursor = atomic_load(&reader->header->head);
+    return reader;
+
+error:
+    {
+        int err = errno;
+        if(fd >= 0)
+            close(fd);
+        free(reader);
+        errno = err;
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_detach
+********************************************************************************
+* Summary:
+*  Unmap the shared ring, and, as a side effect, set the pointer to NULL.
+*
+*******************************************************************************/
+void comm_shm_detach(comm_shm_reader_t *reader)
+{
+    munmap((*reader)->header, (*reader)->map_length);
+    free(*reader);
+    *reader = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_peek
+********************************************************************************
+* Summary:
+*  Get the next record, in place. If the reader fell behind and the writer
+*  dropped records it hadn't read yet, skip to the oldest record left (see
+*  comm_shm_lost()).
+*
+* Return:
+*  const comm_shm_record_t *: The record (valid until comm_shm_next() is
+*                             called), or NULL if there's none.
+*
+*******************************************************************************/
+const comm_shm_record_t *comm_shm_peek(comm_shm_reader_t reader)
+{
+    _header_t *header = reader->header;
+    uint64_t mask = header->size - 1;
+
+    while(1) {
+        uint64_t head = atomic_load_explicit(&header->head, memory_order_acquire);
+        if(reader->cursor == head)
+            return NULL;
+
+        const comm_shm_record_t *record = (comm_shm_record_t *)(reader->data + (reader->cursor & mask));
+        uint32_t length = record->length;
+        uint64_t sequence = record->sequence;
+
+        // The record is valid if the writer didn't drop it while we read it
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+        if(reader->cursor >= tail) {
+            if(reader->synced && sequence != reader->sequence)
+                reader->lost += sequence - reader->sequence;
+            reader->sequence = sequence;
+            reader->synced = true;
+            reader->length = length;
+            return record;
+        }
+
+        reader->cursor = tail;
+    }
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_next
+********************************************************************************
+* Summary:
+*  Move on from the record returned by comm_shm_peek().
+*
+* Return:
+*  bool: 'false' if the writer overwrote the record before this call (its
+*        contents read since comm_shm_peek() may be corrupted).
+*
+*******************************************************************************/
+bool comm_shm_next(comm_shm_reader_t reader)
+{
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&reader->header->tail, memory_order_relaxed);
+    bool valid = reader->cursor >= tail;
+
+    reader->cursor += reader->length;
+    reader->sequence++;
+
+    return valid;
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_wait
+********************************************************************************
+* Summary:
+*  Wait until a record is available.
+*
+* Parameters:
+*  reader: The reader's handle.
+*  timeout_ms: Maximum time to wait in ms, or -1 to wait forever.
+*
+* Return:
+*  int: 1 if a record is available, 0 on timeout or signal.
+*
+*******************************************************************************/
+int comm_shm_wait(comm_shm_reader_t reader, int timeout_ms)
+{
+    _header_t *header = reader->header;
+    struct timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+
+    unsigned futex = atomic_load(&header->futex);
+    atomic_fetch_add(&header->waiters, 1);
+    if(atomic_load(&header->head) == reader->cursor)
+        syscall(SYS_futex, &header->futex, FUTEX_WAIT, futex, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+    atomic_fetch_sub(&header->waiters, 1);
+
+    return atomic_load(&header->head) != reader->cursor;
+}
+
+/*******************************************************************************
+* Function Name: comm_shm_lost
+********************************************************************************
+* Summary:
+*  The number of frames dropped by the writer before this reader read them,
+*  counted from the first record returned by comm_shm_peek() (the frames
+*  dropped before that aren't known to the reader).
+*
+*******************************************************************************/
+uint64_t comm_shm_lost(const struct comm_shm_reader_t *reader)
+{
+    return reader->lost;
+}
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _map
+********************************************************************************
+* Summary:
+*  Map the header page of a shared ring followed by its data area, twice.
+*
+* Parameters:
+*  fd: The shared memory object (a page + 'size' bytes).
+*  size: Size of the data area, a multiple of the page size.
+*
+* Return:
+*  void *: The header, or NULL on error (see errno).
+*
+*******************************************************************************/
+static void *_map(int fd, size_t size)
+{
+    size_t page = _page_size();
+    uint8_t *base = mmap(NULL, page + 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+        return NULL;
+
+    if(mmap(base, page + size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+       || mmap(base + page + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, page) == MAP_FAILED) {
+        int err = errno;
+        munmap(base, page + 2 * size);
+        errno = err;
+        return NULL;
+    }
+
+    return base;
+}
+
+static size_t _page_size(void)
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,93 @@
+/*******************************************************************************
+*
+* Shared-memory export of decoded frames to other processes.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Broadcast ring of decoded frames in POSIX shared memory. One process (the
+*  writer, usually comm_aggregatord) publishes frames, any number of
+*  processes attach by name and read them in place, each with its own cursor.
+*  Like ringbuf_new_mirrored(), the data area is mapped twice, back-to-back,
+*  so every record is contiguous. The writer never waits for the readers:
+*  when the ring is full, the oldest records are dropped, and a reader that
+*  falls behind detects it and skips to the oldest record left (see
+*  comm_shm_lost()).
+*
+* Build:
+*  cc -O2 -I../src -c comm_shm.c (add -lrt on older glibc)
+*
+*******************************************************************************/
+
+#ifndef _COMM_SHM_H
+#define _COMM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "comm_frame_queue.h"
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+// A frame as stored in the shared ring
+typedef struct
+{
+    uint32_t length; // Length of the whole record, padded to 8 bytes
+    uint16_t device; // Index of the device it came from
+    uint8_t count; // The number of bytes in 'data'
+    uint8_t reserved;
+    uint64_t sequence; // Number of frames published before this one
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC when the message was decoded
+    uint8_t data[];
+} comm_shm_record_t;
+
+typedef struct comm_shm_t *comm_shm_t;
+typedef struct comm_shm_reader_t *comm_shm_reader_t;
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+// Writer (one thread of one process)
+comm_shm_t comm_shm_create(const char *name, size_t capacity);
+void comm_shm_destroy(comm_shm_t *shm);
+void comm_shm_publish(comm_shm_t shm, const comm_frame_t *frame);
+
+// Readers
+comm_shm_reader_t comm_shm_attach(const char *name);
+void comm_shm_detach(comm_shm_reader_t *reader);
+const comm_shm_record_t *comm_shm_peek(comm_shm_reader_t reader);
+bool comm_shm_next(comm_shm_reader_t reader);
+int comm_shm_wait(comm_shm_reader_t reader, int timeout_ms);
+uint64_t comm_shm_lost(const struct comm_shm_reader_t *reader);
+
+#endif // _COMM_SHM_H
+
+/* [] END OF FILE */
@@ -0,0 +1,440 @@
+/*******************************************************************************
+*
+* Batched ring buffer I/O with io_uring.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+*******************************************************************************/
+
+#include "comm_uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    int fd;
+    ringbuf_t rb;
+    bool write; // WRITEV from the tail instead of READV at the head
+    void *user;
+    struct iovec iov[2];
+    int iovcnt;
+    ssize_t result;
+} _op_t;
+
+struct comm_uring_t
+{
+    int ring_fd; // -1 when falling back to readv/writev
+    unsigned entries;
+
+    // Submission queue
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+
+    // Completion queue
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Mappings
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+
+    // Operations queued since the last submit
+    _op_t *ops;
+    unsigned count;
+};
+
+
+/*******************************************************************************
+* PRIVATE PROTOTYPES
+*******************************************************************************/
+static int _setup(comm_uring_t uring);
+static bool _queue(comm_uring_t uring, int fd, ringbuf_t rb, bool write, void *user);
+static int _submit_batched(comm_uring_t uring);
+static void _submit_fallback(comm_uring_t uring, unsigned first);
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: comm_uring_new
+********************************************************************************
+* Summary:
+*  Create a batch of up to 'entries' operations. Falls back to
+*  readv/writev if io_uring can't be set up.
+*
+* Return:
+*  comm_uring_t: The new batch, or NULL if there's not enough memory.
+*
+*******************************************************************************/
+comm_uring_t comm_uring_new(unsigned entries)
+{
+    comm_uring_t uring = calloc(1, sizeof(struct comm_uring_t));
+    if(!uring)
+        return NULL;
+
+    uring->entries = entries;
+    uring->ops = calloc(entries, sizeof(_op_t));
+    if(!uring->ops) {
+        free(uring);
+        return NULL;
+    }
+
+    if(_setup(uring) < 0)
+        uring->ring_fd = -1;
+
+    return uring;
+}
+
+/*******************************************************************************
+* Function Name: comm_uring_free
+********************************************************************************
+* Summary:
+*  Deallocate a batch, and, as a side effect, set the pointer to NULL.
+*  Operations queued but not submitted are discarded.
+*
+*******************************************************************************/
+void comm_uring_free(comm_uring_t *uring)
+{
+    if((*uring)->ring_fd >= 0) {
+        munmap((*uring)->sqes, (*uring)->sqes_size);
+        if((*uring)->cq_ptr != (*uring)->sq_ptr)
+            munmap((*uring)->cq_ptr, (*uring)->cq_size);
+        munmap((*uring)->sq_ptr, (*uring)->sq_size);
+        close((*uring)->ring_fd);
+    }
+    free((*uring)->ops);
+    free(*uring);
+    *uring = NULL;
+}
+
+/*******************************************************************************
+* Function Name: comm_uring_is_batched
+********************************************************************************
+* Summary:
+*  'true' if io_uring is used, 'false' when falling back to readv/writev.
+*
+*******************************************************************************/
+bool comm_uring_is_batched(const struct comm_uring_t *uring)
+{
+    return uring->ring_fd >= 0;
+}
+
+/*******************************************************************************
+* Function Name: comm_uring_queue_read
+********************************************************************************
+* Summary:
+*  Queue a read from 'fd' into all the free space of 'rb'. Neither 'rb' nor
+*  its head pointer may change until comm_uring_submit() returns.
+*
+* Return:
+*  bool: 'false' if the batch is full or 'rb' has no free space.
+*
+*******************************************************************************/
+bool comm_uring_queue_read(comm_uring_t uring, int fd, ringbuf_t rb, void *user)
+{
+    return _queue(uring, fd, rb, false, user);
+}
+
+/*******************************************************************************
+* Function Name: comm_uring_queue_write
+********************************************************************************
+* Summary:
+*  Queue a write of all the used bytes of 'rb' to 'fd'. Neither 'rb' nor
+*  its tail pointer may change until comm_uring_submit() returns.
+*
+* Return:
+*  bool: 'false' if the batch is full or 'rb' is empty.
+*
+*******************************************************************************/
+bool comm_uring_queue_write(comm_uring_t uring, int fd, ringbuf_t rb, void *user)
+{
+    return _queue(uring, fd, rb, true, user);
+}
+
+/*******************************************************************************
+* Function Name: comm_uring_submit
+********************************************************************************
+* Summary:
+*  Submit every queued operation and wait until they all completed. The
+*  ring buffers are updated, then 'done' is called for every operation in
+*  the order they were queued.
+*
+* Parameters:
+*  uring: The batch.
+*  done: Called for every operation (may be NULL).
+*  context: Pointer passed back to 'done'.
+*
+* Return:
+*  int: The number of operations completed, or -1 if io_uring failed before
+*       taking any of them (see errno): then no operation is reported and
+*       the batch is emptied. Operations io_uring didn't take once others
+*       were in flight are done with readv/writev instead.
+*
+*******************************************************************************/
+int comm_uring_submit(comm_uring_t uring, comm_uring_done_t done, void *context)
+{
+    unsigned count = uring->count;
+
+    if(uring->ring_fd >= 0) {
+        if(_submit_batched(uring) < 0) {
+            uring->count = 0;
+            return -1;
+        }
+    }
+    else
+        _submit_fallback(uring, 0);
+
+    for(unsigned i = 0; i < count; i++) {
+        _op_t *op = &uring->ops[i];
+        if(op->result > 0) {
+            if(op->write)
+                ringbuf_remove_from_tail(op->rb, op->result);
+            else
+                ringbuf_advance_head(op->rb, op->result);
+        }
+        if(done)
+            done(context, op->user, op->result);
+    }
+    uring->count = 0;
+
+    return count;
+}
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _setup
+********************************************************************************
+* Summary:
+*  Create the io_uring instance and map its queues.
+*
+* Return:
+*  int: -1 on error.
+*
+*******************************************************************************/
+static int _setup(comm_uring_t uring)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = (int)syscall(__NR_io_uring_setup, uring->entries, &params);
+    if(uring->ring_fd < 0)
+        return -1;
+
+    uring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(uring->cq_size > uring->sq_size)
+            uring->sq_size = uring->cq_size;
+        uring->cq_size = uring->sq_size;
+    }
+
+    uring->sq_ptr = mmap(NULL, uring->sq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+    if(uring->sq_ptr == MAP_FAILED)
+        goto error_sq;
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+        uring->cq_ptr = uring->sq_ptr;
+    else {
+        uring->cq_ptr = mmap(NULL, uring->cq_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_CQ_RING);
+        if(uring->cq_ptr == MAP_FAILED)
+            goto error_cq;
+    }
+
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQES);
+    if(uring->sqes == MAP_FAILED)
+        goto error_sqes;
+
+    uring->sq_head = (unsigned *)((char *)uring->sq_ptr + params.sq_off.head);
+    uring->sq_tail = (unsigned *)((char *)uring->sq_ptr + params.sq_off.tail);
+    uring->sq_mask = (unsigned *)((char *)uring->sq_ptr + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *)((char *)uring->sq_ptr + params.sq_off.array);
+    uring->cq_head = (unsigned *)((char *)uring->cq_ptr + params.cq_off.head);
+    uring->cq_tail = (unsigned *)((char *)uring->cq_ptr + params.cq_off.tail);
+    uring->cq_mask = (unsigned *)((char *)uring->cq_ptr + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)((char *)uring->cq_ptr + params.cq_off.cqes);
+
+    // The kernel may round 'entries' up, never use more than requested
+    return 0;
+
+error_sqes:
+    if(uring->cq_ptr != uring->sq_ptr)
+        munmap(uring->cq_ptr, uring->cq_size);
+error_cq:
+    munmap(uring->sq_ptr, uring->sq_size);
+error_sq:
+    close(uring->ring_fd);
+    uring->ring_fd = -1;
+    return -1;
+}
+
+/*******************************************************************************
+* Function Name: _queue
+********************************************************************************
+* Summary:
+*  Describe the free (read) or used (write) region of 'rb' and add the
+*  operation to the batch.
+*
+*******************************************************************************/
+static bool _queue(comm_uring_t uring, int fd, ringbuf_t rb, bool write, void *user)
+{
+    if(uring->count == uring->entries)
+        return false;
+
+    _op_t *op = &uring->ops[uring->count];
+    if(write)
+        op->iovcnt = ringbuf_tail_iov(rb, op->iov, ringbuf_bytes_used(rb));
+    else
+        op->iovcnt = ringbuf_head_iov(rb, op->iov, ringbuf_bytes_free(rb));
+    if(!op->iovcnt)
+        return false;
+
+    op->fd = fd;
+    op->rb = rb;
+    op->write = write;
+    op->user = user;
+    op->result = 0;
+    uring->count++;
+
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: _submit_batched
+********************************************************************************
+* Summary:
+*  Submit every queued operation with one io_uring_enter(2) and wait for
+*  all the completions (more calls only if interrupted, or if the kernel
+*  took only part of them). Once an operation was taken, this only returns
+*  after its completion: the kernel may write into its ring buffer until
+*  then, and a late completion would be matched with the next batch.
+*
+* Return:
+*  int: -1 if the kernel took no operation (the batch can be retried).
+*
+*******************************************************************************/
+static int _submit_batched(comm_uring_t uring)
+{
+    unsigned tail = *uring->sq_tail;
+    unsigned mask = *uring->sq_mask;
+
+    for(unsigned i = 0; i < uring->count; i++) {
+        _op_t *op = &uring->ops[i];
+        unsigned index = (tail + i) & mask;
+        struct io_uring_sqe *sqe = &uring->sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = op->write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = op->fd;
+        sqe->addr = (unsigned long)op->iov;
+        sqe->len = op->iovcnt;
+        sqe->user_data = i;
+        uring->sq_array[index] = index;
+    }
+    __atomic_store_n(uring->sq_tail, tail + uring->count, __ATOMIC_RELEASE);
+
+    unsigned to_submit = uring->count;
+    unsigned completed = 0;
+    while(completed < uring->count) {
+        int ret = (int)syscall(__NR_io_uring_enter, uring->ring_fd, to_submit,
+                               uring->count - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            
+            // Take back the entries the kernel didn't consume
+            unsigned submitted = uring->count - to_submit;
+            __atomic_store_n(uring->sq_tail, tail + submitted, __ATOMIC_RELEASE);
+            if(!submitted)
+                return -1;
+            
+            // Others are in flight: do the rest without io_uring and keep
+            // waiting for them
+            if(to_submit) {
+                _submit_fallback(uring, submitted);
+                completed += to_submit;
+                to_submit = 0;
+            }
+            continue;
+        }
+        to_submit -= (unsigned)ret;
+
+        // Reap the completions
+        unsigned head = *uring->cq_head;
+        unsigned cq_tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        while(head != cq_tail) {
+            struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+            uring->ops[cqe->user_data].result = cqe->res;
+            head++;
+            completed++;
+        }
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+* Function Name: _submit_fallback
+********************************************************************************
+* Summary:
+*  Do the queued operations from 'first' on with readv(2)/writev(2).
+*
+*******************************************************************************/
+static void _submit_fallback(comm_uring_t uring, unsigned first)
+{
+    for(unsigned i = first; i < uring->count; i++) {
+        _op_t *op = &uring->ops[i];
+        ssize_t n;
+        do {
+            n = op->write ? writev(op->fd, op->iov, op->iovcnt)
+                          : readv(op->fd, op->iov, op->iovcnt);
+        } while(n < 0 && errno == EINTR);
+        op->result = (n < 0) ? -errno : n;
+    }
+}
+
+/* [] END OF FILE */
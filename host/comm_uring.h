@@ -0,0 +1,77 @@
+/*******************************************************************************
+*
+* Batched ring buffer I/O with io_uring.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Queues reads into (or writes from) many ring buffers and submits them all
+*  with a single io_uring_enter(2). Every operation covers the whole free
+*  (or used) region of its ring buffer, both segments when it wraps, with
+*  one READV (or WRITEV). Completed operations move the head (or tail)
+*  pointer like ringbuf_read/ringbuf_write do, but never overflow.
+*
+*  When io_uring isn't available (old kernel, seccomp, etc.) the same
+*  operations are done with one readv(2)/writev(2) each.
+*
+*  A comm_uring_t must only be used by one thread at a time.
+*
+*******************************************************************************/
+
+#ifndef _COMM_URING_H
+#define _COMM_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "ringbuf.h"
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct comm_uring_t *comm_uring_t;
+
+// Called once per completed operation, 'result' is the number of bytes
+// transferred or a negative errno
+typedef void (*comm_uring_done_t)(void *context, void *user, ssize_t result);
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+comm_uring_t comm_uring_new(unsigned entries);
+void comm_uring_free(comm_uring_t *uring);
+bool comm_uring_is_batched(const struct comm_uring_t *uring);
+bool comm_uring_queue_read(comm_uring_t uring, int fd, ringbuf_t rb, void *user);
+bool comm_uring_queue_write(comm_uring_t uring, int fd, ringbuf_t rb, void *user);
+int comm_uring_submit(comm_uring_t uring, comm_uring_done_t done, void *context);
+
+#endif // _COMM_URING_H
+
+/* [] END OF FILE */
@@ -32,17 +32,77 @@
 *******************************************************************************/
 
 #include "comm_driver.h"
+#include "comm_lock.h"
 #include "ringbuf.h"
+#include <string.h>
+#ifdef _COMM_DRIVER_BULK_H
+#include "crc16.h"
+#endif
 
 // Verification
 #if USE_USBUART || USE_UART
     #if CYDEV_HEAP_SIZE < (RX_BUFFER_SIZE + TX_BUFFER_SIZE + 2)
         #error Invalid HEAP size! You need at least (RX_BUFFER_SIZE + TX_BUFFER_SIZE + 2) bytes for comm_driver
     #endif
+    #if COMM_RECORDER_SIZE && CYDEV_HEAP_SIZE < (RX_BUFFER_SIZE + TX_BUFFER_SIZE + COMM_RECORDER_SIZE + 3)
+        #error Invalid HEAP size! The flight recorder needs COMM_RECORDER_SIZE + 1 more bytes
+    #endif
+#endif
+#if COMM_RECORDER_SIZE && !defined(_COMM_DRIVER_BULK_H)
+    #error The flight recorder (COMM_RECORDER_SIZE) needs bulk transfers
+#endif
+#if COMM_RECORDER_SIZE && !RINGBUF_POLICIES
+    #error The flight recorder (COMM_RECORDER_SIZE) needs RINGBUF_POLICIES
 #endif
 #if !USE_USBUART && !USE_UART
     #warning Both USE_USBUART and USE_UART are set to '0'
 #endif
+#if COMM_SHARED_BUFFERS
+    #if RX_BUFFER_MIN_SIZE > RX_BUFFER_SIZE || TX_BUFFER_MIN_SIZE > TX_BUFFER_SIZE
+        #error <RX/TX>_BUFFER_MIN_SIZE must not be larger than <RX/TX>_BUFFER_SIZE
+    #endif
+    #if USE_USBUART && RX_BUFFER_MIN_SIZE < 64u
+        #error RX_BUFFER_MIN_SIZE must hold a whole USB packet (64 bytes)
+    #endif
+    #if defined(_COMM_DRIVER_BULK_H) && TX_BUFFER_MIN_SIZE < BULK_FRAME_LENGTH
+        #error TX_BUFFER_MIN_SIZE must be at least BULK_FRAME_LENGTH bytes for bulk transfers
+    #endif
+#endif
+#ifdef _COMM_DRIVER_BULK_H
+    #if TX_BUFFER_SIZE < BULK_FRAME_LENGTH
+        #error TX_BUFFER_SIZE must be at least BULK_FRAME_LENGTH bytes for bulk transfers
+    #endif
+    #if (BULK_WINDOW & (BULK_WINDOW - 1)) || BULK_WINDOW >= 128
+        #error BULK_WINDOW must be a power of two smaller than 128
+    #endif
+#endif
+#if COMM_ADAPTIVE_TICK && (COMM_INTERRUPT_MIN_FREQ < 1 || COMM_INTERRUPT_MIN_FREQ > COMM_INTERRUPT_FREQ)
+    #error COMM_INTERRUPT_MIN_FREQ must be between 1 and COMM_INTERRUPT_FREQ
+#endif
+#if COMM_ISR_BYTE_BUDGET && USE_USBUART && COMM_ISR_BYTE_BUDGET < 64u
+    #warning COMM_ISR_BYTE_BUDGET is smaller than a USB packet, the interrupt will not send and receive in the same tick
+#endif
+#if COMM_URGENT_MESSAGES && !defined(_COMM_DRIVER_MSG_H)
+    #error Urgent messages (COMM_URGENT_MESSAGES) need custom messages
+#endif
+#if COMM_URGENT_MESSAGES && USE_USBUART
+    // A held urgent message can't wait for room that never comes
+    _Static_assert(RX_BUFFER_POLICY != RINGBUF_BLOCK || RX_BUFFER_SIZE >= MSG_MAX_LENGTH + 64u,
+                   "RX_BUFFER_SIZE must be at least MSG_MAX_LENGTH + 64 bytes for urgent messages");
+#elif COMM_URGENT_MESSAGES
+    // The UART is read as room allows, a held message must only fit
+    _Static_assert(RX_BUFFER_POLICY != RINGBUF_BLOCK || RX_BUFFER_SIZE >= MSG_MAX_LENGTH,
+                   "RX_BUFFER_SIZE must be at least MSG_MAX_LENGTH bytes for urgent messages");
+#endif
+#if !RINGBUF_POLICIES
+    // Ring buffers without policies always drop their oldest bytes
+    _Static_assert((RX_BUFFER_POLICY == RINGBUF_BLOCK || RX_BUFFER_POLICY == RINGBUF_DROP_OLDEST) &&
+                   (TX_BUFFER_POLICY == RINGBUF_BLOCK || TX_BUFFER_POLICY == RINGBUF_DROP_OLDEST),
+                   "RINGBUF_POLICIES is needed for RINGBUF_DROP_NEWEST and RINGBUF_DROP_RECORD");
+#endif
+#if RINGBUF_WATERMARKS && (COMM_HIGH_WATERMARK != RINGBUF_HIGH_WATERMARK || COMM_LOW_WATERMARK != RINGBUF_LOW_WATERMARK)
+    #error COMM_<HIGH/LOW>_WATERMARK must match RINGBUF_<HIGH/LOW>_WATERMARK
+#endif
     
 // TX specific macros
 #if USE_USBUART
@@ -54,14 +114,68 @@
 #endif
 #define TX_MAX_REJECT (8u)
 
+// Capacity of the TX buffer that is always available
+#if COMM_SHARED_BUFFERS
+    #define TX_GUARANTEED_SIZE (TX_BUFFER_MIN_SIZE)
+#else
+    #define TX_GUARANTEED_SIZE (TX_BUFFER_SIZE)
+#endif
+
+// Borrow idle space from the other buffer before waiting for room
+#if COMM_SHARED_BUFFERS
+    #define TX_RESERVE(count) _reserve(_txBuffer, _rxBuffer, RX_BUFFER_MIN_SIZE, (count))
+    #define RX_RESERVE(count) _reserve(_rxBuffer, _txBuffer, TX_BUFFER_MIN_SIZE, (count))
+#else
+    #define TX_RESERVE(count)
+    #define RX_RESERVE(count)
+#endif
+
+// Room for a write in the TX buffer, after applying its overflow policy (the
+// driver waits itself for RINGBUF_BLOCK, ring buffers may be built without
+// policies)
+#define TX_MAKE_ROOM(count) (TX_BUFFER_POLICY == RINGBUF_BLOCK ? \
+    (count) <= ringbuf_bytes_free(_txBuffer) : ringbuf_make_room(_txBuffer, (count)))
+
 // Interrupt macros
 #if CY_PSOC5LP
-    #define COMM_INT_NB_TICKS (BCLK__BUS_CLK__HZ / COMM_INTERRUPT_FREQ)
+    #define COMM_CLOCK_HZ (BCLK__BUS_CLK__HZ)
     #define SYSTICK_INT_NUM (CY_INT_SYSTICK_IRQN)
 #elif CY_PSOC4
-    #define COMM_INT_NB_TICKS (CYDEV_BCLK__SYSCLK__HZ / COMM_INTERRUPT_FREQ)
+    #define COMM_CLOCK_HZ (CYDEV_BCLK__SYSCLK__HZ)
     #define SYSTICK_INT_NUM (SysTick_IRQn + 16)
 #endif
+#define COMM_INT_NB_TICKS (COMM_CLOCK_HZ / COMM_INTERRUPT_FREQ)
+
+// Adaptive interrupt frequency
+#if COMM_ADAPTIVE_TICK
+    #define COMM_INT_MAX_NB_TICKS (COMM_CLOCK_HZ / COMM_INTERRUPT_MIN_FREQ)
+    #if COMM_INT_MAX_NB_TICKS > 0x1000000
+        #error COMM_INTERRUPT_MIN_FREQ is too low, SysTick is limited to 2^24 ticks
+    #endif
+    #define TICK_WAKE() _tick_wake()
+    #define TICK_ACTIVE() (_tickActive = true)
+#else
+    #define TICK_WAKE() ((void)0)
+    #define TICK_ACTIVE() ((void)0)
+#endif
+
+// Work budget of the comm interrupt (number of bytes it may move)
+#define COMM_ISR_BUDGET (COMM_ISR_BYTE_BUDGET || COMM_ISR_CYCLE_BUDGET)
+#if COMM_ISR_BUDGET
+    #define BUDGET(count) _budget_take(count)
+#else
+    #define BUDGET(count) (count)
+#endif
+#define UART_BATCH_SIZE (16u)
+
+// Received bytes go through the urgent message filter first
+#if COMM_URGENT_MESSAGES
+    #define RX_PUT(data, count) _urgent_rx((data), (count))
+    #define RX_HELD (_urgentCount)
+#else
+    #define RX_PUT(data, count) ringbuf_memcpy_into(_rxBuffer, (data), (count))
+    #define RX_HELD (0u)
+#endif
 
 /*******************************************************************************
 * PRIVATE VARIABLES
@@ -79,6 +193,69 @@ bool _txZlpRequired = false; // Flag to indicate the ZLP is required
 uint8 _txReject = 0; // The count of trial rejected by the TX endpoint
 #endif
 
+// Bulk transfers
+#ifdef _COMM_DRIVER_BULK_H
+#define BULK_IDLE (0u)
+#define BULK_RECEIVING (1u)
+#define BULK_SENDING (2u)
+volatile uint8 _bulkState = BULK_IDLE; // Direction of the bulk transfer
+uint8 _bulkFrame[BULK_FRAME_LENGTH]; // Block (or acknowledgement) being received
+uint8 _bulkFrameCount = 0; // The count of bytes in _bulkFrame
+comm_bulk_sink_t _bulkSink = NULL; // Where received blocks are delivered
+void *_bulkContext = NULL; // Context passed to _bulkSink
+uint8 _bulkExpectedSeq = 0; // Sequence of the next block to deliver
+bool _bulkNakSent = false; // Only one NAK is sent per lost block
+uint8 _bulkReply[BULK_ACK_LENGTH]; // Latest acknowledgement to send
+volatile bool _bulkReplyPending = false; // _bulkReply is waiting for TX room
+uint8 _bulkWindow[BULK_WINDOW][BULK_FRAME_LENGTH]; // Blocks sent but not acknowledged
+volatile bool _bulkAckReceived = false; // An ACK was received while sending
+volatile uint8 _bulkAckSeq = 0; // Sequence of the latest ACK received
+volatile bool _bulkNakReceived = false; // A NAK was received while sending
+volatile uint8 _bulkNakSeq = 0; // Sequence of the latest NAK received
+volatile uint16 _bulkTicks = 0; // Interrupts since the last acknowledgement
+#endif
+
+// Flight recorder
+#if COMM_RECORDER_SIZE
+ringbuf_t _recorder; // Latest records, the oldest ones are dropped whole
+uint32 _recorderStart = 0; // Position of the oldest byte (bytes dropped so far)
+uint32 _dumpPos = 0; // Position of the next byte to dump
+uint32 _dumpEnd = 0; // Position of the end of the dump
+uint8 _dumpLastByte = 0; // Last byte dumped
+#endif
+
+// Urgent messages
+#if COMM_URGENT_MESSAGES
+#define URGENT_IDLE (0u) // Looking for MSG_FIRST_BYTE
+#define URGENT_HEADER (1u) // Holding a header until the message ID
+#define URGENT_MESSAGE (2u) // Holding an urgent message until its last byte
+#define URGENT_SKIP (3u) // Passing another message through
+uint8 _urgentState = URGENT_IDLE; // State of the urgent message filter
+uint8 _urgentFrame[MSG_MAX_LENGTH]; // Bytes held by the filter
+uint8 _urgentCount = 0; // The count of bytes in _urgentFrame
+uint8 _urgentSkip = 0; // Bytes left in the message passed through
+uint8 _urgentMask = 0; // Bits of the message ID compared
+uint8 _urgentMatch = 0; // Expected value of these bits
+comm_urgent_t _urgentHook = NULL; // Called with every urgent message
+void *_urgentContext = NULL; // Context passed to _urgentHook
+#endif
+
+// Adaptive interrupt frequency
+#if COMM_ADAPTIVE_TICK
+volatile uint32 _tickReload = COMM_INT_NB_TICKS; // Current SysTick period (in clock ticks)
+uint16 _tickIdle = 0; // Interrupts in a row with nothing to do
+bool _tickActive = false; // Bytes were moved during the current interrupt
+#endif
+
+// Work budget of the comm interrupt
+#if COMM_ISR_BUDGET
+uint32 _budgetBytes = 0; // Bytes the current interrupt may still move
+uint32 _budgetLoad = 0; // SysTick reload value when the current interrupt started
+bool _budgetHit = false; // The current interrupt already stopped on its budget
+#endif
+volatile uint32 _byteBudgetHits = 0; // Interrupts stopped by COMM_ISR_BYTE_BUDGET
+volatile uint32 _cycleBudgetHits = 0; // Interrupts stopped by COMM_ISR_CYCLE_BUDGET
+
 
 /*******************************************************************************
 * PRIVATE PROTOTYPES
@@ -88,6 +265,29 @@ void _init_cdc(bool first_init);
 #endif
 void _comm_rx_isr();
 void _comm_tx_isr();
+#if COMM_SHARED_BUFFERS
+void _reserve(ringbuf_t rb, ringbuf_t lender, size_t lender_min, size_t count);
+#endif
+#ifdef _COMM_DRIVER_BULK_H
+void _bulk_rx(const uint8 *data, uint16 count);
+void _bulk_rx_block();
+void _bulk_reply(uint8 type, uint8 seq);
+void _bulk_put_frame(const uint8 *frame);
+#endif
+#if COMM_RECORDER_SIZE
+uint8 _recorder_source(void *context, uint8 *data, uint8 max_count);
+#endif
+#if COMM_ADAPTIVE_TICK
+void _tick_wake();
+void _tick_adapt();
+#endif
+#if COMM_ISR_BUDGET
+uint32 _budget_take(uint32 count);
+#endif
+#if COMM_URGENT_MESSAGES
+void _urgent_rx(const uint8 *data, uint16 count);
+void _urgent_release();
+#endif
 
 
 /*******************************************************************************
@@ -95,8 +295,16 @@ void _comm_tx_isr();
 *******************************************************************************/
 // Must be placed after the functions prototypes (or after their definition)
 CY_ISR(int_comm_isr) {
+#if COMM_ISR_BUDGET
+    _budgetBytes = COMM_ISR_BYTE_BUDGET ? COMM_ISR_BYTE_BUDGET : UINT32_MAX;
+    _budgetLoad = SysTick->LOAD;
+    _budgetHit = false;
+#endif
     _comm_rx_isr();
     _comm_tx_isr();
+#if COMM_ADAPTIVE_TICK
+    _tick_adapt();
+#endif
 }
 
 
@@ -120,12 +328,26 @@ CY_ISR(int_comm_isr) {
 void comm_init()
 {    
     // Allocate memory for the buffers
+#if COMM_SHARED_BUFFERS
+    ringbuf_new_shared(&_rxBuffer, &_txBuffer, RX_BUFFER_SIZE, TX_BUFFER_SIZE);
+#else
     _rxBuffer = ringbuf_new(RX_BUFFER_SIZE);
     _txBuffer = ringbuf_new(TX_BUFFER_SIZE);
+#endif
     
     // Reset buffers
     ringbuf_reset(_rxBuffer);
     ringbuf_reset(_txBuffer);
+#if RINGBUF_POLICIES
+    ringbuf_set_policy(_rxBuffer, RX_BUFFER_POLICY, COMM_LINE_TERMINATOR);
+    ringbuf_set_policy(_txBuffer, TX_BUFFER_POLICY, COMM_LINE_TERMINATOR);
+#endif
+    
+#if COMM_RECORDER_SIZE
+    // The flight recorder drops its oldest records whole
+    _recorder = ringbuf_new(COMM_RECORDER_SIZE);
+    ringbuf_set_policy(_recorder, RINGBUF_DROP_RECORD, COMM_LINE_TERMINATOR);
+#endif
     
 #if USE_USBUART
     // Start USBFS component
@@ -143,8 +365,13 @@ void comm_init()
 #endif
     
     // Setup interrupt
+#if COMM_ADAPTIVE_TICK
+    _tickReload = COMM_INT_NB_TICKS;
+    _tickIdle = 0;
+#endif
     CyIntSetSysVector(SYSTICK_INT_NUM, int_comm_isr);
     SysTick_Config(COMM_INT_NB_TICKS);
+    comm_lock_init();
     NVIC_EnableIRQ(SYSTICK_INT_NUM);
     CyGlobalIntEnable;  // In case it wasn't done if the main.
 }
@@ -159,25 +386,23 @@ void comm_init()
 *  data: Pointer to a uint8 where the byte read will be copied.
 *
 * Return:
-*  uint8: The number of bytes copied.
+*  size_t: The number of bytes copied.
 *
 *******************************************************************************/
-uint8 comm_getch(uint8 *data)
+size_t comm_getch(uint8 *data)
 {
-    uint8 count = 1;
-    
-    // Exit if 'data' is NULL or if the buffer is empty
-    if(!data || ringbuf_is_empty(_rxBuffer))
+    // Exit if 'data' is NULL
+    if(!data)
         return 0;
     
-    // Prevent interrupts
-    uint8 state = CyEnterCriticalSection();
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
     
     // Extract a single byte from the FIFO buffer
-    ringbuf_memcpy_from(data, _rxBuffer, count); 
+    size_t count = ringbuf_getc(_rxBuffer, data);
     
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
+    // Re-enable comm interrupts
+    comm_unlock(state);
     
     return count;
 }
@@ -195,9 +420,8 @@ uint8 comm_getch(uint8 *data)
 *  None.
 *
 *******************************************************************************/
-void comm_putch(uint8 *data)
+void comm_putch(const uint8 *data)
 {
-    uint8 count = 1;
     uint8 state;
     
     // Exit if 'data' is NULL
@@ -206,342 +430,1584 @@ void comm_putch(uint8 *data)
     
     // Wait until there's enough room in the TX buffer
     while(1u) {
-        // Prevent interrupts
-        state = CyEnterCriticalSection();
+        // Prevent comm interrupts
+        state = comm_lock();
         
-        // Check if there's enough space free in the TX buffer
-        if(ringbuf_bytes_free(_txBuffer) >= count) break;
+        // Copy a single byte into the FIFO buffer if there's room
+        TX_RESERVE(1);
+        if(ringbuf_putc(_txBuffer, *data)) break;
+        
+        // Otherwise apply the overflow policy, only RINGBUF_BLOCK waits
+        if(TX_BUFFER_POLICY != RINGBUF_BLOCK) {
+            ringbuf_memcpy_into(_txBuffer, data, 1);
+            break;
+        }
         
-        // Re-enable interrupts
-        CyExitCriticalSection(state);
+        // Re-enable comm interrupts
+        comm_unlock(state);
     }
+    TICK_WAKE();
     
-    // Copy a single byte into the FIFO buffer
-    ringbuf_memcpy_into(_txBuffer, data, count); 
-    
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
+    // Re-enable comm interrupts
+    comm_unlock(state);
 }
 
 /*******************************************************************************
-* Function Name: comm_getline
+* Function Name: comm_read
 ********************************************************************************
 * Summary:
-*  Read a line from the rxBuffer. A line ends with COMM_LINE_TERMINATOR
-*  (see comm_driver.h).
+*  Read raw bytes from the rxBuffer, whatever their framing.
 *   
 * Parameters:
 *  data: Pointer to an array of uint8 where the bytes read will be copied.
-*        The line terminator will not be copied.
+*  max_count: The size of the array 'data'.
 *
 * Return:
-*  uint8: The number of bytes returned.
+*  size_t: The number of bytes copied (all those available, up to
+*          'max_count').
 *
 *******************************************************************************/
-uint8 comm_getline(uint8 *data)
+size_t comm_read(uint8 *data, size_t max_count)
 {
-    // Exit if 'data' is NULL or if the buffer is empty
-    if(!data || ringbuf_is_empty(_rxBuffer))
-        return 0;
-    
-    // Look for a line terminator in the buffer, exit if not found
-    uint16 line_term_offs = ringbuf_findchr(_rxBuffer, COMM_LINE_TERMINATOR, 0);
-    if(line_term_offs == ringbuf_bytes_used(_rxBuffer))
+    // Exit if 'data' is NULL
+    if(!data || !max_count)
         return 0;
     
-    // Prevent interrupts
-    uint8 state = CyEnterCriticalSection();
-    
-    // Extract a line from the FIFO buffer (without the line terminator)
-    ringbuf_memcpy_from(data, _rxBuffer, line_term_offs);
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
     
-    // Remove the line terminator from the FIFO buffer
-    ringbuf_remove_from_tail(_rxBuffer, 1);
+    // Extract everything available in one go
+    size_t count = MIN(ringbuf_bytes_used(_rxBuffer), max_count);
+    ringbuf_memcpy_from(data, _rxBuffer, count);
     
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
+    // Re-enable comm interrupts
+    comm_unlock(state);
     
-    return line_term_offs;
+    return count;
 }
 
 /*******************************************************************************
-* Function Name: comm_putline
+* Function Name: comm_write
 ********************************************************************************
 * Summary:
-*  Write a line to the txBuffer. The line terminator COMM_LINE_TERMINATOR
-*  will be appended automatically (see comm_driver.h).
+*  Write raw bytes to the txBuffer, without framing. Blocks until all of
+*  them are in the txBuffer; 'count' may be larger than the buffer, the
+*  bytes are then copied as the buffer empties.
 *   
 * Parameters:
-*  data: Pointer to an array of uint8 containing the line to send.
+*  data: Pointer to an array of uint8 containing the bytes to send.
 *  count: The number of bytes in the array 'data'.
 *
 * Return:
 *  None.
 *
 *******************************************************************************/
-void comm_putline(uint8 *data, uint8 count)
+void comm_write(const uint8 *data, size_t count)
 {
-    uint8 state;
-    
     // Exit if 'data' is NULL
-    if(!data || count <= 0)
+    if(!data)
         return;
     
-    // Wait until there's enough room in the TX buffer
-    while(1u) {
-        // Prevent interrupts
-        state = CyEnterCriticalSection();
+    while(count) {
+        // Prevent comm interrupts
+        uint8 state = comm_lock();
         
-        // Check if there's enough space free in the TX buffer
-        if(ringbuf_bytes_free(_txBuffer) >= count+1) break;
+        // Copy as much as there's room for, or everything if the overflow
+        // policy doesn't wait for room
+        TX_RESERVE(count);
+        size_t n = count;
+        if(TX_BUFFER_POLICY == RINGBUF_BLOCK)
+            n = MIN(ringbuf_bytes_free(_txBuffer), count);
+        ringbuf_memcpy_into(_txBuffer, data, n);
+        TICK_WAKE();
+        
+        // Re-enable comm interrupts
+        comm_unlock(state);
         
-        // Re-enable interrupts
-        CyExitCriticalSection(state);
+        data += n;
+        count -= n;
     }
-    
-    // Copy the line into the FIFO buffer
-    ringbuf_memcpy_into(_txBuffer, data, count);
-    
-    // Copy the line terminator into the FIFO buffer
-    uint8 line_terminator = COMM_LINE_TERMINATOR;
-    ringbuf_memcpy_into(_txBuffer, &line_terminator, 1);
-    
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
 }
 
-#ifdef _COMM_DRIVER_MSG_H
 /*******************************************************************************
-* Function Name: comm_getmsg
+* Function Name: comm_tick_freq
 ********************************************************************************
 * Summary:
-*  Read a message from the rxBuffer. A message ends with MSG_LAST_BYTE
-*  (see comm_driver_msg.h). It may return '0' if a complete message couldn't
-*  be found in the FIFO buffer.
+*  Current frequency of the comm interrupts. Always COMM_INTERRUPT_FREQ,
+*  unless COMM_ADAPTIVE_TICK is set (see comm_driver.h).
 *   
 * Parameters:
-*  data: Pointer to an array of uint8 where the bytes read will be copied.
-*        The bytes used to verify the message's integrity will not be copied.
+*  None.
 *
 * Return:
-*  uint8: The number of bytes returned.
+*  uint32: The frequency (Hz).
 *
 *******************************************************************************/
-uint8 comm_getmsg(uint8 *data)
+uint32 comm_tick_freq()
 {
-    // Exit if 'data' is NULL or if the buffer is empty
-    if(!data || ringbuf_is_empty(_rxBuffer))
-        return 0;
-    
-    bool message_found = false;
-    uint16 msg_first_byte_offs = 0;
-    uint8 msg_length = 0;
-    uint8 msg_last_byte = 0;
-    
-    // Find the first complete message in the FIFO buffer, exit if not found
-    while(!message_found) {
-        
-        // Find the first occurence of MSG_FIRST_BYTE, exit if not found
-        msg_first_byte_offs = ringbuf_findchr(_rxBuffer, MSG_FIRST_BYTE, 0);
-        if(msg_first_byte_offs == ringbuf_bytes_used(_rxBuffer))
-            return 0;
-        
-        // Remove all bytes until MSG_FIRST_BYTE if it's not at the begginning
-        // of the FIFO buffer
-        if(msg_first_byte_offs)
-            ringbuf_remove_from_tail(_rxBuffer, msg_first_byte_offs);
-            
-        // Extract the MSG_LENGTH, exit if not found
-        if(ringbuf_bytes_used(_rxBuffer) < MSG_HEADER_LENGTH)
-            return 0;
-        msg_length = ringbuf_peek(_rxBuffer, MSG_LENGTH_OFFS_FROM_FIRST_BYTE);
-            
-        // Check if message length is valid (smaller than buffer size)
-        if(msg_length >= 100) {
-            ringbuf_remove_from_tail(_rxBuffer, 1);
-            return 0;
-        }
-        
-        // Check if MSG_LAST_BYTE is where expected, exit if not enough bytes
-        // in FIFO buffer
-        if(ringbuf_bytes_used(_rxBuffer) < msg_length)
-            return 0;
-        msg_last_byte = ringbuf_peek(_rxBuffer, msg_length-1);
-        if(msg_last_byte == MSG_LAST_BYTE)
-            message_found = true;
-            
-        // Remove first byte if message not found and try again
-        if(!message_found)
-            ringbuf_remove_from_tail(_rxBuffer, MSG_LENGTH_OFFS_FROM_FIRST_BYTE);
-    }
-    
-    // Prevent interrupts
-    uint8 state = CyEnterCriticalSection();
-    
-    // Remove message header from the FIFO buffer
-    ringbuf_remove_from_tail(_rxBuffer, MSG_HEADER_LENGTH);
-    
-    // Extract the message from the FIFO buffer (without the header/footer)
-    uint8 count = msg_length - MSG_STRUCTURE_LENGTH;
-    ringbuf_memcpy_from(data, _rxBuffer, count);
-    
-    // Remove the message footer from the FIFO buffer
-    ringbuf_remove_from_tail(_rxBuffer, MSG_FOOTER_LENGTH);
-    
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
-    
-    return count;
+#if COMM_ADAPTIVE_TICK
+    return COMM_CLOCK_HZ / _tickReload;
+#else
+    return COMM_CLOCK_HZ / COMM_INT_NB_TICKS;
+#endif
 }
 
 /*******************************************************************************
-* Function Name: comm_putmsg
+* Function Name: comm_byte_budget_hits
 ********************************************************************************
 * Summary:
-*  Write a message to the txBuffer. The message will be padded with the
-*  custom structure found in "comm_driver_msg.h".
+*  Number of comm interrupts that stopped before moving every byte available
+*  because of COMM_ISR_BYTE_BUDGET, since comm_init().
 *   
 * Parameters:
-*  data: Pointer to an array of uint8 containing the message to send.
-*  count: The number of bytes in the array 'data'.
+*  None.
 *
 * Return:
-*  None.
+*  uint32: The number of interrupts.
 *
 *******************************************************************************/
-void comm_putmsg(uint8 *data, uint8 count)
+uint32 comm_byte_budget_hits()
 {
-    uint8 state;
-    
-    // Exit if 'data' is NULL
-    if(!data || count <= 0)
-        return;
-    
-    uint8 msg_length = count + MSG_STRUCTURE_LENGTH;
-    
-    // Wait until there's enough room in the TX buffer
-    while(1u) {
-        // Prevent interrupts
-        state = CyEnterCriticalSection();
-        
-        // Check if there's enough space free in the TX buffer
-        if(ringbuf_bytes_free(_txBuffer) >= msg_length) break;
-        
-        // Re-enable interrupts
-        CyExitCriticalSection(state);
-    }
-    
-    // Write the message header into the FIFO buffer
-    uint8 msg_header[MSG_HEADER_LENGTH] = {MSG_FIRST_BYTE, msg_length};
-    ringbuf_memcpy_into(_txBuffer, msg_header, MSG_HEADER_LENGTH);
-    
-    // Copy the message into the FIFO buffer
-    ringbuf_memcpy_into(_txBuffer, data, count);
-    
-    // Write the message footer into the FIFO buffer
-    uint8 msg_footer[MSG_FOOTER_LENGTH] = {MSG_LAST_BYTE};
-    ringbuf_memcpy_into(_txBuffer, msg_footer, MSG_FOOTER_LENGTH);
-    
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
+    return _byteBudgetHits;
 }
-#endif // _COMM_DRIVER_MSG_H
-
 
 /*******************************************************************************
-* PRIVATE FUNCTIONS
-*******************************************************************************/
-/*******************************************************************************
-* Function Name: _init_cdc
+* Function Name: comm_cycle_budget_hits
 ********************************************************************************
 * Summary:
-*  Wait for USBFS enumeration and configure the CDC interface.
-*  This should be called periodically to check if the USBFS configuration
-*  has changed.
+*  Number of comm interrupts that stopped before moving every byte available
+*  because of COMM_ISR_CYCLE_BUDGET, since comm_init().
 *   
 * Parameters:
-*  first_init: Must only be 'TRUE' right after the call to COMM_Start().
+*  None.
 *
 * Return:
-*  None.
+*  uint32: The number of interrupts.
 *
 *******************************************************************************/
-#if USE_USBUART
-void _init_cdc(bool first_init)
+uint32 comm_cycle_budget_hits()
 {
-    // To do only on first init or if configurations have changed
-    if(first_init || COMM_IsConfigurationChanged()) {
-        
-        // Wait for USBFS to enumerate
-        while (!COMM_GetConfiguration());
-        
-        // Ensure to clear the CHANGE flag
-        COMM_IsConfigurationChanged();
-        
-        // Initialize the CDC feature
-        COMM_CDC_Init();
-    }
+    return _cycleBudgetHits;
 }
-#endif
 
 /*******************************************************************************
-* Function Name: _comm_rx_isr
+* Function Name: comm_rx_dropped
 ********************************************************************************
 * Summary:
-*  Copy all available bytes from COMM block into the RX FIFO buffer.
+*  Number of bytes dropped by the overflow policy of the rxBuffer (see
+*  RX_BUFFER_POLICY) since comm_init(). Always 0 if the ring buffers are
+*  built without RINGBUF_POLICIES.
 *   
 * Parameters:
 *  None.
 *
 * Return:
-*  None.
+*  size_t: The number of bytes dropped.
 *
 *******************************************************************************/
-void _comm_rx_isr()
+size_t comm_rx_dropped()
 {
-    // Prevent interrupts
-    uint8 state = CyEnterCriticalSection();
+#if RINGBUF_POLICIES
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
     
-#if USE_USBUART
-    uint16 count = 0;
+    size_t dropped = ringbuf_dropped(_rxBuffer);
     
-    // Check if USBFS configuration has changed
-    _init_cdc(false);
+    // Re-enable comm interrupts
+    comm_unlock(state);
     
-    // Check if USBUART has data available
-    if (COMM_DataIsReady()) {
-        
-        // Check that the FIFO buffer has enough free space to receive 
-        // all available bytes from COMM block
-        if (COMM_GetCount() <= ringbuf_bytes_free(_rxBuffer)) {
-            
-            // Copy available bytes into the FIFO buffer
-            count = COMM_GetAll(_tempBuffer);
-            ringbuf_memcpy_into(_rxBuffer, _tempBuffer, count);
+    return dropped;
+#else
+    return 0;
+#endif
+}
+
+/*******************************************************************************
+* Function Name: comm_tx_dropped
+********************************************************************************
+* Summary:
+*  Number of bytes dropped by the overflow policy of the txBuffer (see
+*  TX_BUFFER_POLICY) since comm_init(). Always 0 if the ring buffers are
+*  built without RINGBUF_POLICIES.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  size_t: The number of bytes dropped.
+*
+*******************************************************************************/
+size_t comm_tx_dropped()
+{
+#if RINGBUF_POLICIES
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    size_t dropped = ringbuf_dropped(_txBuffer);
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    return dropped;
+#else
+    return 0;
+#endif
+}
+
+#if RINGBUF_WATERMARKS
+/*******************************************************************************
+* Function Name: comm_rx_watermarks
+********************************************************************************
+* Summary:
+*  Set the watermarks of the rxBuffer (see ringbuf_set_watermarks). The
+*  callback is called by the comm interrupt when it fills the rxBuffer up to
+*  'high' bytes (COMM_HIGH_WATERMARK), and by the reading function when it
+*  empties it down to 'low' bytes (COMM_LOW_WATERMARK). Must be called
+*  after comm_init().
+*   
+* Parameters:
+*  low: Low watermark, in bytes used.
+*  high: High watermark, in bytes used (higher than 'low').
+*  callback: Function called on every event (may be 0 to only use
+*            comm_rx_events()).
+*  context: Passed to 'callback'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_rx_watermarks(size_t low, size_t high, comm_watermark_t callback, void *context)
+{
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    ringbuf_set_watermarks(_rxBuffer, low, high, callback, context);
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+}
+
+/*******************************************************************************
+* Function Name: comm_tx_watermarks
+********************************************************************************
+* Summary:
+*  Set the watermarks of the txBuffer (see ringbuf_set_watermarks). The
+*  callback is called by the writing function when it fills the txBuffer up
+*  to 'high' bytes (COMM_HIGH_WATERMARK), and by the comm interrupt when it
+*  empties it down to 'low' bytes (COMM_LOW_WATERMARK). Must be called
+*  after comm_init().
+*   
+* Parameters:
+*  low: Low watermark, in bytes used.
+*  high: High watermark, in bytes used (higher than 'low').
+*  callback: Function called on every event (may be 0 to only use
+*            comm_tx_events()).
+*  context: Passed to 'callback'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_tx_watermarks(size_t low, size_t high, comm_watermark_t callback, void *context)
+{
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    ringbuf_set_watermarks(_txBuffer, low, high, callback, context);
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+}
+
+/*******************************************************************************
+* Function Name: comm_rx_events
+********************************************************************************
+* Summary:
+*  Watermark events of the rxBuffer since the last call (see
+*  comm_rx_watermarks).
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  unsigned: COMM_HIGH_WATERMARK and/or COMM_LOW_WATERMARK, or 0.
+*
+*******************************************************************************/
+unsigned comm_rx_events()
+{
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    unsigned events = ringbuf_watermark_events(_rxBuffer);
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    return events;
+}
+
+/*******************************************************************************
+* Function Name: comm_tx_events
+********************************************************************************
+* Summary:
+*  Watermark events of the txBuffer since the last call (see
+*  comm_tx_watermarks).
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  unsigned: COMM_HIGH_WATERMARK and/or COMM_LOW_WATERMARK, or 0.
+*
+*******************************************************************************/
+unsigned comm_tx_events()
+{
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    unsigned events = ringbuf_watermark_events(_txBuffer);
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    return events;
+}
+#endif // RINGBUF_WATERMARKS
+
+/*******************************************************************************
+* Function Name: comm_getline
+********************************************************************************
+* Summary:
+*  Read a line from the rxBuffer. A line ends with COMM_LINE_TERMINATOR
+*  (see comm_driver.h).
+*   
+* Parameters:
+*  data: Pointer to an array of uint8 where the bytes read will be copied.
+*        The line terminator will not be copied.
+*
+* Return:
+*  size_t: The number of bytes returned.
+*
+*******************************************************************************/
+size_t comm_getline(uint8 *data)
+{
+    // Exit if 'data' is NULL
+    if(!data)
+        return 0;
+    
+    // Prevent comm interrupts from the scan to the last removal: the RX
+    // overflow policy and the buffer lending move the tail from the ISR
+    uint8 state = comm_lock();
+    
+    // Look for a line terminator in the buffer, exit if not found
+    size_t line_term_offs = ringbuf_findchr(_rxBuffer, COMM_LINE_TERMINATOR, 0);
+    if(line_term_offs == ringbuf_bytes_used(_rxBuffer)) {
+        comm_unlock(state);
+        return 0;
+    }
+    
+    // Extract a line from the FIFO buffer (without the line terminator)
+    ringbuf_memcpy_from(data, _rxBuffer, line_term_offs);
+    
+    // Remove the line terminator from the FIFO buffer
+    ringbuf_remove_from_tail(_rxBuffer, 1);
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    return line_term_offs;
+}
+
+/*******************************************************************************
+* Function Name: comm_putline
+********************************************************************************
+* Summary:
+*  Write a line to the txBuffer. The line terminator COMM_LINE_TERMINATOR
+*  will be appended automatically (see comm_driver.h).
+*   
+* Parameters:
+*  data: Pointer to an array of uint8 containing the line to send.
+*  count: The number of bytes in the array 'data'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_putline(const uint8 *data, size_t count)
+{
+    uint8 state;
+    
+    // Exit if 'data' is NULL or if the line can never fit in the TX buffer
+    if(!data || count <= 0 || count + 1 > TX_GUARANTEED_SIZE)
+        return;
+    
+    // Wait until there's enough room in the TX buffer
+    while(1u) {
+        // Prevent comm interrupts
+        state = comm_lock();
+        
+        // Check if there's enough space free in the TX buffer (or if the
+        // overflow policy made some)
+        TX_RESERVE(count+1);
+        if(TX_MAKE_ROOM(count+1)) break;
+        
+        // Re-enable comm interrupts
+        comm_unlock(state);
+        
+        // Only RINGBUF_BLOCK waits, the line was dropped otherwise
+        if(TX_BUFFER_POLICY != RINGBUF_BLOCK)
+            return;
+    }
+    
+    // Copy the line into the FIFO buffer
+    ringbuf_memcpy_into(_txBuffer, data, count);
+    
+    // Copy the line terminator into the FIFO buffer
+    uint8 line_terminator = COMM_LINE_TERMINATOR;
+    ringbuf_memcpy_into(_txBuffer, &line_terminator, 1);
+    TICK_WAKE();
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+}
+
+#ifdef _COMM_DRIVER_MSG_H
+/*******************************************************************************
+* Function Name: comm_getmsg
+********************************************************************************
+* Summary:
+*  Read a message from the rxBuffer. A message ends with MSG_LAST_BYTE
+*  (see comm_driver_msg.h). It may return '0' if a complete message couldn't
+*  be found in the FIFO buffer.
+*   
+* Parameters:
+*  data: Pointer to an array of uint8 where the bytes read will be copied.
+*        The bytes used to verify the message's integrity will not be copied.
+*
+* Return:
+*  size_t: The number of bytes returned.
+*
+*******************************************************************************/
+size_t comm_getmsg(uint8 *data)
+{
+    // Exit if 'data' is NULL
+    if(!data)
+        return 0;
+    
+    bool message_found = false;
+    uint16 msg_first_byte_offs = 0;
+    uint8 msg_length = 0;
+    uint8 msg_last_byte = 0;
+    
+    // Prevent comm interrupts from the scan to the last removal: the RX
+    // overflow policy and the buffer lending move the tail from the ISR
+    uint8 state = comm_lock();
+    
+    // Find the first complete message in the FIFO buffer, exit if not found
+    while(!message_found) {
+        
+        // Find the first occurence of MSG_FIRST_BYTE, exit if not found
+        msg_first_byte_offs = ringbuf_findchr(_rxBuffer, MSG_FIRST_BYTE, 0);
+        if(msg_first_byte_offs == ringbuf_bytes_used(_rxBuffer)) {
+            comm_unlock(state);
+            return 0;
+        }
+        
+        // Remove all bytes until MSG_FIRST_BYTE if it's not at the begginning
+        // of the FIFO buffer
+        if(msg_first_byte_offs)
+            ringbuf_remove_from_tail(_rxBuffer, msg_first_byte_offs);
+            
+        // Extract the MSG_LENGTH, exit if not found
+        if(ringbuf_bytes_used(_rxBuffer) < MSG_HEADER_LENGTH) {
+            comm_unlock(state);
+            return 0;
+        }
+        msg_length = ringbuf_peek(_rxBuffer, MSG_LENGTH_OFFS_FROM_FIRST_BYTE);
+            
+        // Check if message length is valid (smaller than buffer size)
+        if(msg_length > MSG_MAX_LENGTH) {
+            ringbuf_remove_from_tail(_rxBuffer, 1);
+            comm_unlock(state);
+            return 0;
+        }
+        
+        // Check if MSG_LAST_BYTE is where expected, exit if not enough bytes
+        // in FIFO buffer
+        if(ringbuf_bytes_used(_rxBuffer) < msg_length) {
+            comm_unlock(state);
+            return 0;
+        }
+        msg_last_byte = ringbuf_peek(_rxBuffer, msg_length-1);
+        if(msg_last_byte == MSG_LAST_BYTE)
+            message_found = true;
+            
+        // Remove first byte if message not found and try again
+        if(!message_found)
+            ringbuf_remove_from_tail(_rxBuffer, MSG_LENGTH_OFFS_FROM_FIRST_BYTE);
+    }
+    
+    // Remove message header from the FIFO buffer
+    ringbuf_remove_from_tail(_rxBuffer, MSG_HEADER_LENGTH);
+    
+    // Extract the message from the FIFO buffer (without the header/footer)
+    size_t count = msg_length - MSG_STRUCTURE_LENGTH;
+    ringbuf_memcpy_from(data, _rxBuffer, count);
+    
+    // Remove the message footer from the FIFO buffer
+    ringbuf_remove_from_tail(_rxBuffer, MSG_FOOTER_LENGTH);
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    return count;
+}
+
+/*******************************************************************************
+* Function Name: comm_putmsg
+********************************************************************************
+* Summary:
+*  Write a message to the txBuffer. The message will be padded with the
+*  custom structure found in "comm_driver_msg.h".
+*   
+* Parameters:
+*  data: Pointer to an array of uint8 containing the message to send.
+*  count: The number of bytes in the array 'data'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_putmsg(const uint8 *data, size_t count)
+{
+    uint8 state;
+    
+    // Exit if 'data' is NULL, if the message is too long for MSG_LENGTH or
+    // if it would never fit in the TX buffer
+    if(!data || count <= 0 || count > MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH ||
+       count + MSG_STRUCTURE_LENGTH > TX_GUARANTEED_SIZE)
+        return;
+    
+    uint8 msg_length = count + MSG_STRUCTURE_LENGTH;
+    
+    // Wait until there's enough room in the TX buffer
+    while(1u) {
+        // Prevent comm interrupts
+        state = comm_lock();
+        
+        // Check if there's enough space free in the TX buffer (or if the
+        // overflow policy made some)
+        TX_RESERVE(msg_length);
+        if(TX_MAKE_ROOM(msg_length)) break;
+        
+        // Re-enable comm interrupts
+        comm_unlock(state);
+        
+        // Only RINGBUF_BLOCK waits, the message was dropped otherwise
+        if(TX_BUFFER_POLICY != RINGBUF_BLOCK)
+            return;
+    }
+    
+    // Write the message header into the FIFO buffer
+    uint8 msg_header[MSG_HEADER_LENGTH] = {MSG_FIRST_BYTE, msg_length};
+    ringbuf_memcpy_into(_txBuffer, msg_header, MSG_HEADER_LENGTH);
+    
+    // Copy the message into the FIFO buffer
+    ringbuf_memcpy_into(_txBuffer, data, count);
+    
+    // Write the message footer into the FIFO buffer
+    uint8 msg_footer[MSG_FOOTER_LENGTH] = {MSG_LAST_BYTE};
+    ringbuf_memcpy_into(_txBuffer, msg_footer, MSG_FOOTER_LENGTH);
+    TICK_WAKE();
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+}
+
+#if COMM_URGENT_MESSAGES
+/*******************************************************************************
+* Function Name: comm_urgent_hook
+********************************************************************************
+* Summary:
+*  Register the function handling urgent messages. The comm interrupt calls
+*  'hook' with the payload of every valid message whose ID (first byte of
+*  the payload) verifies (id & id_mask) == id_match, as soon as its last
+*  byte is received. 'hook' runs in interrupt context: it must be short and
+*  must not wait (no comm_put*()). Messages it doesn't consume, and all the
+*  others, go to the rxBuffer as usual.
+*   
+* Parameters:
+*  id_mask: Bits of the message ID compared.
+*  id_match: Expected value of these bits.
+*  hook: Function called with every urgent message (NULL to stop).
+*  context: Pointer passed back to 'hook'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_urgent_hook(uint8 id_mask, uint8 id_match, comm_urgent_t hook, void *context)
+{
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    // Bytes held by the previous filter go to the rxBuffer
+    _urgent_release();
+    
+    _urgentMask = id_mask;
+    _urgentMatch = id_match & id_mask;
+    _urgentHook = hook;
+    _urgentContext = context;
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+}
+#endif // COMM_URGENT_MESSAGES
+#endif // _COMM_DRIVER_MSG_H
+
+#ifdef _COMM_DRIVER_BULK_H
+/*******************************************************************************
+* Function Name: comm_bulk_receive
+********************************************************************************
+* Summary:
+*  Start receiving a bulk transfer (see comm_driver_bulk.h). Until the end of
+*  the transfer, all received bytes bypass the rxBuffer and every valid block
+*  is delivered to 'sink', in order and in interrupt context. Returns
+*  immediately, use comm_bulk_is_active() to know when the transfer is done.
+*   
+* Parameters:
+*  sink: Function called with the content of every valid block.
+*  context: Pointer passed back to 'sink'.
+*
+* Return:
+*  bool: 'false' if 'sink' is NULL or if a bulk transfer is already active.
+*
+*******************************************************************************/
+bool comm_bulk_receive(comm_bulk_sink_t sink, void *context)
+{
+    // Exit if 'sink' is NULL
+    if(!sink)
+        return false;
+    
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    // Exit if a transfer is already active
+    if(_bulkState != BULK_IDLE) {
+        comm_unlock(state);
+        return false;
+    }
+    
+    _bulkSink = sink;
+    _bulkContext = context;
+    _bulkFrameCount = 0;
+    _bulkExpectedSeq = 0;
+    _bulkNakSent = false;
+    _bulkState = BULK_RECEIVING;
+    
+    // Tell the sender we're ready for the first block
+    _bulk_reply(BULK_NAK, 0);
+    TICK_WAKE();
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: comm_bulk_send
+********************************************************************************
+* Summary:
+*  Send a bulk transfer (see comm_driver_bulk.h). Blocks are filled by
+*  'source' and sent until it returns less than BULK_BLOCK_SIZE bytes.
+*  Up to BULK_WINDOW blocks are sent ahead of the acknowledgements. This
+*  function only returns once the last block was acknowledged, or when the
+*  receiver stopped answering.
+*   
+* Parameters:
+*  source: Function filling the next block.
+*  context: Pointer passed back to 'source'.
+*
+* Return:
+*  bool: 'true' if every block was acknowledged.
+*
+*******************************************************************************/
+bool comm_bulk_send(comm_bulk_source_t source, void *context)
+{
+    uint8 base = 0; // Oldest block not acknowledged
+    uint8 next = 0; // Sequence of the next new block
+    uint8 retries = 0;
+    bool last_block_sent = false;
+    bool resend, sending;
+    uint8 state;
+    
+    // Exit if 'source' is NULL
+    if(!source)
+        return false;
+    
+    // Prevent comm interrupts
+    state = comm_lock();
+    
+    // Exit if a transfer is already active
+    if(_bulkState != BULK_IDLE) {
+        comm_unlock(state);
+        return false;
+    }
+    
+    _bulkFrameCount = 0;
+    _bulkAckReceived = false;
+    _bulkNakReceived = false;
+    _bulkTicks = 0;
+    _bulkState = BULK_SENDING;
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    while(!last_block_sent || base != next) {
+        
+        // Fill the window with new blocks
+        while(!last_block_sent && (uint8)(next - base) < BULK_WINDOW) {
+            uint8 *frame = _bulkWindow[next % BULK_WINDOW];
+            uint8 length = source(context, &frame[BULK_HEADER_LENGTH], BULK_BLOCK_SIZE);
+            if(length > BULK_BLOCK_SIZE)
+                length = BULK_BLOCK_SIZE;
+            memset(&frame[BULK_HEADER_LENGTH + length], 0, BULK_BLOCK_SIZE - length);
+            frame[BULK_SEQ_OFFS] = next;
+            frame[BULK_LENGTH_OFFS] = length;
+            uint16 crc = crc16_ccitt(CRC16_INIT, frame, BULK_FRAME_LENGTH - BULK_CRC_LENGTH);
+            frame[BULK_FRAME_LENGTH - 2] = (uint8)(crc >> 8);
+            frame[BULK_FRAME_LENGTH - 1] = (uint8)crc;
+            
+            _bulk_put_frame(frame);
+            last_block_sent = (length < BULK_BLOCK_SIZE);
+            next++;
+        }
+        
+        resend = false;
+        
+        // Prevent comm interrupts
+        state = comm_lock();
+        
+        // An ACK confirms every block up to its sequence
+        if(_bulkAckReceived) {
+            if((uint8)(_bulkAckSeq - base) < (uint8)(next - base)) {
+                base = _bulkAckSeq + 1;
+                retries = 0;
+                _bulkTicks = 0;
+            }
+            _bulkAckReceived = false;
+        }
+        
+        // A NAK confirms every block before its sequence and asks for the rest
+        if(_bulkNakReceived) {
+            if((uint8)(_bulkNakSeq - base) < (uint8)(next - base)) {
+                retries = (_bulkNakSeq == base) ? retries + 1 : 0;
+                base = _bulkNakSeq;
+                resend = true;
+                _bulkTicks = 0;
+            }
+            _bulkNakReceived = false;
+        }
+        
+        // Send the whole window again if the receiver stays silent
+        if(_bulkTicks > BULK_TIMEOUT_TICKS) {
+            resend = true;
+            _bulkTicks = 0;
+            retries++;
+        }
+        
+        // Give up if the same block keeps failing
+        if(retries > BULK_MAX_RETRIES)
+            _bulkState = BULK_IDLE;
+        sending = (_bulkState == BULK_SENDING);
+        
+        // Re-enable comm interrupts
+        comm_unlock(state);
+        
+        // Exit if the transfer failed (or comm_bulk_abort() was called)
+        if(!sending)
+            return false;
+        
+        if(resend) {
+            for(uint8 seq = base; seq != next; seq++)
+                _bulk_put_frame(_bulkWindow[seq % BULK_WINDOW]);
+        }
+    }
+    
+    // Prevent comm interrupts
+    state = comm_lock();
+    
+    _bulkState = BULK_IDLE;
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+    
+    return true;
+}
+
+/*******************************************************************************
+* Function Name: comm_bulk_is_active
+********************************************************************************
+* Summary:
+*  Check if a bulk transfer is in progress.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  bool: 'true' until the last block of a transfer was received or sent.
+*
+*******************************************************************************/
+bool comm_bulk_is_active()
+{
+    return _bulkState != BULK_IDLE;
+}
+
+/*******************************************************************************
+* Function Name: comm_bulk_abort
+********************************************************************************
+* Summary:
+*  Stop the current bulk transfer. Received bytes go back to the rxBuffer.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_bulk_abort()
+{
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+    _bulkState = BULK_IDLE;
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+}
+#endif // _COMM_DRIVER_BULK_H
+
+#if COMM_RECORDER_SIZE
+/*******************************************************************************
+* Function Name: comm_recorder_put
+********************************************************************************
+* Summary:
+*  Add a record to the flight recorder. COMM_LINE_TERMINATOR is appended
+*  to the record, which must not contain it. The oldest records are dropped
+*  to make room. Can be called from interrupts, and during a dump.
+*   
+* Parameters:
+*  data: Pointer to an array of uint8 containing the record.
+*  count: The number of bytes in the array 'data'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void comm_recorder_put(const uint8 *data, size_t count)
+{
+    // Exit if 'data' is NULL or if the record can never fit in the recorder
+    if(!data || count + 1 > COMM_RECORDER_SIZE)
+        return;
+    
+    // Prevent all interrupts, records may come from any of them
+    uint8 state = CyEnterCriticalSection();
+    
+    // Drop the oldest records, keeping track of the position of the oldest byte
+    size_t bytes_used = ringbuf_bytes_used(_recorder);
+    ringbuf_make_room(_recorder, count + 1);
+    _recorderStart += bytes_used - ringbuf_bytes_used(_recorder);
+    
+    // Copy the record and its terminator
+    uint8 line_terminator = COMM_LINE_TERMINATOR;
+    ringbuf_memcpy_into(_recorder, data, count);
+    ringbuf_memcpy_into(_recorder, &line_terminator, 1);
+    
+    // Re-enable interrupts
+    CyExitCriticalSection(state);
+}
+
+/*******************************************************************************
+* Function Name: comm_recorder_dump
+********************************************************************************
+* Summary:
+*  Send the content of the flight recorder, as it is when called, with a
+*  bulk transfer (see comm_bulk_send()). Records can still be added during
+*  the dump; the recorder is only read one block at a time. Records dropped
+*  before they could be sent are skipped (a record cut that way ends early).
+*  The recorder is not emptied.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  bool: 'true' if every block was acknowledged.
+*
+*******************************************************************************/
+bool comm_recorder_dump()
+{
+    // Prevent interrupts
+    uint8 state = CyEnterCriticalSection();
+    
+    _dumpPos = _recorderStart;
+    _dumpEnd = _recorderStart + ringbuf_bytes_used(_recorder);
+    _dumpLastByte = COMM_LINE_TERMINATOR;
+    
+    // Re-enable interrupts
+    CyExitCriticalSection(state);
+    
+    return comm_bulk_send(_recorder_source, NULL);
+}
+#endif // COMM_RECORDER_SIZE
+
+
+/*******************************************************************************
+* PRIVATE FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _init_cdc
+********************************************************************************
+* Summary:
+*  Wait for USBFS enumeration and configure the CDC interface.
+*  This should be called periodically to check if the USBFS configuration
+*  has changed.
+*   
+* Parameters:
+*  first_init: Must only be 'TRUE' right after the call to COMM_Start().
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+#if USE_USBUART
+void _init_cdc(bool first_init)
+{
+    // To do only on first init or if configurations have changed
+    if(first_init || COMM_IsConfigurationChanged()) {
+        
+        // Wait for USBFS to enumerate
+        while (!COMM_GetConfiguration());
+        
+        // Ensure to clear the CHANGE flag
+        COMM_IsConfigurationChanged();
+        
+        // Initialize the CDC feature
+        COMM_CDC_Init();
+    }
+}
+#endif
+
+#if COMM_SHARED_BUFFERS
+/*******************************************************************************
+* Function Name: _reserve
+********************************************************************************
+* Summary:
+*  Make sure a buffer has 'count' bytes free, if possible, by borrowing idle
+*  space from the other buffer (see COMM_SHARED_BUFFERS). Lending moves the
+*  bytes of both buffers: it must be called with the comm lock held, like
+*  every access to the buffers from the application.
+*   
+* Parameters:
+*  rb: The buffer that needs room.
+*  lender: The other buffer.
+*  lender_min: The minimum size of the other buffer.
+*  count: The number of bytes that must be free in 'rb'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _reserve(ringbuf_t rb, ringbuf_t lender, size_t lender_min, size_t count)
+{
+    size_t bytes_free = ringbuf_bytes_free(rb);
+    size_t lender_capacity = ringbuf_capacity(lender);
+    
+    // Nothing to do if there's already enough room or nothing to borrow
+    if(bytes_free >= count || lender_capacity <= lender_min)
+        return;
+    
+    ringbuf_lend(lender, rb, MIN(count - bytes_free, lender_capacity - lender_min));
+}
+#endif
+
+#if COMM_RECORDER_SIZE
+/*******************************************************************************
+* Function Name: _recorder_source
+********************************************************************************
+* Summary:
+*  Fill the next block of a flight recorder dump (see comm_bulk_send()).
+*   
+* Parameters:
+*  context: Unused.
+*  data: Where to copy the block.
+*  max_count: The size of a block.
+*
+* Return:
+*  uint8: The number of bytes copied, less than 'max_count' at the end.
+*
+*******************************************************************************/
+uint8 _recorder_source(void *context, uint8 *data, uint8 max_count)
+{
+    uint8 count = 0;
+    (void)context;
+    
+    // Prevent interrupts
+    uint8 state = CyEnterCriticalSection();
+    
+    // Skip what was dropped since the last block, ending a cut record
+    if((int32)(_recorderStart - _dumpPos) > 0) {
+        if(_dumpLastByte != COMM_LINE_TERMINATOR)
+            data[count++] = COMM_LINE_TERMINATOR;
+        _dumpPos = _recorderStart;
+    }
+    
+    // Copy up to the end of the dump
+    if((int32)(_dumpEnd - _dumpPos) > 0) {
+        uint8 n = MIN(max_count - count, _dumpEnd - _dumpPos);
+        ringbuf_peek_into(&data[count], _recorder, _dumpPos - _recorderStart, n);
+        _dumpPos += n;
+        count += n;
+    }
+    
+    if(count)
+        _dumpLastByte = data[count - 1];
+    
+    // Re-enable interrupts
+    CyExitCriticalSection(state);
+    
+    return count;
+}
+#endif
+
+#ifdef _COMM_DRIVER_BULK_H
+/*******************************************************************************
+* Function Name: _bulk_rx
+********************************************************************************
+* Summary:
+*  Handle bytes received from the COMM block during a bulk transfer.
+*  Assemble blocks when receiving, or acknowledgements when sending.
+*   
+* Parameters:
+*  data: Pointer to the bytes received.
+*  count: The number of bytes in 'data'.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _bulk_rx(const uint8 *data, uint16 count)
+{
+    for(uint16 i=0; i < count; i++) {
+        
+        if(_bulkState == BULK_RECEIVING) {
+            _bulkFrame[_bulkFrameCount++] = data[i];
+            if(_bulkFrameCount == BULK_FRAME_LENGTH)
+                _bulk_rx_block();
+        }
+        
+        else if(_bulkState == BULK_SENDING) {
+            // Wait for the acknowledgement type
+            if(_bulkFrameCount == 0) {
+                if(data[i] == BULK_ACK || data[i] == BULK_NAK)
+                    _bulkFrame[_bulkFrameCount++] = data[i];
+                continue;
+            }
+            
+            // Acknowledgement complete
+            if(_bulkFrame[0] == BULK_ACK) {
+                _bulkAckSeq = data[i];
+                _bulkAckReceived = true;
+            }
+            else {
+                _bulkNakSeq = data[i];
+                _bulkNakReceived = true;
+            }
+            _bulkFrameCount = 0;
+        }
+    }
+}
+
+/*******************************************************************************
+* Function Name: _bulk_rx_block
+********************************************************************************
+* Summary:
+*  Validate the complete block in _bulkFrame, deliver it and acknowledge it.
+*  If the CRC doesn't match, the first byte is dropped so the next block
+*  boundary can be found again.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _bulk_rx_block()
+{
+    uint8 seq = _bulkFrame[BULK_SEQ_OFFS];
+    uint8 length = _bulkFrame[BULK_LENGTH_OFFS];
+    uint16 crc = crc16_ccitt(CRC16_INIT, _bulkFrame, BULK_FRAME_LENGTH - BULK_CRC_LENGTH);
+    
+    // Check the integrity of the block, resynchronize if invalid
+    if(length > BULK_BLOCK_SIZE
+       || _bulkFrame[BULK_FRAME_LENGTH - 2] != (uint8)(crc >> 8)
+       || _bulkFrame[BULK_FRAME_LENGTH - 1] != (uint8)crc) {
+        memmove(_bulkFrame, &_bulkFrame[1], BULK_FRAME_LENGTH - 1);
+        _bulkFrameCount--;
+        if(!_bulkNakSent) {
+            _bulk_reply(BULK_NAK, _bulkExpectedSeq);
+            _bulkNakSent = true;
+        }
+        return;
+    }
+    _bulkFrameCount = 0;
+    
+    // Acknowledge again a block already delivered (our ACK was lost)
+    if((uint8)(_bulkExpectedSeq - seq) <= BULK_WINDOW && seq != _bulkExpectedSeq) {
+        _bulk_reply(BULK_ACK, _bulkExpectedSeq - 1);
+        return;
+    }
+    
+    // Ask for the missing block (only once, the sender resends the window)
+    if(seq != _bulkExpectedSeq) {
+        if(!_bulkNakSent) {
+            _bulk_reply(BULK_NAK, _bulkExpectedSeq);
+            _bulkNakSent = true;
+        }
+        return;
+    }
+    
+    // Deliver the block
+    _bulkSink(_bulkContext, &_bulkFrame[BULK_HEADER_LENGTH], length);
+    _bulk_reply(BULK_ACK, seq);
+    _bulkExpectedSeq++;
+    _bulkNakSent = false;
+    
+    // A short block ends the transfer
+    if(length < BULK_BLOCK_SIZE)
+        _bulkState = BULK_IDLE;
+}
+
+/*******************************************************************************
+* Function Name: _bulk_reply
+********************************************************************************
+* Summary:
+*  Prepare an acknowledgement that will be sent by the TX interrupt. Only the
+*  latest acknowledgement is kept since they are cumulative.
+*   
+* Parameters:
+*  type: BULK_ACK or BULK_NAK.
+*  seq: Sequence of the block acknowledged.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _bulk_reply(uint8 type, uint8 seq)
+{
+    _bulkReply[0] = type;
+    _bulkReply[1] = seq;
+    _bulkReplyPending = true;
+}
+
+/*******************************************************************************
+* Function Name: _bulk_put_frame
+********************************************************************************
+* Summary:
+*  Write a complete bulk block to the txBuffer.
+*   
+* Parameters:
+*  frame: Pointer to BULK_FRAME_LENGTH bytes.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _bulk_put_frame(const uint8 *frame)
+{
+    uint8 state;
+    
+    // Wait until there's enough room in the TX buffer
+    while(1u) {
+        // Prevent comm interrupts
+        state = comm_lock();
+        
+        // Check if there's enough space free in the TX buffer
+        TX_RESERVE(BULK_FRAME_LENGTH);
+        if(ringbuf_bytes_free(_txBuffer) >= BULK_FRAME_LENGTH) break;
+        
+        // Re-enable comm interrupts
+        comm_unlock(state);
+    }
+    
+    // Copy the block into the FIFO buffer
+    ringbuf_memcpy_into(_txBuffer, frame, BULK_FRAME_LENGTH);
+    TICK_WAKE();
+    
+    // Re-enable comm interrupts
+    comm_unlock(state);
+}
+#endif // _COMM_DRIVER_BULK_H
+
+#if COMM_ADAPTIVE_TICK
+/*******************************************************************************
+* Function Name: _tick_wake
+********************************************************************************
+* Summary:
+*  Bring the comm interrupt back to COMM_INTERRUPT_FREQ, the next interrupt
+*  coming one full-speed period from now. Must be called with interrupts
+*  disabled.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _tick_wake()
+{
+    _tickIdle = 0;
+    if (_tickReload == COMM_INT_NB_TICKS)
+        return;
+    
+    _tickReload = COMM_INT_NB_TICKS;
+    SysTick->LOAD = COMM_INT_NB_TICKS - 1u;
+    
+    // Restart the count, the slow period may have just begun
+    SysTick->VAL = 0u;
+}
+
+/*******************************************************************************
+* Function Name: _tick_adapt
+********************************************************************************
+* Summary:
+*  Called at the end of every comm interrupt. Halves the frequency after
+*  COMM_IDLE_TICKS idle interrupts (down to COMM_INTERRUPT_MIN_FREQ), goes
+*  back to full speed as soon as there's something to do.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _tick_adapt()
+{
+    // Busy if bytes were moved or are waiting to be sent
+    bool busy = _tickActive || !ringbuf_is_empty(_txBuffer);
+#if USE_USBUART
+    busy = busy || _txZlpRequired;
+#endif
+#ifdef _COMM_DRIVER_BULK_H
+    // Bulk timeouts are counted in interrupts
+    busy = busy || _bulkState != BULK_IDLE || _bulkReplyPending;
+#endif
+    _tickActive = false;
+    
+    if (busy) {
+        _tick_wake();
+        return;
+    }
+    
+    // Slow down after enough idle interrupts
+    if (++_tickIdle < COMM_IDLE_TICKS || _tickReload >= COMM_INT_MAX_NB_TICKS)
+        return;
+    _tickIdle = 0;
+    _tickReload = MIN(2u * _tickReload, COMM_INT_MAX_NB_TICKS);
+    
+    // Applied from the next period on
+    SysTick->LOAD = _tickReload - 1u;
+}
+#endif // COMM_ADAPTIVE_TICK
+
+#if COMM_ISR_BUDGET
+/*******************************************************************************
+* Function Name: _budget_take
+********************************************************************************
+* Summary:
+*  Take up to 'count' bytes from the budget of the current comm interrupt.
+*  Counts the interrupt in _byteBudgetHits or _cycleBudgetHits the first time
+*  its budget falls short.
+*   
+* Parameters:
+*  count: The number of bytes the caller would like to move.
+*
+* Return:
+*  uint32: The number of bytes it may move (0 once the budget is spent).
+*
+*******************************************************************************/
+uint32 _budget_take(uint32 count)
+{
+    if (!count)
+        return 0;
+    
+#if COMM_ISR_CYCLE_BUDGET
+    // SysTick counts down from the reload value it had when the interrupt
+    // started. If the period changed since (COMM_ADAPTIVE_TICK), the count
+    // restarted and tells nothing: only the byte budget is left.
+    if (SysTick->LOAD == _budgetLoad &&
+        _budgetLoad - SysTick->VAL >= COMM_ISR_CYCLE_BUDGET) {
+        if (!_budgetHit)
+            _cycleBudgetHits++;
+        _budgetHit = true;
+        return 0;
+    }
+#endif
+    
+    if (count > _budgetBytes) {
+        if (!_budgetHit)
+            _byteBudgetHits++;
+        _budgetHit = true;
+        count = _budgetBytes;
+    }
+    _budgetBytes -= count;
+    
+    return count;
+}
+#endif // COMM_ISR_BUDGET
+
+#if COMM_URGENT_MESSAGES
+/*******************************************************************************
+* Function Name: _urgent_rx
+********************************************************************************
+* Summary:
+*  Copy received bytes into the rxBuffer, except the urgent messages consumed
+*  by _urgentHook. The header of every message is held until its ID is
+*  known, and urgent messages until their last byte. The bytes of other
+*  messages are copied as they come. Must be called with comm interrupts
+*  disabled.
+*   
+* Parameters:
+*  data: Pointer to the bytes received.
+*  count: The number of bytes received.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _urgent_rx(const uint8 *data, uint16 count)
+{
+    // Nothing to filter
+    if (!_urgentHook) {
+        ringbuf_memcpy_into(_rxBuffer, data, count);
+        return;
+    }
+    
+    while (count) {
+        uint16 n = count;
+        
+        switch (_urgentState) {
+        case URGENT_IDLE: {
+            // Copy everything up to the next MSG_FIRST_BYTE
+            const uint8 *first = memchr(data, MSG_FIRST_BYTE, count);
+            if (first) {
+                n = (uint16)(first - data);
+                _urgentState = URGENT_HEADER;
+            }
+            ringbuf_memcpy_into(_rxBuffer, data, n);
+            break;
+        }
+        
+        case URGENT_SKIP:
+            // Copy the rest of a message that isn't urgent
+            n = MIN(count, _urgentSkip);
+            ringbuf_memcpy_into(_rxBuffer, data, n);
+            _urgentSkip -= n;
+            if (!_urgentSkip)
+                _urgentState = URGENT_IDLE;
+            break;
+        
+        default: {
+            // Hold the next byte
+            n = 1;
+            _urgentFrame[_urgentCount++] = *data;
+            uint8 msg_length = _urgentFrame[MSG_LENGTH_OFFS_FROM_FIRST_BYTE];
+            
+            // Invalid length, the bytes go to the rxBuffer
+            if (_urgentCount == MSG_HEADER_LENGTH &&
+                (msg_length <= MSG_STRUCTURE_LENGTH || msg_length > MSG_MAX_LENGTH)) {
+                _urgent_release();
+            }
+            
+            // Once the ID is known, hold urgent messages, let others through
+            else if (_urgentState == URGENT_HEADER && _urgentCount > MSG_HEADER_LENGTH) {
+                if ((_urgentFrame[MSG_HEADER_LENGTH] & _urgentMask) == _urgentMatch) {
+                    _urgentState = URGENT_MESSAGE;
+                }
+                else {
+                    _urgentSkip = msg_length - _urgentCount;
+                    _urgent_release();
+                    if (_urgentSkip)
+                        _urgentState = URGENT_SKIP;
+                }
+            }
+            
+            // Whole urgent message
+            else if (_urgentState == URGENT_MESSAGE && _urgentCount == msg_length) {
+                if (_urgentFrame[msg_length-1] == MSG_LAST_BYTE &&
+                    _urgentHook(_urgentContext, &_urgentFrame[MSG_HEADER_LENGTH],
+                                msg_length - MSG_STRUCTURE_LENGTH)) {
+                    _urgentCount = 0;
+                    _urgentState = URGENT_IDLE;
+                }
+                else {
+                    _urgent_release();
+                }
+            }
+            break;
+        }
+        }
+        
+        data += n;
+        count -= n;
+    }
+}
+
+/*******************************************************************************
+* Function Name: _urgent_release
+********************************************************************************
+* Summary:
+*  Copy the bytes held by the urgent message filter into the rxBuffer and
+*  look for the next message. Must be called with comm interrupts disabled.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _urgent_release()
+{
+    ringbuf_memcpy_into(_rxBuffer, _urgentFrame, _urgentCount);
+    _urgentCount = 0;
+    _urgentState = URGENT_IDLE;
+}
+#endif // COMM_URGENT_MESSAGES
+
+/*******************************************************************************
+* Function Name: _comm_rx_isr
+********************************************************************************
+* Summary:
+*  Copy all available bytes from COMM block into the RX FIFO buffer.
+*   
+* Parameters:
+*  None.
+*
+* Return:
+*  None.
+*
+*******************************************************************************/
+void _comm_rx_isr()
+{
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+#if USE_USBUART
+    uint16 count = 0;
+    
+    // Check if USBFS configuration has changed
+    _init_cdc(false);
+    
+    // Check if USBUART has data available
+    if (COMM_DataIsReady()) {
+        
+#if COMM_ISR_BUDGET
+        // Leave the packet in the COMM block if this interrupt has no budget
+        // left (a packet is always received whole)
+        if (COMM_GetCount() && !_budget_take(COMM_GetCount())) {
+            TICK_ACTIVE();
+            comm_unlock(state);
+            return;
+        }
+#endif
+        
+#ifdef _COMM_DRIVER_BULK_H
+        // Bulk transfers bypass the FIFO buffer
+        if (_bulkState != BULK_IDLE) {
+            count = COMM_GetAll(_tempBuffer);
+            _bulk_rx(_tempBuffer, count);
+            TICK_ACTIVE();
+            comm_unlock(state);
+            return;
         }
+#endif
+        
+        // Check that the FIFO buffer has enough free space to receive 
+        // all available bytes from COMM block, unless the overflow policy
+        // doesn't wait for room (with the bytes held by the urgent message
+        // filter)
+        RX_RESERVE(COMM_GetCount() + RX_HELD);
+        if (RX_BUFFER_POLICY != RINGBUF_BLOCK ||
+            COMM_GetCount() + RX_HELD <= ringbuf_bytes_free(_rxBuffer)) {
+            
+            // Copy available bytes into the FIFO buffer
+            count = COMM_GetAll(_tempBuffer);
+            RX_PUT(_tempBuffer, count);
+        }
+        TICK_ACTIVE();
     }
 #elif USE_UART
     uint32 available_bytes = COMM_SpiUartGetRxBufferSize();
     uint32 byte_read_32 = 0;
     uint8 byte_read_8;
     
-    // Check that the FIFO buffer has enough free space to receive 
-    // all available bytes from COMM
-    if (available_bytes <= ringbuf_bytes_free(_rxBuffer)) {
-        
-        // Copy available bytes into the FIFO buffer
-        for(uint32 i=0; i < available_bytes; i++) {
+    if (available_bytes)
+        TICK_ACTIVE();
+    
+#ifdef _COMM_DRIVER_BULK_H
+    // Bulk transfers bypass the FIFO buffer (and may contain null bytes)
+    if (_bulkState != BULK_IDLE) {
+        uint32 n;
+        while((n = BUDGET(MIN(available_bytes, UART_BATCH_SIZE))) != 0) {
+            for(uint32 i=0; i < n; i++) {
+                byte_read_8 = (uint8)(COMM_SpiUartReadRxData() & 0xFF);
+                _bulk_rx(&byte_read_8, 1);
+            }
+            available_bytes -= n;
+        }
+        comm_unlock(state);
+        return;
+    }
+#endif
+    
+    // Only read the bytes the FIFO buffer has room for, with the bytes held
+    // by the urgent message filter, unless the overflow policy doesn't wait
+    // for room. Unlike a USB packet, the rest can stay in COMM: waiting for
+    // room for everything COMM holds could wait forever behind a held
+    // message.
+    RX_RESERVE(available_bytes + RX_HELD);
+    if (RX_BUFFER_POLICY == RINGBUF_BLOCK) {
+        uint32 bytes_free = ringbuf_bytes_free(_rxBuffer);
+        available_bytes = bytes_free > RX_HELD ? MIN(available_bytes, bytes_free - RX_HELD) : 0;
+    }
+    
+    // Copy available bytes into the FIFO buffer, in batches within the
+    // budget of this interrupt
+    uint32 n;
+    while((n = BUDGET(MIN(available_bytes, UART_BATCH_SIZE))) != 0) {
+        for(uint32 i=0; i < n; i++) {
             byte_read_32 = COMM_SpiUartReadRxData();
             if(byte_read_32 == 0)
                 continue;
             byte_read_8 = (uint8)(byte_read_32 & 0xFF);
-            ringbuf_memcpy_into(_rxBuffer, &byte_read_8, 1);
+#if COMM_URGENT_MESSAGES
+            _urgent_rx(&byte_read_8, 1);
+#else
+            if(!ringbuf_putc(_rxBuffer, byte_read_8))
+                ringbuf_memcpy_into(_rxBuffer, &byte_read_8, 1);
+#endif
         }
+        available_bytes -= n;
     }
 #endif
     
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
+    // Re-enable comm interrupts
+    comm_unlock(state);
 }
 
 /*******************************************************************************
@@ -562,8 +2028,20 @@ void _comm_tx_isr()
 {
     uint16 count = 0;
     
-    // Prevent interrupts
-    uint8 state = CyEnterCriticalSection();
+    // Prevent comm interrupts
+    uint8 state = comm_lock();
+    
+#ifdef _COMM_DRIVER_BULK_H
+    // Queue the latest bulk acknowledgement
+    if (_bulkReplyPending && ringbuf_bytes_free(_txBuffer) >= BULK_ACK_LENGTH) {
+        ringbuf_memcpy_into(_txBuffer, _bulkReply, BULK_ACK_LENGTH);
+        _bulkReplyPending = false;
+    }
+    
+    // Used by the sender to detect a silent receiver
+    if (_bulkState == BULK_SENDING)
+        _bulkTicks++;
+#endif
     
 #if USE_USBUART
     // Check if there's anything in the TX FIFO buffer or if a Zero Length
@@ -580,9 +2058,18 @@ void _comm_tx_isr()
             // Can't send more than COMM_TX_MAX_PACKET_SIZE bytes
             count = MIN(ringbuf_bytes_used(_txBuffer), COMM_TX_MAX_PACKET_SIZE);
             
+#if COMM_ISR_BUDGET
+            // Nor more than the budget left to this interrupt
+            if (count && !(count = _budget_take(count))) {
+                comm_unlock(state);
+                return;
+            }
+#endif
+            
             // Send packet
             ringbuf_memcpy_from(_tempBuffer, _txBuffer, count);
             COMM_PutData(_tempBuffer, count);
+            TICK_ACTIVE();
             
             // Clear the buffer
             _txZlpRequired = (count == COMM_TX_MAX_PACKET_SIZE);
@@ -613,9 +2100,18 @@ void _comm_tx_isr()
             // Can't send more than COMM_TX_MAX_PACKET_SIZE bytes
             count = MIN(ringbuf_bytes_used(_txBuffer), COMM_TX_MAX_PACKET_SIZE);
             
+#if COMM_ISR_BUDGET
+            // Nor more than the budget left to this interrupt
+            if (count && !(count = _budget_take(count))) {
+                comm_unlock(state);
+                return;
+            }
+#endif
+            
             // Send packet
             ringbuf_memcpy_from(_tempBuffer, _txBuffer, count);
             COMM_SpiUartPutArray(_tempBuffer, count);
+            TICK_ACTIVE();
         }
         
         // Expect next time
@@ -624,8 +2120,8 @@ void _comm_tx_isr()
     }
 #endif
 
-    // Re-enable interrupts
-    CyExitCriticalSection(state);
+    // Re-enable comm interrupts
+    comm_unlock(state);
 }
 
 /* [] END OF FILE */
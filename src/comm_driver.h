@@ -36,8 +36,11 @@
 *  hold more than the 64 bytes allowed by USBUART.
 * 
 * Required files (see References):
+*  comm_lock.h
 *  ringbuf.h
 *  ringbuf.c
+*  crc16.h (only with bulk transfers)
+*  crc16.c (only with bulk transfers)
 *
 * Required components in TopDesign:
 *  1 x USBUART or UART (named 'COMM')
@@ -83,6 +86,14 @@
 *  Otherwise, you can comment the line mentionned previously and it will
 *  deactivate all the functions related to custom messages.
 *
+* Bulk transfers:
+*  Large transfers (calibration uploads, log downloads, etc.) can bypass the
+*  FIFO buffers and the custom message structure. Blocks are validated with
+*  a CRC and acknowledged by the receiver (see "comm_driver_bulk.h" and
+*  host/comm_bulk.c). They are disabled by default: add crc16.c and crc16.h
+*  to your project and uncomment this line to activate them:
+*    #include "comm_driver_bulk.h"
+*
 * References:
 *  https://github.com/noritan/Design307
 *  https://github.com/dhess/c-ringbuf
@@ -92,6 +103,18 @@
 * Revisions:
 *  1.0: First.
 *  1.1: Bug fix: First TX sent garbage.
+*  1.2: Bulk block-transfer mode.
+*  1.3: Raw comm_read()/comm_write(), size_t counts, inline single-byte
+*       ring buffer accesses.
+*  1.4: Optional shared RX/TX memory (COMM_SHARED_BUFFERS).
+*  1.5: Overflow policy per buffer, with drop counters.
+*  1.6: Flight recorder dumped through bulk transfers.
+*  1.7: Watermark notifications on RX and TX buffers.
+*  1.8: Optional adaptive interrupt frequency (COMM_ADAPTIVE_TICK).
+*  1.9: Optional work budget per comm interrupt.
+*  1.10: Only the comm interrupt is masked while accessing the buffers
+*        (comm_lock.h).
+*  1.11: Optional urgent messages handled in the comm interrupt.
 *
 *******************************************************************************/
 
@@ -101,7 +124,9 @@
 #include <project.h>
 #include <sys/param.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "comm_driver_msg.h"
+//#include "comm_driver_bulk.h"
 
 /*******************************************************************************
 * MACROS
@@ -118,12 +143,92 @@
 // The number of ticks (SysClk / COMM_INTERRUPT_FREQ) must fit in a 24-bits register.
 #define COMM_INTERRUPT_FREQ (2000u)
 
+// Adaptive interrupt frequency
+// With '1', COMM_INTERRUPT_FREQ is the highest frequency: after COMM_IDLE_TICKS
+// interrupts in a row with nothing received nor to send, the frequency is
+// halved, down to COMM_INTERRUPT_MIN_FREQ. A byte received or queued for
+// sending brings it back to COMM_INTERRUPT_FREQ right away. While the
+// interrupt is slow, bytes sent by the host wait up to 1/COMM_INTERRUPT_MIN_FREQ
+// before being received.
+#define COMM_ADAPTIVE_TICK 0
+#define COMM_INTERRUPT_MIN_FREQ (250u)
+#define COMM_IDLE_TICKS (20u)
+
+// Work budget of each comm interrupt (0 for no limit)
+// The comm interrupt holds the comm lock while it moves bytes: only the comm
+// interrupt (and, on PSoC 5LP, those of the same or lower priority) is masked,
+// or all interrupts with COMM_LOCK_ALL_INTERRUPTS. It stops moving bytes once
+// it has moved COMM_ISR_BYTE_BUDGET bytes, or once COMM_ISR_CYCLE_BUDGET
+// SysTick clock ticks have elapsed since it started, and resumes on the next
+// interrupt. This bounds the time these interrupts are delayed whatever the
+// traffic (with UART, whatever the depth of its FIFOs), at the cost of
+// throughput if the budget is too small. The cycle budget is checked between batches of
+// bytes (a USB packet, or up to 16 bytes of UART), and a received USB packet
+// is always moved whole. If the interrupt period changes while it runs
+// (COMM_ADAPTIVE_TICK), only the byte budget applies until it returns.
+#define COMM_ISR_BYTE_BUDGET (0u)
+#define COMM_ISR_CYCLE_BUDGET (0u)
+
 // Size of the buffers
 // Memory allocated will be larger by one byte.
 // Make sure the Heap is large enough.
 #define RX_BUFFER_SIZE (128u)  
 #define TX_BUFFER_SIZE (128u)
 
+// Shared RX/TX memory
+// With '1', RX and TX use a single block of RX_BUFFER_SIZE + TX_BUFFER_SIZE
+// bytes and lend each other their idle space at run time (a TX burst can use
+// the RX space while the host is quiet, and vice versa). Each buffer keeps at
+// least its minimum size. Lines and messages must fit in TX_BUFFER_MIN_SIZE.
+#define COMM_SHARED_BUFFERS 0
+#define RX_BUFFER_MIN_SIZE (64u)
+#define TX_BUFFER_MIN_SIZE (100u)
+
+// What happens when a buffer is full (see ringbuf.h)
+//  RINGBUF_BLOCK: RX leaves the bytes in the COMM block until there's room,
+//                 comm_put*() wait for room.
+//  RINGBUF_DROP_NEWEST: a write that doesn't fit is discarded whole: a USB
+//                       packet or a UART byte on RX, a whole line, message
+//                       or comm_write() on TX.
+//  RINGBUF_DROP_OLDEST: the oldest bytes are discarded to make room (the
+//                       oldest line or message may then be cut).
+//  RINGBUF_DROP_RECORD: the oldest whole lines or messages (ending with
+//                       COMM_LINE_TERMINATOR) are discarded to make room.
+// Dropped bytes are counted (see comm_rx_dropped() and comm_tx_dropped()).
+// Bulk transfers always wait for room. Ring buffers built with
+// RINGBUF_POLICIES set to 0 (ringbuf.h) only allow RINGBUF_BLOCK and
+// RINGBUF_DROP_OLDEST, and don't count dropped bytes.
+#define RX_BUFFER_POLICY RINGBUF_BLOCK
+#define TX_BUFFER_POLICY RINGBUF_BLOCK
+
+// Size of the flight recorder (0 to disable it)
+// The latest records passed to comm_recorder_put() are kept in RAM, the oldest
+// ones being dropped whole, and are sent only when comm_recorder_dump() is
+// called (as a bulk transfer, see comm_driver_bulk.h).
+#define COMM_RECORDER_SIZE (0u)
+
+// Watermark events (see comm_rx_watermarks() and comm_tx_watermarks())
+#define COMM_HIGH_WATERMARK (1u)
+#define COMM_LOW_WATERMARK (2u)
+
+// Interrupts masked while the driver accesses its buffers (see comm_lock.h)
+// With '0', only the comm interrupt is masked and the others keep running
+// (on PSoC 5LP, those of the same or lower priority than
+// COMM_INTERRUPT_PRIORITY are masked too, so give a higher priority, lower
+// number, to the interrupts that must not be delayed). With '1', all
+// interrupts are disabled (CyEnterCriticalSection()).
+#define COMM_LOCK_ALL_INTERRUPTS 0
+#define COMM_INTERRUPT_PRIORITY (7u)
+
+// Urgent messages (custom messages only)
+// With '1', comm_urgent_hook() registers a function that the comm interrupt
+// calls as soon as a message with a matching ID (its first byte after the
+// header) is received, without waiting for comm_getmsg(). The incoming
+// message is held until its last byte, so with RINGBUF_BLOCK on RX,
+// RX_BUFFER_SIZE must be at least MSG_MAX_LENGTH + 64 bytes with USBUART
+// (a packet is received whole), MSG_MAX_LENGTH bytes with UART.
+#define COMM_URGENT_MESSAGES 0
+
 // Index of the USBUART component
 // Shouldn't be changed unless you have more than one USBFS component.
 #define USBFS_DEVICE (0u)
@@ -131,6 +236,28 @@
 // Terminator of a line of data (limited to a single character)
 #define COMM_LINE_TERMINATOR ((uint8)'\n')
 
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+// Receives watermark events, from the comm interrupt (when it fills the RX
+// buffer or empties the TX buffer) or the application (the other way
+// around), always with the comm lock held (see comm_lock.h)
+typedef void (*comm_watermark_t)(void *context, unsigned event);
+
+#ifdef _COMM_DRIVER_MSG_H
+// Handles an urgent message payload (called in interrupt context), returning
+// 'true' consumes the message, 'false' lets it through to comm_getmsg()
+typedef bool (*comm_urgent_t)(void *context, const uint8 *data, size_t count);
+#endif // _COMM_DRIVER_MSG_H
+
+#ifdef _COMM_DRIVER_BULK_H
+// Receives the content of every valid bulk block (called in interrupt context)
+typedef void (*comm_bulk_sink_t)(void *context, const uint8 *data, uint8 count);
+
+// Fills the next bulk block, returning less than 'max_count' ends the transfer
+typedef uint8 (*comm_bulk_source_t)(void *context, uint8 *data, uint8 max_count);
+#endif // _COMM_DRIVER_BULK_H
+
 /*******************************************************************************
 * PUBLIC PROTOTYPES
 *******************************************************************************/
@@ -138,18 +265,58 @@
 void comm_init();
 
 // Single character
-uint8 comm_getch(uint8 *data);
-void comm_putch(uint8 *data);
+size_t comm_getch(uint8 *data);
+void comm_putch(const uint8 *data);
+
+// Raw bytes
+size_t comm_read(uint8 *data, size_t max_count);
+void comm_write(const uint8 *data, size_t count);
+
+// Current frequency of the comm interrupts (Hz)
+uint32 comm_tick_freq();
+
+// Comm interrupts that stopped on their byte or cycle budget
+uint32 comm_byte_budget_hits();
+uint32 comm_cycle_budget_hits();
+
+// Overflow accounting
+size_t comm_rx_dropped();
+size_t comm_tx_dropped();
+
+// Watermarks (not with ring buffers built with RINGBUF_WATERMARKS set to 0)
+#if !defined(RINGBUF_WATERMARKS) || RINGBUF_WATERMARKS
+void comm_rx_watermarks(size_t low, size_t high, comm_watermark_t callback, void *context);
+void comm_tx_watermarks(size_t low, size_t high, comm_watermark_t callback, void *context);
+unsigned comm_rx_events();
+unsigned comm_tx_events();
+#endif
 
 // Line
-uint8 comm_getline(uint8 *data);
-void comm_putline(uint8 *data, uint8 count);
+size_t comm_getline(uint8 *data);
+void comm_putline(const uint8 *data, size_t count);
 
 // Custom messages
 #ifdef _COMM_DRIVER_MSG_H
-uint8 comm_getmsg(uint8 *data);
-void comm_putmsg(uint8 *data, uint8 count);
+size_t comm_getmsg(uint8 *data);
+void comm_putmsg(const uint8 *data, size_t count);
+#if COMM_URGENT_MESSAGES
+void comm_urgent_hook(uint8 id_mask, uint8 id_match, comm_urgent_t hook, void *context);
+#endif
 #endif // _COMM_DRIVER_MSG_H
 
+// Bulk transfers
+#ifdef _COMM_DRIVER_BULK_H
+bool comm_bulk_receive(comm_bulk_sink_t sink, void *context);
+bool comm_bulk_send(comm_bulk_source_t source, void *context);
+bool comm_bulk_is_active();
+void comm_bulk_abort();
+#endif // _COMM_DRIVER_BULK_H
+
+// Flight recorder
+#if COMM_RECORDER_SIZE
+void comm_recorder_put(const uint8 *data, size_t count);
+bool comm_recorder_dump();
+#endif
+
 #endif // _COMM_DRIVER_H
 /* [] END OF FILE */
@@ -0,0 +1,547 @@
+/*******************************************************************************
+*
+* Header-only C++ communication driver.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  C++ counterpart of comm_driver.c, as a class template:
+*
+*    comm::Comm<Transport, RxSize, TxSize, Framing, InterruptFreq>
+*
+*  Transport is comm::UsbUart or comm::Uart (the component named COMM, as
+*  selected by USE_USBUART/USE_UART in comm_driver.h), the sizes are those of
+*  the RX/TX rings and Framing holds the line terminator and the custom
+*  message structure (comm_driver_msg.h by default). Everything is resolved
+*  at compile time: the rings are static arrays (no heap), their size is a
+*  constant and there is no virtual call. Invalid configurations (frames
+*  that can't fit the rings, SysTick reload out of range, ...) are rejected
+*  with static_assert.
+*
+*  The functions mirror comm_getch/getline/getmsg/put*, plus std::string_view
+*  and std::span (C++20) overloads. Only one driver can own the SysTick
+*  interrupt: don't build comm_driver.c with it. Bulk transfers are only
+*  available in the C driver.
+*
+*  Example:
+*    using Link = comm::Comm<comm::UsbUart, 128, 256>;
+*
+*    Link::init();
+*    Link::putline("ready");
+*    uint8_t msg[Link::max_payload];
+*    if(size_t count = Link::getmsg(msg)) { ... }
+*
+*******************************************************************************/
+
+#ifndef _COMM_DRIVER_HPP
+#define _COMM_DRIVER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+    #include <span>
+    #define COMM_HAVE_SPAN 1
+#endif
+
+extern "C" {
+#include "comm_driver.h"
+}
+
+namespace comm {
+
+/*******************************************************************************
+* PLATFORM
+*******************************************************************************/
+struct Platform
+{
+#if CY_PSOC5LP
+    static constexpr uint32_t clock_hz = BCLK__BUS_CLK__HZ;
+    static constexpr int systick_irq = CY_INT_SYSTICK_IRQN;
+#elif CY_PSOC4
+    static constexpr uint32_t clock_hz = CYDEV_BCLK__SYSCLK__HZ;
+    static constexpr int systick_irq = SysTick_IRQn + 16;
+#endif
+
+    static uint8 lock() { return CyEnterCriticalSection(); }
+    static void unlock(uint8 state) { CyExitCriticalSection(state); }
+
+    static void start_tick(cyisraddress isr, uint32_t ticks)
+    {
+        CyIntSetSysVector(systick_irq, isr);
+        SysTick_Config(ticks);
+        NVIC_EnableIRQ(systick_irq);
+        CyGlobalIntEnable;
+    }
+};
+
+/*******************************************************************************
+* TRANSPORTS
+*******************************************************************************/
+#if USE_USBUART
+struct UsbUart
+{
+    static constexpr std::size_t packet_size = 64u;
+    static constexpr bool needs_zlp = true; // Full packets need a zero-length packet
+    static constexpr uint8_t max_reject = 8u; // Ticks before unsent data is dropped
+
+    static void start()
+    {
+        COMM_Start(USBFS_DEVICE, COMM_5V_OPERATION);
+        configure(true);
+    }
+
+    // Wait for USBFS enumeration and (re)configure CDC if needed
+    static void configure(bool first = false)
+    {
+        if(first || COMM_IsConfigurationChanged()) {
+            while(!COMM_GetConfiguration());
+            COMM_IsConfigurationChanged();
+            COMM_CDC_Init();
+        }
+    }
+
+    static std::size_t rx_available() { return COMM_DataIsReady() ? COMM_GetCount() : 0u; }
+
+    // Read 'count' bytes (what rx_available() returned), returns the bytes kept
+    static std::size_t read(uint8_t *data, std::size_t count)
+    {
+        (void)count;
+        return COMM_GetAll(data);
+    }
+
+    static bool tx_ready() { return COMM_CDCIsReady(); }
+    static void write(const uint8_t *data, std::size_t count) { COMM_PutData(data, (uint16)count); }
+};
+using DefaultTransport = UsbUart;
+#endif // USE_USBUART
+
+#if USE_UART
+struct Uart
+{
+    static constexpr std::size_t packet_size = COMM_UART_TX_BUFFER_SIZE;
+    static constexpr bool needs_zlp = false;
+    static constexpr uint8_t max_reject = 0u;
+
+    static void start()
+    {
+        COMM_Start();
+        COMM_SpiUartClearRxBuffer();
+        COMM_SpiUartClearTxBuffer();
+    }
+
+    static void configure(bool first = false) { (void)first; }
+
+    static std::size_t rx_available() { return COMM_SpiUartGetRxBufferSize(); }
+
+    // Null bytes (an empty RX FIFO) are dropped, like comm_driver.c
+    static std::size_t read(uint8_t *data, std::size_t count)
+    {
+        std::size_t kept = 0;
+        for(std::size_t i = 0; i < count; i++) {
+            uint32 byte = COMM_SpiUartReadRxData();
+            if(byte)
+                data[kept++] = (uint8_t)(byte & 0xFF);
+        }
+        return kept;
+    }
+
+    static bool tx_ready() { return COMM_SpiUartGetTxBufferSize() == 0; }
+    static void write(const uint8_t *data, std::size_t count) { COMM_SpiUartPutArray(data, (uint32)count); }
+};
+#if !USE_USBUART
+using DefaultTransport = Uart;
+#endif
+#endif // USE_UART
+
+#if !USE_USBUART && !USE_UART
+struct NoTransport; // Pass your own transport to Comm
+using DefaultTransport = NoTransport;
+#endif
+
+/*******************************************************************************
+* FRAMING
+*******************************************************************************/
+template<uint8_t LineTerminator = COMM_LINE_TERMINATOR,
+         uint8_t FirstByte = MSG_FIRST_BYTE,
+         uint8_t LastByte = MSG_LAST_BYTE,
+         uint8_t MaxLength = MSG_MAX_LENGTH>
+struct Framing
+{
+    static constexpr uint8_t line_terminator = LineTerminator;
+    static constexpr uint8_t first_byte = FirstByte;
+    static constexpr uint8_t last_byte = LastByte;
+    static constexpr std::size_t header_length = 2u; // First byte, length
+    static constexpr std::size_t footer_length = 1u; // Last byte
+    static constexpr std::size_t max_length = MaxLength; // From first to last byte
+
+    static_assert(max_length > header_length + footer_length, "MaxLength leaves no room for a payload");
+};
+
+/*******************************************************************************
+* RING
+*******************************************************************************/
+// Fixed-size FIFO, same scheme as ringbuf_static.h: head and tail are
+// positions in [0, 2 * N), so all N bytes are usable and a power-of-two N
+// only needs masks. Not thread-safe, Comm locks around it.
+template<std::size_t N>
+class Ring
+{
+    static_assert(N > 0, "empty ring");
+
+public:
+    static constexpr std::size_t capacity = N;
+
+    void reset() { head_ = tail_ = 0; }
+    std::size_t used() const { return wrap2(head_ + 2 * N - tail_); }
+    std::size_t free() const { return N - used(); }
+    bool empty() const { return head_ == tail_; }
+
+    uint8_t peek(std::size_t offset) const { return buf_[index(tail_ + offset)]; }
+
+    // Offset of the first 'c' from 'offset', or used() if there's none
+    std::size_t find(uint8_t c, std::size_t offset = 0) const
+    {
+        std::size_t count = used();
+        while(offset < count) {
+            std::size_t start = index(tail_ + offset);
+            std::size_t n = N - start < count - offset ? N - start : count - offset;
+            const void *found = std::memchr(buf_ + start, c, n);
+            if(found)
+                return offset + (std::size_t)((const uint8_t *)found - (buf_ + start));
+            offset += n;
+        }
+        return count;
+    }
+
+    void push(uint8_t c)
+    {
+        buf_[index(head_)] = c;
+        head_ = wrap2(head_ + 1);
+    }
+
+    uint8_t pop()
+    {
+        uint8_t c = buf_[index(tail_)];
+        tail_ = wrap2(tail_ + 1);
+        return c;
+    }
+
+    // The caller checks free()
+    void write(const uint8_t *data, std::size_t count)
+    {
+        while(count) {
+            std::size_t start = index(head_);
+            std::size_t n = N - start < count ? N - start : count;
+            std::memcpy(buf_ + start, data, n);
+            head_ = wrap2(head_ + n);
+            data += n;
+            count -= n;
+        }
+    }
+
+    // The caller checks used(), 'data' may be NULL to only remove bytes
+    void read(uint8_t *data, std::size_t count)
+    {
+        if(!data) {
+            tail_ = wrap2(tail_ + count);
+            return;
+        }
+        while(count) {
+            std::size_t start = index(tail_);
+            std::size_t n = N - start < count ? N - start : count;
+            std::memcpy(data, buf_ + start, n);
+            tail_ = wrap2(tail_ + n);
+            data += n;
+            count -= n;
+        }
+    }
+
+private:
+    static constexpr bool pow2 = (N & (N - 1)) == 0;
+
+    static std::size_t wrap2(std::size_t pos)
+    {
+        if constexpr(pow2)
+            return pos & (2 * N - 1);
+        else
+            return pos >= 2 * N ? pos - 2 * N : pos;
+    }
+
+    static std::size_t index(std::size_t pos)
+    {
+        if constexpr(pow2)
+            return pos & (N - 1);
+        else
+            return pos >= 3 * N ? pos - 3 * N : pos >= 2 * N ? pos - 2 * N : pos >= N ? pos - N : pos;
+    }
+
+    std::size_t head_ = 0;
+    std::size_t tail_ = 0;
+    uint8_t buf_[N] = {};
+};
+
+/*******************************************************************************
+* DRIVER
+*******************************************************************************/
+template<class Transport = DefaultTransport,
+         std::size_t RxSize = RX_BUFFER_SIZE,
+         std::size_t TxSize = TX_BUFFER_SIZE,
+         class Framing = comm::Framing<>,
+         uint32_t InterruptFreq = COMM_INTERRUPT_FREQ>
+class Comm
+{
+public:
+    static constexpr std::size_t rx_size = RxSize;
+    static constexpr std::size_t tx_size = TxSize;
+    static constexpr std::size_t max_payload = Framing::max_length - Framing::header_length - Framing::footer_length;
+    static constexpr uint32_t interrupt_ticks = Platform::clock_hz / InterruptFreq;
+
+    static_assert(InterruptFreq > 0 && InterruptFreq <= Platform::clock_hz,
+                  "COMM interrupt frequency must be between 1 Hz and the system clock");
+    static_assert(interrupt_ticks - 1u <= 0xFFFFFFu, "SysTick reload (clock / InterruptFreq) must fit in 24 bits");
+    static_assert(Framing::max_length <= RxSize, "the largest message doesn't fit the RX ring");
+    static_assert(Framing::max_length <= TxSize, "the largest message doesn't fit the TX ring");
+    static_assert(RxSize >= Transport::packet_size || Transport::needs_zlp == false,
+                  "the RX ring can't hold a full USB packet");
+    static_assert(Framing::max_length <= 255u, "the message length must fit in a byte");
+
+    Comm() = delete;
+
+    // Start the transport and the SysTick interrupt (once, before the main loop)
+    static void init()
+    {
+        rx_.reset();
+        tx_.reset();
+        Transport::start();
+        Platform::start_tick(&isr, interrupt_ticks);
+    }
+
+    // Single character
+    static bool getch(uint8_t &data)
+    {
+        uint8 state = Platform::lock();
+        bool found = !rx_.empty();
+        if(found)
+            data = rx_.pop();
+        Platform::unlock(state);
+        return found;
+    }
+
+    static void putch(uint8_t data)
+    {
+        uint8 state = wait_for_room(1u);
+        tx_.push(data);
+        Platform::unlock(state);
+    }
+
+    // Line, without its terminator ('data' must hold RxSize bytes)
+    static std::size_t getline(uint8_t *data) { return getline(data, RxSize); }
+
+    static void putline(const uint8_t *data, std::size_t count)
+    {
+        if(!data || !count || count + 1u > TxSize)
+            return;
+        uint8 state = wait_for_room(count + 1u);
+        tx_.write(data, count);
+        tx_.push(Framing::line_terminator);
+        Platform::unlock(state);
+    }
+
+    static void putline(std::string_view line) { putline((const uint8_t *)line.data(), line.size()); }
+
+    // Message payload ('data' must hold max_payload bytes)
+    static std::size_t getmsg(uint8_t *data) { return getmsg(data, max_payload); }
+
+    // Payloads larger than max_payload are ignored
+    static void putmsg(const uint8_t *data, std::size_t count)
+    {
+        if(!data || !count || count > max_payload)
+            return;
+        uint8_t length = (uint8_t)(count + Framing::header_length + Framing::footer_length);
+        uint8 state = wait_for_room(length);
+        tx_.push(Framing::first_byte);
+        tx_.push(length);
+        tx_.write(data, count);
+        tx_.push(Framing::last_byte);
+        Platform::unlock(state);
+    }
+
+    static void putmsg(std::string_view msg) { putmsg((const uint8_t *)msg.data(), msg.size()); }
+
+#ifdef COMM_HAVE_SPAN
+    // A line longer than 'data' is truncated (the rest is dropped)
+    static std::size_t getline(std::span<uint8_t> data) { return getline(data.data(), data.size()); }
+    static void putline(std::span<const uint8_t> line) { putline(line.data(), line.size()); }
+
+    // A payload longer than 'data' is truncated (the rest is dropped)
+    static std::size_t getmsg(std::span<uint8_t> data) { return getmsg(data.data(), data.size()); }
+    static void putmsg(std::span<const uint8_t> msg) { putmsg(msg.data(), msg.size()); }
+#endif
+
+    // SysTick handler, installed by init()
+    static void isr()
+    {
+        rx_isr();
+        tx_isr();
+    }
+
+private:
+    // Lock once there are 'count' bytes free in the TX ring
+    static uint8 wait_for_room(std::size_t count)
+    {
+        while(1) {
+            uint8 state = Platform::lock();
+            if(tx_.free() >= count)
+                return state;
+            Platform::unlock(state);
+        }
+    }
+
+    static std::size_t getline(uint8_t *data, std::size_t max)
+    {
+        if(!data)
+            return 0;
+
+        uint8 state = Platform::lock();
+        std::size_t length = rx_.find(Framing::line_terminator);
+        bool found = length != rx_.used();
+        if(found) {
+            std::size_t count = length < max ? length : max;
+            rx_.read(data, count);
+            rx_.read(nullptr, length - count + 1u); // Rest and terminator
+            length = count;
+        }
+        Platform::unlock(state);
+
+        return found ? length : 0;
+    }
+
+    static std::size_t getmsg(uint8_t *data, std::size_t max)
+    {
+        if(!data)
+            return 0;
+
+        std::size_t count = 0;
+        uint8 state = Platform::lock();
+
+        while(1) {
+            // Drop everything before the first byte
+            std::size_t first = rx_.find(Framing::first_byte);
+            rx_.read(nullptr, first);
+            if(rx_.used() < Framing::header_length)
+                break;
+
+            // Invalid length: drop the first byte and wait for the next call
+            std::size_t length = rx_.peek(1);
+            if(length > Framing::max_length || length < Framing::header_length + Framing::footer_length) {
+                rx_.read(nullptr, 1u);
+                break;
+            }
+            if(rx_.used() < length)
+                break;
+
+            // Not a message: drop the first byte and look for the next one
+            if(rx_.peek(length - 1u) != Framing::last_byte) {
+                rx_.read(nullptr, 1u);
+                continue;
+            }
+
+            std::size_t payload = length - Framing::header_length - Framing::footer_length;
+            count = payload < max ? payload : max;
+            rx_.read(nullptr, Framing::header_length);
+            rx_.read(data, count);
+            rx_.read(nullptr, payload - count + Framing::footer_length);
+            break;
+        }
+
+        Platform::unlock(state);
+        return count;
+    }
+
+    // Copy all available bytes from the transport into the RX ring
+    static void rx_isr()
+    {
+        uint8 state = Platform::lock();
+
+        Transport::configure();
+        std::size_t available = Transport::rx_available();
+
+        // Only if all of it fits (the transport keeps it otherwise)
+        if(available && available <= rx_.free()) {
+            while(available) {
+                std::size_t n = available < Transport::packet_size ? available : Transport::packet_size;
+                rx_.write(temp_, Transport::read(temp_, n));
+                available -= n;
+            }
+        }
+
+        Platform::unlock(state);
+    }
+
+    // Send up to a packet from the TX ring
+    static void tx_isr()
+    {
+        uint8 state = Platform::lock();
+
+        if(!tx_.empty() || zlp_required_) {
+            Transport::configure();
+
+            if(Transport::tx_ready()) {
+                std::size_t count = tx_.used() < Transport::packet_size ? tx_.used() : Transport::packet_size;
+                tx_.read(temp_, count);
+                Transport::write(temp_, count);
+                zlp_required_ = Transport::needs_zlp && count == Transport::packet_size;
+                reject_ = 0;
+            }
+            // Discard the TX ring if the transport rejects it too many times
+            else if(Transport::max_reject && ++reject_ > Transport::max_reject) {
+                tx_.reset();
+                reject_ = 0;
+            }
+        }
+
+        Platform::unlock(state);
+    }
+
+    static inline Ring<RxSize> rx_;
+    static inline Ring<TxSize> tx_;
+    static inline uint8_t temp_[Transport::packet_size];
+    static inline bool zlp_required_ = false;
+    static inline uint8_t reject_ = 0;
+};
+
+} // namespace comm
+
+#endif // _COMM_DRIVER_HPP
+
+/* [] END OF FILE */
@@ -0,0 +1,87 @@
+/*******************************************************************************
+*
+* Bulk block-transfer structure.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* The bulk transfer mode streams raw fixed-size blocks, bypassing the custom
+* message framing. Each block is structured as follow:
+*    BULK_SEQ (incremented for every block, wraps at 256)
+*    BULK_LENGTH (number of valid bytes in BULK_DATA)
+*    BULK_DATA (always BULK_BLOCK_SIZE bytes, padded with zeros)
+*    BULK_CRC (CRC-16/CCITT of everything above, MSB first)
+*
+* A block shorter than BULK_BLOCK_SIZE (possibly empty) ends the transfer.
+*
+* The receiver answers with 2-byte acknowledgements:
+*    BULK_ACK, seq: every block up to and including 'seq' was received.
+*    BULK_NAK, seq: resend everything starting from 'seq'.
+*
+* The sender may have up to BULK_WINDOW blocks waiting for an
+* acknowledgement. The device sends a BULK_NAK for sequence 0 when it is
+* ready to receive a transfer.
+*
+* This file is shared with the host tools and must not include project.h.
+*
+*******************************************************************************/
+
+#ifndef _COMM_DRIVER_BULK_H
+#define _COMM_DRIVER_BULK_H
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Block
+#define BULK_BLOCK_SIZE (64u)
+#define BULK_HEADER_LENGTH (2u)
+#define BULK_CRC_LENGTH (2u)
+#define BULK_FRAME_LENGTH (BULK_HEADER_LENGTH + BULK_BLOCK_SIZE + BULK_CRC_LENGTH)
+#define BULK_SEQ_OFFS (0u)
+#define BULK_LENGTH_OFFS (1u)
+
+// Acknowledgements
+#define BULK_ACK ((unsigned char)0x06)
+#define BULK_NAK ((unsigned char)0x15)
+#define BULK_ACK_LENGTH (2u)
+
+// Number of blocks that can be sent before waiting for an acknowledgement.
+// The device keeps a copy of every block in flight (BULK_FRAME_LENGTH bytes
+// of RAM each), must be smaller than 128.
+#define BULK_WINDOW (4u)
+
+// Number of comm interrupts without any acknowledgement before the sender
+// sends the whole window again, and number of times the same block can be
+// sent again before giving up.
+#define BULK_TIMEOUT_TICKS (200u)
+#define BULK_MAX_RETRIES (10u)
+
+#endif // _COMM_DRIVER_BULK_H
+
+/* [] END OF FILE */
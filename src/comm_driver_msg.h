@@ -62,6 +62,7 @@
 #define MSG_FOOTER_LENGTH ((unsigned char)1)
 #define MSG_STRUCTURE_LENGTH (MSG_HEADER_LENGTH + MSG_FOOTER_LENGTH)
 #define MSG_LENGTH_OFFS_FROM_FIRST_BYTE ((unsigned char)1)
+#define MSG_MAX_LENGTH ((unsigned char)99) // From first to last byte
 
 #endif // _COMM_DRIVER_H
 
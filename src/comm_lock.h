@@ -0,0 +1,170 @@
+/*******************************************************************************
+*
+* Lock protecting the comm driver from its interrupt.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  comm_lock() and comm_unlock() protect the buffers and the state shared by
+*  comm_driver.c and its interrupt. Unless COMM_LOCK_ALL_INTERRUPTS is set
+*  (see comm_driver.h), only the comm interrupt is masked, the others (motor
+*  encoders, PWM, ...) keep running:
+*   - Cortex-M3 (PSoC 5LP): BASEPRI masks the comm interrupt and every
+*     interrupt of the same or lower priority. comm_lock_init() gives the comm
+*     interrupt the priority COMM_INTERRUPT_PRIORITY.
+*   - Cortex-M0 (PSoC 4): the NVIC can't mask SysTick (a system exception),
+*     so its TICKINT bit is cleared instead. A tick that elapsed while masked
+*     is pended again by comm_unlock().
+*   - Linux (host builds of the driver, where the comm interrupt is a timer
+*     signal): COMM_HOST_SIGNAL is blocked for the calling thread.
+*
+*  Locks nest: comm_unlock() restores the state returned by comm_lock(), like
+*  CyExitCriticalSection(). The comm_*() functions must not be called from
+*  interrupts with a higher priority than the comm interrupt (except
+*  comm_recorder_put(), which masks all interrupts).
+*
+*******************************************************************************/
+
+#ifndef _COMM_LOCK_H
+#define _COMM_LOCK_H
+
+#include "comm_driver.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#if defined(__linux__) && !COMM_LOCK_ALL_INTERRUPTS
+    #include <signal.h>
+    #include <pthread.h>
+    
+    // Signal running the comm interrupt of host builds
+    #ifndef COMM_HOST_SIGNAL
+        #define COMM_HOST_SIGNAL SIGALRM
+    #endif
+#elif CY_PSOC5LP && !COMM_LOCK_ALL_INTERRUPTS
+    #if COMM_INTERRUPT_PRIORITY < 1 || COMM_INTERRUPT_PRIORITY >= (1u << __NVIC_PRIO_BITS)
+        #error COMM_INTERRUPT_PRIORITY must be between 1 and the lowest priority
+    #endif
+    
+    // BASEPRI value masking the comm interrupt priority and lower ones
+    #define COMM_LOCK_BASEPRI (COMM_INTERRUPT_PRIORITY << (8u - __NVIC_PRIO_BITS))
+#endif
+
+// Keeps the compiler from moving memory accesses out of the locked section
+#define COMM_LOCK_BARRIER() __asm volatile ("" ::: "memory")
+
+/*******************************************************************************
+* FUNCTIONS
+*******************************************************************************/
+#if COMM_LOCK_ALL_INTERRUPTS
+
+static inline void comm_lock_init() {}
+static inline uint8 comm_lock() { return CyEnterCriticalSection(); }
+static inline void comm_unlock(uint8 state) { CyExitCriticalSection(state); }
+
+#elif defined(__linux__)
+
+static inline void comm_lock_init() {}
+
+static inline uint8 comm_lock()
+{
+    sigset_t set, old;
+    sigemptyset(&set);
+    sigaddset(&set, COMM_HOST_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    return (uint8)sigismember(&old, COMM_HOST_SIGNAL);
+}
+
+static inline void comm_unlock(uint8 state)
+{
+    if (!state) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, COMM_HOST_SIGNAL);
+        pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    }
+}
+
+#elif CY_PSOC5LP
+
+// Must be called after SysTick_Config(), which sets the lowest priority
+static inline void comm_lock_init()
+{
+    NVIC_SetPriority(SysTick_IRQn, COMM_INTERRUPT_PRIORITY);
+}
+
+static inline uint8 comm_lock()
+{
+    uint8 state = (uint8)__get_BASEPRI();
+    
+    // Only raise the masked level (0 masks nothing)
+    if (state == 0u || state > COMM_LOCK_BASEPRI)
+        __set_BASEPRI(COMM_LOCK_BASEPRI);
+    COMM_LOCK_BARRIER();
+    return state;
+}
+
+static inline void comm_unlock(uint8 state)
+{
+    COMM_LOCK_BARRIER();
+    __set_BASEPRI(state);
+}
+
+#elif CY_PSOC4
+
+static inline void comm_lock_init() {}
+
+static inline uint8 comm_lock()
+{
+    // A tick pending before TICKINT is cleared is taken right away, the
+    // lock isn't held yet
+    uint8 state = (SysTick->CTRL & SysTick_CTRL_TICKINT_Msk) != 0u;
+    SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+    COMM_LOCK_BARRIER();
+    return state;
+}
+
+static inline void comm_unlock(uint8 state)
+{
+    COMM_LOCK_BARRIER();
+    if (state) {
+        // Reading CTRL clears COUNTFLAG, set if a tick elapsed while masked
+        uint32 ctrl = SysTick->CTRL;
+        SysTick->CTRL = ctrl | SysTick_CTRL_TICKINT_Msk;
+        if (ctrl & SysTick_CTRL_COUNTFLAG_Msk)
+            SCB->ICSR = SCB_ICSR_PENDSTSET_Msk;
+    }
+}
+
+#endif
+
+#endif // _COMM_LOCK_H
+
+/* [] END OF FILE */
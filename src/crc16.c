@@ -0,0 +1,78 @@
+/*******************************************************************************
+*
+* CRC-16/CCITT checksum.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*******************************************************************************/
+
+#include "crc16.h"
+
+/*******************************************************************************
+* PRIVATE VARIABLES
+*******************************************************************************/
+// CRC of every 4 bits value, shifted in the upper nibble
+static const uint16_t _crc16Table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+
+/*******************************************************************************
+* PUBLIC FUNCTIONS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: crc16_ccitt
+********************************************************************************
+* Summary:
+*  Update a CRC-16/CCITT with 'count' bytes. Start with CRC16_INIT and
+*  chain calls to checksum non-contiguous data.
+*   
+* Parameters:
+*  crc: CRC of the previous bytes (or CRC16_INIT).
+*  data: Pointer to the bytes to add to the CRC.
+*  count: The number of bytes in 'data'.
+*
+* Return:
+*  uint16_t: The updated CRC.
+*
+*******************************************************************************/
+uint16_t crc16_ccitt(uint16_t crc, const void *data, size_t count)
+{
+    const uint8_t *u8data = data;
+    
+    while(count--) {
+        crc = (uint16_t)(crc << 4) ^ _crc16Table[(crc >> 12) ^ (*u8data >> 4)];
+        crc = (uint16_t)(crc << 4) ^ _crc16Table[(crc >> 12) ^ (*u8data & 0x0F)];
+        u8data++;
+    }
+    
+    return crc;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,61 @@
+/*******************************************************************************
+*
+* CRC-16/CCITT checksum.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) used to
+*  validate bulk transfer blocks. Computed 4 bits at a time with a 16 entries
+*  table to keep the flash footprint small.
+*
+*  This file is shared with the host tools and must not include project.h.
+*
+*******************************************************************************/
+
+#ifndef _CRC16_H
+#define _CRC16_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define CRC16_INIT ((uint16_t)0xFFFF)
+
+/*******************************************************************************
+* PUBLIC PROTOTYPES
+*******************************************************************************/
+uint16_t crc16_ccitt(uint16_t crc, const void *data, size_t count);
+
+#endif // _CRC16_H
+
+/* [] END OF FILE */
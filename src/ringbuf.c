@@ -13,6 +13,10 @@
  * <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* memfd_create */
+#endif
+
 #include "ringbuf.h"
 
 #include <stdint.h>
@@ -21,8 +25,36 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/param.h>
+#ifdef RINGBUF_HAVE_MIRROR
+#include <sys/mman.h>
+#endif
 //#include <assert.h>
 
+/*
+ * SSE2/AVX2 search kernels, selected at run time, for host builds on
+ * x86 with GCC or clang. Other builds use the scalar kernels only.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define RINGBUF_HAVE_SIMD 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Word-wise copies between the ring buffer and the caller's memory on
+ * Cortex-M0/M3 (PSoC 4/5LP), where newlib's memcpy falls back to byte
+ * copies for the short, unaligned segments ring buffers move. Define
+ * RINGBUF_WORD_COPY to 0 or 1 to override. Little-endian only.
+ */
+#ifndef RINGBUF_WORD_COPY
+#if (defined(__ARM_ARCH_6M__) || defined(__ARM_ARCH_7M__) \
+     || defined(__ARM_ARCH_7EM__)) && defined(__GNUC__) \
+    && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define RINGBUF_WORD_COPY 1
+#else
+#define RINGBUF_WORD_COPY 0
+#endif
+#endif
+
 
 /*
  * The code is written for clarity, not cleverness or performance, and
@@ -32,18 +64,34 @@
  * intended.
  */
 
-struct ringbuf_t
+/*
+ * New ring buffers overwrite old data on overflow, as they always
+ * did, haven't dropped anything yet and have no watermarks.
+ */
+static void
+ringbuf_init_policy(ringbuf_t rb)
 {
-    uint8_t *buf;
-    uint8_t *head, *tail;
-    size_t size;
-};
+#if RINGBUF_POLICIES
+    rb->dropped = 0;
+    rb->policy = RINGBUF_DROP_OLDEST;
+    rb->record_end = 0;
+#endif
+#if RINGBUF_WATERMARKS
+    rb->level = RINGBUF_NO_WATERMARKS;
+    rb->events = 0;
+    rb->watermark = 0;
+#endif
+}
 
 ringbuf_t
 ringbuf_new(size_t capacity)
 {
     ringbuf_t rb = malloc(sizeof(struct ringbuf_t));
     if (rb) {
+#ifdef RINGBUF_HAVE_MIRROR
+        rb->mirrored = 0;
+#endif
+        ringbuf_init_policy(rb);
 
         /* One byte is used for detecting the full condition. */
         rb->size = capacity + 1;
@@ -58,22 +106,134 @@ ringbuf_new(size_t capacity)
     return rb;
 }
 
+int
+ringbuf_new_shared(ringbuf_t *a, ringbuf_t *b,
+                   size_t capacity_a, size_t capacity_b)
+{
+    *a = malloc(sizeof(struct ringbuf_t));
+    *b = malloc(sizeof(struct ringbuf_t));
+    uint8_t *buf = malloc(capacity_a + 1 + capacity_b + 1);
+    if (!*a || !*b || !buf) {
+        free(*a);
+        free(*b);
+        free(buf);
+        *a = *b = 0;
+        return 0;
+    }
+
+#ifdef RINGBUF_HAVE_MIRROR
+    (*a)->mirrored = (*b)->mirrored = 0;
+#endif
+    ringbuf_init_policy(*a);
+    ringbuf_init_policy(*b);
+
+    /* a is at the start of the internal buffer, b right after it. */
+    (*a)->size = capacity_a + 1;
+    (*a)->buf = buf;
+    (*b)->size = capacity_b + 1;
+    (*b)->buf = buf + (*a)->size;
+    ringbuf_reset(*a);
+    ringbuf_reset(*b);
+    return 1;
+}
+
+void
+ringbuf_free_shared(ringbuf_t *a, ringbuf_t *b)
+{
+    free((*a)->buf < (*b)->buf ? (*a)->buf : (*b)->buf);
+    free(*a);
+    free(*b);
+    *a = *b = 0;
+}
+
+#ifdef RINGBUF_HAVE_MIRROR
+ringbuf_t
+ringbuf_new_mirrored(size_t capacity)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    ringbuf_t rb = malloc(sizeof(struct ringbuf_t));
+    if (!rb)
+        return 0;
+
+    /* The buffer size must be a multiple of the page size. */
+    rb->size = ((capacity + 1 + page - 1) / page) * page;
+    rb->mirrored = 1;
+    ringbuf_init_policy(rb);
+
+    int fd = memfd_create("ringbuf", MFD_CLOEXEC);
+    if (fd < 0)
+        goto error;
+    if (ftruncate(fd, rb->size) < 0)
+        goto error_fd;
+
+    /* Reserve twice the size, then map the same pages in both halves. */
+    uint8_t *base = mmap(0, 2 * rb->size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        goto error_fd;
+    if (mmap(base, rb->size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + rb->size, rb->size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, 2 * rb->size);
+        goto error_fd;
+    }
+
+    close(fd);
+    rb->buf = base;
+    ringbuf_reset(rb);
+    return rb;
+
+error_fd:
+    close(fd);
+error:
+    free(rb);
+    return 0;
+}
+
+int
+ringbuf_is_mirrored(const struct ringbuf_t *rb)
+{
+    return rb->mirrored;
+}
+#endif /* RINGBUF_HAVE_MIRROR */
+
 size_t
 ringbuf_buffer_size(const struct ringbuf_t *rb)
 {
     return rb->size;
 }
 
+/*
+ * Called after the head or tail pointer moved.
+ */
+static inline void
+ringbuf_moved(ringbuf_t rb)
+{
+#if RINGBUF_WATERMARKS
+    if (rb->level != RINGBUF_NO_WATERMARKS)
+        ringbuf_check_watermarks(rb);
+#else
+    (void)rb;
+#endif
+}
+
 void
 ringbuf_reset(ringbuf_t rb)
 {
     rb->head = rb->tail = rb->buf;
+    ringbuf_moved(rb);
 }
 
 void
 ringbuf_free(ringbuf_t *rb)
 {
 //    assert(rb && *rb);
+#ifdef RINGBUF_HAVE_MIRROR
+    if ((*rb)->mirrored)
+        munmap((*rb)->buf, 2 * (*rb)->size);
+    else
+#endif
     free((*rb)->buf);
     free(*rb);
     *rb = 0;
@@ -96,6 +256,23 @@ ringbuf_end(const struct ringbuf_t *rb)
     return rb->buf + ringbuf_buffer_size(rb);
 }
 
+/*
+ * Return the number of bytes that can be accessed contiguously
+ * starting at p, a location within the ring buffer's contiguous
+ * buffer. A mirrored buffer (see ringbuf_new_mirrored) is mapped a
+ * second time right after its end, so a whole buffer size is always
+ * contiguous.
+ */
+static size_t
+ringbuf_contig(const struct ringbuf_t *rb, const uint8_t *p)
+{
+#ifdef RINGBUF_HAVE_MIRROR
+    if (rb->mirrored)
+        return ringbuf_buffer_size(rb);
+#endif
+    return ringbuf_end(rb) - p;
+}
+
 size_t
 ringbuf_bytes_free(const struct ringbuf_t *rb)
 {
@@ -135,6 +312,91 @@ ringbuf_head(const struct ringbuf_t *rb)
     return rb->head;
 }
 
+#if RINGBUF_POLICIES
+void
+ringbuf_set_policy(ringbuf_t rb, ringbuf_policy_t policy, int record_end)
+{
+    rb->policy = policy;
+    rb->record_end = (uint8_t)record_end;
+}
+
+ringbuf_policy_t
+ringbuf_policy(const struct ringbuf_t *rb)
+{
+    return rb->policy;
+}
+
+size_t
+ringbuf_dropped(const struct ringbuf_t *rb)
+{
+    return rb->dropped;
+}
+#endif /* RINGBUF_POLICIES */
+
+#if RINGBUF_WATERMARKS
+/*
+ * Watermark levels: 0 at or below low, 2 at or above high, 1 between.
+ */
+static uint8_t
+ringbuf_level(const struct ringbuf_t *rb)
+{
+    size_t used = ringbuf_bytes_used(rb);
+    if (used >= rb->high)
+        return 2;
+    return used <= rb->low ? 0 : 1;
+}
+
+void
+ringbuf_set_watermarks(ringbuf_t rb, size_t low, size_t high,
+                       ringbuf_watermark_t callback, void *context)
+{
+    rb->low = low;
+    rb->high = high;
+    rb->watermark = callback;
+    rb->watermark_context = context;
+    rb->events = 0;
+    rb->level = ringbuf_level(rb);
+}
+
+void
+ringbuf_clear_watermarks(ringbuf_t rb)
+{
+    rb->level = RINGBUF_NO_WATERMARKS;
+    rb->events = 0;
+    rb->watermark = 0;
+}
+
+unsigned
+ringbuf_watermark_events(ringbuf_t rb)
+{
+    unsigned events = rb->events;
+    rb->events = 0;
+    return events;
+}
+
+void
+ringbuf_check_watermarks(ringbuf_t rb)
+{
+    uint8_t level = ringbuf_level(rb);
+    if (level == rb->level)
+        return;
+
+    /* Only reaching either end raises an event, not the band between. */
+    unsigned event = 0;
+    if (level == 2)
+        event = RINGBUF_HIGH_WATERMARK;
+    else if (level == 0)
+        event = RINGBUF_LOW_WATERMARK;
+    rb->level = level;
+
+    if (event) {
+        rb->events |= event;
+        if (rb->watermark)
+            rb->watermark(rb->watermark_context, event);
+    }
+}
+#endif /* RINGBUF_WATERMARKS */
+
 /*
  * Given a ring buffer rb and a pointer to a location within its
  * contiguous buffer, return the a pointer to the next logical
@@ -155,15 +417,14 @@ ringbuf_nextp(ringbuf_t rb, const uint8_t *p)
 size_t
 ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset)
 {
-    const uint8_t *bufend = ringbuf_end(rb);
     size_t bytes_used = ringbuf_bytes_used(rb);
     if (offset >= bytes_used)
         return bytes_used;
 
     const uint8_t *start = rb->buf +
         (((rb->tail - rb->buf) + offset) % ringbuf_buffer_size(rb));
-//    assert(bufend > start);
-    size_t n = MIN(bufend - start, bytes_used - offset);
+//    assert(ringbuf_end(rb) > start);
+    size_t n = MIN(ringbuf_contig(rb, start), bytes_used - offset);
     const uint8_t *found = memchr(start, c, n);
     if (found)
         return offset + (found - start);
@@ -171,6 +432,334 @@ ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset)
         return ringbuf_findchr(rb, c, offset + n);
 }
 
+/*
+ * Search kernels. Each one scans the contiguous area [p, p + n) and
+ * returns the index of the first match, or n if there is none.
+ * Multi-byte patterns must lie entirely within the area.
+ */
+typedef size_t (*ringbuf_scan_set_t)(const uint8_t *p, size_t n,
+                                     const uint8_t *set, size_t nset);
+typedef size_t (*ringbuf_scan_mem_t)(const uint8_t *p, size_t n,
+                                     const uint8_t *pat, size_t len);
+
+/* Sets larger than this always use the scalar (bitmap) kernel. */
+#define RINGBUF_SIMD_SET_MAX 8
+
+static size_t
+ringbuf_scan_set_scalar(const uint8_t *p, size_t n,
+                        const uint8_t *set, size_t nset)
+{
+    uint32_t map[256 / 32] = {0};
+    for (size_t i = 0; i != nset; ++i)
+        map[set[i] >> 5] |= (uint32_t)1 << (set[i] & 31);
+
+    size_t i;
+    for (i = 0; i != n; ++i)
+        if (map[p[i] >> 5] & ((uint32_t)1 << (p[i] & 31)))
+            break;
+    return i;
+}
+
+static size_t
+ringbuf_scan_mem_scalar(const uint8_t *p, size_t n,
+                        const uint8_t *pat, size_t len)
+{
+    size_t i = 0;
+    while (i + len <= n) {
+        const uint8_t *found = memchr(p + i, pat[0], n - len + 1 - i);
+        if (!found)
+            break;
+        i = found - p;
+        if (memcmp(found + 1, pat + 1, len - 1) == 0)
+            return i;
+        ++i;
+    }
+    return n;
+}
+
+#ifdef RINGBUF_HAVE_SIMD
+/*
+ * Byte-set search: compare each block against every byte of the set
+ * and OR the results. The set is padded to 4 or 8 bytes by repeating
+ * its last byte, so that the comparisons are unrolled.
+ */
+static size_t
+ringbuf_pad_set(uint8_t pad[RINGBUF_SIMD_SET_MAX], const uint8_t *set,
+                size_t nset)
+{
+    size_t width = nset <= 4 ? 4 : 8;
+    for (size_t k = 0; k != width; ++k)
+        pad[k] = set[MIN(k, nset - 1)];
+    return width;
+}
+
+__attribute__((target("sse2"))) static size_t
+ringbuf_scan_set_sse2(const uint8_t *p, size_t n,
+                      const uint8_t *set, size_t nset)
+{
+    uint8_t pad[RINGBUF_SIMD_SET_MAX];
+    size_t width = ringbuf_pad_set(pad, set, nset);
+    __m128i v[RINGBUF_SIMD_SET_MAX];
+    for (size_t k = 0; k != RINGBUF_SIMD_SET_MAX; ++k)
+        v[k] = _mm_set1_epi8((char)pad[k % width]);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, v[0]), _mm_cmpeq_epi8(block, v[1])),
+            _mm_or_si128(_mm_cmpeq_epi8(block, v[2]), _mm_cmpeq_epi8(block, v[3])));
+        if (width == 8)
+            eq = _mm_or_si128(eq, _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(block, v[4]), _mm_cmpeq_epi8(block, v[5])),
+                _mm_or_si128(_mm_cmpeq_epi8(block, v[6]), _mm_cmpeq_epi8(block, v[7]))));
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + ringbuf_scan_set_scalar(p + i, n - i, set, nset);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+ringbuf_match_set_avx2(__m256i block, const __m256i v[RINGBUF_SIMD_SET_MAX],
+                       size_t width)
+{
+    __m256i eq = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, v[0]), _mm256_cmpeq_epi8(block, v[1])),
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, v[2]), _mm256_cmpeq_epi8(block, v[3])));
+    if (width == 8)
+        eq = _mm256_or_si256(eq, _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, v[4]), _mm256_cmpeq_epi8(block, v[5])),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, v[6]), _mm256_cmpeq_epi8(block, v[7]))));
+    return eq;
+}
+
+__attribute__((target("avx2"))) static size_t
+ringbuf_scan_set_avx2(const uint8_t *p, size_t n,
+                      const uint8_t *set, size_t nset)
+{
+    uint8_t pad[RINGBUF_SIMD_SET_MAX];
+    size_t width = ringbuf_pad_set(pad, set, nset);
+    __m256i v[RINGBUF_SIMD_SET_MAX];
+    for (size_t k = 0; k != RINGBUF_SIMD_SET_MAX; ++k)
+        v[k] = _mm256_set1_epi8((char)pad[k % width]);
+
+    /* Two blocks per iteration. */
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i lo = ringbuf_match_set_avx2(
+            _mm256_loadu_si256((const __m256i *)(p + i)), v, width);
+        __m256i hi = ringbuf_match_set_avx2(
+            _mm256_loadu_si256((const __m256i *)(p + i + 32)), v, width);
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(lo)
+            | (uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32;
+        if (mask)
+            return i + __builtin_ctzll(mask);
+    }
+    for (; i + 32 <= n; i += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(ringbuf_match_set_avx2(
+            _mm256_loadu_si256((const __m256i *)(p + i)), v, width));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + ringbuf_scan_set_scalar(p + i, n - i, set, nset);
+}
+
+/*
+ * Pattern search: only the positions where both the first and the
+ * last byte of the pattern match are compared in full.
+ */
+__attribute__((target("sse2"))) static size_t
+ringbuf_scan_mem_sse2(const uint8_t *p, size_t n,
+                      const uint8_t *pat, size_t len)
+{
+    const __m128i first = _mm_set1_epi8((char)pat[0]);
+    const __m128i last = _mm_set1_epi8((char)pat[len - 1]);
+
+    size_t i = 0;
+    for (; i + len - 1 + 16 <= n; i += 16) {
+        __m128i f = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i l = _mm_loadu_si128((const __m128i *)(p + i + len - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+        while (mask) {
+            size_t j = i + __builtin_ctz(mask);
+            if (memcmp(p + j + 1, pat + 1, len - 1) == 0)
+                return j;
+            mask &= mask - 1;
+        }
+    }
+    size_t k = ringbuf_scan_mem_scalar(p + i, n - i, pat, len);
+    return k == n - i ? n : i + k;
+}
+
+__attribute__((target("avx2"))) static size_t
+ringbuf_scan_mem_avx2(const uint8_t *p, size_t n,
+                      const uint8_t *pat, size_t len)
+{
+    const __m256i first = _mm256_set1_epi8((char)pat[0]);
+    const __m256i last = _mm256_set1_epi8((char)pat[len - 1]);
+
+    size_t i = 0;
+    for (; i + len - 1 + 32 <= n; i += 32) {
+        __m256i f = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i l = _mm256_loadu_si256((const __m256i *)(p + i + len - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(f, first),
+                             _mm256_cmpeq_epi8(l, last)));
+        while (mask) {
+            size_t j = i + __builtin_ctz(mask);
+            if (memcmp(p + j + 1, pat + 1, len - 1) == 0)
+                return j;
+            mask &= mask - 1;
+        }
+    }
+    size_t k = ringbuf_scan_mem_scalar(p + i, n - i, pat, len);
+    return k == n - i ? n : i + k;
+}
+
+static ringbuf_scan_set_t ringbuf_scan_set_impl;
+static ringbuf_scan_mem_t ringbuf_scan_mem_impl;
+
+/*
+ * Pick the best kernels for this CPU. Concurrent first calls may run
+ * this more than once, but always store the same values. Setting the
+ * RINGBUF_SIMD environment variable to "sse2" or "scalar" rules out the
+ * better kernels (to test or compare them).
+ */
+static void
+ringbuf_simd_init(void)
+{
+    ringbuf_scan_set_t scan_set = ringbuf_scan_set_scalar;
+    ringbuf_scan_mem_t scan_mem = ringbuf_scan_mem_scalar;
+    const char *cap = getenv("RINGBUF_SIMD");
+    int scalar = cap && strcmp(cap, "scalar") == 0;
+    int sse2 = scalar || (cap && strcmp(cap, "sse2") == 0);
+
+    __builtin_cpu_init();
+    if (!sse2 && __builtin_cpu_supports("avx2")) {
+        scan_set = ringbuf_scan_set_avx2;
+        scan_mem = ringbuf_scan_mem_avx2;
+    } else if (!scalar && __builtin_cpu_supports("sse2")) {
+        scan_set = ringbuf_scan_set_sse2;
+        scan_mem = ringbuf_scan_mem_sse2;
+    }
+    __atomic_store_n(&ringbuf_scan_mem_impl, scan_mem, __ATOMIC_RELAXED);
+    __atomic_store_n(&ringbuf_scan_set_impl, scan_set, __ATOMIC_RELEASE);
+}
+
+static size_t
+ringbuf_scan_set(const uint8_t *p, size_t n, const uint8_t *set, size_t nset)
+{
+    if (nset > RINGBUF_SIMD_SET_MAX)
+        return ringbuf_scan_set_scalar(p, n, set, nset);
+    if (!__atomic_load_n(&ringbuf_scan_set_impl, __ATOMIC_ACQUIRE))
+        ringbuf_simd_init();
+    return ringbuf_scan_set_impl(p, n, set, nset);
+}
+
+static size_t
+ringbuf_scan_mem(const uint8_t *p, size_t n, const uint8_t *pat, size_t len)
+{
+    /*
+     * memchr (itself vectorized by the C library) is faster as long as
+     * the first byte of the pattern is rare: switch to the first/last
+     * byte filter after a few false candidates only.
+     */
+    size_t i = 0;
+    for (int misses = 0; misses != 4; ++misses) {
+        if (i + len > n)
+            return n;
+        const uint8_t *found = memchr(p + i, pat[0], n - len + 1 - i);
+        if (!found)
+            return n;
+        i = found - p;
+        if (memcmp(found + 1, pat + 1, len - 1) == 0)
+            return i;
+        ++i;
+    }
+
+    if (!__atomic_load_n(&ringbuf_scan_set_impl, __ATOMIC_ACQUIRE))
+        ringbuf_simd_init();
+    size_t k = ringbuf_scan_mem_impl(p + i, n - i, pat, len);
+    return k == n - i ? n : i + k;
+}
+#else
+#define ringbuf_scan_set ringbuf_scan_set_scalar
+#define ringbuf_scan_mem ringbuf_scan_mem_scalar
+#endif /* RINGBUF_HAVE_SIMD */
+
+/*
+ * Return the location of the byte offset bytes from rb's tail
+ * pointer.
+ */
+static const uint8_t *
+ringbuf_at(const struct ringbuf_t *rb, size_t offset)
+{
+    return rb->buf +
+        (((rb->tail - rb->buf) + offset) % ringbuf_buffer_size(rb));
+}
+
+size_t
+ringbuf_findset(const struct ringbuf_t *rb, const uint8_t *set, size_t nset,
+                size_t offset)
+{
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (nset == 0)
+        return bytes_used;
+    if (nset == 1)
+        return ringbuf_findchr(rb, set[0], offset);
+
+    /* At most two iterations, one per ring buffer segment. */
+    while (offset < bytes_used) {
+        const uint8_t *start = ringbuf_at(rb, offset);
+        size_t n = MIN(ringbuf_contig(rb, start), bytes_used - offset);
+        size_t found = ringbuf_scan_set(start, n, set, nset);
+        if (found != n)
+            return offset + found;
+        offset += n;
+    }
+    return bytes_used;
+}
+
+size_t
+ringbuf_findmem(const struct ringbuf_t *rb, const void *pattern, size_t len,
+                size_t offset)
+{
+    const uint8_t *pat = pattern;
+    size_t bytes_used = ringbuf_bytes_used(rb);
+    if (len == 0)
+        return MIN(offset, bytes_used);
+    if (len > bytes_used || offset > bytes_used - len)
+        return bytes_used;
+
+    size_t last = bytes_used - len;
+    while (offset <= last) {
+        const uint8_t *start = ringbuf_at(rb, offset);
+        size_t n = MIN(ringbuf_contig(rb, start), bytes_used - offset);
+        size_t segend = offset + n;
+
+        /* Matches entirely within this segment. */
+        if (n >= len) {
+            size_t found = ringbuf_scan_mem(start, n, pat, len);
+            if (found != n)
+                return offset + found;
+            offset = segend - len + 1;
+        }
+
+        /* Matches straddling the end of the contiguous buffer. */
+        for (; offset < segend && offset <= last; ++offset) {
+            size_t i;
+            for (i = 0; i != len; ++i)
+                if (*ringbuf_at(rb, offset + i) != pat[i])
+                    break;
+            if (i == len)
+                return offset;
+        }
+    }
+    return bytes_used;
+}
+
 size_t
 ringbuf_memset(ringbuf_t dst, int c, size_t len)
 {
@@ -179,18 +768,25 @@ ringbuf_memset(ringbuf_t dst, int c, size_t len)
     size_t count = MIN(len, ringbuf_buffer_size(dst));
     int overflow = count > ringbuf_bytes_free(dst);
 
+    /* The overflow policy may drop the write, or make room for it. */
+    if (overflow) {
+        if (!ringbuf_make_room(dst, count))
+            return 0;
+        overflow = count > ringbuf_bytes_free(dst);
+    }
+
     while (nwritten != count) {
 
         /* don't copy beyond the end of the buffer */
 //        assert(bufend > dst->head);
-        size_t n = MIN(bufend - dst->head, count - nwritten);
+        size_t n = MIN(ringbuf_contig(dst, dst->head), count - nwritten);
         memset(dst->head, c, n);
         dst->head += n;
         nwritten += n;
 
         /* wrap? */
-        if (dst->head == bufend)
-            dst->head = dst->buf;
+        if (dst->head >= bufend)
+            dst->head -= ringbuf_buffer_size(dst);
     }
 
     if (overflow) {
@@ -198,9 +794,81 @@ ringbuf_memset(ringbuf_t dst, int c, size_t len)
 //        assert(ringbuf_is_full(dst));
     }
 
+    ringbuf_moved(dst);
     return nwritten;
 }
 
+#if RINGBUF_WORD_COPY
+/*
+ * The ring buffer side is aligned first (a few byte copies), then
+ * whole 32-bit words are moved. The caller's side is accessed with
+ * unaligned word loads/stores where the core supports them (M3), and
+ * assembled from (or split into) bytes otherwise (M0), which still
+ * halves the memory accesses of a byte loop.
+ */
+typedef uint32_t __attribute__((__may_alias__)) ringbuf_word_t;
+
+static void
+ringbuf_copy_to_ring(uint8_t *ring, const uint8_t *src, size_t n)
+{
+    while (n && ((uintptr_t)ring & 3)) {
+        *ring++ = *src++;
+        --n;
+    }
+
+    if (((uintptr_t)src & 3) == 0) {
+        for (; n >= 4; n -= 4, ring += 4, src += 4)
+            *(ringbuf_word_t *)ring = *(const ringbuf_word_t *)src;
+    } else {
+        for (; n >= 4; n -= 4, ring += 4, src += 4) {
+#ifdef __ARM_FEATURE_UNALIGNED
+            uint32_t w;
+            memcpy(&w, src, 4);
+#else
+            uint32_t w = src[0] | (uint32_t)src[1] << 8
+                | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+#endif
+            *(ringbuf_word_t *)ring = w;
+        }
+    }
+
+    while (n--)
+        *ring++ = *src++;
+}
+
+static void
+ringbuf_copy_from_ring(uint8_t *dst, const uint8_t *ring, size_t n)
+{
+    while (n && ((uintptr_t)ring & 3)) {
+        *dst++ = *ring++;
+        --n;
+    }
+
+    if (((uintptr_t)dst & 3) == 0) {
+        for (; n >= 4; n -= 4, ring += 4, dst += 4)
+            *(ringbuf_word_t *)dst = *(const ringbuf_word_t *)ring;
+    } else {
+        for (; n >= 4; n -= 4, ring += 4, dst += 4) {
+            uint32_t w = *(const ringbuf_word_t *)ring;
+#ifdef __ARM_FEATURE_UNALIGNED
+            memcpy(dst, &w, 4);
+#else
+            dst[0] = (uint8_t)w;
+            dst[1] = (uint8_t)(w >> 8);
+            dst[2] = (uint8_t)(w >> 16);
+            dst[3] = (uint8_t)(w >> 24);
+#endif
+        }
+    }
+
+    while (n--)
+        *dst++ = *ring++;
+}
+#else
+#define ringbuf_copy_to_ring(ring, src, n) memcpy((ring), (src), (n))
+#define ringbuf_copy_from_ring(dst, ring, n) memcpy((dst), (ring), (n))
+#endif /* RINGBUF_WORD_COPY */
+
 void *
 ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count)
 {
@@ -209,17 +877,24 @@ ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count)
     int overflow = count > ringbuf_bytes_free(dst);
     size_t nread = 0;
 
+    /* The overflow policy may drop the write, or make room for it. */
+    if (overflow) {
+        if (!ringbuf_make_room(dst, count))
+            return 0;
+        overflow = count > ringbuf_bytes_free(dst);
+    }
+
     while (nread != count) {
         /* don't copy beyond the end of the buffer */
 //        assert(bufend > dst->head);
-        size_t n = MIN(bufend - dst->head, count - nread);
-        memcpy(dst->head, u8src + nread, n);
+        size_t n = MIN(ringbuf_contig(dst, dst->head), count - nread);
+        ringbuf_copy_to_ring(dst->head, u8src + nread, n);
         dst->head += n;
         nread += n;
 
         /* wrap? */
-        if (dst->head == bufend)
-            dst->head = dst->buf;
+        if (dst->head >= bufend)
+            dst->head -= ringbuf_buffer_size(dst);
     }
 
     if (overflow) {
@@ -227,9 +902,18 @@ ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count)
 //        assert(ringbuf_is_full(dst));
     }
 
+    ringbuf_moved(dst);
     return dst->head;
 }
 
+size_t
+ringbuf_memcpy_into_nooverflow(ringbuf_t dst, const void *src, size_t count)
+{
+    count = MIN(count, ringbuf_bytes_free(dst));
+    ringbuf_memcpy_into(dst, src, count);
+    return count;
+}
+
 ssize_t
 ringbuf_read(int fd, ringbuf_t rb, size_t count)
 {
@@ -238,21 +922,22 @@ ringbuf_read(int fd, ringbuf_t rb, size_t count)
 
     /* don't write beyond the end of the buffer */
 //    assert(bufend > rb->head);
-    count = MIN(bufend - rb->head, count);
+    count = MIN(ringbuf_contig(rb, rb->head), count);
     ssize_t n = read(fd, rb->head, count);
     if (n > 0) {
 //        assert(rb->head + n <= bufend);
         rb->head += n;
 
         /* wrap? */
-        if (rb->head == bufend)
-            rb->head = rb->buf;
+        if (rb->head >= bufend)
+            rb->head -= ringbuf_buffer_size(rb);
 
         /* fix up the tail pointer if an overflow occurred */
         if (n > nfree) {
             rb->tail = ringbuf_nextp(rb, rb->head);
 //            assert(ringbuf_is_full(rb));
         }
+        ringbuf_moved(rb);
     }
 
     return n;
@@ -270,17 +955,18 @@ ringbuf_memcpy_from(void *dst, ringbuf_t src, size_t count)
     size_t nwritten = 0;
     while (nwritten != count) {
 //        assert(bufend > src->tail);
-        size_t n = MIN(bufend - src->tail, count - nwritten);
-        memcpy(u8dst + nwritten, src->tail, n);
+        size_t n = MIN(ringbuf_contig(src, src->tail), count - nwritten);
+        ringbuf_copy_from_ring(u8dst + nwritten, src->tail, n);
         src->tail += n;
         nwritten += n;
 
         /* wrap ? */
-        if (src->tail == bufend)
-            src->tail = src->buf;
+        if (src->tail >= bufend)
+            src->tail -= ringbuf_buffer_size(src);
     }
 
 //    assert(count + ringbuf_bytes_used(src) == bytes_used);
+    ringbuf_moved(src);
     return src->tail;
 }
 
@@ -293,17 +979,18 @@ ringbuf_write(int fd, ringbuf_t rb, size_t count)
 
     const uint8_t *bufend = ringbuf_end(rb);
 //    assert(bufend > rb->head);
-    count = MIN(bufend - rb->tail, count);
+    count = MIN(ringbuf_contig(rb, rb->tail), count);
     ssize_t n = write(fd, rb->tail, count);
     if (n > 0) {
 //        assert(rb->tail + n <= bufend);
         rb->tail += n;
 
         /* wrap? */
-        if (rb->tail == bufend)
-            rb->tail = rb->buf;
+        if (rb->tail >= bufend)
+            rb->tail -= ringbuf_buffer_size(rb);
 
 //        assert(n + ringbuf_bytes_used(rb) == bytes_used);
+        ringbuf_moved(rb);
     }
 
     return n;
@@ -317,24 +1004,31 @@ ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count)
         return 0;
     int overflow = count > ringbuf_bytes_free(dst);
 
+    /* The overflow policy may drop the write, or make room for it. */
+    if (overflow) {
+        if (!ringbuf_make_room(dst, count))
+            return 0;
+        overflow = count > ringbuf_bytes_free(dst);
+    }
+
     const uint8_t *src_bufend = ringbuf_end(src);
     const uint8_t *dst_bufend = ringbuf_end(dst);
     size_t ncopied = 0;
     while (ncopied != count) {
 //        assert(src_bufend > src->tail);
-        size_t nsrc = MIN(src_bufend - src->tail, count - ncopied);
+        size_t nsrc = MIN(ringbuf_contig(src, src->tail), count - ncopied);
 //        assert(dst_bufend > dst->head);
-        size_t n = MIN(dst_bufend - dst->head, nsrc);
+        size_t n = MIN(ringbuf_contig(dst, dst->head), nsrc);
         memcpy(dst->head, src->tail, n);
         src->tail += n;
         dst->head += n;
         ncopied += n;
 
         /* wrap ? */
-        if (src->tail == src_bufend)
-            src->tail = src->buf;
-        if (dst->head == dst_bufend)
-            dst->head = dst->buf;
+        if (src->tail >= src_bufend)
+            src->tail -= ringbuf_buffer_size(src);
+        if (dst->head >= dst_bufend)
+            dst->head -= ringbuf_buffer_size(dst);
     }
 
 //    assert(count + ringbuf_bytes_used(src) == src_bytes_used);
@@ -344,6 +1038,8 @@ ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count)
 //        assert(ringbuf_is_full(dst));
     }
 
+    ringbuf_moved(src);
+    ringbuf_moved(dst);
     return dst->head;
 }
 
@@ -359,20 +1055,95 @@ ringbuf_remove_from_tail(ringbuf_t rb, size_t count)
     size_t nremoved = 0;
     while (nremoved != count) {
 //        assert(bufend > rb->tail);
-        size_t n = MIN(bufend - rb->tail, count - nremoved);
+        size_t n = MIN(ringbuf_contig(rb, rb->tail), count - nremoved);
         rb->tail += n;
         nremoved += n;
         
         /* wrap ? */
-        if (rb->tail == bufend)
-            rb->tail = rb->buf;
+        if (rb->tail >= bufend)
+            rb->tail -= ringbuf_buffer_size(rb);
     }
     
 //    assert(count + ringbuf_bytes_used(rb) == bytes_used);
+    ringbuf_moved(rb);
     return rb->tail;
 }
 
 
+/*
+ * Evicting to make room for a write doesn't raise the low watermark:
+ * the levels are evaluated again after the write. A write larger than
+ * the capacity also overwrites its own first bytes.
+ */
+static void
+ringbuf_drop_oldest(ringbuf_t rb, size_t count)
+{
+    size_t bytes_free = ringbuf_bytes_free(rb);
+    size_t bytes_used = ringbuf_bytes_used(rb);
+#if RINGBUF_WATERMARKS
+    uint8_t level = rb->level;
+
+    rb->level = RINGBUF_NO_WATERMARKS;
+    ringbuf_remove_from_tail(rb, MIN(bytes_used, count - bytes_free));
+    rb->level = level;
+#else
+    ringbuf_remove_from_tail(rb, MIN(bytes_used, count - bytes_free));
+#endif
+#if RINGBUF_POLICIES
+    rb->dropped += bytes_used + count - ringbuf_capacity(rb);
+#endif
+}
+
+int
+ringbuf_make_room(ringbuf_t rb, size_t count)
+{
+    if (count <= ringbuf_bytes_free(rb))
+        return 1;
+
+#if RINGBUF_POLICIES
+#if RINGBUF_WATERMARKS
+    uint8_t level = rb->level;
+#endif
+    switch (rb->policy) {
+    case RINGBUF_DROP_OLDEST:
+        ringbuf_drop_oldest(rb, count);
+        return 1;
+
+    case RINGBUF_DROP_RECORD:
+        if (count > ringbuf_capacity(rb))
+            break;
+#if RINGBUF_WATERMARKS
+        rb->level = RINGBUF_NO_WATERMARKS;
+#endif
+        while (count > ringbuf_bytes_free(rb)) {
+            size_t end = ringbuf_findchr(rb, rb->record_end, 0);
+            size_t n = ringbuf_bytes_used(rb);
+            if (end != n)
+                n = end + 1;
+            ringbuf_remove_from_tail(rb, n);
+            rb->dropped += n;
+        }
+#if RINGBUF_WATERMARKS
+        rb->level = level;
+#endif
+        return 1;
+
+    case RINGBUF_BLOCK:
+        return 0;
+
+    default:
+        break;
+    }
+
+    /* The write is discarded. */
+    rb->dropped += count;
+    return 0;
+#else
+    ringbuf_drop_oldest(rb, count);
+    return 1;
+#endif
+}
+
 uint8_t
 ringbuf_peek(ringbuf_t rb, size_t offset)
 {
@@ -380,12 +1151,194 @@ ringbuf_peek(ringbuf_t rb, size_t offset)
     if (offset > bytes_used)
         return 255;
     
-    const uint8_t *bufend = ringbuf_end(rb);
     uint8_t *address;
-    if ((rb->tail + offset) >= bufend)
-        address = rb->buf + (offset - (bufend - rb->tail));
+    size_t n = ringbuf_contig(rb, rb->tail);
+    if (offset >= n)
+        address = rb->buf + (offset - n);
     else
         address = rb->tail + offset;
     
     return *address;
 }
+
+
+void *
+ringbuf_peek_into(void *dst, const struct ringbuf_t *src, size_t offset,
+                  size_t count)
+{
+    if (offset > ringbuf_bytes_used(src)
+        || count > ringbuf_bytes_used(src) - offset)
+        return 0;
+
+    uint8_t *u8dst = dst;
+    const uint8_t *p = src->buf +
+        (((src->tail - src->buf) + offset) % ringbuf_buffer_size(src));
+    while (count) {
+        size_t n = MIN(ringbuf_contig(src, p), count);
+        ringbuf_copy_from_ring(u8dst, p, n);
+        u8dst += n;
+        count -= n;
+        p = src->buf;
+    }
+    return dst;
+}
+
+
+void *
+ringbuf_advance_head(ringbuf_t rb, size_t count)
+{
+    if (count > ringbuf_bytes_free(rb))
+        return 0;
+
+    const uint8_t *bufend = ringbuf_end(rb);
+    rb->head += count;
+
+    /* wrap ? */
+    if (rb->head >= bufend)
+        rb->head -= ringbuf_buffer_size(rb);
+
+    ringbuf_moved(rb);
+    return rb->head;
+}
+
+
+/*
+ * Rotate the contents of the ring buffer's contiguous buffer so that
+ * the byte at the tail pointer moves to offset new_tail (three
+ * reversals, in place). Used bytes keep their order.
+ */
+static void
+ringbuf_reverse(uint8_t *p, uint8_t *q)
+{
+    while (p < q) {
+        uint8_t t = *p;
+        *p++ = *--q;
+        *q = t;
+    }
+}
+
+static void
+ringbuf_rotate(ringbuf_t rb, size_t new_tail)
+{
+    size_t size = ringbuf_buffer_size(rb);
+    size_t used = ringbuf_bytes_used(rb);
+    size_t k = (new_tail + size - (rb->tail - rb->buf)) % size;
+
+    if (k && used) {
+        ringbuf_reverse(rb->buf, rb->buf + size);
+        ringbuf_reverse(rb->buf, rb->buf + k);
+        ringbuf_reverse(rb->buf + k, rb->buf + size);
+    }
+    rb->tail = rb->buf + new_tail;
+    rb->head = rb->buf + (new_tail + used) % size;
+}
+
+size_t
+ringbuf_lend(ringbuf_t from, ringbuf_t to, size_t count)
+{
+#ifdef RINGBUF_HAVE_MIRROR
+    if (from->mirrored || to->mirrored)
+        return 0;
+#endif
+    count = MIN(count, ringbuf_bytes_free(from));
+    if (count == 0)
+        return 0;
+
+    /*
+     * The receiving ring buffer grows on the side of the boundary;
+     * its used bytes must not wrap around that side.
+     */
+    if (to->head < to->tail)
+        ringbuf_rotate(to, 0);
+
+    if (from->buf + ringbuf_buffer_size(from) == to->buf) {
+        /* from shrinks at its end: its used bytes must lie below it. */
+        size_t new_size = ringbuf_buffer_size(from) - count;
+        if (from->head < from->tail || from->head >= from->buf + new_size)
+            ringbuf_rotate(from, 0);
+        from->size = new_size;
+        to->buf -= count;
+        to->size += count;
+    } else if (to->buf + ringbuf_buffer_size(to) == from->buf) {
+        /* from shrinks at its start: its used bytes must lie above it. */
+        if (from->head < from->tail || from->tail < from->buf + count)
+            ringbuf_rotate(from, count);
+        from->buf += count;
+        from->size -= count;
+        to->size += count;
+    } else
+        return 0;
+
+    return count;
+}
+
+#ifdef RINGBUF_HAVE_IOVEC
+int
+ringbuf_head_iov(const struct ringbuf_t *rb, struct iovec iov[2], size_t count)
+{
+    count = MIN(count, ringbuf_bytes_free(rb));
+    if (count == 0)
+        return 0;
+
+    size_t n = MIN(ringbuf_contig(rb, rb->head), count);
+    iov[0].iov_base = rb->head;
+    iov[0].iov_len = n;
+    if (n == count)
+        return 1;
+
+    iov[1].iov_base = rb->buf;
+    iov[1].iov_len = count - n;
+    return 2;
+}
+
+int
+ringbuf_tail_iov(const struct ringbuf_t *rb, struct iovec iov[2], size_t count)
+{
+    count = MIN(count, ringbuf_bytes_used(rb));
+    if (count == 0)
+        return 0;
+
+    size_t n = MIN(ringbuf_contig(rb, rb->tail), count);
+    iov[0].iov_base = rb->tail;
+    iov[0].iov_len = n;
+    if (n == count)
+        return 1;
+
+    iov[1].iov_base = rb->buf;
+    iov[1].iov_len = count - n;
+    return 2;
+}
+
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count)
+{
+    struct iovec iov[2];
+    int iovcnt = ringbuf_head_iov(rb, iov, count);
+    if (iovcnt == 0)
+        return 0;
+
+    ssize_t n = readv(fd, iov, iovcnt);
+    if (n > 0)
+        ringbuf_advance_head(rb, n);
+
+    return n;
+}
+
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count)
+{
+    struct iovec iov[2];
+    if (count > ringbuf_bytes_used(rb))
+        return 0;
+
+    int iovcnt = ringbuf_tail_iov(rb, iov, count);
+    if (iovcnt == 0)
+        return 0;
+
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n > 0)
+        ringbuf_remove_from_tail(rb, n);
+
+    return n;
+}
+#endif /* RINGBUF_HAVE_IOVEC */
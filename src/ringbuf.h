@@ -27,8 +27,99 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+/*
+ * The scatter/gather functions need struct iovec, which embedded
+ * toolchains don't provide.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define RINGBUF_HAVE_IOVEC 1
+#include <sys/uio.h>
+#endif
+
+/*
+ * Mirrored buffers (see ringbuf_new_mirrored) need memfd_create(2).
+ */
+#if defined(__linux__)
+#define RINGBUF_HAVE_MIRROR 1
+#endif
+
+/*
+ * Overflow policies (ringbuf_set_policy) and their accounting add a
+ * few bytes to every ring buffer. Define RINGBUF_POLICIES to 0 to
+ * leave them out: ring buffers then always drop their oldest bytes.
+ */
+#ifndef RINGBUF_POLICIES
+#define RINGBUF_POLICIES 1
+#endif
+
+/*
+ * Watermarks (ringbuf_set_watermarks) add their levels, callback and
+ * events to every ring buffer, and a test to every pointer move.
+ * Define RINGBUF_WATERMARKS to 0 to leave them out.
+ */
+#ifndef RINGBUF_WATERMARKS
+#define RINGBUF_WATERMARKS 1
+#endif
+
+/*
+ * What a write does when there isn't enough free space for it (see
+ * ringbuf_set_policy):
+ *
+ * RINGBUF_DROP_OLDEST: the oldest bytes are overwritten (default).
+ * RINGBUF_DROP_NEWEST: the whole write is discarded.
+ * RINGBUF_DROP_RECORD: the oldest whole records are discarded until
+ * the write fits (see ringbuf_set_policy).
+ * RINGBUF_BLOCK: the write is refused, without being counted as
+ * dropped; the caller waits for room and tries again.
+ */
+typedef enum
+{
+    RINGBUF_DROP_OLDEST = 0,
+    RINGBUF_DROP_NEWEST,
+    RINGBUF_DROP_RECORD,
+    RINGBUF_BLOCK
+} ringbuf_policy_t;
+
+#if RINGBUF_WATERMARKS
+/*
+ * Watermark events (see ringbuf_set_watermarks).
+ */
+#define RINGBUF_HIGH_WATERMARK 1u
+#define RINGBUF_LOW_WATERMARK 2u
+
+typedef void (*ringbuf_watermark_t)(void *context, unsigned event);
+#endif
+
+/*
+ * The structure is only visible so that the single-byte functions
+ * (ringbuf_putc, ringbuf_getc) can be inlined. Don't access its
+ * fields directly.
+ */
+struct ringbuf_t
+{
+    uint8_t *buf;
+    uint8_t *head, *tail;
+    size_t size;
+#if RINGBUF_POLICIES
+    size_t dropped;
+    uint8_t policy;
+    uint8_t record_end;
+#endif
+#if RINGBUF_WATERMARKS
+    uint8_t level;
+    uint8_t events;
+    size_t low, high;
+    ringbuf_watermark_t watermark;
+    void *watermark_context;
+#endif
+#ifdef RINGBUF_HAVE_MIRROR
+    int mirrored;
+#endif
+};
+
 typedef struct ringbuf_t *ringbuf_t;
 
 /*
@@ -42,6 +133,45 @@ typedef struct ringbuf_t *ringbuf_t;
 ringbuf_t
 ringbuf_new(size_t capacity);
 
+/*
+ * Create two ring buffers, a and b, sharing a single internal buffer
+ * (a's bytes, then b's). Capacity can then be moved from one to the
+ * other at run time with ringbuf_lend. Free them with
+ * ringbuf_free_shared, not ringbuf_free.
+ *
+ * Returns 1, or 0 (and a and b are set to 0) if there's not enough
+ * memory.
+ */
+int
+ringbuf_new_shared(ringbuf_t *a, ringbuf_t *b,
+                   size_t capacity_a, size_t capacity_b);
+
+void
+ringbuf_free_shared(ringbuf_t *a, ringbuf_t *b);
+
+#ifdef RINGBUF_HAVE_MIRROR
+/*
+ * Create a new ring buffer whose internal buffer is mapped twice,
+ * back-to-back, in virtual memory. Every readable or writable region
+ * of the ring buffer is then contiguous: the functions below never
+ * need to split a copy or a search at the end of the buffer, and a
+ * parser can access the ringbuf_bytes_used bytes starting at
+ * ringbuf_tail as a single array.
+ *
+ * The internal buffer size is rounded up to a multiple of the page
+ * size, so the usable capacity may be larger than requested. Use
+ * ringbuf_free as usual.
+ *
+ * Returns the new ring buffer object, or 0 if the mappings couldn't
+ * be created.
+ */
+ringbuf_t
+ringbuf_new_mirrored(size_t capacity);
+
+int
+ringbuf_is_mirrored(const struct ringbuf_t *rb);
+#endif /* RINGBUF_HAVE_MIRROR */
+
 /*
  * The size of the internal buffer, in bytes. One or more bytes may be
  * unusable in order to distinguish the "buffer full" state from the
@@ -94,6 +224,134 @@ ringbuf_is_full(const struct ringbuf_t *rb);
 int
 ringbuf_is_empty(const struct ringbuf_t *rb);
 
+#if RINGBUF_WATERMARKS
+/*
+ * Register low and high watermarks, in bytes used (low < high). When
+ * an operation moves the head or tail pointer so that the number of
+ * bytes used goes from below high to high or more, the
+ * RINGBUF_HIGH_WATERMARK event is raised; from above low to low or
+ * less, RINGBUF_LOW_WATERMARK. Nothing is evaluated unless a pointer
+ * moves, and nothing at all without watermarks.
+ *
+ * An event calls callback (if not 0) right away, from whichever side
+ * moved the pointer (an interrupt, for instance), and is also kept
+ * until read with ringbuf_watermark_events. The callback may use the
+ * ring buffer. Each operation that moves a pointer updates the level
+ * and the kept events: if both sides do, as with a reader and an
+ * interrupt, serialize every operation (not only the writes), or
+ * neither the events nor the callbacks can be trusted.
+ *
+ * Use ringbuf_clear_watermarks to remove them.
+ */
+void
+ringbuf_set_watermarks(ringbuf_t rb, size_t low, size_t high,
+                       ringbuf_watermark_t callback, void *context);
+
+void
+ringbuf_clear_watermarks(ringbuf_t rb);
+
+/*
+ * Return the watermark events raised since the last call (a
+ * combination of RINGBUF_HIGH_WATERMARK and RINGBUF_LOW_WATERMARK),
+ * and forget them.
+ */
+unsigned
+ringbuf_watermark_events(ringbuf_t rb);
+
+/*
+ * Evaluate the watermarks after the head or tail pointer moved. The
+ * ring buffer functions call it; you shouldn't need to.
+ */
+#define RINGBUF_NO_WATERMARKS 0xFF
+
+void
+ringbuf_check_watermarks(ringbuf_t rb);
+#endif /* RINGBUF_WATERMARKS */
+
+/*
+ * Copy the byte c to the ring buffer's head pointer. Unlike
+ * ringbuf_memcpy_into, a full ring buffer is not overwritten.
+ *
+ * Returns 1, or 0 (and c is not copied) if the ring buffer is full.
+ */
+static inline int
+ringbuf_putc(ringbuf_t rb, uint8_t c)
+{
+    uint8_t *next = rb->head + 1;
+    if (next == rb->buf + rb->size)
+        next = rb->buf;
+    if (next == rb->tail)
+        return 0;
+
+    *rb->head = c;
+    rb->head = next;
+#if RINGBUF_WATERMARKS
+    if (rb->level != RINGBUF_NO_WATERMARKS)
+        ringbuf_check_watermarks(rb);
+#endif
+    return 1;
+}
+
+/*
+ * Remove the byte at the ring buffer's tail pointer and copy it to c.
+ *
+ * Returns 1, or 0 if the ring buffer is empty.
+ */
+static inline int
+ringbuf_getc(ringbuf_t rb, uint8_t *c)
+{
+    if (rb->tail == rb->head)
+        return 0;
+
+    *c = *rb->tail;
+    uint8_t *next = rb->tail + 1;
+    rb->tail = next == rb->buf + rb->size ? rb->buf : next;
+#if RINGBUF_WATERMARKS
+    if (rb->level != RINGBUF_NO_WATERMARKS)
+        ringbuf_check_watermarks(rb);
+#endif
+    return 1;
+}
+
+#if RINGBUF_POLICIES
+/*
+ * Set the overflow policy of the ring buffer (RINGBUF_DROP_OLDEST
+ * when created). With RINGBUF_DROP_RECORD, records end with the byte
+ * record_end; bytes of an unterminated record at the tail are
+ * discarded together if discarding complete records isn't enough.
+ * The policy applies to ringbuf_memcpy_into, ringbuf_memset and
+ * ringbuf_copy (not to ringbuf_putc, which never overwrites, nor to
+ * ringbuf_read).
+ */
+void
+ringbuf_set_policy(ringbuf_t rb, ringbuf_policy_t policy, int record_end);
+
+ringbuf_policy_t
+ringbuf_policy(const struct ringbuf_t *rb);
+
+/*
+ * The number of bytes dropped by the overflow policy since the ring
+ * buffer was created (overwritten or discarded old bytes, and
+ * discarded writes).
+ */
+size_t
+ringbuf_dropped(const struct ringbuf_t *rb);
+#endif /* RINGBUF_POLICIES */
+
+/*
+ * Apply the overflow policy to make room for a write of count bytes,
+ * so that the write can then be done in several parts (a header and a
+ * payload, for instance) and is kept or dropped as a whole.
+ *
+ * Returns 1 if count bytes can be written (old bytes may have been
+ * dropped), or 0 if the write must not be done: the ring buffer is
+ * full and its policy is RINGBUF_BLOCK, or the write has been counted
+ * as dropped. Without RINGBUF_POLICIES, the oldest bytes are dropped
+ * and 1 is returned.
+ */
+int
+ringbuf_make_room(ringbuf_t rb, size_t count);
+
 /*
  * Const access to the head and tail pointers of the ring buffer.
  */
@@ -117,6 +375,29 @@ ringbuf_head(const struct ringbuf_t *rb);
 size_t
 ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset);
 
+/*
+ * Like ringbuf_findchr, but locate the first byte that is any of the
+ * nset bytes in set. On x86 host builds, sets of up to 8 bytes are
+ * searched with SSE2/AVX2, selected at run time (the RINGBUF_SIMD
+ * environment variable, "sse2" or "scalar", limits the choice).
+ */
+size_t
+ringbuf_findset(const struct ringbuf_t *rb, const uint8_t *set, size_t nset,
+                size_t offset);
+
+/*
+ * Locate the first occurrence of the len-byte pattern in ring buffer
+ * rb, beginning the search at offset bytes from the ring buffer's
+ * tail pointer. The pattern may straddle the end of the contiguous
+ * buffer. Returns the offset of the first byte of the pattern from
+ * the tail pointer, or the number of bytes used in the ring buffer if
+ * the pattern does not occur. On x86 host builds the search uses
+ * SSE2/AVX2, selected at run time.
+ */
+size_t
+ringbuf_findmem(const struct ringbuf_t *rb, const void *pattern, size_t len,
+                size_t offset);
+
 /*
  * Beginning at ring buffer dst's head pointer, fill the ring buffer
  * with a repeating sequence of len bytes, each of value c (converted
@@ -135,6 +416,11 @@ ringbuf_findchr(const struct ringbuf_t *rb, int c, size_t offset);
  *
  * Returns the actual number of bytes written to dst: len, if
  * len < ringbuf_buffer_size(dst), else ringbuf_buffer_size(dst).
+ *
+ * Overwriting old data is the default RINGBUF_DROP_OLDEST policy; with
+ * another policy (see ringbuf_set_policy), a write that doesn't fit
+ * follows that policy and the function returns 0 if nothing was
+ * written.
  */
 size_t
 ringbuf_memset(ringbuf_t dst, int c, size_t len);
@@ -151,10 +437,27 @@ ringbuf_memset(ringbuf_t dst, int c, size_t len);
  * needed. However, note that, if calling the function results in an
  * overflow, the value of the ring buffer's tail pointer may be
  * different than it was before the function was called.
+ *
+ * Overwriting old data is the default RINGBUF_DROP_OLDEST policy; with
+ * another policy (see ringbuf_set_policy), a write that doesn't fit
+ * follows that policy and the function returns 0 if nothing was
+ * copied.
  */
 void *
 ringbuf_memcpy_into(ringbuf_t dst, const void *src, size_t count);
 
+/*
+ * Copy up to count bytes from a contiguous memory area src into the
+ * ring buffer dst, but never more than the number of free bytes in
+ * dst. Returns the number of bytes copied.
+ *
+ * Unlike ringbuf_memcpy_into, this function will *not* allow the ring
+ * buffer to overflow: the tail pointer is never modified, and bytes
+ * that don't fit are simply not copied.
+ */
+size_t
+ringbuf_memcpy_into_nooverflow(ringbuf_t dst, const void *src, size_t count);
+
 /*
  * This convenience function calls read(2) on the file descriptor fd,
  * using the ring buffer rb as the destination buffer for the read,
@@ -236,6 +539,11 @@ ringbuf_write(int fd, ringbuf_t rb, size_t count);
  * It is *not* possible to underflow src; if count is greater than the
  * number of bytes used in src, no bytes are copied, and the function
  * returns 0.
+ *
+ * Overwriting old data is dst's default RINGBUF_DROP_OLDEST policy;
+ * with another policy (see ringbuf_set_policy), a copy that doesn't
+ * fit follows that policy and the function returns 0 if nothing was
+ * copied (src is then left untouched).
  */
 void *
 ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count);
@@ -244,8 +552,94 @@ ringbuf_copy(ringbuf_t dst, ringbuf_t src, size_t count);
 void *
 ringbuf_remove_from_tail(ringbuf_t rb, size_t count);
 
+/*
+ * Mark count bytes, already written at the ring buffer's head pointer
+ * by other means (e.g., see ringbuf_head_iov), as used. Returns the
+ * ring buffer's new head pointer.
+ *
+ * This function will *not* allow the ring buffer to overflow. If
+ * count is greater than the number of free bytes in the ring buffer,
+ * the head pointer is not moved, and the function will return 0.
+ */
+void *
+ringbuf_advance_head(ringbuf_t rb, size_t count);
+
 uint8_t
 ringbuf_peek(ringbuf_t rb, size_t offset);
 
+/*
+ * Copy count bytes, starting offset bytes after the tail pointer,
+ * from ring buffer src into dst without removing them from src.
+ *
+ * Returns dst, or 0 (and nothing is copied) if offset + count is
+ * greater than the number of bytes used in src.
+ */
+void *
+ringbuf_peek_into(void *dst, const struct ringbuf_t *src, size_t offset,
+                  size_t count);
+
+/*
+ * Move up to count bytes of capacity from ring buffer from to ring
+ * buffer to, created together by ringbuf_new_shared. Only free bytes
+ * of from can be lent; used bytes are kept, in order, in both ring
+ * buffers, although they may be moved within their internal buffers
+ * (their head and tail pointers change). Neither ring buffer may be
+ * accessed at the same time, even by a reader.
+ *
+ * Returns the number of bytes of capacity moved (0 if from is full or
+ * the ring buffers don't share an internal buffer).
+ */
+size_t
+ringbuf_lend(ringbuf_t from, ringbuf_t to, size_t count);
+
+#ifdef RINGBUF_HAVE_IOVEC
+/*
+ * Describe, in up to two segments, the free space of ring buffer rb
+ * starting at its head pointer, limited to count bytes. Returns the
+ * number of segments filled in iov (0 if the ring buffer is full).
+ *
+ * Nothing is modified: once data was copied into the segments (e.g.,
+ * by readv(2) or an asynchronous read), call ringbuf_advance_head
+ * with the number of bytes copied.
+ */
+int
+ringbuf_head_iov(const struct ringbuf_t *rb, struct iovec iov[2], size_t count);
+
+/*
+ * Describe, in up to two segments, the used bytes of ring buffer rb
+ * starting at its tail pointer, limited to count bytes. Returns the
+ * number of segments filled in iov (0 if the ring buffer is empty).
+ *
+ * Nothing is modified: once data was copied from the segments (e.g.,
+ * by writev(2) or an asynchronous write), call
+ * ringbuf_remove_from_tail with the number of bytes copied.
+ */
+int
+ringbuf_tail_iov(const struct ringbuf_t *rb, struct iovec iov[2], size_t count);
+
+/*
+ * Like ringbuf_read, but calls readv(2) once with both segments of
+ * the free space, so the read isn't cut short where the free space
+ * wraps around the end of the internal buffer. It will never read
+ * more than the number of free bytes in rb, nor more than count: the
+ * ring buffer can *not* overflow with this function. If rb is full,
+ * readv(2) isn't called and the function returns 0.
+ */
+ssize_t
+ringbuf_readv(int fd, ringbuf_t rb, size_t count);
+
+/*
+ * Like ringbuf_write, but calls writev(2) once with both segments of
+ * the used bytes, so the write isn't cut short where the data wraps
+ * around the end of the internal buffer.
+ *
+ * If count is greater than the number of bytes used in the ring
+ * buffer, no bytes are written to the file descriptor, and the
+ * function will return 0.
+ */
+ssize_t
+ringbuf_writev(int fd, ringbuf_t rb, size_t count);
+#endif /* RINGBUF_HAVE_IOVEC */
+
 
 #endif /* INCLUDED_RINGBUF_H */
@@ -0,0 +1,302 @@
+/*******************************************************************************
+*
+* Compact ring buffers with 16-bit indices.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+*
+********************************************************************************
+*
+* Summary:
+*  Implementation of ringbuf16.h. Functions follow ringbuf.c one for one,
+*  with offsets into the embedded storage instead of pointers.
+*
+*******************************************************************************/
+
+#include "ringbuf16.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+/*
+ * Number of bytes that can be accessed contiguously starting at
+ * offset, up to the end of the storage.
+ */
+static size_t
+ringbuf16_contig(const struct ringbuf16_t *rb, uint16_t offset)
+{
+    return rb->size - offset;
+}
+
+/*
+ * Move an offset forward by count bytes (at most the buffer size),
+ * wrapping at the end of the storage.
+ */
+static uint16_t
+ringbuf16_advance(const struct ringbuf16_t *rb, uint16_t offset, size_t count)
+{
+    size_t next = offset + count;
+    if (next >= rb->size)
+        next -= rb->size;
+    return (uint16_t)next;
+}
+
+/*
+ * After an overflow, the oldest bytes have been overwritten: the tail
+ * is right after the head and the ring buffer is full.
+ */
+static void
+ringbuf16_fix_overflow(ringbuf16_t rb)
+{
+    rb->tail = ringbuf16_advance(rb, rb->head, 1);
+}
+
+ringbuf16_t
+ringbuf16_init(void *storage, size_t capacity)
+{
+    if (!storage || capacity > RINGBUF16_MAX_CAPACITY)
+        return 0;
+
+    ringbuf16_t rb = storage;
+
+    /* One byte is used for detecting the full condition. */
+    rb->size = (uint16_t)(capacity + 1);
+    ringbuf16_reset(rb);
+    return rb;
+}
+
+ringbuf16_t
+ringbuf16_new(size_t capacity)
+{
+    if (capacity > RINGBUF16_MAX_CAPACITY)
+        return 0;
+
+    return ringbuf16_init(malloc(RINGBUF16_STORAGE_SIZE(capacity)), capacity);
+}
+
+void
+ringbuf16_free(ringbuf16_t *rb)
+{
+    free(*rb);
+    *rb = 0;
+}
+
+void
+ringbuf16_reset(ringbuf16_t rb)
+{
+    rb->head = rb->tail = 0;
+}
+
+size_t
+ringbuf16_buffer_size(const struct ringbuf16_t *rb)
+{
+    return rb->size;
+}
+
+size_t
+ringbuf16_capacity(const struct ringbuf16_t *rb)
+{
+    return rb->size - 1u;
+}
+
+size_t
+ringbuf16_bytes_free(const struct ringbuf16_t *rb)
+{
+    if (rb->head >= rb->tail)
+        return ringbuf16_capacity(rb) - (rb->head - rb->tail);
+    else
+        return rb->tail - rb->head - 1u;
+}
+
+size_t
+ringbuf16_bytes_used(const struct ringbuf16_t *rb)
+{
+    return ringbuf16_capacity(rb) - ringbuf16_bytes_free(rb);
+}
+
+int
+ringbuf16_is_full(const struct ringbuf16_t *rb)
+{
+    return ringbuf16_bytes_free(rb) == 0;
+}
+
+int
+ringbuf16_is_empty(const struct ringbuf16_t *rb)
+{
+    return rb->head == rb->tail;
+}
+
+const void *
+ringbuf16_tail(const struct ringbuf16_t *rb)
+{
+    return rb->buf + rb->tail;
+}
+
+const void *
+ringbuf16_head(const struct ringbuf16_t *rb)
+{
+    return rb->buf + rb->head;
+}
+
+size_t
+ringbuf16_findchr(const struct ringbuf16_t *rb, int c, size_t offset)
+{
+    size_t bytes_used = ringbuf16_bytes_used(rb);
+
+    while (offset < bytes_used) {
+        uint16_t start = ringbuf16_advance(rb, rb->tail, offset);
+        size_t n = MIN(ringbuf16_contig(rb, start), bytes_used - offset);
+        const uint8_t *found = memchr(rb->buf + start, c, n);
+        if (found)
+            return offset + (found - (rb->buf + start));
+        offset += n;
+    }
+    return bytes_used;
+}
+
+size_t
+ringbuf16_memset(ringbuf16_t dst, int c, size_t len)
+{
+    size_t nwritten = 0;
+    size_t count = MIN(len, ringbuf16_buffer_size(dst));
+    int overflow = count > ringbuf16_bytes_free(dst);
+
+    while (nwritten != count) {
+        size_t n = MIN(ringbuf16_contig(dst, dst->head), count - nwritten);
+        memset(dst->buf + dst->head, c, n);
+        dst->head = ringbuf16_advance(dst, dst->head, n);
+        nwritten += n;
+    }
+
+    if (overflow)
+        ringbuf16_fix_overflow(dst);
+
+    return nwritten;
+}
+
+void *
+ringbuf16_memcpy_into(ringbuf16_t dst, const void *src, size_t count)
+{
+    const uint8_t *u8src = src;
+    int overflow = count > ringbuf16_bytes_free(dst);
+    size_t nread = 0;
+
+    while (nread != count) {
+        size_t n = MIN(ringbuf16_contig(dst, dst->head), count - nread);
+        memcpy(dst->buf + dst->head, u8src + nread, n);
+        dst->head = ringbuf16_advance(dst, dst->head, n);
+        nread += n;
+    }
+
+    if (overflow)
+        ringbuf16_fix_overflow(dst);
+
+    return dst->buf + dst->head;
+}
+
+size_t
+ringbuf16_memcpy_into_nooverflow(ringbuf16_t dst, const void *src,
+                                 size_t count)
+{
+    count = MIN(count, ringbuf16_bytes_free(dst));
+    ringbuf16_memcpy_into(dst, src, count);
+    return count;
+}
+
+void *
+ringbuf16_memcpy_from(void *dst, ringbuf16_t src, size_t count)
+{
+    if (count > ringbuf16_bytes_used(src))
+        return 0;
+
+    uint8_t *u8dst = dst;
+    size_t nwritten = 0;
+    while (nwritten != count) {
+        size_t n = MIN(ringbuf16_contig(src, src->tail), count - nwritten);
+        memcpy(u8dst + nwritten, src->buf + src->tail, n);
+        src->tail = ringbuf16_advance(src, src->tail, n);
+        nwritten += n;
+    }
+
+    return src->buf + src->tail;
+}
+
+void *
+ringbuf16_copy(ringbuf16_t dst, ringbuf16_t src, size_t count)
+{
+    if (count > ringbuf16_bytes_used(src))
+        return 0;
+    int overflow = count > ringbuf16_bytes_free(dst);
+
+    size_t ncopied = 0;
+    while (ncopied != count) {
+        size_t nsrc = MIN(ringbuf16_contig(src, src->tail), count - ncopied);
+        size_t n = MIN(ringbuf16_contig(dst, dst->head), nsrc);
+        memcpy(dst->buf + dst->head, src->buf + src->tail, n);
+        src->tail = ringbuf16_advance(src, src->tail, n);
+        dst->head = ringbuf16_advance(dst, dst->head, n);
+        ncopied += n;
+    }
+
+    if (overflow)
+        ringbuf16_fix_overflow(dst);
+
+    return dst->buf + dst->head;
+}
+
+void *
+ringbuf16_remove_from_tail(ringbuf16_t rb, size_t count)
+{
+    if (count > ringbuf16_bytes_used(rb))
+        return 0;
+
+    rb->tail = ringbuf16_advance(rb, rb->tail, count);
+    return rb->buf + rb->tail;
+}
+
+void *
+ringbuf16_advance_head(ringbuf16_t rb, size_t count)
+{
+    if (count > ringbuf16_bytes_free(rb))
+        return 0;
+
+    rb->head = ringbuf16_advance(rb, rb->head, count);
+    return rb->buf + rb->head;
+}
+
+uint8_t
+ringbuf16_peek(ringbuf16_t rb, size_t offset)
+{
+    if (offset > ringbuf16_bytes_used(rb))
+        return 255;
+
+    return rb->buf[ringbuf16_advance(rb, rb->tail, offset)];
+}
+
+/* [] END OF FILE */
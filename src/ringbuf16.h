@@ -0,0 +1,214 @@
+/*******************************************************************************
+*
+* Compact ring buffers with 16-bit indices.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Same FIFO as ringbuf.h, for parts with a few KB of SRAM. The descriptor
+*  holds 16-bit head/tail indices and the size (6 bytes instead of three
+*  pointers and a size_t, 16 bytes on Cortex-M) and the storage follows it
+*  in the same block: one malloc per ring instead of two, or no heap at
+*  all with ringbuf16_init() on a static array.
+*
+*  Capacity is limited to RINGBUF16_MAX_CAPACITY bytes. The file
+*  descriptor, scatter/gather and multi-byte search functions of
+*  ringbuf.h are host-only and not provided.
+*
+*  RAM per ring, Cortex-M (newlib-nano malloc, 8 bytes per block):
+*    ringbuf_t                   16 + 1 + 2 x 8 = 33 bytes + capacity
+*    ringbuf16_t (ringbuf16_new)  6 + 1 + 8     = 15 bytes + capacity
+*    ringbuf16_t (static)         6 + 1         =  7 bytes + capacity
+*
+*  Example:
+*    static RINGBUF16_STORAGE(log_storage, 256);
+*    ringbuf16_t log = ringbuf16_init(log_storage, 256);
+*    ringbuf16_putc(log, c);
+*
+*******************************************************************************/
+
+#ifndef INCLUDED_RINGBUF16_H
+#define INCLUDED_RINGBUF16_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * As in ringbuf.h, one byte of the storage is never used, to tell a
+ * full buffer from an empty one. Head and tail are offsets into buf.
+ */
+struct ringbuf16_t
+{
+    uint16_t head, tail;
+    uint16_t size;
+    uint8_t buf[];
+};
+
+typedef struct ringbuf16_t *ringbuf16_t;
+
+#define RINGBUF16_MAX_CAPACITY (UINT16_MAX - 1u)
+
+/*
+ * Bytes needed by a ring of the given capacity, descriptor included.
+ */
+#define RINGBUF16_STORAGE_SIZE(capacity) \
+    (sizeof(struct ringbuf16_t) + (capacity) + 1)
+
+/*
+ * Declare a suitably aligned array to pass to ringbuf16_init.
+ */
+#define RINGBUF16_STORAGE(name, capacity) \
+    uint16_t name[(RINGBUF16_STORAGE_SIZE(capacity) + 1) / 2]
+
+/*
+ * Allocate a ring buffer and its storage in a single block.
+ *
+ * Returns the new ring buffer, or 0 if there's not enough memory or
+ * the capacity is larger than RINGBUF16_MAX_CAPACITY.
+ */
+ringbuf16_t
+ringbuf16_new(size_t capacity);
+
+/*
+ * Create a ring buffer in caller-provided storage of at least
+ * RINGBUF16_STORAGE_SIZE(capacity) bytes, aligned for uint16_t (see
+ * RINGBUF16_STORAGE). Don't call ringbuf16_free on it.
+ *
+ * Returns the ring buffer (at the start of the storage), or 0 if the
+ * capacity is larger than RINGBUF16_MAX_CAPACITY.
+ */
+ringbuf16_t
+ringbuf16_init(void *storage, size_t capacity);
+
+/*
+ * Deallocate a ring buffer created with ringbuf16_new, and set the
+ * pointer to 0.
+ */
+void
+ringbuf16_free(ringbuf16_t *rb);
+
+void
+ringbuf16_reset(ringbuf16_t rb);
+
+size_t
+ringbuf16_buffer_size(const struct ringbuf16_t *rb);
+
+size_t
+ringbuf16_capacity(const struct ringbuf16_t *rb);
+
+size_t
+ringbuf16_bytes_free(const struct ringbuf16_t *rb);
+
+size_t
+ringbuf16_bytes_used(const struct ringbuf16_t *rb);
+
+int
+ringbuf16_is_full(const struct ringbuf16_t *rb);
+
+int
+ringbuf16_is_empty(const struct ringbuf16_t *rb);
+
+/*
+ * Copy the byte c to the head. A full ring buffer is not overwritten.
+ *
+ * Returns 1, or 0 (and c is not copied) if the ring buffer is full.
+ */
+static inline int
+ringbuf16_putc(ringbuf16_t rb, uint8_t c)
+{
+    uint16_t next = rb->head + 1;
+    if (next == rb->size)
+        next = 0;
+    if (next == rb->tail)
+        return 0;
+
+    rb->buf[rb->head] = c;
+    rb->head = next;
+    return 1;
+}
+
+/*
+ * Remove the byte at the tail and copy it to c.
+ *
+ * Returns 1, or 0 if the ring buffer is empty.
+ */
+static inline int
+ringbuf16_getc(ringbuf16_t rb, uint8_t *c)
+{
+    if (rb->tail == rb->head)
+        return 0;
+
+    *c = rb->buf[rb->tail];
+    uint16_t next = rb->tail + 1;
+    rb->tail = next == rb->size ? 0 : next;
+    return 1;
+}
+
+const void *
+ringbuf16_tail(const struct ringbuf16_t *rb);
+
+const void *
+ringbuf16_head(const struct ringbuf16_t *rb);
+
+/*
+ * The following functions behave exactly like their ringbuf.h
+ * counterparts.
+ */
+size_t
+ringbuf16_findchr(const struct ringbuf16_t *rb, int c, size_t offset);
+
+size_t
+ringbuf16_memset(ringbuf16_t dst, int c, size_t len);
+
+void *
+ringbuf16_memcpy_into(ringbuf16_t dst, const void *src, size_t count);
+
+size_t
+ringbuf16_memcpy_into_nooverflow(ringbuf16_t dst, const void *src,
+                                 size_t count);
+
+void *
+ringbuf16_memcpy_from(void *dst, ringbuf16_t src, size_t count);
+
+void *
+ringbuf16_copy(ringbuf16_t dst, ringbuf16_t src, size_t count);
+
+void *
+ringbuf16_remove_from_tail(ringbuf16_t rb, size_t count);
+
+void *
+ringbuf16_advance_head(ringbuf16_t rb, size_t count);
+
+uint8_t
+ringbuf16_peek(ringbuf16_t rb, size_t offset);
+
+#endif /* INCLUDED_RINGBUF16_H */
+
+/* [] END OF FILE */
@@ -0,0 +1,267 @@
+/*******************************************************************************
+*
+* Fixed-size ring buffers generated at compile time.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  RINGBUF_STATIC_DEFINE(name, capacity) generates a ring buffer type,
+*  name_t, whose capacity is a compile-time constant, and static inline
+*  functions name_xxx() mirroring the ringbuf.h API. Since the size is a
+*  constant the compiler folds it into every operation: with a
+*  power-of-two capacity all index arithmetic is masks, otherwise it is
+*  compares (never divisions, which Cortex-M0 doesn't have). The storage
+*  is part of the structure, so a ring can be a static variable, and all
+*  'capacity' bytes are usable.
+*
+*  Use the dynamic ringbuf_t (ringbuf.h) for buffers sized at run time.
+*
+*  Example:
+*    RINGBUF_STATIC_DEFINE(log_ring, 256)
+*    static log_ring_t log;
+*    log_ring_putc(&log, c);
+*
+*******************************************************************************/
+
+#ifndef INCLUDED_RINGBUF_STATIC_H
+#define INCLUDED_RINGBUF_STATIC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Head and tail are positions in [0, 2 * capacity): a position and
+ * the same position plus capacity index the same byte, which tells a
+ * full buffer from an empty one without wasting a byte. With a
+ * power-of-two capacity these are plain masks.
+ */
+#define RINGBUF_STATIC_IS_POW2(capacity) (((capacity) & ((capacity) - 1)) == 0)
+
+#define RINGBUF_STATIC_DEFINE(name, capacity)                               \
+                                                                            \
+typedef struct                                                              \
+{                                                                           \
+    size_t head;                                                            \
+    size_t tail;                                                            \
+    uint8_t buf[capacity];                                                  \
+} name##_t;                                                                 \
+                                                                            \
+_Static_assert((capacity) > 0 && (capacity) <= SIZE_MAX / 2,                \
+               #name ": invalid capacity");                                 \
+                                                                            \
+/* Position 'pos' moved forward by n <= capacity bytes. */                  \
+static inline size_t                                                        \
+name##_advance_pos(size_t pos, size_t n)                                    \
+{                                                                           \
+    if (RINGBUF_STATIC_IS_POW2(capacity))                                   \
+        return (pos + n) & (2 * (capacity) - 1);                            \
+    pos += n;                                                               \
+    return pos >= 2 * (capacity) ? pos - 2 * (capacity) : pos;              \
+}                                                                           \
+                                                                            \
+/* Index of the byte at position 'pos'. */                                  \
+static inline size_t                                                        \
+name##_index(size_t pos)                                                    \
+{                                                                           \
+    if (RINGBUF_STATIC_IS_POW2(capacity))                                   \
+        return pos & ((capacity) - 1);                                      \
+    return pos >= (capacity) ? pos - (capacity) : pos;                      \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+name##_reset(name##_t *rb)                                                  \
+{                                                                           \
+    rb->head = rb->tail = 0;                                                \
+}                                                                           \
+                                                                            \
+static inline size_t                                                        \
+name##_capacity(void)                                                       \
+{                                                                           \
+    return (capacity);                                                      \
+}                                                                           \
+                                                                            \
+static inline size_t                                                        \
+name##_bytes_used(const name##_t *rb)                                       \
+{                                                                           \
+    if (RINGBUF_STATIC_IS_POW2(capacity))                                   \
+        return (rb->head - rb->tail) & (2 * (capacity) - 1);                \
+    return rb->head >= rb->tail ? rb->head - rb->tail                       \
+                                : rb->head + 2 * (capacity) - rb->tail;     \
+}                                                                           \
+                                                                            \
+static inline size_t                                                        \
+name##_bytes_free(const name##_t *rb)                                       \
+{                                                                           \
+    return (capacity) - name##_bytes_used(rb);                              \
+}                                                                           \
+                                                                            \
+static inline int                                                           \
+name##_is_empty(const name##_t *rb)                                         \
+{                                                                           \
+    return rb->head == rb->tail;                                            \
+}                                                                           \
+                                                                            \
+static inline int                                                           \
+name##_is_full(const name##_t *rb)                                          \
+{                                                                           \
+    return name##_bytes_used(rb) == (capacity);                             \
+}                                                                           \
+                                                                            \
+/* Append a byte. Returns 0 (and drops the byte) if the buffer is full. */  \
+static inline int                                                           \
+name##_putc(name##_t *rb, uint8_t c)                                        \
+{                                                                           \
+    if (name##_is_full(rb))                                                 \
+        return 0;                                                           \
+    rb->buf[name##_index(rb->head)] = c;                                    \
+    rb->head = name##_advance_pos(rb->head, 1);                             \
+    return 1;                                                               \
+}                                                                           \
+                                                                            \
+/* Remove the oldest byte. Returns 0 if the buffer is empty. */             \
+static inline int                                                           \
+name##_getc(name##_t *rb, uint8_t *c)                                       \
+{                                                                           \
+    if (name##_is_empty(rb))                                                \
+        return 0;                                                           \
+    *c = rb->buf[name##_index(rb->tail)];                                   \
+    rb->tail = name##_advance_pos(rb->tail, 1);                             \
+    return 1;                                                               \
+}                                                                           \
+                                                                            \
+/* Byte at 'offset' from the tail, or 255 if there's no such byte. */       \
+static inline uint8_t                                                       \
+name##_peek(const name##_t *rb, size_t offset)                              \
+{                                                                           \
+    if (offset >= name##_bytes_used(rb))                                    \
+        return 255;                                                         \
+    return rb->buf[name##_index(name##_advance_pos(rb->tail, offset))];     \
+}                                                                           \
+                                                                            \
+/* See ringbuf_findchr. */                                                  \
+static inline size_t                                                        \
+name##_findchr(const name##_t *rb, int c, size_t offset)                    \
+{                                                                           \
+    size_t bytes_used = name##_bytes_used(rb);                              \
+    while (offset < bytes_used) {                                           \
+        size_t start = name##_index(name##_advance_pos(rb->tail, offset));  \
+        size_t n = (capacity) - start;                                      \
+        if (n > bytes_used - offset)                                        \
+            n = bytes_used - offset;                                        \
+        const uint8_t *found = memchr(rb->buf + start, c, n);               \
+        if (found)                                                          \
+            return offset + (size_t)(found - (rb->buf + start));            \
+        offset += n;                                                        \
+    }                                                                       \
+    return bytes_used;                                                      \
+}                                                                           \
+                                                                            \
+/*                                                                          \
+ * See ringbuf_memcpy_into: on overflow the oldest bytes are                \
+ * overwritten.                                                             \
+ */                                                                         \
+static inline void                                                          \
+name##_memcpy_into(name##_t *rb, const void *src, size_t count)             \
+{                                                                           \
+    const uint8_t *u8src = src;                                             \
+    int overflow = count > name##_bytes_free(rb);                           \
+                                                                            \
+    /* only the last 'capacity' bytes would remain */                       \
+    if (count > (capacity)) {                                               \
+        u8src += count - (capacity);                                        \
+        count = (capacity);                                                 \
+    }                                                                       \
+                                                                            \
+    while (count) {                                                         \
+        size_t start = name##_index(rb->head);                              \
+        size_t n = (capacity) - start;                                      \
+        if (n > count)                                                      \
+            n = count;                                                      \
+        memcpy(rb->buf + start, u8src, n);                                  \
+        rb->head = name##_advance_pos(rb->head, n);                         \
+        u8src += n;                                                         \
+        count -= n;                                                         \
+    }                                                                       \
+                                                                            \
+    if (overflow)                                                           \
+        rb->tail = name##_advance_pos(rb->head, (capacity));                \
+}                                                                           \
+                                                                            \
+/* See ringbuf_memcpy_into_nooverflow. */                                   \
+static inline size_t                                                        \
+name##_memcpy_into_nooverflow(name##_t *rb, const void *src, size_t count)  \
+{                                                                           \
+    size_t bytes_free = name##_bytes_free(rb);                              \
+    if (count > bytes_free)                                                 \
+        count = bytes_free;                                                 \
+    name##_memcpy_into(rb, src, count);                                     \
+    return count;                                                           \
+}                                                                           \
+                                                                            \
+/*                                                                          \
+ * Remove 'count' bytes from the tail and copy them to dst (which may       \
+ * be 0 to only remove them). Returns 0, without removing anything, if      \
+ * there are fewer than 'count' bytes in the buffer.                        \
+ */                                                                         \
+static inline int                                                           \
+name##_memcpy_from(void *dst, name##_t *rb, size_t count)                   \
+{                                                                           \
+    uint8_t *u8dst = dst;                                                   \
+    if (count > name##_bytes_used(rb))                                      \
+        return 0;                                                           \
+                                                                            \
+    while (count) {                                                         \
+        size_t start = name##_index(rb->tail);                              \
+        size_t n = (capacity) - start;                                      \
+        if (n > count)                                                      \
+            n = count;                                                      \
+        if (u8dst) {                                                        \
+            memcpy(u8dst, rb->buf + start, n);                              \
+            u8dst += n;                                                     \
+        }                                                                   \
+        rb->tail = name##_advance_pos(rb->tail, n);                         \
+        count -= n;                                                         \
+    }                                                                       \
+    return 1;                                                               \
+}                                                                           \
+                                                                            \
+static inline int                                                           \
+name##_remove_from_tail(name##_t *rb, size_t count)                         \
+{                                                                           \
+    if (count > name##_bytes_used(rb))                                      \
+        return 0;                                                           \
+    rb->tail = name##_advance_pos(rb->tail, count);                         \
+    return 1;                                                               \
+}
+
+#endif /* INCLUDED_RINGBUF_STATIC_H */
+
+/* [] END OF FILE */
@@ -0,0 +1,189 @@
+#!/bin/sh
+#
+# Builds and runs the tests on a Linux host.
+#
+# The ring buffer and host tool tests are built once. The driver tests
+# (comm_driver.c, and comm_driver.hpp in C++) run against the simulated COMM
+# block of test/sim, once for every configuration listed at the end of this
+# file: a configuration is a copy of src/ in the build directory with some
+# macros of comm_driver.h changed.
+#
+# Usage:
+#  test/run_tests.sh [build directory]    (default: build/test)
+#
+# CC, CFLAGS, CXX and CXXFLAGS can be set in the environment.
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${1:-$ROOT/build/test}
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+CFLAGS=${CFLAGS:--std=gnu11 -O2 -g -Wall -Werror -fsanitize=address,undefined -fno-sanitize-recover=all}
+CXXFLAGS=${CXXFLAGS:--O2 -g -Wall -Werror -fsanitize=address,undefined -fno-sanitize-recover=all}
+
+mkdir -p "$BUILD"
+
+# ringbuf NAME SOURCES... [-DMACRO=VALUE]...
+# Builds and runs a ring buffer test.
+ringbuf()
+{
+    name=$1
+    shift
+    echo "== $name"
+    $CC $CFLAGS -I"$ROOT/src" -I"$ROOT/test" -o "$BUILD/$name" "$@"
+    "$BUILD/$name"
+}
+
+# host NAME SOURCES... [FLAG]...
+# Builds and runs a test of the host tools.
+host()
+{
+    name=$1
+    shift
+    echo "== $name"
+    $CC $CFLAGS -I"$ROOT/src" -I"$ROOT/host" -I"$ROOT/test" -o "$BUILD/$name" "$@"
+    "$BUILD/$name"
+}
+
+# tool NAME SOURCES... [FLAG]...
+# Builds a host tool, to catch warnings (it isn't run).
+tool()
+{
+    name=$1
+    shift
+    echo "== $name (build only)"
+    $CC $CFLAGS -I"$ROOT/src" -I"$ROOT/host" -o "$BUILD/$name" "$@"
+}
+
+# configure NAME [SETTING]...
+# Copies src/ to $BUILD/NAME/src and applies the settings to its
+# comm_driver.h. A setting is MACRO=VALUE (the macro must be defined in
+# comm_driver.h), 'bulk' (uncomments the comm_driver_bulk.h include) or a
+# compiler flag (-DMACRO=VALUE, for the other headers). Sets dir and flags.
+configure()
+{
+    dir=$BUILD/$1
+    shift
+    flags=
+    rm -rf "$dir"
+    mkdir -p "$dir/src"
+    cp "$ROOT"/src/*.c "$ROOT"/src/*.h "$ROOT"/src/*.hpp "$dir/src/"
+    for setting in "$@"; do
+        case $setting in
+        bulk)
+            sed -i 's|^//#include "comm_driver_bulk.h"|#include "comm_driver_bulk.h"|' "$dir/src/comm_driver.h"
+            grep -q '^#include "comm_driver_bulk.h"' "$dir/src/comm_driver.h"
+            ;;
+        -*)
+            flags="$flags $setting"
+            ;;
+        *)
+            macro=${setting%%=*}
+            value=${setting#*=}
+            sed -i "s|^#define $macro .*|#define $macro $value|" "$dir/src/comm_driver.h"
+            grep -q "^#define $macro $value\$" "$dir/src/comm_driver.h" || {
+                echo "$macro isn't defined in comm_driver.h" >&2
+                exit 1
+            }
+            ;;
+        esac
+    done
+}
+
+# driver NAME [SETTING]...
+# Builds and runs test_comm_driver.c with the settings (see configure).
+driver()
+{
+    echo "== $*"
+    configure "$@"
+    $CC $CFLAGS $flags -I"$dir/src" -I"$ROOT/host" -I"$ROOT/test" -I"$ROOT/test/sim" -o "$dir/test_comm_driver" \
+        "$ROOT/test/test_comm_driver.c" "$ROOT/test/sim/sim.c" "$ROOT/host/comm_capture.c" \
+        "$dir/src/comm_driver.c" "$dir/src/ringbuf.c" "$dir/src/crc16.c"
+    (cd "$dir" && ./test_comm_driver)
+}
+
+# driver_hpp NAME STANDARD [SETTING]...
+# Builds and runs test_comm_driver_hpp.cpp in C++ STANDARD (c++17, ...) with
+# the settings (see configure).
+driver_hpp()
+{
+    name=$1
+    std=$2
+    shift 2
+    echo "== $name $std $*"
+    configure "$name" "$@"
+    for source in "$ROOT/test/sim/sim.c" "$ROOT/host/comm_capture.c"; do
+        $CC $CFLAGS $flags -I"$dir/src" -I"$ROOT/host" -I"$ROOT/test/sim" -c -o "$dir/$(basename "$source" .c).o" "$source"
+    done
+    $CXX -std=$std $CXXFLAGS $flags -I"$dir/src" -I"$ROOT/host" -I"$ROOT/test" -I"$ROOT/test/sim" \
+        -o "$dir/test_comm_driver_hpp" "$ROOT/test/test_comm_driver_hpp.cpp" "$dir/sim.o" "$dir/comm_capture.o"
+    (cd "$dir" && ./test_comm_driver_hpp)
+}
+
+ringbuf test_ringbuf "$ROOT/test/test_ringbuf.c" "$ROOT/src/ringbuf.c"
+# Again with the lesser search kernels (the best one the CPU has runs above)
+for simd in sse2 scalar; do
+    echo "== test_ringbuf RINGBUF_SIMD=$simd"
+    RINGBUF_SIMD=$simd "$BUILD/test_ringbuf"
+done
+ringbuf test_ringbuf_word_copy "$ROOT/test/test_ringbuf.c" "$ROOT/src/ringbuf.c" -DRINGBUF_WORD_COPY=1
+ringbuf test_ringbuf_no_policies "$ROOT/test/test_ringbuf.c" "$ROOT/src/ringbuf.c" -DRINGBUF_POLICIES=0
+ringbuf test_ringbuf_no_watermarks "$ROOT/test/test_ringbuf.c" "$ROOT/src/ringbuf.c" -DRINGBUF_WATERMARKS=0
+ringbuf test_ringbuf_minimal "$ROOT/test/test_ringbuf.c" "$ROOT/src/ringbuf.c" -DRINGBUF_POLICIES=0 -DRINGBUF_WATERMARKS=0
+ringbuf test_ringbuf_static "$ROOT/test/test_ringbuf_static.c" "$ROOT/src/ringbuf.c"
+ringbuf test_ringbuf16 "$ROOT/test/test_ringbuf16.c" "$ROOT/src/ringbuf16.c" "$ROOT/src/ringbuf.c"
+
+host test_comm_mpsc "$ROOT/test/test_comm_mpsc.c" -pthread
+host test_comm_host "$ROOT/test/test_comm_host.c" "$ROOT/host/comm_host.c" "$ROOT/src/ringbuf.c"
+host test_comm_aggregator "$ROOT/test/test_comm_aggregator.c" "$ROOT/host/comm_aggregator.c" \
+    "$ROOT/host/comm_frame_queue.c" "$ROOT/host/comm_host.c" "$ROOT/host/comm_uring.c" "$ROOT/src/ringbuf.c" -pthread
+host test_comm_shm "$ROOT/test/test_comm_shm.c" "$ROOT/host/comm_shm.c" -pthread -lrt
+host test_comm_decode "$ROOT/test/test_comm_decode.c" "$ROOT/host/comm_capture.c" -pthread
+host test_comm_analyze "$ROOT/test/test_comm_analyze.c" "$ROOT/host/comm_capture.c"
+tool comm_bulk "$ROOT/host/comm_bulk.c" "$ROOT/src/crc16.c"
+tool comm_aggregatord "$ROOT/host/comm_aggregatord.c" "$ROOT/host/comm_aggregator.c" "$ROOT/host/comm_frame_queue.c" \
+    "$ROOT/host/comm_host.c" "$ROOT/host/comm_shm.c" "$ROOT/host/comm_uring.c" "$ROOT/src/ringbuf.c" -pthread -lrt
+tool comm_replay "$ROOT/host/comm_replay.c" "$ROOT/host/comm_capture.c"
+tool comm_decode "$ROOT/host/comm_decode.c" "$ROOT/host/comm_capture.c" -pthread
+tool comm_analyze "$ROOT/host/comm_analyze.c" "$ROOT/host/comm_capture.c"
+
+driver usbuart
+driver uart USE_USBUART=0 USE_UART=1
+driver small_tx "TX_BUFFER_SIZE=(80u)"
+driver shared COMM_SHARED_BUFFERS=1
+driver shared_small_tx COMM_SHARED_BUFFERS=1 "TX_BUFFER_MIN_SIZE=(64u)"
+driver shared_uart COMM_SHARED_BUFFERS=1 USE_USBUART=0 USE_UART=1
+driver shared_drop_record COMM_SHARED_BUFFERS=1 RX_BUFFER_POLICY=RINGBUF_DROP_RECORD TX_BUFFER_POLICY=RINGBUF_DROP_RECORD
+driver shared_drop_oldest_uart COMM_SHARED_BUFFERS=1 RX_BUFFER_POLICY=RINGBUF_DROP_OLDEST TX_BUFFER_POLICY=RINGBUF_DROP_OLDEST "TX_BUFFER_MIN_SIZE=(96u)" USE_USBUART=0 USE_UART=1
+driver drop_newest RX_BUFFER_POLICY=RINGBUF_DROP_NEWEST TX_BUFFER_POLICY=RINGBUF_DROP_NEWEST
+driver drop_newest_uart RX_BUFFER_POLICY=RINGBUF_DROP_NEWEST TX_BUFFER_POLICY=RINGBUF_DROP_NEWEST USE_USBUART=0 USE_UART=1
+driver drop_oldest RX_BUFFER_POLICY=RINGBUF_DROP_OLDEST TX_BUFFER_POLICY=RINGBUF_DROP_OLDEST
+driver drop_record_uart RX_BUFFER_POLICY=RINGBUF_DROP_RECORD TX_BUFFER_POLICY=RINGBUF_DROP_RECORD USE_USBUART=0 USE_UART=1
+driver no_policies -DRINGBUF_POLICIES=0
+driver no_policies_drop_oldest RX_BUFFER_POLICY=RINGBUF_DROP_OLDEST TX_BUFFER_POLICY=RINGBUF_DROP_OLDEST -DRINGBUF_POLICIES=0
+driver no_watermarks -DRINGBUF_WATERMARKS=0
+driver minimal_uart USE_USBUART=0 USE_UART=1 -DRINGBUF_POLICIES=0 -DRINGBUF_WATERMARKS=0
+driver bulk_usbuart bulk
+driver bulk_uart bulk USE_USBUART=0 USE_UART=1
+driver recorder bulk "COMM_RECORDER_SIZE=(600u)"
+driver recorder_uart bulk "COMM_RECORDER_SIZE=(600u)" USE_USBUART=0 USE_UART=1
+driver adaptive COMM_ADAPTIVE_TICK=1
+driver adaptive_uart COMM_ADAPTIVE_TICK=1 USE_USBUART=0 USE_UART=1
+driver adaptive_bulk bulk COMM_ADAPTIVE_TICK=1
+driver budget_bytes "COMM_ISR_BYTE_BUDGET=(96u)"
+driver budget_bytes_uart "COMM_ISR_BYTE_BUDGET=(24u)" USE_USBUART=0 USE_UART=1
+driver budget_cycles_uart "COMM_ISR_CYCLE_BUDGET=(800u)" USE_USBUART=0 USE_UART=1
+driver budget_both "COMM_ISR_BYTE_BUDGET=(96u)" "COMM_ISR_CYCLE_BUDGET=(800u)"
+driver budget_adaptive_uart "COMM_ISR_CYCLE_BUDGET=(800u)" COMM_ADAPTIVE_TICK=1 USE_USBUART=0 USE_UART=1
+driver budget_adaptive_both "COMM_ISR_BYTE_BUDGET=(96u)" "COMM_ISR_CYCLE_BUDGET=(800u)" COMM_ADAPTIVE_TICK=1
+driver lock_all COMM_LOCK_ALL_INTERRUPTS=1
+driver lock_all_uart COMM_LOCK_ALL_INTERRUPTS=1 USE_USBUART=0 USE_UART=1
+driver urgent COMM_URGENT_MESSAGES=1 "RX_BUFFER_SIZE=(164u)"
+driver urgent_uart COMM_URGENT_MESSAGES=1 USE_USBUART=0 USE_UART=1
+driver urgent_shared_uart COMM_URGENT_MESSAGES=1 COMM_SHARED_BUFFERS=1 USE_USBUART=0 USE_UART=1
+driver_hpp hpp_usbuart c++17
+driver_hpp hpp_uart c++20 USE_USBUART=0 USE_UART=1
+
+echo "All tests passed"
@@ -0,0 +1,144 @@
+/*******************************************************************************
+*
+* Host simulator of the PSoC project header.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Stands in for the project.h generated by PSoC Creator, so that
+*  comm_driver.c (and comm_driver.hpp) can be built and run on a PC. Both the
+*  USBUART and the UART (SCB) component APIs are declared, named 'COMM', and
+*  are implemented by sim.c. SysTick is a plain structure: its VAL register
+*  is set to LOAD when the comm interrupt starts and is decremented by the
+*  cycles the simulated COMM block costs (see sim.h).
+*
+*******************************************************************************/
+
+#ifndef _SIM_PROJECT_H
+#define _SIM_PROJECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef int8_t int8;
+typedef int16_t int16;
+typedef int32_t int32;
+
+typedef void (*cyisraddress)(void);
+
+typedef struct
+{
+    volatile uint32 CTRL;
+    volatile uint32 LOAD;
+    volatile uint32 VAL;
+    volatile uint32 CALIB;
+} SysTick_Type;
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Device
+#define CY_PSOC5LP 1
+#define CY_PSOC4 0
+#define CYDEV_HEAP_SIZE (0x10000)
+#define BCLK__BUS_CLK__HZ (64000000u)
+#define CYDEV_BCLK__SYSCLK__HZ (64000000u)
+
+// Interrupts
+#define CY_ISR(name) void name(void)
+#define CY_ISR_PROTO(name) void name(void)
+#define CY_INT_SYSTICK_IRQN (15)
+#define SysTick_IRQn (-1)
+#define CyGlobalIntEnable do {} while(0)
+
+// SysTick
+#define SysTick (&sim_systick)
+#define SysTick_CTRL_ENABLE_Msk (1u << 0)
+#define SysTick_CTRL_TICKINT_Msk (1u << 1)
+#define SysTick_CTRL_CLKSOURCE_Msk (1u << 2)
+#define SysTick_CTRL_COUNTFLAG_Msk (1u << 16)
+#define SysTick_LOAD_RELOAD_Msk (0xFFFFFFu)
+
+// USBUART ('COMM_Start(device, voltage)') and UART ('COMM_Start()')
+#define COMM_5V_OPERATION (1u)
+#define COMM_Start(...) sim_comm_start()
+
+// UART (SCB) FIFO
+#define COMM_UART_TX_BUFFER_SIZE (8u)
+
+/*******************************************************************************
+* PROTOTYPES
+*******************************************************************************/
+extern SysTick_Type sim_systick;
+void sim_comm_start(void);
+
+// System
+uint8 CyEnterCriticalSection(void);
+void CyExitCriticalSection(uint8 state);
+void CyIntSetSysVector(int number, cyisraddress address);
+uint32 SysTick_Config(uint32 ticks);
+void NVIC_EnableIRQ(int number);
+
+// USBUART
+uint8 COMM_GetConfiguration(void);
+uint8 COMM_IsConfigurationChanged(void);
+void COMM_CDC_Init(void);
+uint8 COMM_DataIsReady(void);
+uint16 COMM_GetCount(void);
+uint16 COMM_GetAll(uint8 *data);
+uint8 COMM_CDCIsReady(void);
+void COMM_PutData(const uint8 *data, uint16 count);
+
+// UART (SCB)
+void COMM_SpiUartClearRxBuffer(void);
+void COMM_SpiUartClearTxBuffer(void);
+uint32 COMM_SpiUartGetRxBufferSize(void);
+uint32 COMM_SpiUartReadRxData(void);
+uint32 COMM_SpiUartGetTxBufferSize(void);
+void COMM_SpiUartPutArray(const uint8 *data, uint32 count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SIM_PROJECT_H
+
+/* [] END OF FILE */
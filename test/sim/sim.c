@@ -0,0 +1,282 @@
+/*******************************************************************************
+*
+* Host simulator of the PSoC COMM block and SysTick.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Implementation of the functions declared in project.h and sim.h.
+*
+*******************************************************************************/
+
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "comm_capture.h"
+#include "sim.h"
+
+/*******************************************************************************
+* VARIABLES
+*******************************************************************************/
+SysTick_Type sim_systick;
+
+uint8 sim_h2d[SIM_STREAM_SIZE];
+size_t sim_h2d_len = 0, sim_h2d_pos = 0;
+uint8 sim_d2h[SIM_STREAM_SIZE];
+size_t sim_d2h_len = 0;
+int sim_cdc_busy = 0;
+size_t sim_uart_rx_depth = 32;
+unsigned long sim_isr_bytes = 0;
+unsigned long sim_isr_cycles = 0;
+
+comm_capture_t sim_capture = NULL;
+void (*sim_host_step)(void) = NULL;
+cyisraddress sim_isr = NULL;
+volatile unsigned long sim_ticks = 0;
+volatile int sim_in_isr = 0;
+
+double sim_masked_start_ns[SIM_MASKED_MAX];
+double sim_masked_ns[SIM_MASKED_MAX];
+size_t sim_masked_count = 0;
+static unsigned _maskedDepth = 0;
+
+
+/*******************************************************************************
+* SIMULATOR
+*******************************************************************************/
+void sim_host_send(const void *data, size_t count)
+{
+    memcpy(sim_h2d + sim_h2d_len, data, count);
+    sim_h2d_len += count;
+}
+
+void sim_tick(void)
+{
+    sim_ticks++;
+    if(sim_host_step)
+        sim_host_step();
+    
+    // The interrupt fires when SysTick reloads
+    size_t h2d_pos = sim_h2d_pos, d2h_len = sim_d2h_len;
+    sim_systick.VAL = sim_systick.LOAD;
+    sim_isr_bytes = 0;
+    sim_isr_cycles = 0;
+    sim_in_isr = 1;
+    sim_isr();
+    sim_in_isr = 0;
+    
+    if(sim_capture) {
+        if(sim_h2d_pos > h2d_pos)
+            comm_capture_write(sim_capture, COMM_CAPTURE_TX, sim_h2d + h2d_pos, sim_h2d_pos - h2d_pos);
+        if(sim_d2h_len > d2h_len)
+            comm_capture_write(sim_capture, COMM_CAPTURE_RX, sim_d2h + d2h_len, sim_d2h_len - d2h_len);
+    }
+}
+
+static void _on_alarm(int signal_number)
+{
+    (void)signal_number;
+    sim_tick();
+}
+
+void sim_start_timer(unsigned period_us)
+{
+    struct itimerval timer = {{0, period_us}, {0, period_us}};
+    signal(SIGALRM, _on_alarm);
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+void sim_stop_timer(void)
+{
+    struct itimerval timer = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+double sim_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+
+// SysTick counts down 'cycles', reloading past 0 (a write to VAL clears it)
+static void _sim_cycles(uint32 cycles)
+{
+    sim_isr_cycles += cycles;
+    while(cycles > sim_systick.VAL) {
+        cycles -= sim_systick.VAL + 1u;
+        sim_systick.VAL = sim_systick.LOAD;
+    }
+    sim_systick.VAL -= cycles;
+}
+
+
+/*******************************************************************************
+* SYSTEM
+*******************************************************************************/
+uint8 CyEnterCriticalSection(void)
+{
+    sigset_t set, old;
+    sigfillset(&set);
+    sigprocmask(SIG_BLOCK, &set, &old);
+    if(_maskedDepth++ == 0 && sim_masked_count < SIM_MASKED_MAX)
+        sim_masked_start_ns[sim_masked_count] = sim_now_ns();
+    return (uint8)sigismember(&old, SIGALRM);
+}
+
+void CyExitCriticalSection(uint8 state)
+{
+    if(--_maskedDepth == 0 && sim_masked_count < SIM_MASKED_MAX) {
+        sim_masked_ns[sim_masked_count] = sim_now_ns() - sim_masked_start_ns[sim_masked_count];
+        sim_masked_count++;
+    }
+    if(!state) {
+        sigset_t set;
+        sigfillset(&set);
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+    }
+}
+
+void CyIntSetSysVector(int number, cyisraddress address)
+{
+    (void)number;
+    sim_isr = address;
+}
+
+uint32 SysTick_Config(uint32 ticks)
+{
+    sim_systick.LOAD = ticks - 1u;
+    sim_systick.VAL = 0u;
+    sim_systick.CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk |
+                       SysTick_CTRL_ENABLE_Msk;
+    return 0u;
+}
+
+void NVIC_EnableIRQ(int number)
+{
+    (void)number;
+}
+
+void sim_comm_start(void)
+{
+}
+
+
+/*******************************************************************************
+* USBUART
+*******************************************************************************/
+uint8 COMM_GetConfiguration(void)
+{
+    return 1u;
+}
+
+uint8 COMM_IsConfigurationChanged(void)
+{
+    return 0u;
+}
+
+void COMM_CDC_Init(void)
+{
+}
+
+uint8 COMM_DataIsReady(void)
+{
+    return sim_h2d_pos < sim_h2d_len;
+}
+
+uint16 COMM_GetCount(void)
+{
+    size_t count = sim_h2d_len - sim_h2d_pos;
+    return (uint16)(count > SIM_USB_PACKET_SIZE ? SIM_USB_PACKET_SIZE : count);
+}
+
+uint16 COMM_GetAll(uint8 *data)
+{
+    uint16 count = COMM_GetCount();
+    memcpy(data, sim_h2d + sim_h2d_pos, count);
+    sim_h2d_pos += count;
+    sim_isr_bytes += count;
+    return count;
+}
+
+uint8 COMM_CDCIsReady(void)
+{
+    return !sim_cdc_busy;
+}
+
+void COMM_PutData(const uint8 *data, uint16 count)
+{
+    memcpy(sim_d2h + sim_d2h_len, data, count);
+    sim_d2h_len += count;
+    sim_isr_bytes += count;
+}
+
+
+/*******************************************************************************
+* UART (SCB)
+*******************************************************************************/
+void COMM_SpiUartClearRxBuffer(void)
+{
+}
+
+void COMM_SpiUartClearTxBuffer(void)
+{
+}
+
+uint32 COMM_SpiUartGetRxBufferSize(void)
+{
+    size_t count = sim_h2d_len - sim_h2d_pos;
+    return (uint32)(count > sim_uart_rx_depth ? sim_uart_rx_depth : count);
+}
+
+uint32 COMM_SpiUartReadRxData(void)
+{
+    sim_isr_bytes++;
+    _sim_cycles(SIM_UART_RX_CYCLES);
+    return sim_h2d[sim_h2d_pos++];
+}
+
+uint32 COMM_SpiUartGetTxBufferSize(void)
+{
+    return 0u;
+}
+
+void COMM_SpiUartPutArray(const uint8 *data, uint32 count)
+{
+    memcpy(sim_d2h + sim_d2h_len, data, count);
+    sim_d2h_len += count;
+    sim_isr_bytes += count;
+    _sim_cycles(SIM_UART_TX_CYCLES * count);
+}
+
+/* [] END OF FILE */
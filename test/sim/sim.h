@@ -0,0 +1,134 @@
+/*******************************************************************************
+*
+* Host simulator of the PSoC COMM block and SysTick.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  The host side of the simulated link. Bytes sent by the host (sim_h2d) are
+*  received by the COMM block, in USB packets of up to SIM_USB_PACKET_SIZE
+*  bytes or through a UART RX FIFO of sim_uart_rx_depth bytes. Bytes sent by
+*  the device are appended to sim_d2h.
+*
+*  sim_tick() runs one comm interrupt, after sim_host_step() (the host's
+*  reaction to what it received so far). sim_start_timer() runs it from a
+*  SIGALRM timer instead, to exercise the driver's locking: comm_lock.h
+*  blocks that signal in host builds.
+*
+*  While sim_capture is set, the bytes each sim_tick() moves are recorded
+*  in it (see comm_capture.h), as a host would see them: what the COMM block
+*  received is TX, what it sent is RX. Don't set it while the timer runs.
+*
+*  Every section with all interrupts masked (CyEnterCriticalSection()) is
+*  timestamped in sim_masked_start_ns/sim_masked_ns.
+*
+*******************************************************************************/
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include "project.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+// Size of each direction of the link (bytes)
+#define SIM_STREAM_SIZE (1u << 22)
+
+// Largest USB packet received by the COMM block
+#define SIM_USB_PACKET_SIZE (64u)
+
+// SysTick cycles spent by the comm interrupt per UART byte read or written
+#define SIM_UART_RX_CYCLES (40u)
+#define SIM_UART_TX_CYCLES (20u)
+
+// Number of masked sections recorded
+#define SIM_MASKED_MAX (1u << 20)
+
+/*******************************************************************************
+* VARIABLES
+*******************************************************************************/
+// Host -> device
+extern uint8 sim_h2d[];
+extern size_t sim_h2d_len, sim_h2d_pos;
+
+// Device -> host
+extern uint8 sim_d2h[];
+extern size_t sim_d2h_len;
+
+// The USBUART doesn't accept data to send while it's set
+extern int sim_cdc_busy;
+
+// Bytes the UART RX FIFO holds (default 32)
+extern size_t sim_uart_rx_depth;
+
+// Bytes read or written by the COMM block since the comm interrupt started,
+// and the SysTick cycles they took (SysTick reloads as on the PSoC if they
+// outlast the period)
+extern unsigned long sim_isr_bytes;
+extern unsigned long sim_isr_cycles;
+
+// Records the link (a comm_capture_t, may be NULL)
+extern struct comm_capture_t *sim_capture;
+
+// Called before every comm interrupt (may be NULL)
+extern void (*sim_host_step)(void);
+
+// The comm interrupt, the number of times sim_tick() ran it, and whether
+// it's running
+extern cyisraddress sim_isr;
+extern volatile unsigned long sim_ticks;
+extern volatile int sim_in_isr;
+
+// Sections with all interrupts masked
+extern double sim_masked_start_ns[];
+extern double sim_masked_ns[];
+extern size_t sim_masked_count;
+
+/*******************************************************************************
+* PROTOTYPES
+*******************************************************************************/
+void sim_host_send(const void *data, size_t count);
+void sim_tick(void);
+void sim_start_timer(unsigned period_us);
+void sim_stop_timer(void);
+double sim_now_ns(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SIM_H
+
+/* [] END OF FILE */
@@ -0,0 +1,247 @@
+/*******************************************************************************
+*
+* Tests of host/comm_aggregator.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Feeds pipes added with comm_aggregator_add_fd() with random messages,
+*  valid or broken, between garbage, in random chunks, while the workers
+*  run. Every device's frames must come out of the queue in order, as
+*  comm_parse.h finds them in its stream, with nothing left behind once
+*  the writes stop. With a small queue, the frames popped and dropped must
+*  add up.
+*
+*******************************************************************************/
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "comm_aggregator.h"
+#include "comm_parse.h"
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define DEVICES (4u)
+#define STREAM_LENGTH (60000u)
+#define MAX_CHUNK (500u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    uint8_t stream[STREAM_LENGTH + 4 * MSG_MAX_LENGTH];
+    size_t length;
+    size_t sent;
+    size_t expected; // Position of the next frame in 'stream'
+    uint64_t frames; // Non-empty messages in 'stream'
+    int fd[2];
+} device_t;
+
+
+/*******************************************************************************
+* HELPERS
+*******************************************************************************/
+static void _random_bytes(uint8_t *data, size_t count, int range)
+{
+    for(size_t i = 0; i < count; i++)
+        data[i] = (uint8_t)(rand() % range);
+}
+
+// Appends a message to the stream of 'd'. 'broken' is 0 for a valid message,
+// else what's wrong with it (1: length too large, 2: no last byte, 3: cut
+// short).
+static void _append_message(device_t *d, int broken)
+{
+    uint8_t *p = d->stream + d->length;
+    uint8_t msg_length = (uint8_t)(MSG_STRUCTURE_LENGTH + 1 + rand() % (MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH));
+    p[0] = MSG_FIRST_BYTE;
+    p[1] = msg_length;
+    _random_bytes(p + MSG_HEADER_LENGTH, msg_length - MSG_STRUCTURE_LENGTH, 256);
+    p[msg_length - MSG_FOOTER_LENGTH] = MSG_LAST_BYTE;
+    switch(broken) {
+    case 1:
+        p[1] = (uint8_t)(MSG_MAX_LENGTH + 1 + rand() % (256 - MSG_MAX_LENGTH - 1));
+        break;
+    case 2:
+        p[msg_length - MSG_FOOTER_LENGTH] = (uint8_t)(MSG_LAST_BYTE + 1);
+        break;
+    case 3:
+        d->length += (size_t)rand() % msg_length;
+        return;
+    }
+    d->length += msg_length;
+}
+
+// Builds a random stream. It ends with a message right after a wrong length:
+// comm_host_getmsg() stops at the wrong length, the message must still be
+// decoded without more bytes coming.
+static void _build_stream(device_t *d)
+{
+    d->length = d->sent = d->expected = 0;
+    while(d->length < STREAM_LENGTH) {
+        if(rand() % 4 == 0) {
+            size_t garbage = (size_t)rand() % 20;
+            _random_bytes(d->stream + d->length, garbage, 4);
+            d->length += garbage;
+        }
+        _append_message(d, rand() % 8 < 3 ? 1 + rand() % 3 : 0);
+    }
+    _append_message(d, 1);
+    _append_message(d, 0);
+
+    // The frames to expect
+    size_t position = 0, parsed;
+    comm_parse_result_t result;
+    d->frames = 0;
+    while((result = comm_parse_step(d->stream + position, d->length - position, &parsed)) != COMM_PARSE_MORE) {
+        d->frames += (result == COMM_PARSE_MESSAGE && parsed > MSG_STRUCTURE_LENGTH);
+        position += parsed;
+    }
+}
+
+// Checks a frame popped from the aggregator against the next non-empty
+// message of its device
+static void _check_frame(device_t *devices, const comm_frame_t *frame)
+{
+    CHECK(frame->device < DEVICES);
+    device_t *d = &devices[frame->device];
+    size_t parsed;
+    comm_parse_result_t result;
+    while((result = comm_parse_step(d->stream + d->expected, d->length - d->expected, &parsed)) != COMM_PARSE_MESSAGE
+          || parsed == MSG_STRUCTURE_LENGTH) {
+        CHECK(result != COMM_PARSE_MORE);
+        d->expected += parsed;
+    }
+    CHECK(frame->count == parsed - MSG_STRUCTURE_LENGTH);
+    CHECK(!memcmp(frame->data, d->stream + d->expected + MSG_HEADER_LENGTH, frame->count));
+    d->expected += parsed;
+}
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_devices
+********************************************************************************
+* Summary:
+*  Writes the streams of DEVICES pipes in random chunks, popping frames in
+*  between, then pops the rest. With 'queue_capacity' large enough, every
+*  frame arrives, in order for each device; otherwise the frames popped and
+*  dropped add up to the frames sent.
+*
+*******************************************************************************/
+static void _test_devices(size_t queue_capacity, unsigned workers)
+{
+    static device_t devices[DEVICES];
+    comm_aggregator_t agg = comm_aggregator_new(DEVICES, queue_capacity);
+    CHECK(agg);
+
+    uint64_t total = 0;
+    for(unsigned i = 0; i < DEVICES; i++) {
+        device_t *d = &devices[i];
+        _build_stream(d);
+        total += d->frames;
+        CHECK(!pipe(d->fd));
+        CHECK(comm_aggregator_add_fd(agg, d->fd[0]) == (int)i);
+        CHECK(comm_host_fd(comm_aggregator_device(agg, (int)i)) == d->fd[0]);
+    }
+    CHECK(comm_aggregator_add_fd(agg, devices[0].fd[0]) == -1);
+    CHECK(!comm_aggregator_start(agg, workers));
+
+    // Write and pop at the same time: in order, without drops, the frames
+    // match as they come
+    bool lossless = queue_capacity >= total;
+    uint64_t popped = 0;
+    comm_frame_t frame;
+    for(bool writing = true; writing;) {
+        writing = false;
+        for(unsigned i = 0; i < DEVICES; i++) {
+            device_t *d = &devices[i];
+            if(d->sent == d->length)
+                continue;
+            size_t count = 1 + (size_t)rand() % MAX_CHUNK;
+            count = MIN(count, d->length - d->sent);
+            CHECK(write(d->fd[1], d->stream + d->sent, count) == (ssize_t)count);
+            d->sent += count;
+            writing = true;
+        }
+        while(lossless && comm_aggregator_pop(agg, &frame)) {
+            _check_frame(devices, &frame);
+            popped++;
+        }
+    }
+
+    // The rest, without more bytes coming
+    while(popped + comm_aggregator_dropped(agg) < total) {
+        if(!comm_aggregator_pop(agg, &frame)) {
+            CHECK(comm_aggregator_wait(agg, 5000) == 1);
+            continue;
+        }
+        if(lossless)
+            _check_frame(devices, &frame);
+        popped++;
+    }
+    CHECK(lossless ? !comm_aggregator_dropped(agg) : comm_aggregator_dropped(agg) > 0);
+    CHECK(popped + comm_aggregator_dropped(agg) == total);
+    CHECK(!comm_aggregator_pop(agg, &frame));
+
+    // Nothing more once stopped
+    comm_aggregator_stop(agg);
+    CHECK(write(devices[0].fd[1], devices[0].stream, 200) == 200);
+    usleep(50000);
+    CHECK(!comm_aggregator_pop(agg, &frame));
+
+    comm_aggregator_free(&agg);
+    CHECK(!agg);
+    for(unsigned i = 0; i < DEVICES; i++) {
+        close(devices[i].fd[0]);
+        close(devices[i].fd[1]);
+    }
+}
+
+int main(void)
+{
+    srand(1);
+    _test_devices(1u << 16, 1);
+    _test_devices(1u << 16, 3);
+    _test_devices(64, 2);
+
+    printf("test_comm_aggregator: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,376 @@
+/*******************************************************************************
+*
+* Tests of host/comm_analyze.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Feeds random streams to the analyzer, in random chunks, from memory, from
+*  a capture and from a file read live, with message and line framing. The
+*  counters, histograms and the frames exported to pcapng must match a
+*  model of the framing: comm_parse_step() for messages, and lines longer
+*  than the buffer dropped as garbage.
+*
+*  comm_analyze.c is included to drive the analyzer without its main().
+*
+*******************************************************************************/
+
+#define main comm_analyze_main
+#include "comm_analyze.c"
+#undef main
+
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define STREAM_LENGTH (300000u)
+#define MAX_CHUNK (3000u)
+#define MAX_FRAMES (STREAM_LENGTH)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    size_t offset; // In the stream, with the framing bytes
+    size_t length;
+} frame_t;
+
+// A stream and what the analyzer must find in it
+typedef struct
+{
+    uint8_t data[STREAM_LENGTH + 3 * ANALYZE_BUFFER_SIZE];
+    size_t length;
+    bool lines;
+    _counters_t total;
+    size_t pending; // Bytes of an incomplete frame at the end
+    frame_t frames[MAX_FRAMES];
+} stream_t;
+
+
+/*******************************************************************************
+* HELPERS
+*******************************************************************************/
+static void _random_bytes(uint8_t *data, size_t count, int range)
+{
+    for(size_t i = 0; i < count; i++)
+        data[i] = (uint8_t)(rand() % range);
+}
+
+static void _add_frame(stream_t *s, size_t offset, size_t length, size_t payload)
+{
+    CHECK(s->total.frames < MAX_FRAMES);
+    s->frames[s->total.frames].offset = offset;
+    s->frames[s->total.frames].length = length;
+    s->total.frames++;
+    s->total.payload += payload;
+}
+
+// Messages, valid or broken, between garbage
+static void _build_messages(stream_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    while(s->length < STREAM_LENGTH) {
+        uint8_t *p = s->data + s->length;
+        if(rand() % 4 == 0) {
+            size_t garbage = (size_t)rand() % 30;
+            _random_bytes(p, garbage, 4);
+            s->length += garbage;
+            continue;
+        }
+
+        uint8_t msg_length = (uint8_t)(MSG_STRUCTURE_LENGTH + rand() % (MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH + 1));
+        p[0] = MSG_FIRST_BYTE;
+        p[1] = msg_length;
+        _random_bytes(p + MSG_HEADER_LENGTH, msg_length - MSG_STRUCTURE_LENGTH, 256);
+        p[msg_length - MSG_FOOTER_LENGTH] = MSG_LAST_BYTE;
+        switch(rand() % 8) {
+        case 0:
+            p[1] = (uint8_t)(MSG_MAX_LENGTH + 1 + rand() % (256 - MSG_MAX_LENGTH - 1));
+            break;
+        case 1:
+            p[msg_length - MSG_FOOTER_LENGTH] = (uint8_t)(MSG_LAST_BYTE + 1);
+            break;
+        case 2:
+            msg_length = (uint8_t)(rand() % msg_length);
+            break;
+        }
+        s->length += msg_length;
+    }
+    // Ends in the middle of a message
+    s->data[s->length++] = MSG_FIRST_BYTE;
+    s->data[s->length++] = MSG_MAX_LENGTH;
+
+    size_t pos = 0, length;
+    comm_parse_result_t result;
+    while((result = comm_parse_step(s->data + pos, s->length - pos, &length)) != COMM_PARSE_MORE) {
+        if(result == COMM_PARSE_MESSAGE)
+            _add_frame(s, pos, length, length - MSG_STRUCTURE_LENGTH);
+        else {
+            s->total.garbage += length;
+            s->total.resyncs += result == COMM_PARSE_RESYNC;
+        }
+        pos += length;
+    }
+    s->total.bytes = s->length;
+    s->pending = s->length - pos;
+}
+
+// Lines, empty to longer than the analyzer's buffer
+static void _build_lines(stream_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->lines = true;
+    while(s->length < STREAM_LENGTH) {
+        size_t line = (size_t)rand() % 200;
+        switch(rand() % 200) {
+        case 0:
+            line = ANALYZE_BUFFER_SIZE + (size_t)rand() % 1000;
+            break;
+        case 1:
+            line = ANALYZE_BUFFER_SIZE * (1u + (unsigned)rand() % 2);
+            break;
+        }
+        for(size_t i = 0; i < line; i++)
+            s->data[s->length + i] = (uint8_t)(ANALYZE_LINE_TERMINATOR + 1 + rand() % 200);
+        s->data[s->length + line] = ANALYZE_LINE_TERMINATOR;
+
+        // Every full buffer of the line is dropped, the rest makes a line
+        size_t dropped = line / ANALYZE_BUFFER_SIZE * ANALYZE_BUFFER_SIZE;
+        s->total.garbage += dropped;
+        _add_frame(s, s->length + dropped, line - dropped + 1, line - dropped);
+        s->length += line + 1;
+    }
+    s->pending = 1 + (size_t)rand() % 100;
+    _random_bytes(s->data + s->length, s->pending, ANALYZE_LINE_TERMINATOR);
+    s->length += s->pending;
+    s->total.bytes = s->length;
+}
+
+static void _new_analyzer(_analyzer_t *analyzer, const stream_t *s, uint8_t dir)
+{
+    memset(analyzer, 0, sizeof(*analyzer));
+    analyzer->lines = s->lines;
+    analyzer->dir = dir;
+    analyzer->pcap = tmpfile();
+    CHECK(analyzer->pcap);
+    _pcapng_header(analyzer->pcap);
+}
+
+static uint32_t _get32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/*******************************************************************************
+* Function Name: _check
+********************************************************************************
+* Summary:
+*  Compare what the analyzer found with the stream, and read back its pcapng
+*  file: a section header, an interface with ns timestamps, then every frame
+*  in order, its time being the one the analyzer saw it at.
+*
+*******************************************************************************/
+static void _check(_analyzer_t *analyzer, const stream_t *s)
+{
+    static uint8_t pcap[2 * (STREAM_LENGTH + 3 * ANALYZE_BUFFER_SIZE) + 64 * MAX_FRAMES];
+    const _counters_t *c = &analyzer->total;
+
+    CHECK(!memcmp(c, &s->total, sizeof(*c)));
+    CHECK(analyzer->length == s->pending);
+    uint64_t sizes = 0, gaps = 0;
+    for(unsigned b = 0; b < ANALYZE_SIZE_BUCKETS; b++)
+        sizes += analyzer->size_hist[b];
+    for(unsigned b = 0; b < ANALYZE_GAP_BUCKETS; b++)
+        gaps += analyzer->gap_hist[b];
+    CHECK(sizes == c->frames && gaps == c->frames - 1 && analyzer->gap_count == c->frames - 1);
+    CHECK(analyzer->gap_min_ns <= analyzer->gap_max_ns);
+
+    CHECK(!fflush(analyzer->pcap));
+    rewind(analyzer->pcap);
+    size_t length = fread(pcap, 1, sizeof(pcap), analyzer->pcap);
+    CHECK(length < sizeof(pcap) && feof(analyzer->pcap));
+    fclose(analyzer->pcap);
+    analyzer->pcap = NULL;
+
+    // Blocks, each one framed by its length
+    size_t pos = 0, frames = 0;
+    uint64_t first_ns = 0, last_ns = 0;
+    while(pos < length) {
+        CHECK(length - pos >= 12);
+        uint32_t type = _get32(pcap + pos), total = _get32(pcap + pos + 4);
+        CHECK(total % 4 == 0 && total >= 12 && total <= length - pos);
+        CHECK(_get32(pcap + pos + total - 4) == total);
+        const uint8_t *body = pcap + pos + 8;
+
+        if(pos == 0)
+            CHECK(type == PCAPNG_SHB && _get32(body) == PCAPNG_BYTE_ORDER_MAGIC);
+        else if(type == PCAPNG_IDB) {
+            CHECK(body[0] == PCAPNG_LINKTYPE_USER0 && body[8] == PCAPNG_OPT_IF_TSRESOL && body[12] == 9);
+        }
+        else {
+            CHECK(type == PCAPNG_EPB && frames < s->total.frames);
+            const frame_t *frame = &s->frames[frames++];
+            uint64_t time_ns = (uint64_t)_get32(body + 4) << 32 | _get32(body + 8);
+            CHECK(_get32(body + 12) == frame->length && _get32(body + 16) == frame->length);
+            CHECK(!memcmp(body + 20, s->data + frame->offset, frame->length));
+            const uint8_t *options = body + 20 + (frame->length + 3) / 4 * 4;
+            CHECK(options[0] == PCAPNG_OPT_EPB_FLAGS && options[2] == 4);
+            CHECK(_get32(options + 4) == (analyzer->dir == COMM_CAPTURE_TX ? PCAPNG_FLAG_OUTBOUND : PCAPNG_FLAG_INBOUND));
+            CHECK(frames == 1 || time_ns >= last_ns);
+            if(frames == 1)
+                first_ns = time_ns;
+            last_ns = time_ns;
+        }
+        pos += total;
+    }
+    CHECK(frames == s->total.frames);
+
+    // The gaps add up to the time between the first and last frames
+    CHECK(last_ns - first_ns == analyzer->gap_sum_ns);
+}
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_feed
+********************************************************************************
+* Summary:
+*  The stream in random chunks, a microsecond or so apart.
+*
+*******************************************************************************/
+static void _test_feed(const stream_t *s)
+{
+    static _analyzer_t analyzer;
+    _new_analyzer(&analyzer, s, COMM_CAPTURE_RX);
+
+    uint64_t time_ns = 1000000000u;
+    for(size_t pos = 0; pos < s->length;) {
+        size_t count = 1 + (size_t)rand() % MAX_CHUNK;
+        if(count > s->length - pos)
+            count = s->length - pos;
+        time_ns += (uint64_t)rand() % 2000u;
+        _feed(&analyzer, time_ns, s->data + pos, count);
+        pos += count;
+    }
+    CHECK(analyzer.last_ns == time_ns);
+
+    _check(&analyzer, s);
+}
+
+/*******************************************************************************
+* Function Name: _test_capture
+********************************************************************************
+* Summary:
+*  The stream as the TX side of a capture, with other bytes on the RX side.
+*
+*******************************************************************************/
+static void _test_capture(const stream_t *s)
+{
+    static _analyzer_t analyzer;
+    static uint8_t other[MAX_CHUNK];
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_comm_analyze_%d.commcap", (int)getpid());
+
+    comm_capture_t capture = comm_capture_create(path);
+    CHECK(capture);
+    for(size_t pos = 0; pos < s->length;) {
+        size_t count = 1 + (size_t)rand() % MAX_CHUNK;
+        if(count > s->length - pos)
+            count = s->length - pos;
+        CHECK(comm_capture_write(capture, COMM_CAPTURE_TX, s->data + pos, count) == 0);
+        pos += count;
+        _random_bytes(other, MAX_CHUNK, 256);
+        CHECK(comm_capture_write(capture, COMM_CAPTURE_RX, other, 1 + (size_t)rand() % MAX_CHUNK) == 0);
+    }
+    CHECK(comm_capture_finish(&capture) == 0);
+
+    comm_capture_reader_t reader = comm_capture_open(path);
+    CHECK(reader);
+    _new_analyzer(&analyzer, s, COMM_CAPTURE_TX);
+    analyzer.reader = reader;
+    _run_capture(&analyzer, reader);
+    _check(&analyzer, s);
+    comm_capture_close(&reader);
+    unlink(path);
+}
+
+/*******************************************************************************
+* Function Name: _test_live
+********************************************************************************
+* Summary:
+*  The stream read from a file as if it were a tty.
+*
+*******************************************************************************/
+static void _test_live(const stream_t *s)
+{
+    static _analyzer_t analyzer;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_comm_analyze_%d.bin", (int)getpid());
+
+    FILE *file = fopen(path, "wb");
+    CHECK(file && fwrite(s->data, 1, s->length, file) == s->length && !fclose(file));
+
+    _new_analyzer(&analyzer, s, COMM_CAPTURE_RX);
+    int fd = _open_tty(path);
+    CHECK(fd >= 0);
+    CHECK(_run_live(&analyzer, fd) == 0);
+    close(fd);
+    _check(&analyzer, s);
+    unlink(path);
+}
+
+int main(void)
+{
+    static stream_t s;
+    srand(1);
+
+    _build_messages(&s);
+    CHECK(s.total.frames && s.total.resyncs && s.total.garbage && s.pending);
+    _test_feed(&s);
+    _test_capture(&s);
+    _test_live(&s);
+
+    _build_lines(&s);
+    CHECK(s.total.frames && s.total.garbage && s.pending);
+    _test_feed(&s);
+    _test_capture(&s);
+    _test_live(&s);
+
+    printf("test_comm_analyze: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,226 @@
+/*******************************************************************************
+*
+* Tests of host/comm_decode.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Writes a capture of random RX and TX streams (messages, broken messages
+*  and garbage, in random chunks) and decodes it with every number of jobs
+*  and threads: the statistics must be those of a sequential parse with
+*  comm_parse_step(). Parts of the RX stream hold two chains of messages
+*  interleaved, so that a job starting in the wrong one doesn't meet the
+*  exact parse within its window and has to be decoded again.
+*
+*  comm_decode.c is included to call _decode_capture().
+*
+*******************************************************************************/
+
+#define main comm_decode_main
+#include "comm_decode.c"
+#undef main
+
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define RX_LENGTH (2000000u)
+#define TX_LENGTH (200000u)
+#define MAX_CHUNK (4000u)
+
+// Interleaved chains: messages of CHAIN_LENGTH bytes, each holding the start
+// of a message of the other chain in its middle
+#define CHAIN_LENGTH (80u)
+#define CHAIN_MESSAGES (120u) // Longer than DECODE_WINDOW
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    uint8_t data[RX_LENGTH + 2 * CHAIN_MESSAGES * CHAIN_LENGTH];
+    size_t length;
+    size_t written; // Bytes written to the capture
+    _stats_t stats; // Of a sequential parse
+} stream_t;
+
+
+/*******************************************************************************
+* HELPERS
+*******************************************************************************/
+static void _random_bytes(uint8_t *data, size_t count, int range)
+{
+    for(size_t i = 0; i < count; i++)
+        data[i] = (uint8_t)(rand() % range);
+}
+
+// Appends a message, valid or broken (0: valid, 1: length too large, 2: no
+// last byte, 3: cut short)
+static void _append_message(stream_t *s, int broken)
+{
+    uint8_t *p = s->data + s->length;
+    uint8_t msg_length = (uint8_t)(MSG_STRUCTURE_LENGTH + rand() % (MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH + 1));
+    p[0] = MSG_FIRST_BYTE;
+    p[1] = msg_length;
+    _random_bytes(p + MSG_HEADER_LENGTH, msg_length - MSG_STRUCTURE_LENGTH, 8);
+    p[msg_length - MSG_FOOTER_LENGTH] = MSG_LAST_BYTE;
+    switch(broken) {
+    case 1:
+        p[1] = (uint8_t)(MSG_MAX_LENGTH + 1 + rand() % (256 - MSG_MAX_LENGTH - 1));
+        break;
+    case 2:
+        p[msg_length - MSG_FOOTER_LENGTH] = (uint8_t)(MSG_LAST_BYTE + 1);
+        break;
+    case 3:
+        s->length += (size_t)rand() % msg_length;
+        return;
+    }
+    s->length += msg_length;
+}
+
+// Appends CHAIN_MESSAGES messages, the middle of each one starting a message
+// that ends in the middle of the next one
+static void _append_chains(stream_t *s)
+{
+    uint8_t *p = s->data + s->length;
+    size_t length = CHAIN_MESSAGES * CHAIN_LENGTH;
+    _random_bytes(p, length, 8);
+    for(size_t pos = 0; pos < length; pos += CHAIN_LENGTH / 2) {
+        p[pos] = MSG_FIRST_BYTE;
+        p[pos + MSG_LENGTH_OFFS_FROM_FIRST_BYTE] = CHAIN_LENGTH;
+        if(pos + CHAIN_LENGTH <= length)
+            p[pos + CHAIN_LENGTH - MSG_FOOTER_LENGTH] = MSG_LAST_BYTE;
+    }
+    s->length += length;
+}
+
+static void _build_stream(stream_t *s, size_t length, bool chains)
+{
+    s->length = s->written = 0;
+    while(s->length < length) {
+        int kind = rand() % 16;
+        if(kind == 0) {
+            size_t garbage = (size_t)rand() % 200;
+            _random_bytes(s->data + s->length, garbage, 4);
+            s->length += garbage;
+        }
+        else if(kind == 1 && chains && rand() % 50 == 0)
+            _append_chains(s);
+        else
+            _append_message(s, kind < 5 ? 1 + rand() % 3 : 0);
+    }
+
+    // What comm_decode must find, as it counts the steps
+    memset(&s->stats, 0, sizeof(s->stats));
+    _event_t event;
+    for(uint64_t pos = 0; _make_event(&event, pos, s->data + pos, s->length - pos); pos += event.length)
+        _add_event(&s->stats, &event);
+}
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_decode
+********************************************************************************
+* Summary:
+*  Decodes both directions of the capture with various numbers of jobs and
+*  threads, sequentially first.
+*
+*******************************************************************************/
+static void _test_decode(const char *path, stream_t *rx, stream_t *tx)
+{
+    const long jobs[] = {1, 2, 5, 16, 1000};
+    const unsigned threads[] = {1, 3};
+    unsigned redone_total = 0;
+
+    comm_capture_reader_t reader = comm_capture_open(path);
+    CHECK(reader);
+    const comm_capture_index_t *index;
+    CHECK(comm_capture_get_index(reader, &index) > 16);
+
+    for(size_t j = 0; j < sizeof(jobs) / sizeof(*jobs); j++) {
+        for(size_t t = 0; t < sizeof(threads) / sizeof(*threads); t++) {
+            for(int d = 0; d < 2; d++) {
+                stream_t *s = d ? tx : rx;
+                _stats_t stats;
+                uint64_t length;
+                unsigned redone;
+                long run = _decode_capture(reader, d ? COMM_CAPTURE_TX : COMM_CAPTURE_RX, threads[t], (size_t)jobs[j],
+                                           &stats, &length, &redone);
+                CHECK(run >= 1 && run <= jobs[j]);
+                CHECK(length == s->length);
+                CHECK(!memcmp(&stats, &s->stats, sizeof(stats)));
+                CHECK(jobs[j] > 1 || !redone);
+                redone_total += redone;
+            }
+        }
+    }
+    CHECK(redone_total > 0);
+
+    comm_capture_close(&reader);
+    CHECK(!reader);
+}
+
+int main(void)
+{
+    static stream_t rx, tx;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test_comm_decode_%d.commcap", (int)getpid());
+    srand(1);
+    _build_stream(&rx, RX_LENGTH, true);
+    _build_stream(&tx, TX_LENGTH, false);
+    CHECK(rx.stats.messages && rx.stats.resyncs && rx.stats.garbage);
+
+    // Both directions in random chunks, in proportion
+    comm_capture_t capture = comm_capture_create(path);
+    CHECK(capture);
+    while(rx.written < rx.length || tx.written < tx.length) {
+        stream_t *s = (size_t)rand() % (rx.length + tx.length) < tx.length ? &tx : &rx;
+        if(s->written == s->length)
+            s = s == &rx ? &tx : &rx;
+        size_t count = 1 + (size_t)rand() % MAX_CHUNK;
+        if(count > s->length - s->written)
+            count = s->length - s->written;
+        CHECK(comm_capture_write(capture, s == &rx ? COMM_CAPTURE_RX : COMM_CAPTURE_TX, s->data + s->written, count) == 0);
+        s->written += count;
+    }
+    CHECK(comm_capture_finish(&capture) == 0);
+
+    _test_decode(path, &rx, &tx);
+    unlink(path);
+
+    printf("test_comm_decode: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
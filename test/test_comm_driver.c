@@ -0,0 +1,1167 @@
+/*******************************************************************************
+*
+* Tests of the COMM driver on the host simulator.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Runs comm_driver.c against the fake COMM block of sim/: single bytes and
+*  blocks of bytes, lines and messages split in random packets, the comm
+*  lock, watermark events, full buffers with the configured overflow
+*  policies, the interrupt frequency (with COMM_ADAPTIVE_TICK), work
+*  budgets and urgent messages, a session recorded then replayed from a
+*  capture file, bulk transfers in both directions (when comm_driver_bulk.h
+*  is included) and flight recorder dumps (with COMM_RECORDER_SIZE).
+*  run_tests.sh builds it once for every configuration of comm_driver.h it
+*  tests.
+*
+*******************************************************************************/
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "comm_capture.h"
+#include "comm_driver.h"
+#include "comm_lock.h"
+#include "ringbuf.h"
+#include "sim.h"
+#include "test.h"
+#ifdef _COMM_DRIVER_BULK_H
+#include "crc16.h"
+#endif
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define STREAM_RECORDS (5000u)
+
+// A USB packet is only read if it fits in the RX buffer, and the RX buffer
+// may hold an incomplete record: records longer than this could deadlock
+// (messages can't be longer than MSG_MAX_LENGTH anyway)
+#define STREAM_MAX_LENGTH (MIN(RX_BUFFER_SIZE - SIM_USB_PACKET_SIZE, MSG_MAX_LENGTH))
+
+// Records of _test_async_read, and how often the application stops reading
+// for ASYNC_PAUSE_TICKS comm interrupts (enough to overflow the RX buffer)
+#define ASYNC_RECORDS (2000u)
+#define ASYNC_PAUSE_RECORDS (50u)
+#define ASYNC_PAUSE_TICKS (4u * RX_BUFFER_SIZE / 32u)
+
+// Capacity of the TX buffer that is always available (see comm_driver.c)
+#if COMM_SHARED_BUFFERS
+    #define TX_GUARANTEED_SIZE (TX_BUFFER_MIN_SIZE)
+#else
+    #define TX_GUARANTEED_SIZE (TX_BUFFER_SIZE)
+#endif
+
+// Most each buffer can hold, borrowing from the other with COMM_SHARED_BUFFERS
+#if COMM_SHARED_BUFFERS
+    #define RX_CAPACITY (RX_BUFFER_SIZE + TX_BUFFER_SIZE - TX_BUFFER_MIN_SIZE)
+    #define TX_CAPACITY (TX_BUFFER_SIZE + RX_BUFFER_SIZE - RX_BUFFER_MIN_SIZE)
+#else
+    #define RX_CAPACITY (RX_BUFFER_SIZE)
+    #define TX_CAPACITY (TX_BUFFER_SIZE)
+#endif
+
+// Longest payload comm_putmsg accepts
+#define PUTMSG_MAX_LENGTH (MIN(MSG_MAX_LENGTH, TX_GUARANTEED_SIZE) - MSG_STRUCTURE_LENGTH)
+
+// Bytes the host and the application send in _test_watermarks
+#define WATERMARK_RX_COUNT (RX_BUFFER_SIZE * 3 / 4)
+#define WATERMARK_TX_COUNT (TX_GUARANTEED_SIZE * 3 / 4)
+
+// What a comm interrupt may move past its budgets: a USB packet is always
+// received whole, and the cycles are checked between batches of up to 16
+// UART bytes (see comm_driver.h)
+#define BUDGET_BYTES_OVER (USE_USBUART ? SIM_USB_PACKET_SIZE - 1 : 0)
+#define BUDGET_CYCLES_OVER (16u * SIM_UART_RX_CYCLES)
+#define BUDGET_TEST_SIZE (2000u)
+
+// Stray bytes before the urgent messages of _test_urgent: with the first
+// byte of the message, they fill the UART FIFO
+#define URGENT_STRAY_BYTES (31u)
+
+// Lines of _test_policies, with their terminator (capacities are multiples)
+#define POLICY_LINE_LENGTH (8u)
+
+// Capture written by _test_replay (in the current directory)
+#define REPLAY_PATH "test_comm_driver.commcap"
+#define REPLAY_MESSAGES (300u)
+
+// Size of the bulk transfers (the last block is short)
+#define BULK_TEST_SIZE (1000u)
+
+// Records put in the flight recorder, several times what it holds
+#define RECORDER_RECORDS (4 * COMM_RECORDER_SIZE / 6)
+#define RECORDER_MAX_LENGTH (11u)
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_bytes
+********************************************************************************
+* Summary:
+*  comm_getch, comm_read, comm_putch and comm_write, with a write larger
+*  than the TX buffer sent while the comm interrupt runs from a timer. A
+*  message that can't fit in the TX buffer is ignored.
+*
+*******************************************************************************/
+static void _test_bytes(void)
+{
+    uint8 data[300], c = 0;
+    
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    sim_host_send("abcdef", 6);
+    sim_tick();
+    CHECK(comm_getch(&c) == 1 && c == 'a');
+    CHECK(comm_read(data, 3) == 3 && !memcmp(data, "bcd", 3));
+    CHECK(comm_read(data, 10) == 2 && !memcmp(data, "ef", 2));
+    CHECK(comm_read(data, 10) == 0 && comm_getch(&c) == 0);
+    
+    // Only RINGBUF_BLOCK waits for room, the write must fit otherwise
+    size_t count = TX_BUFFER_POLICY == RINGBUF_BLOCK ? sizeof(data) : TX_GUARANTEED_SIZE - 1;
+    for(size_t i = 0; i < count; i++)
+        data[i] = (uint8)i;
+    sim_start_timer(500);
+    comm_write(data, count);
+    comm_putch((const uint8 *)"Z");
+    comm_putmsg(data, PUTMSG_MAX_LENGTH + 1);
+    while(*(volatile size_t *)&sim_d2h_len < count + 1);
+    sim_stop_timer();
+    sim_tick();
+    CHECK(sim_d2h_len == count + 1);
+    CHECK(!memcmp(sim_d2h, data, count) && sim_d2h[count] == 'Z');
+}
+
+/*******************************************************************************
+* Function Name: _test_stream
+********************************************************************************
+* Summary:
+*  The host sends lines or messages of random lengths, cut in packets of
+*  random sizes, and the application reads them between comm interrupts.
+*  Then the application sends them back.
+*
+*******************************************************************************/
+static void _test_stream(bool messages)
+{
+    static uint8 sent[SIM_STREAM_SIZE / 2], received[SIM_STREAM_SIZE / 2];
+    size_t sent_len = 0, received_len = 0;
+    uint8 data[MSG_MAX_LENGTH + 1];
+    size_t count;
+    
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    for(unsigned i = 0; i < STREAM_RECORDS; i++) {
+        uint8 record[MSG_MAX_LENGTH];
+        size_t length = 1 + (size_t)rand() % (STREAM_MAX_LENGTH - MSG_STRUCTURE_LENGTH);
+        for(size_t k = 0; k < length; k++)
+            record[k] = (uint8)(messages ? rand() % 256 : 'a' + rand() % 26);
+#if USE_UART
+        // The UART driver drops null bytes (an empty RX FIFO reads 0)
+        for(size_t k = 0; k < length; k++)
+            record[k] += !record[k];
+#endif
+        memcpy(sent + sent_len, record, length);
+        sent_len += length;
+        
+        if(messages) {
+            uint8 header[MSG_HEADER_LENGTH] = { MSG_FIRST_BYTE, (uint8)(length + MSG_STRUCTURE_LENGTH) };
+            uint8 footer = MSG_LAST_BYTE;
+            sim_host_send(header, sizeof(header));
+            sim_host_send(record, length);
+            sim_host_send(&footer, 1);
+        }
+        else {
+            sim_host_send(record, length);
+            sim_host_send("\n", 1);
+        }
+    }
+    
+    // The USB packets are cut at random places by the application's reads
+    unsigned long last_progress = sim_ticks;
+    while(received_len < sent_len) {
+        size_t pending = sim_h2d_len, packet = (size_t)rand() % 100;
+        sim_h2d_len = MIN(pending, sim_h2d_pos + packet);
+        sim_tick();
+        sim_h2d_len = pending;
+        while((count = messages ? comm_getmsg(data) : comm_getline(data))) {
+            memcpy(received + received_len, data, count);
+            received_len += count;
+            last_progress = sim_ticks;
+        }
+        CHECK(sim_ticks - last_progress < 1000);
+    }
+    CHECK(received_len == sent_len && !memcmp(sent, received, sent_len));
+    
+    // Send them back while the comm interrupt runs from a timer
+    size_t pos = 0, d2h_pos = 0, expected_len = 0;
+    received_len = 0;
+    sim_start_timer(100);
+    while(pos < sent_len) {
+        size_t length = 1 + (size_t)rand() % PUTMSG_MAX_LENGTH;
+        length = MIN(length, sent_len - pos);
+        
+        // Only RINGBUF_BLOCK waits for room, don't overflow the TX buffer
+        if(TX_BUFFER_POLICY != RINGBUF_BLOCK)
+            while(*(volatile size_t *)&sim_d2h_len < expected_len);
+        if(messages) {
+            comm_putmsg(sent + pos, length);
+            expected_len += length + MSG_STRUCTURE_LENGTH;
+        }
+        else {
+            // Lines can't hold their terminator
+            for(size_t k = 0; k < length; k++)
+                data[k] = sent[pos + k] == '\n' ? ' ' : sent[pos + k];
+            comm_putline(data, length);
+            expected_len += length + 1;
+        }
+        pos += length;
+    }
+    while(*(volatile size_t *)&sim_d2h_len < expected_len);
+    sim_stop_timer();
+    CHECK(sim_d2h_len == expected_len);
+    while(d2h_pos < sim_d2h_len) {
+        if(messages) {
+            CHECK(sim_d2h[d2h_pos] == MSG_FIRST_BYTE);
+            count = sim_d2h[d2h_pos + 1];
+            CHECK(sim_d2h[d2h_pos + count - 1] == MSG_LAST_BYTE);
+            memcpy(received + received_len, sim_d2h + d2h_pos + MSG_HEADER_LENGTH, count - MSG_STRUCTURE_LENGTH);
+            received_len += count - MSG_STRUCTURE_LENGTH;
+            d2h_pos += count;
+        }
+        else {
+            CHECK(sim_d2h[d2h_pos] != '\n');
+            count = (size_t)((uint8 *)memchr(sim_d2h + d2h_pos, '\n', sim_d2h_len - d2h_pos) - sim_d2h) - d2h_pos;
+            memcpy(received + received_len, sim_d2h + d2h_pos, count);
+            received_len += count;
+            d2h_pos += count + 1;
+        }
+    }
+    CHECK(received_len == sent_len);
+    CHECK(messages ? !memcmp(sent, received, sent_len) : !memchr(received, '\n', received_len));
+}
+
+/*******************************************************************************
+* Function Name: _test_async_read
+********************************************************************************
+* Summary:
+*  The host sends lines or messages while the comm interrupt runs from a
+*  timer, so it can preempt comm_getline and comm_getmsg anywhere, and the
+*  application stops reading now and then to overflow the RX buffer. With
+*  RINGBUF_BLOCK, every record is received in order; otherwise records may
+*  be lost, but each one received is whole (a line may lose its beginning
+*  to RINGBUF_DROP_OLDEST). RINGBUF_DROP_NEWEST drops bytes from within
+*  the records, it isn't tested here.
+*
+*******************************************************************************/
+static uint8 _asyncRecords[ASYNC_RECORDS][MSG_MAX_LENGTH];
+static size_t _asyncLengths[ASYNC_RECORDS];
+
+// Finds the record received from 'next' on, returns the one after it
+static size_t _async_match(const uint8 *data, size_t count, size_t next, bool suffix)
+{
+    for(size_t i = next; i < ASYNC_RECORDS; i++) {
+        size_t length = _asyncLengths[i];
+        if(length == count && !memcmp(_asyncRecords[i], data, count))
+            return i + 1;
+        if(suffix && length > count && !memcmp(_asyncRecords[i] + length - count, data, count))
+            return i + 1;
+        CHECK(RX_BUFFER_POLICY != RINGBUF_BLOCK);
+    }
+    CHECK(false);
+    return ASYNC_RECORDS;
+}
+
+static void _test_async_read(bool messages)
+{
+    const bool suffix = !messages && RX_BUFFER_POLICY != RINGBUF_BLOCK &&
+                        (RX_BUFFER_POLICY == RINGBUF_DROP_OLDEST || !RINGBUF_POLICIES);
+    uint8 data[MSG_MAX_LENGTH + 1];
+    size_t count, next = 0, dropped = comm_rx_dropped();
+    
+    if(RINGBUF_POLICIES && RX_BUFFER_POLICY == RINGBUF_DROP_NEWEST)
+        return;
+    
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    for(unsigned i = 0; i < ASYNC_RECORDS; i++) {
+        size_t length = 1 + (size_t)rand() % (STREAM_MAX_LENGTH - MSG_STRUCTURE_LENGTH);
+        for(size_t k = 0; k < length; k++)
+            _asyncRecords[i][k] = (uint8)('a' + rand() % 26);
+        _asyncLengths[i] = length;
+        if(messages) {
+            uint8 header[MSG_HEADER_LENGTH] = { MSG_FIRST_BYTE, (uint8)(length + MSG_STRUCTURE_LENGTH) };
+            uint8 footer = MSG_LAST_BYTE;
+            sim_host_send(header, sizeof(header));
+            sim_host_send(_asyncRecords[i], length);
+            sim_host_send(&footer, 1);
+        }
+        else {
+            sim_host_send(_asyncRecords[i], length);
+            sim_host_send("\n", 1);
+        }
+    }
+    
+    sim_start_timer(100);
+    for(size_t records = 0; *(volatile size_t *)&sim_h2d_pos < sim_h2d_len; ) {
+        while((count = messages ? comm_getmsg(data) : comm_getline(data))) {
+            next = _async_match(data, count, next, suffix);
+            if(++records % ASYNC_PAUSE_RECORDS == 0) {
+                unsigned long ticks = sim_ticks;
+                while(sim_ticks - ticks < ASYNC_PAUSE_TICKS);
+            }
+        }
+    }
+    sim_stop_timer();
+    
+    // Read what's left (the UART FIFO may still hold the last bytes)
+    for(int i = 0; i < 50; i++) {
+        sim_tick();
+        while((count = messages ? comm_getmsg(data) : comm_getline(data)))
+            next = _async_match(data, count, next, suffix);
+    }
+    CHECK(next == ASYNC_RECORDS);
+    CHECK(RX_BUFFER_POLICY == RINGBUF_BLOCK ? comm_rx_dropped() == dropped :
+          !RINGBUF_POLICIES || comm_rx_dropped() > dropped);
+}
+
+/*******************************************************************************
+* Function Name: _test_comm_lock
+********************************************************************************
+* Summary:
+*  comm_lock() blocks the timer signal running the comm interrupt, and
+*  nests. Unless COMM_LOCK_ALL_INTERRUPTS is set, it leaves the other
+*  signals alone and the driver never masks all interrupts
+*  (CyEnterCriticalSection()) while exchanging data.
+*
+*******************************************************************************/
+static bool _signal_blocked(int signal_number)
+{
+    sigset_t set;
+    sigprocmask(SIG_BLOCK, NULL, &set);
+    return sigismember(&set, signal_number);
+}
+
+static void _test_comm_lock(void)
+{
+    uint8 data[TX_GUARANTEED_SIZE / 2];
+    
+    uint8 state = comm_lock();
+    uint8 nested = comm_lock();
+    CHECK(_signal_blocked(SIGALRM) && _signal_blocked(SIGUSR1) == COMM_LOCK_ALL_INTERRUPTS);
+    comm_unlock(nested);
+    CHECK(_signal_blocked(SIGALRM));
+    comm_unlock(state);
+    CHECK(!_signal_blocked(SIGALRM) && !_signal_blocked(SIGUSR1));
+    
+    // Both directions, from the application and the comm interrupt (the
+    // masked sections recorded so far may have filled sim_masked_ns)
+    sim_masked_count = 0;
+    memset(data, 'a', sizeof(data));
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    sim_host_send(data, sizeof(data));
+    comm_write(data, sizeof(data));
+    for(int i = 0; i < 100 && sim_d2h_len < sizeof(data); i++)
+        sim_tick();
+    CHECK(comm_read(data, sizeof(data)) == sizeof(data) && sim_d2h_len == sizeof(data));
+    CHECK(COMM_LOCK_ALL_INTERRUPTS ? sim_masked_count > 0 : sim_masked_count == 0);
+}
+
+#if RINGBUF_WATERMARKS
+/*******************************************************************************
+* Function Name: _test_watermarks
+********************************************************************************
+* Summary:
+*  The watermark callbacks and events of both ring buffers: the host fills
+*  the rxBuffer past its high watermark and the application empties it,
+*  then the application fills the txBuffer and the comm interrupt empties it.
+*  Then both at once, with the comm interrupt running from a timer. The
+*  callbacks are called from both contexts, always with the comm lock held.
+*
+*******************************************************************************/
+#define WATERMARK_ROUNDS (50u)
+
+static int _rxHigh, _rxLow, _txHigh, _txLow;
+
+static void _on_rx_watermark(void *context, unsigned event)
+{
+    (void)context;
+    CHECK(_signal_blocked(SIGALRM));
+    if(event == COMM_HIGH_WATERMARK) {
+        CHECK(sim_in_isr);
+        _rxHigh++;
+    }
+    else {
+        // The overflow policy may empty it from the comm interrupt
+        CHECK(!sim_in_isr || RX_BUFFER_POLICY != RINGBUF_BLOCK);
+        _rxLow++;
+    }
+}
+
+static void _on_tx_watermark(void *context, unsigned event)
+{
+    (void)context;
+    CHECK(_signal_blocked(SIGALRM));
+    if(event == COMM_HIGH_WATERMARK) {
+        CHECK(!sim_in_isr);
+        _txHigh++;
+    }
+    else {
+        CHECK(sim_in_isr);
+        _txLow++;
+    }
+}
+
+static void _test_watermarks(void)
+{
+    static uint8 data[RX_BUFFER_SIZE + TX_BUFFER_SIZE];
+    const size_t rx_count = WATERMARK_RX_COUNT, tx_count = WATERMARK_TX_COUNT;
+    memset(data, 'a', sizeof(data));
+    
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    comm_rx_watermarks(16, rx_count - 4, _on_rx_watermark, NULL);
+    comm_tx_watermarks(tx_count / 4, tx_count, _on_tx_watermark, NULL);
+    
+    sim_host_send(data, rx_count);
+    for(int i = 0; i < 5; i++)
+        sim_tick();
+    CHECK(_rxHigh == 1 && _rxLow == 0 && comm_rx_events() == COMM_HIGH_WATERMARK);
+    CHECK(comm_read(data, sizeof(data)) == rx_count);
+    CHECK(_rxHigh == 1 && _rxLow == 1 && comm_rx_events() == COMM_LOW_WATERMARK);
+    
+    comm_write(data, tx_count);
+    CHECK(_txHigh == 1 && _txLow == 0);
+    for(int i = 0; i < 100 && sim_d2h_len < tx_count; i++)
+        sim_tick();
+    CHECK(_txHigh == 1 && _txLow == 1 && sim_d2h_len == tx_count);
+    CHECK(comm_tx_events() == (COMM_HIGH_WATERMARK | COMM_LOW_WATERMARK));
+    
+    // The host fills the rxBuffer while the application waits, then the
+    // application empties it a few bytes at a time, and fills the txBuffer
+    // once the previous round was sent
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    for(unsigned i = 0; i < WATERMARK_ROUNDS; i++)
+        sim_host_send(data, rx_count);
+    sim_start_timer(100);
+    for(unsigned i = 0; i < WATERMARK_ROUNDS; i++) {
+        while(*(volatile size_t *)&sim_d2h_len < i * tx_count);
+        comm_write(data, tx_count);
+        unsigned long ticks = sim_ticks;
+        while(sim_ticks - ticks < 4);
+        while(comm_read(data, 8));
+    }
+    while(*(volatile size_t *)&sim_d2h_len < WATERMARK_ROUNDS * tx_count);
+    sim_stop_timer();
+    CHECK(_rxHigh > 1 && _rxLow > 1 && _txHigh == 1 + WATERMARK_ROUNDS && _txLow == _txHigh);
+    
+    // The next tests overflow the buffers from either side
+    comm_rx_watermarks(16, rx_count - 4, NULL, NULL);
+    comm_tx_watermarks(tx_count / 4, tx_count, NULL, NULL);
+}
+#endif // RINGBUF_WATERMARKS
+
+// Writes line 'number' of the policy tests, digits and newline
+static void _policy_line(uint8 *line, size_t number)
+{
+    for(int k = POLICY_LINE_LENGTH - 2; k >= 0; k--, number /= 10)
+        line[k] = (uint8)('0' + number % 10);
+    line[POLICY_LINE_LENGTH - 1] = '\n';
+}
+
+// Checks that 'data' holds whole consecutive lines, returns their number
+static size_t _policy_lines(const uint8 *data, size_t count, size_t *first)
+{
+    uint8 line[POLICY_LINE_LENGTH];
+    size_t lines = count / POLICY_LINE_LENGTH;
+    
+    CHECK(count % POLICY_LINE_LENGTH == 0);
+    *first = 0;
+    for(size_t k = 0; k < POLICY_LINE_LENGTH - 1; k++)
+        *first = *first * 10 + (size_t)(data[k] - '0');
+    for(size_t i = 0; i < lines; i++) {
+        _policy_line(line, *first + i);
+        CHECK(!memcmp(data + i * POLICY_LINE_LENGTH, line, POLICY_LINE_LENGTH));
+    }
+    return lines;
+}
+
+static void _check_policy(ringbuf_policy_t policy, size_t first, size_t kept, size_t sent,
+                          size_t capacity, size_t dropped)
+{
+    if(policy == RINGBUF_DROP_NEWEST)
+        CHECK(first == 0 && kept * POLICY_LINE_LENGTH == capacity);
+    else
+        CHECK(first + kept == sent && kept * POLICY_LINE_LENGTH <= capacity);
+#if RINGBUF_POLICIES
+    CHECK(dropped == (sent - kept) * POLICY_LINE_LENGTH);
+#else
+    CHECK(dropped == 0);
+#endif
+}
+
+/*******************************************************************************
+* Function Name: _test_policies
+********************************************************************************
+* Summary:
+*  The host sends, then the application writes, four times what the buffers
+*  hold, without anything being read or sent in between. The lines kept
+*  depend on RX_BUFFER_POLICY and TX_BUFFER_POLICY, the other bytes are
+*  counted as dropped. With RINGBUF_BLOCK, everything arrives once the
+*  buffers are emptied (TX is only tested with the other policies).
+*
+*******************************************************************************/
+static void _test_policies(void)
+{
+    static uint8 received[4 * (RX_CAPACITY + TX_CAPACITY)];
+    const size_t rx_lines = 4 * RX_CAPACITY / POLICY_LINE_LENGTH;
+    const size_t tx_lines = 4 * TX_CAPACITY / POLICY_LINE_LENGTH;
+    size_t count = 0, dropped = comm_rx_dropped(), first;
+    uint8 line[POLICY_LINE_LENGTH];
+    
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    for(size_t i = 0; i < rx_lines; i++) {
+        _policy_line(line, i);
+        sim_host_send(line, POLICY_LINE_LENGTH);
+    }
+    for(int i = 0; i < 50; i++)
+        sim_tick();
+    if(RX_BUFFER_POLICY == RINGBUF_BLOCK) {
+        for(int i = 0; i < 100 && count < sizeof(received); i++) {
+            count += comm_read(received + count, sizeof(received) - count);
+            sim_tick();
+        }
+        CHECK(_policy_lines(received, count, &first) == rx_lines && first == 0);
+        CHECK(comm_rx_dropped() == dropped);
+    }
+    else {
+        count = comm_read(received, sizeof(received));
+        size_t kept = _policy_lines(received, count, &first);
+        _check_policy(RX_BUFFER_POLICY, first, kept, rx_lines, RX_CAPACITY, comm_rx_dropped() - dropped);
+    }
+    
+    if(TX_BUFFER_POLICY == RINGBUF_BLOCK)
+        return;
+    sim_d2h_len = 0;
+    dropped = comm_tx_dropped();
+    for(size_t i = 0; i < tx_lines; i++) {
+        _policy_line(line, i);
+        comm_putline(line, POLICY_LINE_LENGTH - 1);
+    }
+    for(int i = 0; i < 50; i++)
+        sim_tick();
+    size_t kept = _policy_lines(sim_d2h, sim_d2h_len, &first);
+    _check_policy(TX_BUFFER_POLICY, first, kept, tx_lines, TX_CAPACITY, comm_tx_dropped() - dropped);
+}
+
+#if COMM_ADAPTIVE_TICK
+/*******************************************************************************
+* Function Name: _test_adaptive_tick
+********************************************************************************
+* Summary:
+*  With nothing to do, the comm interrupt halves its frequency every
+*  COMM_IDLE_TICKS interrupts down to COMM_INTERRUPT_MIN_FREQ. A byte from
+*  the host brings it back to COMM_INTERRUPT_FREQ on the next interrupt, a
+*  byte queued by the application right away.
+*
+*******************************************************************************/
+static void _tick_idle(void)
+{
+    uint32 freq = comm_tick_freq();
+    
+    for(int i = 0; i < 1000 && comm_tick_freq() > COMM_INTERRUPT_MIN_FREQ; i++) {
+        sim_tick();
+        CHECK(comm_tick_freq() <= freq);
+        freq = comm_tick_freq();
+        CHECK(freq * (SysTick->LOAD + 1u) == BCLK__BUS_CLK__HZ);
+    }
+    CHECK(freq == COMM_INTERRUPT_MIN_FREQ);
+}
+
+static void _test_adaptive_tick(void)
+{
+    uint8 c = 'a';
+    
+    // Woken up by the host
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    _tick_idle();
+    sim_host_send(&c, 1);
+    sim_tick();
+    CHECK(comm_tick_freq() == COMM_INTERRUPT_FREQ);
+    CHECK(comm_getch(&c) == 1 && c == 'a');
+    
+    // Full speed for COMM_IDLE_TICKS idle interrupts, then slower
+    for(unsigned i = 0; i < COMM_IDLE_TICKS - 1; i++) {
+        sim_tick();
+        CHECK(comm_tick_freq() == COMM_INTERRUPT_FREQ);
+    }
+    sim_tick();
+    CHECK(comm_tick_freq() < COMM_INTERRUPT_FREQ);
+    _tick_idle();
+    
+    // Woken up by the application, and kept awake until the byte is sent
+    comm_putch(&c);
+    CHECK(comm_tick_freq() == COMM_INTERRUPT_FREQ);
+    for(int i = 0; i < 10; i++)
+        sim_tick();
+    CHECK(sim_d2h_len == 1 && sim_d2h[0] == 'a');
+    CHECK(comm_tick_freq() == COMM_INTERRUPT_FREQ);
+    _tick_idle();
+}
+#endif // COMM_ADAPTIVE_TICK
+
+#if COMM_ISR_BYTE_BUDGET || COMM_ISR_CYCLE_BUDGET
+/*******************************************************************************
+* Function Name: _test_budget
+********************************************************************************
+* Summary:
+*  The host and the application send each other a stream at once, the comm
+*  interrupt running from a timer: no interrupt moves more than its budgets
+*  allow, and every byte still arrives. The interrupts stopped on their
+*  budget are counted. With COMM_ADAPTIVE_TICK, the comm interrupt starts
+*  slowed down, so the first interrupts change its period.
+*
+*******************************************************************************/
+static unsigned long _budgetTicks;
+
+// Checks the previous comm interrupt, before the next one
+static void _budget_check(void)
+{
+    if(_budgetTicks++ == 0)
+        return;
+#if COMM_ISR_BYTE_BUDGET
+    CHECK(sim_isr_bytes <= COMM_ISR_BYTE_BUDGET + BUDGET_BYTES_OVER);
+#endif
+#if COMM_ISR_CYCLE_BUDGET
+    CHECK(sim_isr_cycles <= COMM_ISR_CYCLE_BUDGET + BUDGET_CYCLES_OVER);
+#endif
+}
+
+static void _test_budget(void)
+{
+    static uint8 sent[BUDGET_TEST_SIZE], received[BUDGET_TEST_SIZE];
+    size_t received_len = 0;
+    uint32 byte_hits = comm_byte_budget_hits(), cycle_hits = comm_cycle_budget_hits();
+    
+    // The UART driver ignores null bytes
+    for(size_t i = 0; i < BUDGET_TEST_SIZE; i++)
+        sent[i] = (uint8)(1 + rand() % 255);
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    sim_host_send(sent, BUDGET_TEST_SIZE);
+    
+#if COMM_ADAPTIVE_TICK
+    _tick_idle();
+#endif
+    _budgetTicks = 0;
+    sim_host_step = _budget_check;
+    sim_start_timer(100);
+    comm_write(sent, BUDGET_TEST_SIZE);
+    while(received_len < BUDGET_TEST_SIZE)
+        received_len += comm_read(received + received_len, BUDGET_TEST_SIZE - received_len);
+    while(*(volatile size_t *)&sim_d2h_len < BUDGET_TEST_SIZE);
+    sim_stop_timer();
+    sim_host_step = NULL;
+    _budget_check();
+    
+    CHECK(!memcmp(received, sent, BUDGET_TEST_SIZE));
+    CHECK(sim_d2h_len == BUDGET_TEST_SIZE && !memcmp(sim_d2h, sent, BUDGET_TEST_SIZE));
+    
+    // An interrupt is counted once, on the first budget it runs out of (the
+    // simulated USB COMM block costs no cycles)
+    byte_hits = comm_byte_budget_hits() - byte_hits;
+    cycle_hits = comm_cycle_budget_hits() - cycle_hits;
+    CHECK(byte_hits + cycle_hits > 0 || (!COMM_ISR_BYTE_BUDGET && USE_USBUART));
+    CHECK((COMM_ISR_BYTE_BUDGET || !byte_hits) && (COMM_ISR_CYCLE_BUDGET || !cycle_hits));
+}
+#endif
+
+#if COMM_URGENT_MESSAGES
+/*******************************************************************************
+* Function Name: _test_urgent
+********************************************************************************
+* Summary:
+*  The hook gets the urgent messages from the comm interrupt, the other
+*  messages and the ones it refuses go to comm_getmsg(). Then, with a hook
+*  matching every ID, stray bytes followed by messages of MSG_MAX_LENGTH
+*  bytes: the messages are held while the application reads the stray
+*  bytes, and must be received even though what the UART FIFO holds and
+*  the held bytes don't fit together in the rxBuffer.
+*
+*******************************************************************************/
+static int _urgentCalls;
+static uint8 _urgentPayload[MSG_MAX_LENGTH];
+static size_t _urgentLength;
+
+static bool _urgent_hook(void *context, const uint8 *data, size_t count)
+{
+    _urgentCalls++;
+    memcpy(_urgentPayload, data, count);
+    _urgentLength = count;
+    return context == NULL;
+}
+
+static void _urgent_message(uint8 *message, uint8 id, size_t count)
+{
+    message[0] = MSG_FIRST_BYTE;
+    message[MSG_LENGTH_OFFS_FROM_FIRST_BYTE] = (uint8)(count + MSG_STRUCTURE_LENGTH);
+    message[MSG_HEADER_LENGTH] = id;
+    for(size_t i = 1; i < count; i++)
+        message[MSG_HEADER_LENGTH + i] = (uint8)('a' + i % 26);
+    message[MSG_HEADER_LENGTH + count] = MSG_LAST_BYTE;
+}
+
+static void _test_urgent(void)
+{
+    static uint8 received[RX_BUFFER_SIZE];
+    uint8 message[MSG_MAX_LENGTH], payload[MSG_MAX_LENGTH];
+    const size_t count = MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH;
+    size_t received_len = 0;
+    
+    // Only IDs 0x8X are urgent
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    _urgentCalls = 0;
+    comm_urgent_hook(0xF0, 0x80, _urgent_hook, NULL);
+    _urgent_message(message, 0x12, 10);
+    sim_host_send(message, 10 + MSG_STRUCTURE_LENGTH);
+    _urgent_message(message, 0x85, 20);
+    sim_host_send(message, 20 + MSG_STRUCTURE_LENGTH);
+    for(int i = 0; i < 10; i++)
+        sim_tick();
+    CHECK(_urgentCalls == 1 && _urgentLength == 20 && _urgentPayload[0] == 0x85);
+    CHECK(comm_getmsg(payload) == 10 && payload[0] == 0x12);
+    CHECK(comm_getmsg(payload) == 0);
+    
+    // Refused by the hook
+    comm_urgent_hook(0xF0, 0x80, _urgent_hook, (void *)1);
+    sim_host_send(message, 20 + MSG_STRUCTURE_LENGTH);
+    for(int i = 0; i < 10; i++)
+        sim_tick();
+    CHECK(_urgentCalls == 2 && comm_getmsg(payload) == 20 && payload[0] == 0x85);
+    
+    // Every ID is urgent, the messages come right after stray bytes
+    comm_urgent_hook(0x00, 0x00, _urgent_hook, NULL);
+    _urgentCalls = 0;
+    memset(message, 'x', URGENT_STRAY_BYTES);
+    sim_host_send(message, URGENT_STRAY_BYTES);
+    _urgent_message(message, 0x42, count);
+    for(int i = 0; i < 3; i++)
+        sim_host_send(message, MSG_MAX_LENGTH);
+    for(int i = 0; i < 100 && _urgentCalls < 3; i++) {
+        sim_tick();
+        received_len += comm_read(received + received_len, sizeof(received) - received_len);
+    }
+    CHECK(_urgentCalls == 3 && _urgentLength == count && !memcmp(_urgentPayload, message + MSG_HEADER_LENGTH, count));
+    CHECK(received_len == URGENT_STRAY_BYTES && !memchr(received, MSG_FIRST_BYTE, received_len));
+    
+    comm_urgent_hook(0x00, 0x00, NULL, NULL);
+}
+#endif // COMM_URGENT_MESSAGES
+
+/*******************************************************************************
+* Function Name: _test_replay
+********************************************************************************
+* Summary:
+*  Records a session where the application echoes every message of the
+*  host, then replays what the host sent from the capture: the device must
+*  send back exactly what was recorded.
+*
+*******************************************************************************/
+static size_t _replaySent, _replayExpected;
+
+static void _replay_host(void)
+{
+    // One message at a time, the echo never blocks the application
+    if(_replaySent == REPLAY_MESSAGES || sim_d2h_len < _replayExpected)
+        return;
+    
+    uint8 message[MSG_MAX_LENGTH];
+    uint8 length = (uint8)(MSG_STRUCTURE_LENGTH + 1 + rand() % PUTMSG_MAX_LENGTH);
+    message[0] = MSG_FIRST_BYTE;
+    message[1] = length;
+    for(uint8 k = MSG_HEADER_LENGTH; k < length - MSG_FOOTER_LENGTH; k++)
+        message[k] = (uint8)(1 + rand() % 255);
+    message[length - 1] = MSG_LAST_BYTE;
+    sim_host_send(message, length);
+    _replaySent++;
+    _replayExpected += length;
+}
+
+static void _replay_echo(void)
+{
+    uint8 data[MSG_MAX_LENGTH];
+    size_t count;
+    
+    sim_tick();
+    while((count = comm_getmsg(data)))
+        comm_putmsg(data, count);
+}
+
+static void _test_replay(void)
+{
+    static uint8 recorded[SIM_STREAM_SIZE / 2];
+    size_t recorded_len = 0, sent_len;
+    comm_capture_reader_t reader;
+    comm_capture_chunk_t chunk;
+    
+    // Record
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    _replaySent = _replayExpected = 0;
+    sim_capture = comm_capture_create(REPLAY_PATH);
+    CHECK(sim_capture);
+    sim_host_step = _replay_host;
+    for(int i = 0; i < 100000 && sim_d2h_len < _replayExpected + (_replaySent < REPLAY_MESSAGES); i++)
+        _replay_echo();
+    sim_host_step = NULL;
+    CHECK(_replaySent == REPLAY_MESSAGES && sim_d2h_len == _replayExpected);
+    CHECK(comm_capture_finish(&sim_capture) == 0);
+    sent_len = sim_h2d_len;
+    
+    // Replay what the host sent, chunk by chunk, waiting for the recorded
+    // answers like the host did
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    reader = comm_capture_open(REPLAY_PATH);
+    CHECK(reader);
+    while(comm_capture_next(reader, &chunk)) {
+        if(chunk.dir == COMM_CAPTURE_TX)
+            sim_host_send(chunk.data, chunk.count);
+        else {
+            memcpy(recorded + recorded_len, chunk.data, chunk.count);
+            recorded_len += chunk.count;
+        }
+        for(int i = 0; i < 100 && (sim_h2d_pos < sim_h2d_len || sim_d2h_len < recorded_len); i++)
+            _replay_echo();
+        CHECK(sim_h2d_pos == sim_h2d_len && sim_d2h_len >= recorded_len);
+    }
+    comm_capture_close(&reader);
+    
+    CHECK(sim_h2d_len == sent_len && recorded_len == _replayExpected);
+    CHECK(sim_d2h_len == recorded_len && !memcmp(sim_d2h, recorded, recorded_len));
+}
+
+#ifdef _COMM_DRIVER_BULK_H
+/*******************************************************************************
+* Function Name: _test_bulk_receive
+********************************************************************************
+* Summary:
+*  The host sends a transfer with a window of BULK_WINDOW blocks, one of them
+*  corrupted, and resends from every NAK it receives.
+*
+*******************************************************************************/
+static uint8 _bulkData[BULK_TEST_SIZE], _bulkReceived[BULK_TEST_SIZE + BULK_BLOCK_SIZE];
+static size_t _bulkReceivedLen, _bulkD2hPos, _bulkNext, _bulkBase;
+static bool _bulkFault;
+
+static void _bulk_frame(uint8 *frame, uint8 seq)
+{
+    size_t pos = (size_t)seq * BULK_BLOCK_SIZE;
+    uint8 length = (uint8)MIN(BULK_TEST_SIZE - pos, BULK_BLOCK_SIZE);
+    
+    memset(frame, 0, BULK_FRAME_LENGTH);
+    frame[BULK_SEQ_OFFS] = seq;
+    frame[BULK_LENGTH_OFFS] = length;
+    memcpy(&frame[BULK_HEADER_LENGTH], _bulkData + pos, length);
+    uint16_t crc = crc16_ccitt(CRC16_INIT, frame, BULK_FRAME_LENGTH - BULK_CRC_LENGTH);
+    frame[BULK_FRAME_LENGTH - 2] = (uint8)(crc >> 8);
+    frame[BULK_FRAME_LENGTH - 1] = (uint8)crc;
+}
+
+static void _bulk_sink(void *context, const uint8 *data, uint8 count)
+{
+    (void)context;
+    memcpy(_bulkReceived + _bulkReceivedLen, data, count);
+    _bulkReceivedLen += count;
+}
+
+static void _bulk_host_sender(void)
+{
+    const size_t frames = BULK_TEST_SIZE / BULK_BLOCK_SIZE + 1;
+    uint8 frame[BULK_FRAME_LENGTH];
+    
+    // Acknowledgements
+    for(; _bulkD2hPos + BULK_ACK_LENGTH <= sim_d2h_len; _bulkD2hPos += BULK_ACK_LENGTH) {
+        uint8 type = sim_d2h[_bulkD2hPos], seq = sim_d2h[_bulkD2hPos + 1];
+        CHECK(type == BULK_ACK || type == BULK_NAK);
+        if(type == BULK_ACK)
+            _bulkBase = MAX(_bulkBase, (size_t)seq + 1);
+        else {
+            _bulkNext = seq;
+            _bulkBase = MAX(_bulkBase, _bulkNext);
+        }
+    }
+    
+    // Fill the window, block 5 is corrupted the first time
+    while(_bulkNext < frames && _bulkNext < _bulkBase + BULK_WINDOW) {
+        _bulk_frame(frame, (uint8)_bulkNext);
+        if(_bulkNext == 5 && !_bulkFault) {
+            frame[BULK_HEADER_LENGTH] ^= 0x40;
+            _bulkFault = true;
+        }
+        sim_host_send(frame, BULK_FRAME_LENGTH);
+        _bulkNext++;
+    }
+}
+
+static void _test_bulk_receive(void)
+{
+    for(size_t i = 0; i < BULK_TEST_SIZE; i++)
+        _bulkData[i] = (uint8)rand();
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    _bulkReceivedLen = _bulkD2hPos = _bulkNext = _bulkBase = 0;
+    _bulkFault = false;
+    
+    CHECK(comm_bulk_receive(_bulk_sink, NULL));
+    CHECK(comm_bulk_is_active() && !comm_bulk_receive(_bulk_sink, NULL));
+    sim_host_step = _bulk_host_sender;
+    for(int i = 0; i < 2000 && comm_bulk_is_active(); i++)
+        sim_tick();
+    sim_tick();
+    sim_host_step = NULL;
+    
+    CHECK(!comm_bulk_is_active() && _bulkFault);
+    CHECK(_bulkReceivedLen == BULK_TEST_SIZE && !memcmp(_bulkReceived, _bulkData, BULK_TEST_SIZE));
+}
+
+/*******************************************************************************
+* Function Name: _test_bulk_send
+********************************************************************************
+* Summary:
+*  The device sends a transfer while the comm interrupt runs from a timer.
+*  The host acknowledges every block, except one it pretends was lost.
+*
+*******************************************************************************/
+static size_t _bulkSourcePos;
+
+static uint8 _bulk_source(void *context, uint8 *data, uint8 max_count)
+{
+    (void)context;
+    uint8 count = (uint8)MIN(BULK_TEST_SIZE - _bulkSourcePos, max_count);
+    memcpy(data, _bulkData + _bulkSourcePos, count);
+    _bulkSourcePos += count;
+    return count;
+}
+
+static void _bulk_host_receiver(void)
+{
+    for(; _bulkD2hPos + BULK_FRAME_LENGTH <= sim_d2h_len; _bulkD2hPos += BULK_FRAME_LENGTH) {
+        const uint8 *frame = sim_d2h + _bulkD2hPos;
+        uint8 seq = frame[BULK_SEQ_OFFS], length = frame[BULK_LENGTH_OFFS];
+        uint16_t crc = crc16_ccitt(CRC16_INIT, frame, BULK_FRAME_LENGTH - BULK_CRC_LENGTH);
+        uint8 reply[BULK_ACK_LENGTH];
+        CHECK(frame[BULK_FRAME_LENGTH - 2] == (uint8)(crc >> 8) && frame[BULK_FRAME_LENGTH - 1] == (uint8)crc);
+        
+        if(seq == _bulkNext && seq == 3 && !_bulkFault) {
+            // Lost, ask for it again
+            _bulkFault = true;
+            reply[0] = BULK_NAK;
+            reply[1] = seq;
+        }
+        else if(seq == _bulkNext) {
+            _bulk_sink(NULL, &frame[BULK_HEADER_LENGTH], length);
+            reply[0] = BULK_ACK;
+            reply[1] = (uint8)_bulkNext++;
+        }
+        else if(seq < _bulkNext) {
+            reply[0] = BULK_ACK;
+            reply[1] = (uint8)(_bulkNext - 1);
+        }
+        else
+            continue;
+        sim_host_send(reply, BULK_ACK_LENGTH);
+    }
+}
+
+static void _test_bulk_send(void)
+{
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    _bulkReceivedLen = _bulkD2hPos = _bulkNext = _bulkSourcePos = 0;
+    _bulkFault = false;
+    
+    sim_host_step = _bulk_host_receiver;
+    sim_start_timer(100);
+    CHECK(comm_bulk_send(_bulk_source, NULL));
+    sim_stop_timer();
+    sim_host_step = NULL;
+    
+    CHECK(!comm_bulk_is_active() && _bulkFault);
+    CHECK(_bulkReceivedLen == BULK_TEST_SIZE && !memcmp(_bulkReceived, _bulkData, BULK_TEST_SIZE));
+}
+#endif // _COMM_DRIVER_BULK_H
+
+#if COMM_RECORDER_SIZE
+/*******************************************************************************
+* Function Name: _test_recorder
+********************************************************************************
+* Summary:
+*  Fills the flight recorder several times over and dumps it: the latest
+*  records arrive whole and in order. A second dump runs while the host
+*  adds records from the comm interrupt, dropping some that weren't sent
+*  yet: they are skipped, a record cut that way ending early.
+*
+*******************************************************************************/
+static unsigned _recorderNext;
+
+// Writes record 'number': 5 digits and up to 6 letters, no terminator
+static size_t _recorder_record(char *record, unsigned number)
+{
+    size_t length = 5 + number % 7;
+    
+    snprintf(record, RECORDER_MAX_LENGTH + 1, "%05u", number % 100000);
+    for(size_t i = 5; i < length; i++)
+        record[i] = (char)('a' + i);
+    return length;
+}
+
+static void _recorder_put(void)
+{
+    char record[RECORDER_MAX_LENGTH + 1];
+    size_t length = _recorder_record(record, _recorderNext++);
+    comm_recorder_put((const uint8 *)record, length);
+}
+
+static void _recorder_host(void)
+{
+    size_t frames = _bulkD2hPos;
+    
+    _bulk_host_receiver();
+    if(_bulkD2hPos != frames)
+        for(int i = 0; i < 8; i++)
+            _recorder_put();
+}
+
+// Checks the records of a dump, returns the number of the last one
+static unsigned _recorder_check(bool cut_allowed)
+{
+    char record[RECORDER_MAX_LENGTH + 1];
+    size_t pos = 0, lines = 0;
+    unsigned number = 0;
+    
+    CHECK(_bulkReceivedLen > 0 && _bulkReceived[_bulkReceivedLen - 1] == COMM_LINE_TERMINATOR);
+    while(pos < _bulkReceivedLen) {
+        const uint8 *line = _bulkReceived + pos;
+        size_t length = (size_t)((const uint8 *)memchr(line, COMM_LINE_TERMINATOR, _bulkReceivedLen - pos) - line);
+        pos += length + 1;
+        
+        // A cut record may be too short to hold its number
+        if(length < 5) {
+            CHECK(cut_allowed && lines > 0);
+            continue;
+        }
+        unsigned n = 0;
+        for(size_t i = 0; i < 5; i++)
+            n = n * 10 + (unsigned)(line[i] - '0');
+        size_t expected = _recorder_record(record, n);
+        CHECK(length == expected || (cut_allowed && length < expected));
+        CHECK(!memcmp(line, record, length));
+        CHECK(lines == 0 || n == number + 1 || (cut_allowed && n > number));
+        number = n;
+        lines++;
+    }
+    return number;
+}
+
+static void _test_recorder(void)
+{
+    // Records that can never fit are ignored
+    static uint8 too_long[COMM_RECORDER_SIZE];
+    memset(too_long, 'x', sizeof(too_long));
+    comm_recorder_put(too_long, sizeof(too_long));
+    
+    _recorderNext = 0;
+    for(size_t i = 0; i < RECORDER_RECORDS; i++)
+        _recorder_put();
+    
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    _bulkReceivedLen = _bulkD2hPos = _bulkNext = 0;
+    _bulkFault = false;
+    sim_host_step = _bulk_host_receiver;
+    sim_start_timer(100);
+    CHECK(comm_recorder_dump());
+    sim_stop_timer();
+    sim_host_step = NULL;
+    
+    // The latest records, only the oldest ones dropped
+    CHECK(_recorder_check(false) == RECORDER_RECORDS - 1);
+    CHECK(_bulkReceivedLen <= COMM_RECORDER_SIZE);
+    CHECK(_bulkReceivedLen + RECORDER_MAX_LENGTH + 1 > COMM_RECORDER_SIZE);
+    
+    // Dumped again, while records are added
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    _bulkReceivedLen = _bulkD2hPos = _bulkNext = 0;
+    _bulkFault = false;
+    sim_host_step = _recorder_host;
+    sim_start_timer(100);
+    CHECK(comm_recorder_dump());
+    sim_stop_timer();
+    sim_host_step = NULL;
+    
+    CHECK(_recorder_check(true) < _recorderNext && _recorderNext > RECORDER_RECORDS);
+}
+#endif // COMM_RECORDER_SIZE
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(void)
+{
+    srand(1);
+    comm_init();
+    _test_bytes();
+    _test_stream(true);
+    _test_stream(false);
+    _test_async_read(true);
+    _test_async_read(false);
+    _test_comm_lock();
+#if RINGBUF_WATERMARKS
+    _test_watermarks();
+#endif
+    _test_policies();
+#if COMM_ADAPTIVE_TICK
+    _test_adaptive_tick();
+#endif
+#if COMM_ISR_BYTE_BUDGET || COMM_ISR_CYCLE_BUDGET
+    _test_budget();
+#endif
+#if COMM_URGENT_MESSAGES
+    _test_urgent();
+#endif
+    _test_replay();
+#ifdef _COMM_DRIVER_BULK_H
+    _test_bulk_receive();
+    _test_bulk_send();
+#endif
+#if COMM_RECORDER_SIZE
+    _test_recorder();
+#endif
+    
+    printf("test_comm_driver: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,183 @@
+/*******************************************************************************
+*
+* Tests of the C++ COMM driver template on the host simulator.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Runs comm::Comm (comm_driver.hpp) against the fake COMM block of sim/:
+*  lines and messages split in random packets, read between comm
+*  interrupts, then sent back while the comm interrupt runs from a timer,
+*  through the pointer, std::string_view and std::span (C++20) overloads.
+*
+*******************************************************************************/
+
+#include <cstring>
+#include <string_view>
+
+#include "comm_driver.hpp"
+#include "sim.h"
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define STREAM_RECORDS (2000u)
+
+using Link = comm::Comm<>;
+
+// Records longer than this could deadlock (see test_comm_driver.c)
+static constexpr std::size_t max_record = Link::rx_size - SIM_USB_PACKET_SIZE - 3u;
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_stream
+********************************************************************************
+* Summary:
+*  The host sends lines or messages of random lengths, cut in packets of
+*  random sizes, and the application reads them between comm interrupts.
+*  Then the application sends them back.
+*
+*******************************************************************************/
+static void _test_stream(bool messages)
+{
+    static uint8_t sent[SIM_STREAM_SIZE / 2], received[SIM_STREAM_SIZE / 2];
+    std::size_t sent_len = 0, received_len = 0, count;
+    uint8_t data[Link::rx_size];
+    
+    sim_h2d_len = sim_h2d_pos = sim_d2h_len = 0;
+    for(unsigned i = 0; i < STREAM_RECORDS; i++) {
+        uint8_t record[Link::rx_size];
+        std::size_t length = 1 + (std::size_t)rand() % max_record;
+        for(std::size_t k = 0; k < length; k++)
+            record[k] = (uint8_t)(messages ? 1 + rand() % 255 : 'a' + rand() % 26);
+        std::memcpy(sent + sent_len, record, length);
+        sent_len += length;
+        
+        if(messages) {
+            uint8_t header[MSG_HEADER_LENGTH] = { MSG_FIRST_BYTE, (uint8_t)(length + MSG_STRUCTURE_LENGTH) };
+            uint8_t footer = MSG_LAST_BYTE;
+            sim_host_send(header, sizeof(header));
+            sim_host_send(record, length);
+            sim_host_send(&footer, 1);
+        }
+        else {
+            sim_host_send(record, length);
+            sim_host_send("\n", 1);
+        }
+    }
+    
+    unsigned long last_progress = sim_ticks;
+    while(received_len < sent_len) {
+        std::size_t pending = sim_h2d_len, packet = (std::size_t)rand() % 100;
+        sim_h2d_len = pending < sim_h2d_pos + packet ? pending : sim_h2d_pos + packet;
+        sim_tick();
+        sim_h2d_len = pending;
+        while((count = messages ? Link::getmsg(data) : Link::getline(data))) {
+            std::memcpy(received + received_len, data, count);
+            received_len += count;
+            last_progress = sim_ticks;
+        }
+        CHECK(sim_ticks - last_progress < 1000);
+    }
+    CHECK(received_len == sent_len && !std::memcmp(sent, received, sent_len));
+    
+    // Send them back, one overload after the other
+    std::size_t pos = 0, expected_len = 0;
+    unsigned overload = 0;
+    sim_start_timer(100);
+    while(pos < sent_len) {
+        std::size_t length = 1 + (std::size_t)rand() % Link::max_payload;
+        length = length < sent_len - pos ? length : sent_len - pos;
+        const uint8_t *record = sent + pos;
+        std::string_view view((const char *)record, length);
+        switch(overload++ % 3) {
+        case 0:
+            messages ? Link::putmsg(record, length) : Link::putline(record, length);
+            break;
+        case 1:
+            messages ? Link::putmsg(view) : Link::putline(view);
+            break;
+        default:
+#ifdef COMM_HAVE_SPAN
+            messages ? Link::putmsg(std::span<const uint8_t>(record, length)) :
+                       Link::putline(std::span<const uint8_t>(record, length));
+#else
+            messages ? Link::putmsg(record, length) : Link::putline(record, length);
+#endif
+            break;
+        }
+        expected_len += length + (messages ? MSG_STRUCTURE_LENGTH : 1u);
+        pos += length;
+    }
+    while(*(volatile std::size_t *)&sim_d2h_len < expected_len);
+    sim_stop_timer();
+    CHECK(sim_d2h_len == expected_len);
+    
+    // Lines are cut anywhere, only their bytes are compared
+    std::size_t d2h_pos = 0;
+    received_len = 0;
+    while(d2h_pos < sim_d2h_len) {
+        if(messages) {
+            CHECK(sim_d2h[d2h_pos] == MSG_FIRST_BYTE);
+            count = sim_d2h[d2h_pos + 1];
+            CHECK(sim_d2h[d2h_pos + count - 1] == MSG_LAST_BYTE);
+            std::memcpy(received + received_len, sim_d2h + d2h_pos + MSG_HEADER_LENGTH, count - MSG_STRUCTURE_LENGTH);
+            received_len += count - MSG_STRUCTURE_LENGTH;
+            d2h_pos += count;
+        }
+        else {
+            if(sim_d2h[d2h_pos] != '\n')
+                received[received_len++] = sim_d2h[d2h_pos];
+            d2h_pos++;
+        }
+    }
+    CHECK(received_len == sent_len && !std::memcmp(sent, received, sent_len));
+}
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(void)
+{
+    srand(1);
+    Link::init();
+    _test_stream(true);
+    _test_stream(false);
+    
+    printf("test_comm_driver_hpp: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,356 @@
+/*******************************************************************************
+*
+* Tests of host/comm_host.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Sends random streams of lines, messages and garbage to a comm_host_t
+*  through a socketpair, in random chunks, and compares what
+*  comm_host_getline() and comm_host_getmsg() return with a naive split of
+*  the stream (and comm_parse.h for the messages). Also checks the
+*  COMM_HOST_RX_FULL result of comm_host_poll(), and the framing both ways
+*  through a pty opened with comm_host_open().
+*
+*******************************************************************************/
+
+#define _GNU_SOURCE /* ptsname_r */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "comm_host.h"
+#include "comm_parse.h"
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define STREAM_LENGTH (200000u)
+#define MAX_CHUNK (700u)
+#define MAX_LINE (300u)
+
+/*******************************************************************************
+* HELPERS
+*******************************************************************************/
+static void _random_bytes(uint8_t *data, size_t count, int range)
+{
+    for(size_t i = 0; i < count; i++)
+        data[i] = (uint8_t)(rand() % range);
+}
+
+// Appends a random message to 'stream' (at 'length'), sometimes broken:
+// wrong length, missing last byte, or cut short. Returns the new length.
+static size_t _random_message(uint8_t *stream, size_t length)
+{
+    uint8_t msg_length = (uint8_t)(MSG_STRUCTURE_LENGTH + rand() % (MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH + 1));
+    stream[length] = MSG_FIRST_BYTE;
+    stream[length + 1] = msg_length;
+    _random_bytes(stream + length + MSG_HEADER_LENGTH, msg_length - MSG_STRUCTURE_LENGTH, 256);
+    stream[length + msg_length - MSG_FOOTER_LENGTH] = MSG_LAST_BYTE;
+    switch(rand() % 10) {
+    case 0:
+        stream[length + 1] = (uint8_t)(MSG_MAX_LENGTH + 1 + rand() % (256 - MSG_MAX_LENGTH - 1));
+        break;
+    case 1:
+        stream[length + 1] = (uint8_t)(rand() % MSG_STRUCTURE_LENGTH);
+        break;
+    case 2:
+        stream[length + msg_length - MSG_FOOTER_LENGTH] = (uint8_t)(MSG_LAST_BYTE + 1);
+        break;
+    case 3:
+        return length + (size_t)rand() % msg_length;
+    }
+    return length + msg_length;
+}
+
+// Writes up to MAX_CHUNK bytes of 'stream' from '*sent' to 'fd'
+static void _send_chunk(int fd, const uint8_t *stream, size_t length, size_t *sent)
+{
+    size_t count = 1 + (size_t)rand() % MAX_CHUNK;
+    count = MIN(count, length - *sent);
+    CHECK(write(fd, stream + *sent, count) == (ssize_t)count);
+    *sent += count;
+}
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_lines
+********************************************************************************
+* Summary:
+*  Random lines, sent in random chunks, are returned one by one by
+*  comm_host_getline(), whole and without their terminator.
+*
+*******************************************************************************/
+static void _test_lines(void)
+{
+    static uint8_t stream[STREAM_LENGTH + MAX_LINE + 1];
+    int sv[2];
+    CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    comm_host_t host = comm_host_attach(sv[0], 0, 0);
+    CHECK(host && comm_host_fd(host) == sv[0]);
+
+    // Lines of at least one byte: an empty one can't be told from no line
+    size_t length = 0;
+    while(length < STREAM_LENGTH) {
+        size_t line = 1 + (size_t)rand() % MAX_LINE;
+        for(size_t i = 0; i < line; i++)
+            stream[length + i] = (uint8_t)(COMM_HOST_LINE_TERMINATOR + 1 + rand() % 200);
+        stream[length + line] = COMM_HOST_LINE_TERMINATOR;
+        length += line + 1;
+    }
+
+    size_t sent = 0, received = 0;
+    while(sent < length) {
+        _send_chunk(sv[1], stream, length, &sent);
+        if(rand() % 2)
+            CHECK(comm_host_poll(host, 1000) == 1);
+        else
+            CHECK(comm_host_receive(host) > 0);
+
+        uint8_t line[COMM_HOST_RX_BUFFER_SIZE];
+        size_t count;
+        while((count = comm_host_getline(host, line))) {
+            CHECK(received + count < length);
+            CHECK(!memcmp(line, stream + received, count));
+            CHECK(stream[received + count] == COMM_HOST_LINE_TERMINATOR);
+            received += count + 1;
+        }
+        CHECK(received + ringbuf_bytes_used(comm_host_rx_buffer(host)) == sent);
+    }
+    CHECK(received == length);
+
+    // Nothing left to read
+    CHECK(comm_host_poll(host, 10) == 0);
+    comm_host_close(&host);
+    CHECK(!host);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/*******************************************************************************
+* Function Name: _test_messages
+********************************************************************************
+* Summary:
+*  Random messages, valid or broken, between random garbage, sent in random
+*  chunks: comm_host_getmsg() must return the messages comm_parse_step()
+*  finds in the whole stream.
+*
+*******************************************************************************/
+static void _test_messages(void)
+{
+    static uint8_t stream[STREAM_LENGTH + MAX_CHUNK + MSG_MAX_LENGTH];
+    int sv[2];
+    CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    comm_host_t host = comm_host_attach(sv[0], 0, 0);
+    CHECK(host);
+
+    size_t length = 0;
+    while(length < STREAM_LENGTH) {
+        if(rand() % 4 == 0) {
+            size_t garbage = (size_t)rand() % 20;
+            _random_bytes(stream + length, garbage, 4);
+            length += garbage;
+        }
+        length = _random_message(stream, length);
+    }
+
+    // The messages, as parsed from the whole stream. Empty ones are
+    // skipped: comm_host_getmsg() returns 0 for them.
+    size_t expected = 0, parsed;
+    comm_parse_result_t result;
+    size_t sent = 0;
+    while(sent < length) {
+        _send_chunk(sv[1], stream, length, &sent);
+        CHECK(comm_host_poll(host, 1000) == 1);
+
+        // comm_host_getmsg() stops after a wrong length, call it again
+        // until nothing moves
+        uint8_t data[MSG_MAX_LENGTH];
+        ringbuf_t rx = comm_host_rx_buffer(host);
+        size_t count, used;
+        do {
+            used = ringbuf_bytes_used(rx);
+            count = comm_host_getmsg(host, data);
+            if(!count)
+                continue;
+            while((result = comm_parse_step(stream + expected, length - expected, &parsed)) != COMM_PARSE_MESSAGE
+                  || parsed == MSG_STRUCTURE_LENGTH) {
+                CHECK(result != COMM_PARSE_MORE);
+                expected += parsed;
+            }
+            CHECK(count == parsed - MSG_STRUCTURE_LENGTH);
+            CHECK(!memcmp(data, stream + expected + MSG_HEADER_LENGTH, count));
+            expected += parsed;
+        } while(count || ringbuf_bytes_used(rx) != used);
+    }
+
+    // What's left can't hold a message
+    while((result = comm_parse_step(stream + expected, length - expected, &parsed)) != COMM_PARSE_MORE) {
+        CHECK(result != COMM_PARSE_MESSAGE || parsed == MSG_STRUCTURE_LENGTH);
+        expected += parsed;
+    }
+    comm_host_close(&host);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/*******************************************************************************
+* Function Name: _test_rx_full
+********************************************************************************
+* Summary:
+*  A full RX ring buffer isn't overwritten: comm_host_poll() returns
+*  COMM_HOST_RX_FULL right away (even without a timeout) until bytes are
+*  taken out, then reads again.
+*
+*******************************************************************************/
+static void _test_rx_full(void)
+{
+    int sv[2];
+    CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    comm_host_t host = comm_host_attach(sv[0], 0, 0);
+    CHECK(host);
+    ringbuf_t rx = comm_host_rx_buffer(host);
+    size_t capacity = ringbuf_capacity(rx);
+
+    // More than the RX ring buffer holds, without a line terminator
+    uint8_t data[2 * COMM_HOST_RX_BUFFER_SIZE + 100];
+    size_t length = MIN(sizeof(data), capacity + 100);
+    memset(data, 'x', length);
+    CHECK(write(sv[1], data, length) == (ssize_t)length);
+
+    CHECK(comm_host_poll(host, 1000) == 1);
+    CHECK(ringbuf_is_full(rx));
+    CHECK(comm_host_poll(host, -1) == COMM_HOST_RX_FULL);
+    CHECK(comm_host_poll(host, -1) == COMM_HOST_RX_FULL);
+    CHECK(comm_host_getline(host, data) == 0);
+    CHECK(comm_host_poll(host, -1) == COMM_HOST_RX_FULL);
+
+    // Taking bytes out reads the rest
+    uint8_t c;
+    CHECK(comm_host_getch(host, &c) == 1 && c == 'x');
+    CHECK(comm_host_poll(host, 1000) == 1);
+    CHECK(ringbuf_is_full(rx));
+    for(size_t i = 0; i < 100; i++)
+        CHECK(comm_host_getch(host, &c) == 1);
+    CHECK(comm_host_poll(host, 1000) == 1);
+    CHECK(ringbuf_bytes_used(rx) == length - 101);
+    CHECK(comm_host_poll(host, 10) == 0);
+
+    // The peer going away is reported
+    close(sv[1]);
+    CHECK(comm_host_poll(host, 1000) == -1 && errno == ENOTCONN);
+    comm_host_close(&host);
+    close(sv[0]);
+}
+
+/*******************************************************************************
+* Function Name: _test_pty
+********************************************************************************
+* Summary:
+*  Lines and messages both ways through a pty opened with comm_host_open(),
+*  which puts it in raw mode.
+*
+*******************************************************************************/
+static void _test_pty(void)
+{
+    char path[64];
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0 && !grantpt(master) && !unlockpt(master));
+    CHECK(!ptsname_r(master, path, sizeof(path)));
+    comm_host_t host = comm_host_open(path, 0, 0);
+    CHECK(host);
+
+    // Device to host: bytes a cooked tty would change or act on
+    const uint8_t line[] = {'a', '\r', 0x03, 0x7f, 'z', '\n'};
+    const uint8_t msg[] = {MSG_FIRST_BYTE, 7, '\r', 0x04, 0x1a, 0x11, MSG_LAST_BYTE};
+    CHECK(write(master, line, sizeof(line)) == sizeof(line));
+    CHECK(write(master, msg, sizeof(msg)) == sizeof(msg));
+    uint8_t data[COMM_HOST_RX_BUFFER_SIZE];
+    size_t count = 0;
+    for(int i = 0; i < 100 && ringbuf_bytes_used(comm_host_rx_buffer(host)) < sizeof(line) + sizeof(msg); i++)
+        CHECK(comm_host_poll(host, 100) >= 0);
+    CHECK((count = comm_host_getline(host, data)) == sizeof(line) - 1);
+    CHECK(!memcmp(data, line, count));
+    CHECK((count = comm_host_getmsg(host, data)) == sizeof(msg) - MSG_STRUCTURE_LENGTH);
+    CHECK(!memcmp(data, msg + MSG_HEADER_LENGTH, count));
+
+    // Host to device
+    const uint8_t payload[] = {'\n', '\r', 0x03, 0xff};
+    uint8_t expected[64], received[64];
+    size_t length = 0;
+    CHECK(comm_host_putline(host, payload + 1, sizeof(payload) - 1));
+    memcpy(expected, payload + 1, sizeof(payload) - 1);
+    length += sizeof(payload) - 1;
+    expected[length++] = COMM_HOST_LINE_TERMINATOR;
+    CHECK(comm_host_putmsg(host, payload, sizeof(payload)));
+    expected[length++] = MSG_FIRST_BYTE;
+    expected[length++] = sizeof(payload) + MSG_STRUCTURE_LENGTH;
+    memcpy(expected + length, payload, sizeof(payload));
+    length += sizeof(payload);
+    expected[length++] = MSG_LAST_BYTE;
+    CHECK(comm_host_putch(host, payload + 3));
+    expected[length++] = payload[3];
+    size_t total = 0;
+    while(total < length) {
+        ssize_t n = read(master, received + total, sizeof(received) - total);
+        CHECK(n > 0);
+        total += (size_t)n;
+    }
+    CHECK(total == length && !memcmp(received, expected, length));
+
+    // Too long for a message
+    CHECK(!comm_host_putmsg(host, data, MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH + 1));
+
+    comm_host_close(&host);
+    close(master);
+}
+
+int main(void)
+{
+    srand(1);
+    _test_lines();
+    _test_messages();
+    _test_rx_full();
+    _test_pty();
+
+    printf("test_comm_host: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,257 @@
+/*******************************************************************************
+*
+* Stress test of host/comm_mpsc.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Several producer threads queue numbered records with comm_mpsc_put() and
+*  comm_mpsc_putmsg() while a consumer thread writes them to a pipe with
+*  comm_mpsc_write(), in random amounts. The stream read from the pipe must
+*  hold every record, whole, and each producer's records in order. The ring
+*  positions can start just before 2^32, so the 32-bit ends recorded in
+*  done[] wrap during the run.
+*
+*  comm_mpsc.c is included to set the starting positions with _reset().
+*
+*******************************************************************************/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "comm_mpsc.c"
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define PRODUCERS (4u)
+#define RECORDS (20000u)
+
+// A record queued with comm_mpsc_put(): PUT_FIRST_BYTE, then the record
+#define PUT_FIRST_BYTE ((uint8_t)0x02)
+
+// A record: producer, sequence number (4 bytes), payload length, payload
+#define RECORD_HEADER_LENGTH (6u)
+#define RECORD_MAX_LENGTH (MSG_MAX_LENGTH - MSG_STRUCTURE_LENGTH)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+typedef struct
+{
+    comm_mpsc_t mpsc;
+    int fd; // Write end of the pipe
+    atomic_uint finished; // Producers done
+} run_t;
+
+typedef struct
+{
+    run_t *run;
+    uint8_t id;
+} producer_t;
+
+
+/*******************************************************************************
+* RECORDS
+*******************************************************************************/
+static uint8_t _payload(uint8_t id, uint32_t seq, size_t i)
+{
+    return (uint8_t)(seq * 7u + i * 13u + id);
+}
+
+// Builds record 'seq' of producer 'id' in 'record', returns its length
+static size_t _record(uint8_t *record, uint8_t id, uint32_t seq, size_t length)
+{
+    record[0] = id;
+    memcpy(record + 1, &seq, sizeof(seq));
+    record[5] = (uint8_t)length;
+    for(size_t i = 0; i < length; i++)
+        record[RECORD_HEADER_LENGTH + i] = _payload(id, seq, i);
+    return RECORD_HEADER_LENGTH + length;
+}
+
+// Checks the record at 'p' and returns its length, 'next' holds the next
+// sequence number of every producer
+static size_t _check_record(const uint8_t *p, size_t available, uint32_t next[PRODUCERS])
+{
+    CHECK(available >= RECORD_HEADER_LENGTH);
+    uint8_t id = p[0];
+    uint32_t seq;
+    memcpy(&seq, p + 1, sizeof(seq));
+    size_t length = p[5];
+    CHECK(id < PRODUCERS && seq == next[id]++);
+    CHECK(available >= RECORD_HEADER_LENGTH + length);
+    for(size_t i = 0; i < length; i++)
+        CHECK(p[RECORD_HEADER_LENGTH + i] == _payload(id, seq, i));
+    return RECORD_HEADER_LENGTH + length;
+}
+
+
+/*******************************************************************************
+* THREADS
+*******************************************************************************/
+static void *_producer(void *arg)
+{
+    producer_t *producer = arg;
+    unsigned seed = producer->id + 1u;
+
+    for(uint32_t seq = 0; seq < RECORDS; seq++) {
+        uint8_t record[1 + RECORD_MAX_LENGTH];
+        bool message = rand_r(&seed) % 2;
+        size_t length = (size_t)rand_r(&seed) % (RECORD_MAX_LENGTH - RECORD_HEADER_LENGTH + 1);
+
+        // Retry until the consumer makes room
+        if(message) {
+            length = _record(record, producer->id, seq, length);
+            while(!comm_mpsc_putmsg(producer->run->mpsc, record, length))
+                sched_yield();
+        }
+        else {
+            record[0] = PUT_FIRST_BYTE;
+            length = 1 + _record(record + 1, producer->id, seq, length);
+            while(!comm_mpsc_put(producer->run->mpsc, record, length))
+                sched_yield();
+        }
+    }
+    atomic_fetch_add(&producer->run->finished, 1);
+    return NULL;
+}
+
+static void *_consumer(void *arg)
+{
+    run_t *run = arg;
+    unsigned seed = 1234;
+
+    while(1) {
+        // Every record is published once its producer returns
+        bool finished = atomic_load(&run->finished) == PRODUCERS;
+        ssize_t n = comm_mpsc_write(run->fd, run->mpsc, 1 + (size_t)rand_r(&seed) % 300);
+        CHECK(n >= 0);
+        if(!n && finished) {
+            CHECK(!comm_mpsc_bytes_used(run->mpsc));
+            CHECK(atomic_load(&run->mpsc->commit_pos) == atomic_load(&run->mpsc->reserve_pos));
+            break;
+        }
+        if(!n)
+            sched_yield();
+    }
+    close(run->fd);
+    return NULL;
+}
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_run
+********************************************************************************
+* Summary:
+*  Runs the producers and the consumer on a ring of 'capacity' bytes whose
+*  positions start at 'start', and checks the stream.
+*
+*******************************************************************************/
+static void _test_run(size_t capacity, size_t start)
+{
+    static uint8_t stream[PRODUCERS * RECORDS * (1 + MSG_MAX_LENGTH)];
+    run_t run;
+    producer_t producers[PRODUCERS];
+    pthread_t threads[PRODUCERS + 1];
+    int fd[2];
+
+    run.mpsc = comm_mpsc_new(capacity);
+    CHECK(run.mpsc);
+    _reset(run.mpsc, start);
+    CHECK(!pipe(fd));
+    run.fd = fd[1];
+    atomic_init(&run.finished, 0);
+
+    CHECK(!pthread_create(&threads[PRODUCERS], NULL, _consumer, &run));
+    for(unsigned i = 0; i < PRODUCERS; i++) {
+        producers[i].run = &run;
+        producers[i].id = (uint8_t)i;
+        CHECK(!pthread_create(&threads[i], NULL, _producer, &producers[i]));
+    }
+
+    // Read everything until the consumer closes the pipe
+    size_t length = 0;
+    ssize_t n;
+    while((n = read(fd[0], stream + length, sizeof(stream) - length)) > 0)
+        length += (size_t)n;
+    CHECK(n == 0);
+    for(unsigned i = 0; i <= PRODUCERS; i++)
+        CHECK(!pthread_join(threads[i], NULL));
+    close(fd[0]);
+
+    // Every record whole, in order for each producer, and none missing
+    uint32_t next[PRODUCERS] = {0};
+    for(size_t i = 0; i < length;) {
+        if(stream[i] == MSG_FIRST_BYTE) {
+            CHECK(i + MSG_HEADER_LENGTH <= length);
+            size_t msg_length = stream[i + MSG_LENGTH_OFFS_FROM_FIRST_BYTE];
+            CHECK(msg_length > MSG_STRUCTURE_LENGTH && i + msg_length <= length);
+            CHECK(stream[i + msg_length - MSG_FOOTER_LENGTH] == MSG_LAST_BYTE);
+            CHECK(_check_record(stream + i + MSG_HEADER_LENGTH, msg_length - MSG_STRUCTURE_LENGTH, next)
+                  == msg_length - MSG_STRUCTURE_LENGTH);
+            i += msg_length;
+        }
+        else {
+            CHECK(stream[i] == PUT_FIRST_BYTE);
+            i += 1 + _check_record(stream + i + 1, length - i - 1, next);
+        }
+    }
+    for(unsigned i = 0; i < PRODUCERS; i++)
+        CHECK(next[i] == RECORDS);
+
+    comm_mpsc_free(&run.mpsc);
+    CHECK(!run.mpsc);
+}
+
+int main(void)
+{
+    // A ring barely larger than a message, then a roomier one; the 32-bit
+    // ends wrap around after a quarter of the run
+    const size_t capacities[] = {128, 4096};
+    for(size_t i = 0; i < sizeof(capacities) / sizeof(*capacities); i++) {
+        _test_run(capacities[i], 0);
+        _test_run(capacities[i], ((size_t)1 << 32) - PRODUCERS * RECORDS * 12);
+        _test_run(capacities[i], ((size_t)1 << 32) - capacities[i] / 2);
+    }
+
+    printf("test_comm_mpsc: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,289 @@
+/*******************************************************************************
+*
+* Tests of host/comm_shm.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Publishes random frames to a shared ring while several readers peek at
+*  them at their own pace, and compares every record, skip and lost count
+*  with a model of the writer dropping the oldest records. Also checks that
+*  comm_shm_next() reports a record overwritten after comm_shm_peek(), and
+*  that comm_shm_wait() is woken by a publish from another thread.
+*
+*******************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "comm_shm.h"
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define FRAMES (200000u)
+#define READERS (3u)
+
+// Same as comm_shm.c
+#define RECORD_LENGTH(count) ((sizeof(comm_shm_record_t) + (count) + 7u) & ~(size_t)7u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+// The writer, as a list of every frame published
+typedef struct
+{
+    comm_shm_t shm;
+    uint64_t size; // Size of the data area
+    uint64_t start[FRAMES]; // Position of every record
+    uint8_t count[FRAMES];
+    uint64_t published, oldest; // Sequence numbers of the next and oldest records
+    uint64_t head;
+} writer_t;
+
+typedef struct
+{
+    comm_shm_reader_t reader;
+    uint64_t next; // Sequence number of the next record to read
+    uint64_t sequence; // The one the reader expects (after the last read)
+    bool synced; // A record was read
+    uint64_t lost;
+} reader_t;
+
+// What the run went through
+static uint64_t _lost, _overwritten;
+
+
+/*******************************************************************************
+* MODEL
+*******************************************************************************/
+static uint8_t _data(uint64_t sequence, size_t i)
+{
+    return (uint8_t)(sequence * 31u + i);
+}
+
+static void _publish(writer_t *w, uint8_t count)
+{
+    comm_frame_t frame = {
+        .timestamp_ns = w->published * 1000u,
+        .device = (uint16_t)w->published,
+        .count = count
+    };
+    for(size_t i = 0; i < count; i++)
+        frame.data[i] = _data(w->published, i);
+    comm_shm_publish(w->shm, &frame);
+
+    uint64_t length = RECORD_LENGTH(count);
+    while(w->oldest < w->published && w->head + length - w->start[w->oldest] > w->size)
+        w->oldest++;
+    w->start[w->published] = w->head;
+    w->count[w->published++] = count;
+    w->head += length;
+}
+
+static void _check_record(const writer_t *w, const comm_shm_record_t *record, uint64_t sequence)
+{
+    CHECK(record->sequence == sequence);
+    CHECK(record->length == RECORD_LENGTH(w->count[sequence]));
+    CHECK(record->device == (uint16_t)sequence && record->count == w->count[sequence]);
+    CHECK(record->timestamp_ns == sequence * 1000u);
+    for(size_t i = 0; i < record->count; i++)
+        CHECK(record->data[i] == _data(sequence, i));
+}
+
+// comm_shm_peek() as the model sees it: skips to the oldest record left
+static const comm_shm_record_t *_peek(const writer_t *w, reader_t *r)
+{
+    const comm_shm_record_t *record = comm_shm_peek(r->reader);
+    if(r->next < w->oldest)
+        r->next = w->oldest;
+    if(r->next == w->published) {
+        CHECK(!record);
+        return NULL;
+    }
+
+    CHECK(record);
+    _check_record(w, record, r->next);
+    if(r->synced) {
+        r->lost += r->next - r->sequence;
+        _lost += r->next - r->sequence;
+    }
+    r->sequence = r->next;
+    r->synced = true;
+    CHECK(comm_shm_lost(r->reader) == r->lost);
+    return record;
+}
+
+static void _next(const writer_t *w, reader_t *r)
+{
+    CHECK(comm_shm_next(r->reader) == (r->next >= w->oldest));
+    _overwritten += r->next < w->oldest;
+    r->next++;
+    r->sequence++;
+}
+
+static void _attach(const writer_t *w, reader_t *r, const char *name)
+{
+    r->reader = comm_shm_attach(name);
+    CHECK(r->reader);
+    r->next = w->published;
+    r->synced = false;
+    r->lost = 0;
+}
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_readers
+********************************************************************************
+* Summary:
+*  Random publishes and reads, by readers attached at different times.
+*  Readers that fall behind skip to the oldest record left and count what
+*  they lost, once they've read a record.
+*
+*******************************************************************************/
+static void _test_readers(const char *name)
+{
+    static writer_t w;
+    reader_t readers[READERS];
+
+    w.shm = comm_shm_create(name, 1);
+    CHECK(w.shm);
+    w.size = (uint64_t)sysconf(_SC_PAGESIZE);
+    w.published = w.oldest = w.head = 0;
+    for(unsigned i = 0; i < READERS; i++) {
+        _attach(&w, &readers[i], name);
+        CHECK(!_peek(&w, &readers[i]));
+        CHECK(comm_shm_wait(readers[i].reader, 0) == 0);
+    }
+
+    while(w.published < FRAMES - 8) {
+        reader_t *r = &readers[rand() % READERS];
+        switch(rand() % 8) {
+        case 0: // A new reader
+            comm_shm_detach(&r->reader);
+            CHECK(!r->reader);
+            _attach(&w, r, name);
+            break;
+        case 1: // Overwritten while being read
+            if(_peek(&w, r)) {
+                for(int i = 0; i < 8; i++)
+                    _publish(&w, (uint8_t)(rand() % 100));
+                _next(&w, r);
+            }
+            break;
+        case 2:
+        case 3: // Reading, at any pace
+        {
+            int count = rand() % 60;
+            for(int i = 0; i < count && _peek(&w, r); i++)
+                _next(&w, r);
+            break;
+        }
+        default: // Publishing, sometimes more than the ring holds
+        {
+            int count = 1 + rand() % 10;
+            for(int i = 0; i < count && w.published < FRAMES - 8; i++)
+                _publish(&w, (uint8_t)(rand() % (MSG_MAX_LENGTH + 1)));
+            break;
+        }
+        }
+        CHECK(comm_shm_wait(r->reader, 0) == (r->next != w.published));
+    }
+
+    CHECK(_lost > 0 && _overwritten > 0);
+
+    // The ring outlives its name for the readers attached
+    comm_shm_destroy(&w.shm);
+    CHECK(!w.shm);
+    CHECK(!comm_shm_attach(name) && errno == ENOENT);
+    for(unsigned i = 0; i < READERS; i++) {
+        while(_peek(&w, &readers[i]))
+            _next(&w, &readers[i]);
+        comm_shm_detach(&readers[i].reader);
+    }
+}
+
+/*******************************************************************************
+* Function Name: _test_wait
+********************************************************************************
+* Summary:
+*  comm_shm_wait() times out without records, and is woken by a frame
+*  published from another thread.
+*
+*******************************************************************************/
+static void *_publisher(void *arg)
+{
+    comm_frame_t frame = {.count = 1, .data = {42}};
+    usleep(50000);
+    comm_shm_publish(arg, &frame);
+    return NULL;
+}
+
+static void _test_wait(const char *name)
+{
+    comm_shm_t shm = comm_shm_create(name, 3 * (size_t)sysconf(_SC_PAGESIZE));
+    CHECK(shm);
+    comm_shm_reader_t reader = comm_shm_attach(name);
+    CHECK(reader);
+
+    CHECK(comm_shm_wait(reader, 20) == 0);
+    pthread_t thread;
+    CHECK(!pthread_create(&thread, NULL, _publisher, shm));
+    CHECK(comm_shm_wait(reader, 5000) == 1);
+    CHECK(!pthread_join(thread, NULL));
+    const comm_shm_record_t *record = comm_shm_peek(reader);
+    CHECK(record && record->sequence == 0 && record->count == 1 && record->data[0] == 42);
+    CHECK(comm_shm_next(reader));
+    CHECK(!comm_shm_peek(reader));
+
+    comm_shm_detach(&reader);
+    comm_shm_destroy(&shm);
+}
+
+int main(void)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/test_comm_shm_%d", (int)getpid());
+    srand(1);
+    _test_readers(name);
+    _test_wait(name);
+
+    printf("test_comm_shm: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,816 @@
+/*******************************************************************************
+*
+* Differential tests of ringbuf.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Runs random sequences of ring buffer operations, on single ring buffers
+*  with every overflow policy and on pairs sharing one internal buffer, and
+*  compares every result with a model queue of bytes. Also checks the
+*  scatter/gather functions through a pipe, compares mirrored ring buffers
+*  with regular ones, and checks the watermark events.
+*
+*******************************************************************************/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /* F_SETPIPE_SZ */
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <unistd.h>
+
+#include "ringbuf.h"
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define MODEL_SIZE (1u << 16)
+#define MAX_COUNT (600u)
+
+// Largest sets and patterns of _test_search (the SIMD kernels take sets of
+// up to 8 bytes)
+#define SEARCH_SET_MAX (12u)
+#define SEARCH_PATTERN_MAX (40u)
+
+/*******************************************************************************
+* TYPES
+*******************************************************************************/
+// Bytes [tail, head) of 'data' are the content of the ring buffer
+typedef struct
+{
+    uint8_t data[MODEL_SIZE];
+    size_t head, tail;
+} model_t;
+
+
+/*******************************************************************************
+* MODEL
+*******************************************************************************/
+static size_t _used(const model_t *m)
+{
+    return m->head - m->tail;
+}
+
+static void _push(model_t *m, const uint8_t *data, size_t count)
+{
+    if(m->head + count > MODEL_SIZE) {
+        memmove(m->data, m->data + m->tail, _used(m));
+        m->head -= m->tail;
+        m->tail = 0;
+    }
+    memcpy(m->data + m->head, data, count);
+    m->head += count;
+}
+
+// Compare the whole content of 'rb' with the model, without removing it
+static void _check_content(ringbuf_t rb, const model_t *m)
+{
+    static uint8_t content[MODEL_SIZE];
+    size_t used = ringbuf_bytes_used(rb);
+    
+    CHECK(used == _used(m));
+    CHECK(ringbuf_peek_into(content, rb, 0, used) == content || !used);
+    CHECK(!memcmp(content, m->data + m->tail, used));
+}
+
+static void _random_bytes(uint8_t *data, size_t count, int range)
+{
+    for(size_t i = 0; i < count; i++)
+        data[i] = (uint8_t)(rand() % range);
+}
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _test_operations
+********************************************************************************
+* Summary:
+*  Writes (overflowing ones included), reads, copies between ring buffers,
+*  searches and peeks with the default RINGBUF_DROP_OLDEST policy.
+*
+*******************************************************************************/
+static void _test_operations(void)
+{
+    static model_t m, m2;
+    
+    for(size_t capacity = 1; capacity < 300; capacity += 7) {
+        ringbuf_t rb = ringbuf_new(capacity);
+        ringbuf_t rb2 = ringbuf_new(capacity / 2 + 1);
+        m.head = m.tail = m2.head = m2.tail = 0;
+        CHECK(rb && rb2 && ringbuf_capacity(rb) == capacity);
+        
+        for(int i = 0; i < 5000; i++) {
+            // Caller buffers at any alignment, for the word copies
+            uint8_t data_buffer[MAX_COUNT + 3], out_buffer[MAX_COUNT + 3];
+            uint8_t *data = data_buffer + rand() % 4, *out = out_buffer + rand() % 4;
+            size_t count = (size_t)rand() % (2 * capacity + 3);
+            _random_bytes(data, count, 8);
+            
+            switch(rand() % 9) {
+            case 0: // Write, the oldest bytes are overwritten
+                ringbuf_memcpy_into(rb, data, count);
+                if(count > capacity) {
+                    m.tail = m.head;
+                    _push(&m, data + count - capacity, capacity);
+                }
+                else {
+                    _push(&m, data, count);
+                    m.tail += _used(&m) > capacity ? _used(&m) - capacity : 0;
+                }
+                break;
+            case 1: // Write without overflow
+                CHECK(ringbuf_memcpy_into_nooverflow(rb, data, count) == MIN(count, capacity - _used(&m)));
+                _push(&m, data, MIN(count, capacity - _used(&m)));
+                break;
+            case 2: // Read
+                if(count > _used(&m))
+                    CHECK(!ringbuf_memcpy_from(out, rb, count));
+                else {
+                    CHECK(ringbuf_memcpy_from(out, rb, count));
+                    CHECK(!memcmp(out, m.data + m.tail, count));
+                    m.tail += count;
+                }
+                break;
+            case 3: // Search and peek
+            {
+                size_t offset = (size_t)rand() % (_used(&m) + 1);
+                size_t expected = offset;
+                while(expected < _used(&m) && m.data[m.tail + expected] != (count & 7))
+                    expected++;
+                CHECK(ringbuf_findchr(rb, (int)(count & 7), offset) == expected);
+                if(offset < _used(&m))
+                    CHECK(ringbuf_peek(rb, offset) == m.data[m.tail + offset]);
+                break;
+            }
+            case 4: // Remove
+                if(count > _used(&m))
+                    CHECK(!ringbuf_remove_from_tail(rb, count));
+                else {
+                    CHECK(ringbuf_remove_from_tail(rb, count));
+                    m.tail += count;
+                }
+                break;
+            case 5: // Single bytes
+                if(rand() % 2) {
+                    CHECK(ringbuf_putc(rb, data[0]) == (_used(&m) < capacity));
+                    if(_used(&m) < capacity)
+                        _push(&m, data, 1);
+                }
+                else {
+                    uint8_t c = 0;
+                    CHECK(ringbuf_getc(rb, &c) == (_used(&m) > 0));
+                    if(_used(&m))
+                        CHECK(c == m.data[m.tail++]);
+                }
+                break;
+            case 6: // Copy between ring buffers
+                ringbuf_memcpy_into(rb2, data, MIN(count, ringbuf_bytes_free(rb2)));
+                _push(&m2, data, MIN(count, capacity / 2 + 1 - _used(&m2)));
+                count = (size_t)rand() % (capacity + 1);
+                if(count > _used(&m2))
+                    CHECK(!ringbuf_copy(rb, rb2, count));
+                else {
+                    CHECK(ringbuf_copy(rb, rb2, count));
+                    _push(&m, m2.data + m2.tail, count);
+                    m2.tail += count;
+                    m.tail += _used(&m) > capacity ? _used(&m) - capacity : 0;
+                }
+                break;
+            case 7: // Fill
+                ringbuf_memset(rb, (int)(count & 7), count);
+                memset(data, (int)(count & 7), MIN(count, capacity));
+                _push(&m, data, MIN(count, capacity));
+                m.tail += _used(&m) > capacity ? _used(&m) - capacity : 0;
+                break;
+            default: // Peek a range
+            {
+                size_t offset = (size_t)rand() % (capacity + 1);
+                if(offset + count > _used(&m))
+                    CHECK(!ringbuf_peek_into(out, rb, offset, count));
+                else {
+                    CHECK(ringbuf_peek_into(out, rb, offset, count) == out);
+                    CHECK(!memcmp(out, m.data + m.tail + offset, count));
+                }
+                break;
+            }
+            }
+            
+            _check_content(rb, &m);
+            _check_content(rb2, &m2);
+            CHECK(ringbuf_is_empty(rb) == !_used(&m));
+            CHECK(ringbuf_is_full(rb) == (_used(&m) == capacity));
+        }
+        ringbuf_free(&rb);
+        ringbuf_free(&rb2);
+        CHECK(!rb && !rb2);
+    }
+}
+
+/*******************************************************************************
+* Function Name: _test_search
+********************************************************************************
+* Summary:
+*  ringbuf_findset and ringbuf_findmem against a naive search, on content
+*  starting anywhere in the internal buffer so it may wrap: sets larger
+*  than the SIMD kernels take, patterns straddling the wrap, few distinct
+*  bytes for many false candidates. run_tests.sh runs it with each kernel
+*  (see RINGBUF_SIMD in ringbuf.c).
+*
+*******************************************************************************/
+static void _test_search(void)
+{
+    uint8_t content[MAX_COUNT], set[SEARCH_SET_MAX], pattern[SEARCH_PATTERN_MAX];
+    
+    for(int i = 0; i < 20000; i++) {
+        size_t capacity = 1 + (size_t)rand() % (MAX_COUNT - 1);
+        ringbuf_t rb = ringbuf_new(capacity);
+        size_t size = ringbuf_buffer_size(rb);
+        
+        // The content starts 'start' bytes into the internal buffer, and
+        // wraps 'wrap' bytes after its beginning if it's longer
+        size_t start = (size_t)rand() % size;
+        ringbuf_memset(rb, 0, start);
+        ringbuf_remove_from_tail(rb, start);
+        size_t wrap = size - start;
+        size_t used = (size_t)rand() % (capacity + 1);
+        int range = 1 + rand() % 8;
+        _random_bytes(content, used, range);
+        ringbuf_memcpy_into(rb, content, used);
+        size_t offset = (size_t)rand() % (used + 1);
+        
+        size_t nset = (size_t)rand() % (SEARCH_SET_MAX + 1);
+        _random_bytes(set, nset, 2 * range);
+        size_t expected = offset;
+        while(expected < used && !memchr(set, content[expected], nset))
+            expected++;
+        CHECK(ringbuf_findset(rb, set, nset, offset) == expected);
+        
+        // Half the patterns are taken from the content, across the wrap
+        // when there's one
+        size_t len = (size_t)rand() % (SEARCH_PATTERN_MAX + 1);
+        if(used && rand() % 2) {
+            size_t before = (size_t)rand() % (len + 1);
+            size_t at = (wrap < used && rand() % 2) ? wrap - MIN(wrap, before) : (size_t)rand() % used;
+            len = MIN(len, used - at);
+            memcpy(pattern, content + at, len);
+        }
+        else
+            _random_bytes(pattern, len, range);
+        expected = len ? offset : MIN(offset, used);
+        while(len && expected + len <= used && memcmp(content + expected, pattern, len))
+            expected++;
+        if(len && expected + len > used)
+            expected = used;
+        CHECK(ringbuf_findmem(rb, pattern, len, offset) == expected);
+        
+        ringbuf_free(&rb);
+    }
+}
+
+/*******************************************************************************
+* Function Name: _test_iovec
+********************************************************************************
+* Summary:
+*  ringbuf_readv() and ringbuf_writev() through a non-blocking pipe, with
+*  the free and used regions of the ring buffer wrapped or not: short reads
+*  (fewer bytes in the pipe than asked), short writes (a pipe almost full)
+*  and EAGAIN. Also checks the segments of ringbuf_head_iov() and
+*  ringbuf_tail_iov(), and ringbuf_peek_into() at any offset.
+*
+*******************************************************************************/
+#ifdef RINGBUF_HAVE_IOVEC
+static void _test_iovec(void)
+{
+    static model_t m;
+    static uint8_t data[MODEL_SIZE], out[MODEL_SIZE];
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    int fd[2];
+    CHECK(!pipe(fd));
+    CHECK(fcntl(fd[0], F_SETFL, O_NONBLOCK) == 0 && fcntl(fd[1], F_SETFL, O_NONBLOCK) == 0);
+#ifdef F_SETPIPE_SZ
+    fcntl(fd[1], F_SETPIPE_SZ, (int)(2 * page));
+#endif
+    size_t pipe_size = 0;
+    while(write(fd[1], data, 1) == 1)
+        pipe_size++;
+    CHECK(read(fd[0], out, MODEL_SIZE) == (ssize_t)pipe_size);
+    size_t shorts = 0;
+    
+    for(int r = 0; r < 300; r++) {
+        size_t capacity = 1 + (size_t)rand() % (MIN(pipe_size, MODEL_SIZE / 4) + page);
+        ringbuf_t rb = ringbuf_new(capacity);
+        CHECK(rb);
+        const uint8_t *buf = ringbuf_tail(rb);
+        size_t size = ringbuf_buffer_size(rb);
+        m.head = m.tail = 0;
+        
+        // Start anywhere in the internal buffer
+        size_t start = (size_t)rand() % size;
+        ringbuf_memset(rb, 0, start);
+        ringbuf_remove_from_tail(rb, start);
+        
+        for(int i = 0; i < 200; i++) {
+            size_t count = (size_t)rand() % (2 * capacity + 3);
+            size_t used = _used(&m), free = capacity - used;
+            struct iovec iov[2];
+            
+            switch(rand() % 4) {
+            case 0: // Read from the pipe, holding 'avail' bytes
+            {
+                size_t avail = (size_t)rand() % (MIN(pipe_size, 2 * capacity) + 1);
+                _random_bytes(data, avail, 256);
+                CHECK(!avail || write(fd[1], data, avail) == (ssize_t)avail);
+                ssize_t n = ringbuf_readv(fd[0], rb, count);
+                size_t expected = MIN(avail, MIN(count, free));
+                if(count && free && !avail)
+                    CHECK(n == -1 && errno == EAGAIN);
+                else
+                    CHECK(n == (ssize_t)expected);
+                shorts += expected && expected < MIN(count, free);
+                _push(&m, data, expected);
+                while(read(fd[0], out, MODEL_SIZE) > 0);
+                break;
+            }
+            case 1: // Write to the pipe, holding 'junk' bytes already
+            {
+                size_t junk = rand() % 2 ? (size_t)rand() % (pipe_size + 1) : 0;
+                memset(data, 0xAA, junk);
+                CHECK(!junk || write(fd[1], data, junk) == (ssize_t)junk);
+                count = (size_t)rand() % (used + 2);
+                ssize_t n = ringbuf_writev(fd[1], rb, count);
+                if(!count || count > used)
+                    CHECK(n == 0);
+                else if(n < 0)
+                    CHECK(errno == EAGAIN && junk);
+                else {
+                    // An empty pipe takes up to its size at once
+                    CHECK(n > 0 && (size_t)n <= count);
+                    CHECK((size_t)n == count || junk || count > pipe_size);
+                    shorts += (size_t)n < count;
+                    CHECK(read(fd[0], out, MODEL_SIZE) == (ssize_t)(junk + (size_t)n));
+                    CHECK(!memcmp(out + junk, m.data + m.tail, (size_t)n));
+                    m.tail += (size_t)n;
+                }
+                while(read(fd[0], out, MODEL_SIZE) > 0);
+                break;
+            }
+            case 2: // Free segments, filled by hand
+            {
+                int segments = ringbuf_head_iov(rb, iov, count);
+                size_t expected = MIN(count, free);
+                size_t head = (size_t)((const uint8_t *)ringbuf_head(rb) - buf);
+                CHECK(segments == (!expected ? 0 : head + expected > size ? 2 : 1));
+                if(!segments)
+                    break;
+                CHECK(iov[0].iov_base == ringbuf_head(rb) && iov[0].iov_len == MIN(expected, size - head));
+                if(segments == 2)
+                    CHECK(iov[1].iov_base == buf && iov[1].iov_len == expected - iov[0].iov_len);
+                _random_bytes(data, expected, 256);
+                memcpy(iov[0].iov_base, data, iov[0].iov_len);
+                if(segments == 2)
+                    memcpy(iov[1].iov_base, data + iov[0].iov_len, iov[1].iov_len);
+                CHECK(ringbuf_advance_head(rb, expected) == ringbuf_head(rb));
+                _push(&m, data, expected);
+                break;
+            }
+            default: // Used segments, and peeks
+            {
+                int segments = ringbuf_tail_iov(rb, iov, count);
+                size_t expected = MIN(count, used);
+                size_t tail = (size_t)((const uint8_t *)ringbuf_tail(rb) - buf);
+                CHECK(segments == (!expected ? 0 : tail + expected > size ? 2 : 1));
+                if(segments) {
+                    CHECK(iov[0].iov_base == ringbuf_tail(rb) && iov[0].iov_len == MIN(expected, size - tail));
+                    CHECK(!memcmp(iov[0].iov_base, m.data + m.tail, iov[0].iov_len));
+                }
+                if(segments == 2) {
+                    CHECK(iov[1].iov_base == buf && iov[1].iov_len == expected - iov[0].iov_len);
+                    CHECK(!memcmp(iov[1].iov_base, m.data + m.tail + iov[0].iov_len, iov[1].iov_len));
+                }
+                size_t offset = (size_t)rand() % (used + 2);
+                count = (size_t)rand() % (used + 2);
+                if(offset + count > used)
+                    CHECK(!ringbuf_peek_into(out, rb, offset, count));
+                else {
+                    CHECK(ringbuf_peek_into(out, rb, offset, count) == out);
+                    CHECK(!memcmp(out, m.data + m.tail + offset, count));
+                }
+                break;
+            }
+            }
+            
+            _check_content(rb, &m);
+        }
+        ringbuf_free(&rb);
+    }
+    CHECK(shorts > 0);
+    close(fd[0]);
+    close(fd[1]);
+}
+#endif
+
+/*******************************************************************************
+* Function Name: _test_mirrored
+********************************************************************************
+* Summary:
+*  Runs the same random operations on a mirrored ring buffer and on regular
+*  ones of the same capacity (one of them sharing its internal buffer), and
+*  compares every result, the content and the head and tail offsets. The
+*  content of the mirrored ring buffer must also be contiguous at its tail.
+*
+*******************************************************************************/
+#ifdef RINGBUF_HAVE_MIRROR
+static void _test_mirrored(void)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t max = 4 * page + 3;
+    uint8_t *data = malloc(max), *out = malloc(max), *expected = malloc(max);
+    CHECK(data && out && expected);
+    
+    // One and two pages, then a capacity rounded up
+    const size_t requested[] = {page - 1, 2 * page - 1, page + 1};
+    for(size_t r = 0; r < sizeof(requested) / sizeof(*requested); r++) {
+        ringbuf_t rb[3], other;
+        rb[0] = ringbuf_new_mirrored(requested[r]);
+        CHECK(rb[0] && ringbuf_is_mirrored(rb[0]));
+        size_t capacity = ringbuf_capacity(rb[0]);
+        CHECK(capacity >= requested[r] && ringbuf_buffer_size(rb[0]) % page == 0);
+        rb[1] = ringbuf_new(capacity);
+        CHECK(ringbuf_new_shared(&rb[2], &other, capacity, 16));
+        CHECK(rb[1] && !ringbuf_is_mirrored(rb[1]) && ringbuf_capacity(rb[2]) == capacity);
+        const uint8_t *base[3];
+        for(int k = 0; k < 3; k++)
+            base[k] = ringbuf_tail(rb[k]);
+        
+        for(int i = 0; i < 3000; i++) {
+            size_t count = (size_t)rand() % (2 * capacity + 3);
+            size_t offset = (size_t)rand() % (capacity + 1);
+            int op = rand() % 8;
+            _random_bytes(data, count, 8);
+            
+            // Every result must be the same as the mirrored ring buffer's
+            size_t result[3];
+            for(int k = 0; k < 3; k++) {
+                switch(op) {
+                case 0: // Write, the oldest bytes are overwritten
+                    result[k] = ringbuf_memcpy_into(rb[k], data, count) == ringbuf_head(rb[k]);
+                    break;
+                case 1: // Write without overflow
+                    result[k] = ringbuf_memcpy_into_nooverflow(rb[k], data, count);
+                    break;
+                case 2: // Read
+                    memset(out, 0, count);
+                    result[k] = !!ringbuf_memcpy_from(out, rb[k], count);
+                    if(k)
+                        CHECK(!memcmp(out, expected, count));
+                    else
+                        memcpy(expected, out, count);
+                    break;
+                case 3: // Remove
+                    result[k] = !!ringbuf_remove_from_tail(rb[k], count);
+                    break;
+                case 4: // Searches, from any offset
+                    result[k] = ringbuf_findchr(rb[k], data[0], offset);
+                    CHECK(ringbuf_findset(rb[k], data, count % 12, offset) == ringbuf_findset(rb[0], data, count % 12, offset));
+                    CHECK(ringbuf_findmem(rb[k], data, count % 5, offset) == ringbuf_findmem(rb[0], data, count % 5, offset));
+                    break;
+                case 5: // Single bytes
+                {
+                    uint8_t c = 0;
+                    result[k] = (count % 2) ? (size_t)ringbuf_putc(rb[k], data[0]) : (size_t)(ringbuf_getc(rb[k], &c) << 8 | c);
+                    break;
+                }
+                case 6: // Fill
+                    ringbuf_memset(rb[k], data[0], count);
+                    result[k] = 0;
+                    break;
+                default: // Peek a range
+                    memset(out, 0, count);
+                    result[k] = !!ringbuf_peek_into(out, rb[k], offset, count);
+                    if(k)
+                        CHECK(!memcmp(out, expected, count));
+                    else
+                        memcpy(expected, out, count);
+                    break;
+                }
+            }
+            CHECK(result[1] == result[0] && result[2] == result[0]);
+            
+            size_t used = ringbuf_bytes_used(rb[0]);
+            CHECK(ringbuf_peek_into(expected, rb[0], 0, used) == expected || !used);
+            CHECK(!memcmp(ringbuf_tail(rb[0]), expected, used));
+            for(int k = 1; k < 3; k++) {
+                CHECK(ringbuf_bytes_used(rb[k]) == used);
+                CHECK(ringbuf_bytes_free(rb[k]) == ringbuf_bytes_free(rb[0]));
+                CHECK(ringbuf_is_full(rb[k]) == ringbuf_is_full(rb[0]));
+                CHECK(ringbuf_peek_into(out, rb[k], 0, used) == out || !used);
+                CHECK(!memcmp(out, expected, used));
+                CHECK((const uint8_t *)ringbuf_tail(rb[k]) - base[k] == (const uint8_t *)ringbuf_tail(rb[0]) - base[0]);
+                CHECK((const uint8_t *)ringbuf_head(rb[k]) - base[k] == (const uint8_t *)ringbuf_head(rb[0]) - base[0]);
+            }
+#ifdef RINGBUF_HAVE_IOVEC
+            // The mirrored ring buffer never splits a region
+            struct iovec iov[2], iov2[2];
+            CHECK(ringbuf_tail_iov(rb[0], iov, used) == (used > 0));
+            int n = ringbuf_tail_iov(rb[1], iov2, used);
+            CHECK(!used || iov[0].iov_len == iov2[0].iov_len + (n > 1 ? iov2[1].iov_len : 0));
+            size_t free = ringbuf_bytes_free(rb[0]);
+            CHECK(ringbuf_head_iov(rb[0], iov, free) == (free > 0));
+            CHECK(!free || iov[0].iov_len == free);
+#endif
+        }
+        
+        ringbuf_free(&rb[0]);
+        ringbuf_free(&rb[1]);
+        ringbuf_free_shared(&rb[2], &other);
+    }
+    free(data);
+    free(out);
+    free(expected);
+}
+#endif
+
+#if RINGBUF_POLICIES
+/*******************************************************************************
+* Function Name: _test_policies
+********************************************************************************
+* Summary:
+*  Writes that don't fit, for every overflow policy: what's kept, what's
+*  returned and what's counted as dropped.
+*
+*******************************************************************************/
+static void _test_policies(void)
+{
+    static model_t m;
+    
+    for(int policy = 0; policy < 4; policy++) {
+        for(size_t capacity = 1; capacity < 90; capacity += 11) {
+            ringbuf_t rb = ringbuf_new(capacity);
+            size_t dropped = 0;
+            ringbuf_set_policy(rb, (ringbuf_policy_t)policy, '\n');
+            CHECK(ringbuf_policy(rb) == (ringbuf_policy_t)policy);
+            m.head = m.tail = 0;
+            
+            for(int i = 0; i < 20000; i++) {
+                uint8_t data[MAX_COUNT], out[MAX_COUNT];
+                size_t count = (size_t)rand() % (capacity + capacity / 2 + 2);
+                
+                if(rand() % 2) {
+                    for(size_t k = 0; k < count; k++)
+                        data[k] = (rand() % 6 == 0) ? '\n' : (uint8_t)('a' + rand() % 3);
+                    
+                    bool written = true;
+                    if(count > capacity - _used(&m)) {
+                        switch(policy) {
+                        case RINGBUF_DROP_OLDEST:
+                            dropped += _used(&m) + count - capacity;
+                            m.tail += MIN(_used(&m) + count - capacity, _used(&m));
+                            break;
+                        case RINGBUF_DROP_NEWEST:
+                            dropped += count;
+                            written = false;
+                            break;
+                        case RINGBUF_BLOCK:
+                            written = false;
+                            break;
+                        case RINGBUF_DROP_RECORD:
+                            if(count > capacity) {
+                                dropped += count;
+                                written = false;
+                                break;
+                            }
+                            // Drop whole records, or everything if none ends
+                            while(count > capacity - _used(&m)) {
+                                size_t end = m.tail;
+                                while(end < m.head && m.data[end] != '\n')
+                                    end++;
+                                size_t record = (end < m.head) ? end - m.tail + 1 : _used(&m);
+                                m.tail += record;
+                                dropped += record;
+                            }
+                            break;
+                        }
+                    }
+                    
+                    void *head = ringbuf_memcpy_into(rb, data, count);
+                    CHECK(!head == !written || !count);
+                    if(written && count > capacity)
+                        _push(&m, data + count - capacity, capacity);
+                    else if(written)
+                        _push(&m, data, count);
+                }
+                else {
+                    count = MIN(count, _used(&m));
+                    CHECK(ringbuf_memcpy_from(out, rb, count) || !count);
+                    CHECK(!memcmp(out, m.data + m.tail, count));
+                    m.tail += count;
+                }
+                
+                _check_content(rb, &m);
+                CHECK(ringbuf_dropped(rb) == dropped);
+            }
+            ringbuf_free(&rb);
+        }
+    }
+}
+#endif // RINGBUF_POLICIES
+
+/*******************************************************************************
+* Function Name: _test_lend
+********************************************************************************
+* Summary:
+*  Writes, reads and ringbuf_lend() in both directions between two ring
+*  buffers sharing one internal buffer.
+*
+*******************************************************************************/
+static void _test_lend(void)
+{
+    static model_t m[2];
+    
+    for(int pair = 0; pair < 200; pair++) {
+        size_t capacity_a = 1 + (size_t)rand() % 200;
+        size_t capacity_b = 1 + (size_t)rand() % 200;
+        ringbuf_t rb[2];
+        CHECK(ringbuf_new_shared(&rb[0], &rb[1], capacity_a, capacity_b));
+        m[0].head = m[0].tail = m[1].head = m[1].tail = 0;
+        
+        for(int i = 0; i < 5000; i++) {
+            int k = rand() % 2;
+            uint8_t data[MAX_COUNT], out[MAX_COUNT];
+            size_t count = (size_t)rand() % 300;
+            
+            switch(rand() % 4) {
+            case 0:
+                count = MIN(count, ringbuf_bytes_free(rb[k]));
+                _random_bytes(data, count, 256);
+                ringbuf_memcpy_into(rb[k], data, count);
+                _push(&m[k], data, count);
+                break;
+            case 1:
+                count = MIN(count, _used(&m[k]));
+                CHECK(ringbuf_memcpy_from(out, rb[k], count) || !count);
+                CHECK(!memcmp(out, m[k].data + m[k].tail, count));
+                m[k].tail += count;
+                break;
+            default:
+            {
+                size_t free_bytes = ringbuf_bytes_free(rb[!k]);
+                size_t lent = ringbuf_lend(rb[!k], rb[k], count);
+                CHECK(lent <= MIN(count, free_bytes));
+                CHECK(ringbuf_capacity(rb[0]) + ringbuf_capacity(rb[1]) == capacity_a + capacity_b);
+                break;
+            }
+            }
+            
+            _check_content(rb[0], &m[0]);
+            _check_content(rb[1], &m[1]);
+        }
+        ringbuf_free_shared(&rb[0], &rb[1]);
+    }
+}
+
+#if RINGBUF_WATERMARKS
+/*******************************************************************************
+* Function Name: _test_watermarks
+********************************************************************************
+* Summary:
+*  Every operation moving the head or tail pointer raises the events of the
+*  levels it crosses, once per crossing.
+*
+*******************************************************************************/
+static unsigned _events;
+
+static void _on_watermark(void *context, unsigned event)
+{
+    (void)context;
+    _events |= event;
+}
+
+static void _test_watermarks(void)
+{
+    for(int i = 0; i < 2000; i++) {
+        size_t capacity = 1 + (size_t)rand() % 50;
+        size_t low = (size_t)rand() % capacity;
+        size_t high = low + 1 + (size_t)rand() % (capacity - low + 1);
+        ringbuf_t rb = ringbuf_new(capacity), other = ringbuf_new(capacity);
+        int level = 0; // 0: at or below low, 1: between, 2: at or above high
+        
+#if RINGBUF_POLICIES
+        if(rand() % 2)
+            ringbuf_set_policy(rb, (ringbuf_policy_t)(rand() % 3), '\n');
+#endif
+        ringbuf_set_watermarks(rb, low, high, _on_watermark, NULL);
+        
+        for(int op = 0; op < 300; op++) {
+            uint8_t data[128];
+            size_t count = (size_t)rand() % (capacity + 3);
+            int kind = rand() % 9;
+            for(size_t k = 0; k < count; k++)
+                data[k] = (rand() % 4) ? 'a' : '\n';
+            
+            _events = 0;
+            switch(kind) {
+            case 0: ringbuf_putc(rb, 'x'); break;
+            case 1: { uint8_t c; ringbuf_getc(rb, &c); break; }
+            case 2: ringbuf_memcpy_into(rb, data, count); break;
+            case 3: ringbuf_memcpy_from(data, rb, count); break;
+            case 4: ringbuf_memset(rb, 'q', count); break;
+            case 5: ringbuf_remove_from_tail(rb, count); break;
+            case 6:
+                ringbuf_memcpy_into(other, data, count);
+                ringbuf_copy(rb, other, (size_t)rand() % (capacity + 1));
+                break;
+            case 7: ringbuf_copy(other, rb, count); break;
+            default:
+                if(rand() % 10 == 0)
+                    ringbuf_reset(rb);
+                break;
+            }
+            
+            size_t used = ringbuf_bytes_used(rb);
+            int new_level = (used >= high) ? 2 : (used <= low) ? 0 : 1;
+            unsigned expected = 0;
+            if(new_level != level)
+                expected = (new_level == 2) ? RINGBUF_HIGH_WATERMARK :
+                           (new_level == 0) ? RINGBUF_LOW_WATERMARK : 0;
+            
+            // A copy into 'rb' may evict, then write, in one operation
+            if(kind == 6 || kind == 8)
+                CHECK((_events & expected) == expected);
+            else
+                CHECK(_events == expected);
+            level = new_level;
+        }
+        
+        // Events are latched until read
+        ringbuf_watermark_events(rb);
+        CHECK(ringbuf_watermark_events(rb) == 0);
+        ringbuf_free(&rb);
+        ringbuf_free(&other);
+    }
+}
+
+#endif // RINGBUF_WATERMARKS
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(void)
+{
+    srand(1);
+    _test_operations();
+    _test_search();
+#ifdef RINGBUF_HAVE_IOVEC
+    _test_iovec();
+#endif
+#ifdef RINGBUF_HAVE_MIRROR
+    _test_mirrored();
+#endif
+#if RINGBUF_POLICIES
+    _test_policies();
+#endif
+    _test_lend();
+#if RINGBUF_WATERMARKS
+    _test_watermarks();
+#endif
+    
+    printf("test_ringbuf: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
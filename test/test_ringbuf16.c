@@ -0,0 +1,197 @@
+/*******************************************************************************
+*
+* Differential tests of ringbuf16.c.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Runs the same random operations on a ringbuf_t and on ringbuf16_t ring
+*  buffers (heap allocated and in static storage) and checks that they
+*  return the same results and hold the same content.
+*
+*******************************************************************************/
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "ringbuf.h"
+#include "ringbuf16.h"
+#include "test.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+#define MAX_CAPACITY (300u)
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+/*******************************************************************************
+* Function Name: _check_same
+********************************************************************************
+* Summary:
+*  Checks that both ring buffers hold the same bytes.
+*
+*******************************************************************************/
+static void _check_same(ringbuf_t reference, ringbuf16_t rb)
+{
+    uint8_t expected[2 * MAX_CAPACITY], content[2 * MAX_CAPACITY];
+    size_t used = ringbuf_bytes_used(reference);
+    
+    CHECK(ringbuf16_bytes_used(rb) == used);
+    CHECK(ringbuf_is_full(reference) == ringbuf16_is_full(rb));
+    CHECK(ringbuf_is_empty(reference) == ringbuf16_is_empty(rb));
+    ringbuf_peek_into(expected, reference, 0, used);
+    for(size_t i = 0; i < used; i++)
+        content[i] = (uint8_t)ringbuf16_peek(rb, i);
+    CHECK(!memcmp(expected, content, used));
+}
+
+/*******************************************************************************
+* Function Name: _test_operations
+********************************************************************************
+* Summary:
+*  Random writes, reads, fills, searches, copies and single byte accesses.
+*
+*******************************************************************************/
+static void _test_operations(void)
+{
+    static RINGBUF16_STORAGE(storage, MAX_CAPACITY);
+    
+    for(size_t capacity = 1; capacity < MAX_CAPACITY; capacity += 13) {
+        ringbuf_t reference = ringbuf_new(capacity);
+        ringbuf_t reference2 = ringbuf_new(capacity / 2 + 1);
+        ringbuf16_t rb[2] = { ringbuf16_new(capacity), ringbuf16_init(storage, capacity) };
+        ringbuf16_t rb2 = ringbuf16_new(capacity / 2 + 1);
+        CHECK(rb[0] && rb[1] && rb2 && ringbuf16_capacity(rb[1]) == capacity);
+        
+        for(int i = 0; i < 8000; i++) {
+            uint8_t data[2 * MAX_CAPACITY + 3], expected[2 * MAX_CAPACITY + 3], out[2 * MAX_CAPACITY + 3];
+            size_t count = (size_t)rand() % (2 * capacity + 3);
+            int operation = rand() % 9;
+            for(size_t k = 0; k < count; k++)
+                data[k] = (uint8_t)(rand() % 8);
+            
+            for(int k = 0; k < 2; k++) {
+                switch(operation) {
+                case 0:
+                    ringbuf16_memcpy_into(rb[k], data, count);
+                    break;
+                case 1:
+                    CHECK(ringbuf16_memcpy_into_nooverflow(rb[k], data, count) ==
+                          MIN(count, ringbuf_bytes_free(reference)));
+                    break;
+                case 2:
+                    CHECK(!ringbuf16_memcpy_from(out, rb[k], count) == (count > ringbuf_bytes_used(reference)));
+                    CHECK(count > ringbuf_bytes_used(reference) ||
+                          !memcmp(out, ringbuf_peek_into(expected, reference, 0, count), count));
+                    break;
+                case 3:
+                    CHECK(ringbuf16_memset(rb[k], (int)(count & 7), count) ==
+                          MIN(count, ringbuf16_buffer_size(rb[k])));
+                    break;
+                case 4:
+                {
+                    size_t offset = (size_t)rand() % (capacity + 1);
+                    CHECK(ringbuf16_findchr(rb[k], (int)(count & 7), offset) ==
+                          ringbuf_findchr(reference, (int)(count & 7), offset));
+                    break;
+                }
+                case 5:
+                    CHECK(!ringbuf16_remove_from_tail(rb[k], count) == (count > ringbuf_bytes_used(reference)));
+                    break;
+                case 6:
+                    CHECK(ringbuf16_putc(rb[k], data[0]) == !ringbuf_is_full(reference));
+                    break;
+                case 7:
+                {
+                    uint8_t c = 0;
+                    CHECK(ringbuf16_getc(rb[k], &c) == !ringbuf_is_empty(reference));
+                    CHECK(ringbuf_is_empty(reference) || c == ringbuf_peek(reference, 0));
+                    break;
+                }
+                default:
+                    if(k == 0) {
+                        ringbuf16_memcpy_into(rb2, data, count % (capacity / 2 + 2));
+                        CHECK(!ringbuf16_copy(rb2, rb[0], count / 3) == (count / 3 > ringbuf_bytes_used(reference)));
+                    }
+                    else
+                        ringbuf16_remove_from_tail(rb[1], count / 3 <= ringbuf_bytes_used(reference) ? count / 3 : 0);
+                    break;
+                }
+            }
+            
+            // Apply the operation to the reference last, the checks above use its previous state
+            switch(operation) {
+            case 0: ringbuf_memcpy_into(reference, data, count); break;
+            case 1: ringbuf_memcpy_into_nooverflow(reference, data, count); break;
+            case 2: ringbuf_memcpy_from(out, reference, count); break;
+            case 3: ringbuf_memset(reference, (int)(count & 7), count); break;
+            case 5: ringbuf_remove_from_tail(reference, count); break;
+            case 6: ringbuf_putc(reference, data[0]); break;
+            case 7: { uint8_t c; ringbuf_getc(reference, &c); break; }
+            case 8:
+                ringbuf_memcpy_into(reference2, data, count % (capacity / 2 + 2));
+                ringbuf_copy(reference2, reference, count / 3);
+                _check_same(reference2, rb2);
+                break;
+            }
+            
+            _check_same(reference, rb[0]);
+            _check_same(reference, rb[1]);
+        }
+        ringbuf_free(&reference);
+        ringbuf_free(&reference2);
+        ringbuf16_free(&rb[0]);
+        ringbuf16_free(&rb2);
+    }
+    
+    // Capacities are limited to 16-bit indexes
+    CHECK(!ringbuf16_new(70000));
+    ringbuf16_t rb = ringbuf16_new(65534);
+    CHECK(rb && ringbuf16_capacity(rb) == 65534);
+    ringbuf16_free(&rb);
+}
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(void)
+{
+    srand(1);
+    _test_operations();
+    
+    printf("test_ringbuf16: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */
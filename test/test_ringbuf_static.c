@@ -0,0 +1,130 @@
+/*******************************************************************************
+*
+* Differential tests of ringbuf_static.h.
+* Copyright (C) 2020, Alexandre Bernier
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice,
+* this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright
+* notice, this list of conditions and the following disclaimer in the
+* documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors
+* may be used to endorse or promote products derived from this software without
+* specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+* POSSIBILITY OF SUCH DAMAGE.
+*
+********************************************************************************
+*
+* Summary:
+*  Runs the same random operations on a ringbuf_t and on ring buffers defined
+*  with RINGBUF_STATIC_DEFINE, with a power of 2 capacity and without, and
+*  checks that they return the same results and hold the same content.
+*
+*******************************************************************************/
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "ringbuf.h"
+#include "ringbuf_static.h"
+#include "test.h"
+
+/*******************************************************************************
+* RING BUFFERS
+*******************************************************************************/
+RINGBUF_STATIC_DEFINE(rb128, 128)
+RINGBUF_STATIC_DEFINE(rb100, 100)
+
+
+/*******************************************************************************
+* TESTS
+*******************************************************************************/
+// Runs the test on ring buffer type 'name' with the given capacity
+#define TEST_STATIC(name, capacity) do { \
+    static name##_t rb; \
+    ringbuf_t reference = ringbuf_new(capacity); \
+    name##_reset(&rb); \
+    CHECK(name##_capacity() == (capacity)); \
+    for(int i = 0; i < 300000; i++) { \
+        uint8_t data[300], expected[300], out[300]; \
+        size_t count = (size_t)rand() % (rand() % 8 == 0 ? 300 : 40); \
+        for(size_t k = 0; k < count; k++) \
+            data[k] = (uint8_t)(rand() % 16); \
+        switch(rand() % 7) { \
+        case 0: \
+        case 1: \
+            name##_memcpy_into(&rb, data, count); \
+            ringbuf_memcpy_into(reference, data, count); \
+            break; \
+        case 2: \
+            CHECK(name##_memcpy_into_nooverflow(&rb, data, count) == \
+                  ringbuf_memcpy_into_nooverflow(reference, data, count)); \
+            break; \
+        case 3: \
+        { \
+            bool copied = name##_memcpy_from(out, &rb, count); \
+            CHECK(copied == !!ringbuf_memcpy_from(expected, reference, count)); \
+            CHECK(!copied || !memcmp(out, expected, count)); \
+            break; \
+        } \
+        case 4: \
+        { \
+            size_t offset = (size_t)rand() % ((capacity) + 2); \
+            CHECK(name##_findchr(&rb, 5, offset) == ringbuf_findchr(reference, 5, offset)); \
+            offset = (size_t)rand() % (capacity); \
+            CHECK(name##_peek(&rb, offset) == \
+                  (offset < ringbuf_bytes_used(reference) ? ringbuf_peek(reference, offset) : 255)); \
+            break; \
+        } \
+        case 5: \
+            CHECK(!name##_remove_from_tail(&rb, count) == !ringbuf_remove_from_tail(reference, count)); \
+            break; \
+        default: \
+            if(rand() % 2) \
+                CHECK(name##_putc(&rb, data[0]) == ringbuf_putc(reference, data[0])); \
+            else { \
+                uint8_t c1 = 0, c2 = 0; \
+                CHECK(name##_getc(&rb, &c1) == ringbuf_getc(reference, &c2)); \
+                CHECK(c1 == c2); \
+            } \
+            break; \
+        } \
+        CHECK(name##_bytes_used(&rb) == ringbuf_bytes_used(reference)); \
+        CHECK(name##_bytes_free(&rb) == ringbuf_bytes_free(reference)); \
+        CHECK(name##_is_full(&rb) == ringbuf_is_full(reference)); \
+        CHECK(name##_is_empty(&rb) == ringbuf_is_empty(reference)); \
+    } \
+    ringbuf_free(&reference); \
+} while(0)
+
+
+/*******************************************************************************
+* MAIN
+*******************************************************************************/
+int main(void)
+{
+    srand(1);
+    TEST_STATIC(rb128, 128);
+    TEST_STATIC(rb100, 100);
+    
+    printf("test_ringbuf_static: ok\n");
+    return 0;
+}
+
+/* [] END OF FILE */